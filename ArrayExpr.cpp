@@ -0,0 +1,421 @@
+#include "ArrayExpr.h"
+#include "BatchEval.h"
+#include "PerfCounters.h"
+#include "SimdKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+static const char* const NotANumber = "Expected a number, got an array";
+
+// -----------------------------------------------------
+ArrayLiteralExpr::ArrayLiteralExpr(std::vector<double> values)
+	: values(std::make_shared<const std::vector<double>>(std::move(values))) {}
+
+double ArrayLiteralExpr::apply(const double*)
+{
+	ERR(NotANumber);
+}
+
+void ArrayLiteralExpr::appendText(Printer& out, size_t) const
+{
+	out.write('[');
+	for (size_t i = 0; i < values->size(); ++i) {
+		if (i > 0)
+			out.write(", ");
+		out.writeNumber((*values)[i]);
+	}
+	out.write(']');
+}
+
+void ArrayLiteralExpr::emit(Compiler&) const
+{
+	ERR(NotANumber);
+}
+
+// -----------------------------------------------------
+ArrayIdentifierExpr::ArrayIdentifierExpr(const std::string& name, const ArrayStore& store) : name(name), store(store) {}
+
+double ArrayIdentifierExpr::apply(const double*)
+{
+	ERR(NotANumber);
+}
+
+void ArrayIdentifierExpr::appendText(Printer& out, size_t) const
+{
+	out.write(name);
+}
+
+void ArrayIdentifierExpr::emit(Compiler&) const
+{
+	ERR(NotANumber);
+}
+
+// -----------------------------------------------------
+// Walks root like Expr::compile, but loads the arrays and the scalar inputs
+// instead of compiling them
+ArrayKernel::ArrayKernel(Expr* root, std::span<Expr** const> inputs)
+{
+	std::unordered_map<Expr**, size_t> inputIndex;
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		inputIndex.emplace(inputs[i], i);
+	}
+
+	Compiler compiler;
+	size_t literals = 0;
+	// Loads the leaf or input in slot, or returns false for an element-wise operation
+	auto load = [&](Expr** slot) {
+		Source source;
+		std::string name;
+		auto input = inputIndex.find(slot);
+		if (input != inputIndex.end()) {
+			source.input = input->second;
+			name = std::format("#{}", input->second);
+		}
+		else if (auto* literal = dynamic_cast<ArrayLiteralExpr*>(*slot)) {
+			source.literal = literal->values;
+			name = std::format("[{}]", literals++);
+		}
+		else if (auto* identifier = dynamic_cast<ArrayIdentifierExpr*>(*slot)) {
+			source.name = identifier->name;
+			source.store = &identifier->store;
+			name = identifier->name;
+		}
+		else {
+			return false;
+		}
+		const uint32_t index = compiler.addIdentifier(name);
+		if (index == sources.size())
+			sources.push_back(std::move(source));
+		compiler.emit(OpCode::Load, index);
+		return true;
+	};
+
+	std::vector<std::pair<Expr*, size_t>> stack;
+	if (!load(&root))
+		stack.push_back({ root, 0 });
+	while (!stack.empty()) {
+		auto [expr, next] = stack.back();
+		if (next < expr->childCount()) {
+			++stack.back().second;
+			Expr** slot = &expr->child(next);
+			if (!load(slot))
+				stack.push_back({ *slot, 0 });
+			continue;
+		}
+		expr->emit(compiler);
+		stack.pop_back();
+	}
+	program = std::move(compiler.program);
+}
+
+// Scratch of the kernels run on one thread. Kernels never run inside each
+// other, as the only calls in them are keywords.
+struct KernelScratch
+{
+	BlockEvaluator evaluator;
+	// The arrays of the current run, held until it ends
+	std::vector<ArrayStore::ArrayRef> arrays;
+	std::vector<const double*> starts;
+	std::vector<const double*> block;
+	// One block per scalar input, filled with its value
+	std::vector<double> broadcast;
+};
+
+// Runs kernel over every element in order, hands each block of results to
+// consume(values, n) and returns the number of elements
+template<typename Consume>
+static size_t runBlocks(const ArrayKernel& kernel, const double* inputs, Consume&& consume)
+{
+	constexpr size_t B = BatchBlockSize;
+	thread_local KernelScratch scratch;
+	struct Release
+	{
+		KernelScratch& scratch;
+		~Release() { scratch.arrays.clear(); }
+	} release{ scratch };
+
+	const size_t count = kernel.sources.size();
+	scratch.starts.resize(count);
+	scratch.block.resize(count);
+	scratch.broadcast.resize(count * B);
+	size_t length = 0;
+	bool first = true;
+	for (size_t i = 0; i < count; ++i) {
+		const ArrayKernel::Source& source = kernel.sources[i];
+		if (!source.isArray()) {
+			double* values = scratch.broadcast.data() + i * B;
+			std::fill_n(values, B, inputs[source.input]);
+			scratch.starts[i] = values;
+			continue;
+		}
+		ArrayStore::ArrayRef array = source.literal ? source.literal : source.store->find(source.name);
+		if (!array) {
+			ERR(std::format("Array '{}' not found", source.name));
+		}
+		if (first) {
+			length = array->size();
+			first = false;
+		}
+		else if (array->size() != length) {
+			ERR(std::format("Arrays of different lengths: {} and {}", length, array->size()));
+		}
+		scratch.starts[i] = array->data();
+		scratch.arrays.push_back(std::move(array));
+	}
+
+	scratch.evaluator.prepare(kernel.program);
+	for (size_t start = 0; start < length; start += B) {
+		const size_t n = std::min(B, length - start);
+		for (size_t i = 0; i < count; ++i) {
+			scratch.block[i] = kernel.sources[i].isArray() ? scratch.starts[i] + start : scratch.starts[i];
+		}
+		consume(scratch.evaluator.run(kernel.program, scratch.block.data(), n), n);
+	}
+	return length;
+}
+
+static void checkNotEmpty(KeywordType id, size_t length)
+{
+	if (length == 0) {
+		ERR(std::format("{} of an empty array", KeywordSignatures[static_cast<size_t>(id)].name));
+	}
+}
+
+// Blocks are reduced with the SIMD kernels, and the blocks' results are then
+// combined in order, so the result does not depend on the instruction set
+double ArrayKernel::reduce(KeywordType id, const double* inputs) const
+{
+	const SimdKernels& simd = SimdKernels::best();
+	switch (id)
+	{
+	case KeywordType::Sum:
+	case KeywordType::Dot:
+	case KeywordType::Mean: {
+		double sum = 0.0;
+		const size_t length = runBlocks(*this, inputs, [&](const double* values, size_t n) { sum += simd.sum(values, n); });
+		if (id != KeywordType::Mean)
+			return sum;
+		checkNotEmpty(id, length);
+		return sum / length;
+	}
+	case KeywordType::Min:
+	case KeywordType::Max: {
+		const bool min = id == KeywordType::Min;
+		double result = min ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity();
+		bool nan = false;
+		const size_t length = runBlocks(*this, inputs, [&](const double* values, size_t n) {
+			const double value = min ? simd.min(values, n) : simd.max(values, n);
+			if (std::isnan(value))
+				nan = true;
+			else
+				result = min ? std::min(result, value) : std::max(result, value);
+		});
+		checkNotEmpty(id, length);
+		return nan ? std::numeric_limits<double>::quiet_NaN() : result;
+	}
+	case KeywordType::Var: {
+		// Population variance. Each block's mean and squared deviations are merged
+		// into the running ones (Chan et al.), which stays accurate for large means.
+		double mean = 0.0;
+		double squares = 0.0;
+		size_t count = 0;
+		const size_t length = runBlocks(*this, inputs, [&](const double* values, size_t n) {
+			const double blockMean = simd.sum(values, n) / n;
+			const double blockSquares = simd.squaredDeviation(values, blockMean, n);
+			const double delta = blockMean - mean;
+			const size_t total = count + n;
+			mean += delta * n / total;
+			squares += blockSquares + delta * delta * (static_cast<double>(count) * n / total);
+			count = total;
+		});
+		checkNotEmpty(id, length);
+		return squares / length;
+	}
+	default:
+		ERR(std::format("{} does not reduce arrays", KeywordSignatures[static_cast<size_t>(id)].name));
+	}
+}
+
+std::vector<double> ArrayKernel::evaluate(const double* inputs) const
+{
+	std::vector<double> result;
+	runBlocks(*this, inputs, [&](const double* values, size_t n) { result.insert(result.end(), values, values + n); });
+	return result;
+}
+
+// -----------------------------------------------------
+ArrayExpr::ArrayExpr(Expr* leaf) : root(leaf) {}
+
+ArrayExpr::~ArrayExpr()
+{
+	// Taken over inputs are detached from root already, the rest go with it
+	delete root;
+}
+
+size_t ArrayExpr::childCount() const
+{
+	return inputs.size();
+}
+
+Expr*& ArrayExpr::child(size_t i)
+{
+	return *inputs[i];
+}
+
+double ArrayExpr::apply(const double*)
+{
+	ERR(NotANumber);
+}
+
+void ArrayExpr::appendText(Printer& out, size_t) const
+{
+	out.print(*root);
+}
+
+bool ArrayExpr::printsChildren() const
+{
+	return true;
+}
+
+void ArrayExpr::emit(Compiler&) const
+{
+	ERR(NotANumber);
+}
+
+std::vector<double> ArrayExpr::elements()
+{
+	std::vector<double> values;
+	values.reserve(inputs.size());
+	for (Expr** input : inputs) {
+		values.push_back((*input)->eval());
+	}
+	return ArrayKernel(root, inputs).evaluate(values.data());
+}
+
+const std::string& ArrayExpr::identifierName() const
+{
+	static const std::string none;
+	auto* identifier = dynamic_cast<const ArrayIdentifierExpr*>(root);
+	return identifier ? identifier->name : none;
+}
+
+Expr* ArrayExpr::unary(TokenType op, ArrayExpr* operand)
+{
+	operand->root = new UnaryExpr(op, operand->root);
+	return operand;
+}
+
+Expr* ArrayExpr::binary(TokenType op, Expr* left, Expr* right)
+{
+	auto* leftArray = dynamic_cast<ArrayExpr*>(left);
+	auto* rightArray = dynamic_cast<ArrayExpr*>(right);
+	auto* node = new BinaryExpr(op, leftArray ? leftArray->root : left, rightArray ? rightArray->root : right);
+	if (!leftArray || !rightArray) {
+		ArrayExpr* result = leftArray ? leftArray : rightArray;
+		result->inputs.push_back(leftArray ? &node->right : &node->left);
+		result->root = node;
+		return result;
+	}
+	// The side with more inputs takes the other's, so a long chain is not copied over and over
+	ArrayExpr* result = leftArray->inputs.size() >= rightArray->inputs.size() ? leftArray : rightArray;
+	ArrayExpr* other = result == leftArray ? rightArray : leftArray;
+	result->inputs.insert(result->inputs.end(), other->inputs.begin(), other->inputs.end());
+	result->root = node;
+	other->root = nullptr;
+	delete other;
+	return result;
+}
+
+Expr* ArrayExpr::keyword(const KeywordInfo& info, std::span<Expr*> arguments)
+{
+	if (info.argCount == 1) {
+		auto* array = static_cast<ArrayExpr*>(arguments[0]);
+		array->root = new KeywordExpr(info.id, { array->root });
+		return array;
+	}
+	switch (info.id)
+	{
+	case KeywordType::Mean:
+	case KeywordType::Sum:
+	case KeywordType::Min:
+	case KeywordType::Max:
+	case KeywordType::Var:
+		if (arguments.size() != 1) {
+			ERR(std::format("{} takes either numbers or a single array", info.name));
+		}
+		return new ReduceExpr(info.id, static_cast<ArrayExpr*>(arguments[0]));
+	case KeywordType::Dot:
+		return new ReduceExpr(info.id, static_cast<ArrayExpr*>(binary(TokenType::Mult, arguments[0], arguments[1])));
+	default:
+		ERR(std::format("{} does not take arrays", info.name));
+	}
+}
+
+// -----------------------------------------------------
+ReduceExpr::ReduceExpr(KeywordType id, ArrayExpr* argument)
+	: id(id), argument(argument), kernel(std::make_shared<const ArrayKernel>(argument->root, argument->inputs))
+{
+	auto native = std::make_shared<UserFunction>();
+	native->name = KeywordInfo::getTable().getByID(id).name;
+	native->argCount = argument->inputs.size();
+	native->native = [kernel = kernel, id](std::span<const double> args) { return kernel->reduce(id, args.data()); };
+	function = std::move(native);
+}
+
+ReduceExpr::~ReduceExpr()
+{
+	delete argument;
+}
+
+size_t ReduceExpr::childCount() const
+{
+	return argument->childCount();
+}
+
+Expr*& ReduceExpr::child(size_t i)
+{
+	return argument->child(i);
+}
+
+double ReduceExpr::apply(const double* values)
+{
+	PerfCounters::countKeyword(id);
+	return kernel->reduce(id, values);
+}
+
+void ReduceExpr::appendText(Printer& out, size_t) const
+{
+	out.write(KeywordInfo::getTable().getByID(id).name);
+	out.write('(');
+	if (id == KeywordType::Dot) {
+		auto* product = static_cast<const BinaryExpr*>(argument->root);
+		out.print(*product->left);
+		out.write(", ");
+		out.print(*product->right);
+	}
+	else {
+		out.print(*argument->root);
+	}
+	out.write(')');
+}
+
+bool ReduceExpr::printsChildren() const
+{
+	return true;
+}
+
+void ReduceExpr::emit(Compiler& out) const
+{
+	out.emit(OpCode::CallFunction, out.addFunction(function), static_cast<uint16_t>(argument->inputs.size()));
+}
+
+bool ReduceExpr::isLiteral() const
+{
+	return std::none_of(kernel->sources.begin(), kernel->sources.end(), [](const ArrayKernel::Source& source) { return !source.name.empty(); });
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "Expr.h"
+#include "ArrayStore.h"
+#include "Bytecode.h"
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Arrays are values inside expressions only. "xs * 2 + ys" combines arrays
+// element by element, with numbers broadcast to every element, and one of the
+// reductions sum, mean, min, max, var or dot turns the result into a number.
+// The element-wise part is never expanded per element: it stays one small tree
+// over whole arrays and runs as an ArrayKernel, a block of elements at a time.
+
+// "[1, 2, 3]"
+struct ArrayLiteralExpr : public Expr
+{
+	ArrayStore::ArrayRef values;
+
+	explicit ArrayLiteralExpr(std::vector<double> values);
+	Expr* simplify(Simplifier& pass) override;
+	// An array has no single value, this and emit throw
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	void emit(Compiler& out) const override;
+};
+
+// A name bound in store, the one it was parsed with
+struct ArrayIdentifierExpr : public Expr
+{
+	std::string name;
+	const ArrayStore& store;
+
+	ArrayIdentifierExpr(const std::string& name, const ArrayStore& store);
+	Expr* simplify(Simplifier& pass) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	void emit(Compiler& out) const override;
+};
+
+// The element-wise part of an array expression, compiled for BlockEvaluator.
+// The identifiers of program are the arrays it reads and its scalar inputs,
+// which are broadcast to every element.
+struct ArrayKernel
+{
+	// Where the values of one identifier of program come from
+	struct Source
+	{
+		// Literals are held by the kernel
+		ArrayStore::ArrayRef literal;
+		// Named arrays are looked up in store on every run
+		std::string name;
+		const ArrayStore* store = nullptr;
+		// Index of a scalar input, for neither of the above
+		size_t input = 0;
+
+		bool isArray() const { return literal || !name.empty(); }
+	};
+
+	Program program;
+	std::vector<Source> sources;
+
+	// Compiles root, whose scalar subtrees sit in the slots inputs. Every other
+	// leaf is an array.
+	ArrayKernel(Expr* root, std::span<Expr** const> inputs);
+
+	// inputs holds the values of the scalar inputs. The arrays have to be of
+	// the same length. Only the per-thread scratch of the blocks is reused, so
+	// neither of these allocates once it has grown.
+	double reduce(KeywordType id, const double* inputs) const;
+	std::vector<double> evaluate(const double* inputs) const;
+};
+
+// An array-valued expression while it is parsed, like "xs * 2" before sum takes
+// it. The parser only builds one from an array leaf and grows it with the
+// operators applied to it, so the arrays are always in root and the numbers in
+// its inputs. Evaluated on its own it gives every element, which is how arrays
+// are assigned and shown; as a number it is an error.
+struct ArrayExpr : public Expr
+{
+	Expr* root;
+	// The slots in root that hold scalar subtrees, which are the children of this node
+	std::vector<Expr**> inputs;
+
+	// leaf is an ArrayLiteralExpr or ArrayIdentifierExpr
+	explicit ArrayExpr(Expr* leaf);
+	~ArrayExpr();
+	Expr* simplify(Simplifier& pass) override;
+	size_t childCount() const override;
+	Expr*& child(size_t i) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	bool printsChildren() const override;
+	void emit(Compiler& out) const override;
+
+	// Every element, for the current values of the inputs
+	std::vector<double> elements();
+	// Name of a bare array identifier, empty for anything else
+	const std::string& identifierName() const;
+
+	// The builder's side of the operators. At least one operand is an ArrayExpr,
+	// which the result takes over, and nothing is taken over when they throw.
+	static Expr* unary(TokenType op, ArrayExpr* operand);
+	static Expr* binary(TokenType op, Expr* left, Expr* right);
+	// Element-wise keywords like sqrt stay arrays, reductions become a ReduceExpr
+	static Expr* keyword(const KeywordInfo& info, std::span<Expr*> arguments);
+};
+
+// A reduction of an array expression, like "sum(xs * 2)" or "dot(xs, ys)". Its
+// children are the scalar inputs of the array, so the tree walks treat them like
+// any other operands, and it compiles to a call of function, which runs kernel.
+struct ReduceExpr : public Expr
+{
+	KeywordType id;
+	// dot(a, b) reduces a * b, the root of argument
+	ArrayExpr* argument;
+	std::shared_ptr<const ArrayKernel> kernel;
+	// Native function around kernel, so bytecode, JIT and batches call it like any other
+	FunctionRef function;
+
+	ReduceExpr(KeywordType id, ArrayExpr* argument);
+	~ReduceExpr();
+	Expr* simplify(Simplifier& pass) override;
+	size_t childCount() const override;
+	Expr*& child(size_t i) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	bool printsChildren() const override;
+	void emit(Compiler& out) const override;
+	// Whether the kernel reads only literals, so the value never changes
+	bool isLiteral() const;
+};
@@ -0,0 +1,77 @@
+#include "ArrayStore.h"
+#include <algorithm>
+#include <mutex>
+
+ArrayStore::ArrayRef ArrayStore::find(std::string_view name) const
+{
+	if (count.load(std::memory_order_acquire) == 0) {
+		return nullptr;
+	}
+	std::shared_lock lock(mutex);
+	auto it = arrays.find(name);
+	return it != arrays.end() ? it->second : nullptr;
+}
+
+bool ArrayStore::contains(std::string_view name) const
+{
+	if (count.load(std::memory_order_acquire) == 0) {
+		return false;
+	}
+	std::shared_lock lock(mutex);
+	return arrays.find(name) != arrays.end();
+}
+
+bool ArrayStore::empty() const
+{
+	return count.load(std::memory_order_acquire) == 0;
+}
+
+void ArrayStore::set(std::string_view name, std::vector<double> values)
+{
+	auto array = std::make_shared<const std::vector<double>>(std::move(values));
+	std::unique_lock lock(mutex);
+	auto it = arrays.find(name);
+	if (it != arrays.end()) {
+		it->second = std::move(array);
+		return;
+	}
+	arrays.emplace(std::string(name), std::move(array));
+	count.store(arrays.size(), std::memory_order_release);
+	changes.fetch_add(1, std::memory_order_release);
+}
+
+bool ArrayStore::remove(std::string_view name)
+{
+	std::unique_lock lock(mutex);
+	auto it = arrays.find(name);
+	if (it == arrays.end()) {
+		return false;
+	}
+	arrays.erase(it);
+	count.store(arrays.size(), std::memory_order_release);
+	changes.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+std::vector<std::string> ArrayStore::names() const
+{
+	std::shared_lock lock(mutex);
+	std::vector<std::string> result;
+	result.reserve(arrays.size());
+	for (const auto& [name, array] : arrays) {
+		result.push_back(name);
+	}
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+uint64_t ArrayStore::generation() const
+{
+	return changes.load(std::memory_order_acquire);
+}
+
+ArrayStore& ArrayStore::global()
+{
+	static ArrayStore store;
+	return store;
+}
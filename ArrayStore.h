@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Keyword.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arrays of numbers bound to names, by assignments like "xs = [1, 2, 3]".
+// A stored array never changes; binding the name again replaces it. Expressions
+// look their arrays up on every evaluation, like identifiers, and hold one only
+// while they read it.
+class ArrayStore
+{
+public:
+	using ArrayRef = std::shared_ptr<const std::vector<double>>;
+
+	ArrayRef find(std::string_view name) const;
+	bool contains(std::string_view name) const;
+	// Without taking the lock
+	bool empty() const;
+	void set(std::string_view name, std::vector<double> values);
+	bool remove(std::string_view name);
+	std::vector<std::string> names() const;
+	// Changes whenever a name starts or stops naming an array, which changes how
+	// expressions using it parse, so caches of compiled code can tell when to drop it
+	uint64_t generation() const;
+
+	static ArrayStore& global();
+
+private:
+	mutable std::shared_mutex mutex;
+	StringMap<ArrayRef> arrays;
+	// Lets the parser skip the lock while no array is stored
+	std::atomic<size_t> count = 0;
+	std::atomic<uint64_t> changes = 0;
+};
@@ -0,0 +1,198 @@
+#include "BatchEval.h"
+#include "Function.h"
+#include "MathKernels.h"
+#include "SimdKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <stdexcept>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+void evaluateBatch(const Program& program, std::span<const std::span<const double>> columns, std::span<double> out)
+{
+	evaluateBatch(program, columns, out, detectSimdLevel());
+}
+
+void evaluateBatch(const Program& program, std::span<const std::span<const double>> columns, std::span<double> out, SimdLevel level, MathAccuracy accuracy)
+{
+	if (columns.size() != program.identifiers.size()) {
+		ERR(std::format("Expected {} columns, got {}", program.identifiers.size(), columns.size()));
+	}
+	for (size_t i = 0; i < columns.size(); ++i) {
+		if (columns[i].size() < out.size()) {
+			ERR(std::format("Column '{}' has {} rows, expected {}", program.identifiers[i], columns[i].size(), out.size()));
+		}
+	}
+	if (program.code.empty() || out.empty()) {
+		return;
+	}
+
+	BlockEvaluator evaluator(level, accuracy);
+	evaluator.prepare(program);
+	std::vector<const double*> inputs(columns.size());
+	for (size_t start = 0; start < out.size(); start += BatchBlockSize) {
+		const size_t n = std::min(BatchBlockSize, out.size() - start);
+		for (size_t i = 0; i < columns.size(); ++i) {
+			inputs[i] = columns[i].data() + start;
+		}
+		std::copy_n(evaluator.run(program, inputs.data(), n), n, out.data() + start);
+	}
+}
+
+// -----------------------------------------------------
+BlockEvaluator::BlockEvaluator(SimdLevel level, MathAccuracy accuracy)
+	: kernels(SimdKernels::get(level)), math(MathKernels::get(accuracy, level))
+{
+}
+
+void BlockEvaluator::prepare(const Program& program)
+{
+	constexpr size_t B = BatchBlockSize;
+	storage.resize((program.maxStack + program.constants.size()) * B);
+	double* constantBlocks = storage.data() + program.maxStack * B;
+	for (size_t c = 0; c < program.constants.size(); ++c) {
+		std::fill_n(constantBlocks + c * B, B, program.constants[c]);
+	}
+	stack.resize(program.maxStack);
+}
+
+const double* BlockEvaluator::run(const Program& program, const double* const* inputs, size_t n)
+{
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	constexpr size_t B = BatchBlockSize;
+	double* registers = storage.data();
+	const double* constantBlocks = registers + program.maxStack * B;
+	size_t depth = 0;
+	const Instruction* previous = nullptr;
+
+	for (const Instruction& ins : program.code) {
+		switch (ins.op)
+		{
+		case OpCode::Const:
+			stack[depth++] = constantBlocks + ins.arg * B;
+			break;
+		case OpCode::Load:
+			stack[depth++] = inputs[ins.arg];
+			break;
+		case OpCode::Neg: {
+			double* dst = registers + (depth - 1) * B;
+			kernels.neg(stack[depth - 1], dst, n);
+			stack[depth - 1] = dst;
+			break;
+		}
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Div:
+		case OpCode::Pow: {
+			--depth;
+			const double* l = stack[depth - 1];
+			const double* r = stack[depth];
+			double* dst = registers + (depth - 1) * B;
+			switch (ins.op)
+			{
+			case OpCode::Add:
+				kernels.add(l, r, dst, n);
+				break;
+			case OpCode::Sub:
+				kernels.sub(l, r, dst, n);
+				break;
+			case OpCode::Mul:
+				kernels.mul(l, r, dst, n);
+				break;
+			case OpCode::Div:
+				kernels.div(l, r, dst, n);
+				break;
+			default:
+				// A constant square is a multiplication, see power(). There is no
+				// vector pow that rounds like std::pow, so the rest stays a tight scalar loop.
+				if (previous && previous->op == OpCode::Const && program.constants[previous->arg] == 2.0) {
+					kernels.mul(l, l, dst, n);
+					break;
+				}
+				for (size_t i = 0; i < n; ++i)
+					dst[i] = power(l[i], r[i]);
+				break;
+			}
+			stack[depth - 1] = dst;
+			break;
+		}
+		case OpCode::Call: {
+			const KeywordInfo& info = keywords.getByID(static_cast<KeywordType>(ins.arg));
+			depth -= ins.count;
+			double* dst = registers + depth * B;
+			if (MathKernels::Unary kernel = math.kernels[static_cast<size_t>(info.id)]) {
+				kernel(stack[depth], dst, n);
+			}
+			else if (info.argCount == 0) {
+				std::fill_n(dst, n, info.nullary());
+			}
+			else if (info.argCount == 1) {
+				const double* x = stack[depth];
+				for (size_t i = 0; i < n; ++i)
+					dst[i] = info.unary(x[i]);
+			}
+			else if (info.argCount == 2) {
+				const double* a = stack[depth];
+				const double* b = stack[depth + 1];
+				for (size_t i = 0; i < n; ++i)
+					dst[i] = info.binary(a[i], b[i]);
+			}
+			else {
+				// Rows are gathered into one reused argument list, so this does not allocate
+				args.resize(ins.count);
+				for (size_t i = 0; i < n; ++i) {
+					for (uint16_t a = 0; a < ins.count; ++a)
+						args[a] = stack[depth + a][i];
+					dst[i] = info.variadic(args);
+				}
+			}
+			stack[depth++] = dst;
+			break;
+		}
+		case OpCode::CallFunction: {
+			const UserFunction& function = *program.functions[ins.arg];
+			depth -= ins.count;
+			double* dst = registers + depth * B;
+			args.resize(ins.count);
+			for (size_t i = 0; i < n; ++i) {
+				for (uint16_t a = 0; a < ins.count; ++a)
+					args[a] = stack[depth + a][i];
+				dst[i] = function.call(args.data());
+			}
+			stack[depth++] = dst;
+			break;
+		}
+		default:
+			ERR("Unknown opcode");
+		}
+		previous = &ins;
+	}
+	return stack[0];
+}
+
+// -----------------------------------------------------
+void evaluateBatch(std::string_view source, const StringMap<std::span<const double>>& columnsByName, std::span<double> out, ExprCache& cache)
+{
+	ExprCache::Entry compiled = cache.get(source);
+	if (compiled->isArray) {
+		ERR(std::format("{} is an array, not a number", compiled->text));
+	}
+	std::vector<std::span<const double>> columns = bindColumns(compiled->program, columnsByName);
+	evaluateBatch(compiled->program, columns, out);
+}
+
+std::vector<std::span<const double>> bindColumns(const Program& program, const StringMap<std::span<const double>>& columnsByName)
+{
+	std::vector<std::span<const double>> columns;
+	columns.reserve(program.identifiers.size());
+	for (const std::string& name : program.identifiers) {
+		auto it = columnsByName.find(name);
+		if (it == columnsByName.end()) {
+			ERR(std::format("No column for identifier '{}'", name));
+		}
+		columns.push_back(it->second);
+	}
+	return columns;
+}
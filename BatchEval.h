@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "CpuFeatures.h"
+#include "ExprCache.h"
+#include "Keyword.h"
+#include <span>
+#include <vector>
+
+struct SimdKernels;
+
+// Rows are evaluated in blocks this large, so one block of every stack slot stays in L1
+constexpr size_t BatchBlockSize = 256;
+
+// Runs a program over one block of rows at a time, the loop body of
+// evaluateBatch. The blocks are kept between runs, so evaluating many blocks,
+// or many programs one after another, allocates only when a program needs
+// more of them than any before it. The one-argument keywords run at accuracy.
+class BlockEvaluator
+{
+public:
+	explicit BlockEvaluator(SimdLevel level = detectSimdLevel(), MathAccuracy accuracy = MathAccuracy::Libm);
+
+	// Fills the constant blocks of program, before the first run of it
+	void prepare(const Program& program);
+	// inputs[i] points at n <= BatchBlockSize rows of program.identifiers[i].
+	// Returns the n results, valid until the next prepare or run.
+	const double* run(const Program& program, const double* const* inputs, size_t n);
+
+private:
+	const SimdKernels& kernels;
+	const MathKernels& math;
+	// One block per stack slot for intermediate results, and one pre-filled block per constant
+	std::vector<double> storage;
+	// Stack slots point at a register, a constant block or straight into an input
+	std::vector<const double*> stack;
+	std::vector<double> args;
+};
+
+// Evaluates program once per row of a structure-of-arrays input and writes one
+// result per row into out. columns[i] holds the values of program.identifiers[i]
+// and needs at least out.size() rows. Every instruction runs over a whole block
+// of rows at once using the widest SIMD kernels the CPU supports.
+void evaluateBatch(const Program& program, std::span<const std::span<const double>> columns, std::span<double> out);
+// Same as above, but never uses instructions beyond level, and runs the
+// one-argument keywords at accuracy
+void evaluateBatch(const Program& program, std::span<const std::span<const double>> columns, std::span<double> out, SimdLevel level, MathAccuracy accuracy = MathAccuracy::Libm);
+
+// Looks source up in cache, compiling it on a miss, and evaluates it over named columns
+void evaluateBatch(std::string_view source, const StringMap<std::span<const double>>& columnsByName, std::span<double> out, ExprCache& cache = ExprCache::global());
+
+// Orders named columns the way evaluateBatch expects them for program
+std::vector<std::span<const double>> bindColumns(const Program& program, const StringMap<std::span<const double>>& columnsByName);
@@ -0,0 +1,462 @@
+#include "BatchMode.h"
+#include "ArrayStore.h"
+#include "ExprArena.h"
+#include "ExprCache.h"
+#include "Function.h"
+#include "MappedFile.h"
+#include "ParallelEval.h"
+#include "Parser.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+// Lines evaluated, and results written, per round
+constexpr size_t chunkLines = 16384;
+// Lines a worker takes at a time
+constexpr size_t lineGrain = 256;
+// Bytes the writer collects before handing them to the file
+constexpr size_t writeBufferSize = 1 << 20;
+// Bytes read from stdin at a time
+constexpr size_t readBlockSize = 4 << 20;
+
+std::string BatchSummary::toString() const
+{
+	return std::format("{} expressions, {} errors, {} definitions, {} bytes in {:.3f} s ({:.1f} MB/s)",
+		expressions, errors, definitions, bytes, seconds, seconds > 0.0 ? bytes / seconds / 1e6 : 0.0);
+}
+
+OutputFormat parseOutputFormat(std::string_view name)
+{
+	if (name == "values")
+		return OutputFormat::Values;
+	if (name == "csv")
+		return OutputFormat::Csv;
+	if (name == "json")
+		return OutputFormat::Json;
+	ERR(std::format("Unknown output format: {}", name));
+}
+
+// -----------------------------------------------------
+// Collects output in one large buffer and writes it with a single call when full
+class BufferedWriter
+{
+public:
+	explicit BufferedWriter(std::FILE* file)
+		: file(file)
+	{
+		buffer.reserve(writeBufferSize + 4096);
+	}
+
+	~BufferedWriter()
+	{
+		flush();
+	}
+
+	void write(std::string_view text)
+	{
+		buffer.append(text);
+		if (buffer.size() >= writeBufferSize)
+			flush();
+	}
+
+	void write(char c)
+	{
+		buffer.push_back(c);
+	}
+
+	// The same text as std::format("{}") and so the shell. Plain std::to_chars
+	// picks whichever of 1e+05 and 100000 is shorter.
+	void writeNumber(double value)
+	{
+		char digits[32];
+		auto result = std::format_to_n(digits, sizeof(digits), "{}", value);
+		buffer.append(digits, result.out);
+	}
+
+	void writeNumber(size_t value)
+	{
+		char digits[24];
+		auto result = std::to_chars(digits, digits + sizeof(digits), value);
+		buffer.append(digits, result.ptr);
+	}
+
+	// JSON has no literal for them, so inf and nan are written as strings
+	void writeJsonNumber(double value)
+	{
+		if (std::isfinite(value)) {
+			writeNumber(value);
+			return;
+		}
+		buffer.push_back('"');
+		writeNumber(value);
+		buffer.push_back('"');
+	}
+
+	void writeCsvField(std::string_view text)
+	{
+		if (text.find_first_of(",\"\n") == std::string_view::npos) {
+			buffer.append(text);
+			return;
+		}
+		buffer.push_back('"');
+		for (char c : text) {
+			if (c == '"')
+				buffer.push_back('"');
+			buffer.push_back(c);
+		}
+		buffer.push_back('"');
+	}
+
+	void writeJsonString(std::string_view text)
+	{
+		buffer.push_back('"');
+		for (char c : text) {
+			switch (c)
+			{
+			case '"':
+				buffer.append("\\\"");
+				break;
+			case '\\':
+				buffer.append("\\\\");
+				break;
+			case '\t':
+				buffer.append("\\t");
+				break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+					buffer.append(std::format("\\u{:04x}", static_cast<int>(c)));
+				else
+					buffer.push_back(c);
+			}
+		}
+		buffer.push_back('"');
+	}
+
+	void flush()
+	{
+		if (!buffer.empty()) {
+			std::fwrite(buffer.data(), 1, buffer.size(), file);
+			buffer.clear();
+		}
+	}
+
+private:
+	std::FILE* file;
+	std::string buffer;
+};
+
+// -----------------------------------------------------
+enum class LineKind : uint8_t {
+	Expression,
+	Assignment,
+	Definition,
+	// Only kept for OutputFormat::Values, which writes a line for every input line
+	Blank
+};
+
+// The value of a line, or the elements of an array-valued one
+struct LineResult : EvalResult
+{
+	bool isArray = false;
+	std::vector<double> elements;
+};
+
+// "[1, 2.5, 3]", the way the shell prints an array
+static std::string arrayToString(std::span<const double> elements)
+{
+	std::string result = "[";
+	for (size_t i = 0; i < elements.size(); ++i) {
+		result += std::format("{}{}", i ? ", " : "", elements[i]);
+	}
+	return result + "]";
+}
+
+// Splits text into lines, evaluates them a chunk at a time and writes the
+// results of each chunk before the next one is read
+class BatchRunner
+{
+public:
+	BatchRunner(std::FILE* out, const BatchOptions& options)
+		: format(options.format), writer(out), start(std::chrono::steady_clock::now())
+	{
+		if (options.threads > 1) {
+			pool = std::make_unique<ThreadPool>(options.threads);
+		}
+		// One per worker plus one for the calling thread
+		arenas.resize(pool ? pool->size() + 1 : 1);
+		if (format == OutputFormat::Csv) {
+			writer.write("line,expression,value,error\n");
+		}
+		else if (format == OutputFormat::Json) {
+			writer.write('[');
+		}
+	}
+
+	// Handles the complete lines of text. Nothing of text is kept afterwards.
+	void process(std::string_view text)
+	{
+		summary.bytes += text.size();
+		size_t begin = 0;
+		while (begin < text.size()) {
+			size_t end = text.find('\n', begin);
+			if (end == std::string_view::npos)
+				end = text.size();
+			std::string_view line = text.substr(begin, end - begin);
+			begin = end + 1;
+			++lineNumber;
+			if (!line.empty() && line.back() == '\r')
+				line.remove_suffix(1);
+			LineKind kind = LineKind::Expression;
+			if (line.find_first_not_of(" \t") == std::string_view::npos) {
+				if (format != OutputFormat::Values)
+					continue;
+				kind = LineKind::Blank;
+			}
+			else if (line.find('=') != std::string_view::npos)
+				kind = FunctionTable::isDefinition(line) ? LineKind::Definition : LineKind::Assignment;
+			lines.push_back({ line, lineNumber, kind });
+			if (lines.size() == chunkLines)
+				runChunk();
+		}
+		runChunk();
+	}
+
+	BatchSummary finish()
+	{
+		if (format == OutputFormat::Json) {
+			writer.write(written ? "\n]\n" : "]\n");
+		}
+		writer.flush();
+		summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return summary;
+	}
+
+private:
+	struct Line
+	{
+		std::string_view text;
+		size_t number;
+		LineKind kind;
+	};
+
+	static void evaluate(const Line& line, ExprArena& arena, LineResult& result)
+	{
+		if (line.kind == LineKind::Blank)
+			return;
+		// Failures only pay for the exception, the common path is a plain call
+		try {
+			arena.clear();
+			PrattParser parser{ line.text };
+			parseArenaExpr(parser, arena);
+			result.value = arena.eval();
+			return;
+		}
+		catch (const std::exception& e) {
+			result.error = e.what();
+		}
+		// An ExprArena rejects arrays, so a line that may use one is run again the way the shell runs it
+		if (line.text.find('[') != std::string_view::npos || !ArrayStore::global().empty())
+			evaluateTree(line, result);
+	}
+
+	static void evaluateTree(const Line& line, LineResult& result)
+	{
+		try {
+			ExprCache::Entry compiled = ExprCache::global().get(line.text);
+			if (compiled->isArray) {
+				result.isArray = true;
+				result.elements = compiled->elements;
+			}
+			else {
+				result.value = execute(compiled->program);
+			}
+			result.error.clear();
+		}
+		catch (const std::exception& e) {
+			result.error = e.what();
+		}
+	}
+
+	// Evaluates lines [begin, end), none of which assigns or defines anything
+	void evaluateRange(size_t begin, size_t end)
+	{
+		if (!pool || end - begin <= lineGrain) {
+			for (size_t i = begin; i < end; ++i)
+				evaluate(lines[i], arenas.back(), results[i]);
+			return;
+		}
+		pool->parallelFor(end - begin, lineGrain, [&](size_t first, size_t last, size_t worker) {
+			for (size_t i = begin + first; i < begin + last; ++i)
+				evaluate(lines[i], arenas[worker], results[i]);
+		});
+	}
+
+	void runChunk()
+	{
+		results.assign(lines.size(), LineResult{});
+		// Lines with side effects split the chunk, so everything sees them in order
+		size_t begin = 0;
+		for (size_t i = 0; i < lines.size(); ++i) {
+			if (lines[i].kind == LineKind::Expression || lines[i].kind == LineKind::Blank)
+				continue;
+			evaluateRange(begin, i);
+			if (lines[i].kind == LineKind::Definition) {
+				try {
+					FunctionTable::global().define(lines[i].text);
+				}
+				catch (const std::exception& e) {
+					results[i].error = e.what();
+				}
+			}
+			else {
+				evaluate(lines[i], arenas.back(), results[i]);
+			}
+			begin = i + 1;
+		}
+		evaluateRange(begin, lines.size());
+
+		for (size_t i = 0; i < lines.size(); ++i) {
+			write(lines[i], results[i]);
+		}
+		lines.clear();
+	}
+
+	void write(const Line& line, const LineResult& result)
+	{
+		// Values keeps one output line per input line, so they can be matched up
+		if (line.kind == LineKind::Blank || (line.kind == LineKind::Definition && result.ok())) {
+			if (line.kind == LineKind::Definition)
+				++summary.definitions;
+			if (format == OutputFormat::Values)
+				writer.write('\n');
+			return;
+		}
+		++summary.expressions;
+		if (!result.ok())
+			++summary.errors;
+
+		switch (format)
+		{
+		case OutputFormat::Values:
+			if (result.isArray)
+				writer.write(arrayToString(result.elements));
+			else if (result.ok())
+				writer.writeNumber(result.value);
+			writer.write('\n');
+			break;
+		case OutputFormat::Csv:
+			writer.writeNumber(line.number);
+			writer.write(',');
+			writer.writeCsvField(line.text);
+			writer.write(',');
+			if (result.isArray)
+				writer.writeCsvField(arrayToString(result.elements));
+			else if (result.ok())
+				writer.writeNumber(result.value);
+			writer.write(',');
+			writer.writeCsvField(result.error);
+			writer.write('\n');
+			break;
+		case OutputFormat::Json:
+			writer.write(written ? ",\n{\"line\":" : "\n{\"line\":");
+			writer.writeNumber(line.number);
+			writer.write(",\"expression\":");
+			writer.writeJsonString(line.text);
+			if (!result.ok()) {
+				writer.write(",\"error\":");
+				writer.writeJsonString(result.error);
+			}
+			else if (result.isArray) {
+				writer.write(",\"value\":[");
+				for (size_t i = 0; i < result.elements.size(); ++i) {
+					if (i)
+						writer.write(',');
+					writer.writeJsonNumber(result.elements[i]);
+				}
+				writer.write(']');
+			}
+			else {
+				writer.write(",\"value\":");
+				writer.writeJsonNumber(result.value);
+			}
+			writer.write('}');
+			break;
+		}
+		written = true;
+	}
+
+	OutputFormat format;
+	BufferedWriter writer;
+	std::unique_ptr<ThreadPool> pool;
+	std::vector<ExprArena> arenas;
+	std::vector<Line> lines;
+	std::vector<LineResult> results;
+	size_t lineNumber = 0;
+	bool written = false;
+	BatchSummary summary;
+	std::chrono::steady_clock::time_point start;
+};
+
+// -----------------------------------------------------
+BatchSummary runBatch(std::string_view input, std::FILE* out, const BatchOptions& options)
+{
+	BatchRunner runner(out, options);
+	runner.process(input);
+	return runner.finish();
+}
+
+// Reads file in large blocks, handing the runner only complete lines
+static BatchSummary runBatchStream(std::FILE* file, std::FILE* out, const BatchOptions& options)
+{
+	BatchRunner runner(out, options);
+	std::vector<char> block(readBlockSize);
+	size_t carried = 0;
+	while (true) {
+		if (carried == block.size()) {
+			// A single line longer than the block
+			block.resize(block.size() * 2);
+		}
+		size_t read = std::fread(block.data() + carried, 1, block.size() - carried, file);
+		size_t filled = carried + read;
+		if (read == 0) {
+			runner.process(std::string_view(block.data(), filled));
+			break;
+		}
+		std::string_view text(block.data(), filled);
+		size_t lastNewline = text.rfind('\n');
+		if (lastNewline == std::string_view::npos) {
+			carried = filled;
+			continue;
+		}
+		runner.process(text.substr(0, lastNewline + 1));
+		carried = filled - lastNewline - 1;
+		std::copy(block.begin() + lastNewline + 1, block.begin() + filled, block.begin());
+	}
+	return runner.finish();
+}
+
+BatchSummary runBatchFile(const std::string& path, std::FILE* out, const BatchOptions& options)
+{
+	if (path == "-") {
+		return runBatchStream(stdin, out, options);
+	}
+	MappedFile mapped(path);
+	if (mapped.isMapped()) {
+		return runBatch(mapped.view(), out, options);
+	}
+	// Empty files, pipes and anything else that cannot be mapped are read instead
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "rb"), &std::fclose);
+	if (!file) {
+		ERR(std::format("Cannot open {}", path));
+	}
+	return runBatchStream(file.get(), out, options);
+}
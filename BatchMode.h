@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+enum class OutputFormat {
+	Values,	// One line per input line: the value, or empty for a failed expression,
+			// a blank line or a function definition
+	Csv,	// line,expression,value,error with a header
+	Json	// An array of { line, expression, value } or { line, expression, error }
+};
+
+struct BatchOptions
+{
+	OutputFormat format = OutputFormat::Values;
+	// Threads evaluating expressions; 1 evaluates on the calling thread only
+	size_t threads = 1;
+};
+
+// What one batch run did
+struct BatchSummary
+{
+	// Expressions and assignments evaluated, and how many of them failed
+	size_t expressions = 0;
+	size_t errors = 0;
+	size_t definitions = 0;
+	size_t bytes = 0;
+	double seconds = 0.0;
+
+	std::string toString() const;
+};
+
+// Evaluates every line of input and writes the results to out in input order.
+// Lines are evaluated in chunks, in parallel when options.threads > 1. Lines
+// containing '=' are run on their own between the lines around them, so
+// assignments and function definitions take effect exactly where they appear.
+// Except with OutputFormat::Values, blank lines and definitions produce no
+// output.
+BatchSummary runBatch(std::string_view input, std::FILE* out, const BatchOptions& options = {});
+// Same for a file, which is mapped into memory where possible. "-" reads stdin
+// in large blocks. Throws if the file cannot be opened.
+BatchSummary runBatchFile(const std::string& path, std::FILE* out, const BatchOptions& options = {});
+
+// "values", "csv" or "json"
+OutputFormat parseOutputFormat(std::string_view name);
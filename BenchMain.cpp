@@ -0,0 +1,96 @@
+#include "Benchmark.h"
+
+#include <fstream>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+static void usage()
+{
+	std::println("Usage: rationalis_bench [--json FILE] [--scale FACTOR]");
+	std::println("       rationalis_bench --lexer | --batch | --batch-mode | --scaling | --jit | --graph | --gradient | --sharing | --load | --stats | --accuracy");
+	std::println("Without --json the results are written to stdout as JSON.");
+}
+
+int main(int argc, char** argv)
+{
+	std::string jsonPath;
+	double scale = 1.0;
+	try {
+		for (int i = 1; i < argc; ++i) {
+			std::string_view arg = argv[i];
+			if (arg == "--json" && i + 1 < argc) {
+				jsonPath = argv[++i];
+			}
+			else if (arg == "--scale" && i + 1 < argc) {
+				scale = std::stod(argv[++i]);
+			}
+			else if (arg == "--lexer") {
+				benchmarkLexers();
+				return 0;
+			}
+			else if (arg == "--batch") {
+				benchmarkBatch();
+				return 0;
+			}
+			else if (arg == "--batch-mode") {
+				benchmarkBatchMode();
+				return 0;
+			}
+			else if (arg == "--scaling") {
+				benchmarkScaling();
+				return 0;
+			}
+			else if (arg == "--jit") {
+				benchmarkJit();
+				return 0;
+			}
+			else if (arg == "--graph") {
+				benchmarkGraph();
+				return 0;
+			}
+			else if (arg == "--gradient") {
+				benchmarkGradient();
+				return 0;
+			}
+			else if (arg == "--sharing") {
+				benchmarkSharing();
+				return 0;
+			}
+			else if (arg == "--load") {
+				benchmarkProgramFile();
+				return 0;
+			}
+			else if (arg == "--stats") {
+				benchmarkPerfCounters();
+				return 0;
+			}
+			else if (arg == "--accuracy") {
+				benchmarkAccuracy();
+				return 0;
+			}
+			else {
+				usage();
+				return arg == "--help" ? 0 : 1;
+			}
+		}
+
+		std::vector<BenchmarkResult> results = runBenchmarkSuite(scale);
+		std::string json = benchmarkResultsToJson(results);
+		if (jsonPath.empty()) {
+			std::print("{}", json);
+			return 0;
+		}
+		std::ofstream file(jsonPath, std::ios::binary);
+		if (!file || !(file << json)) {
+			throw std::runtime_error("Cannot write " + jsonPath);
+		}
+		std::print("{}", benchmarkResultsToTable(results));
+	}
+	catch (const std::exception& e) {
+		std::println(stderr, "Error: {}", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,982 @@
+#include "Benchmark.h"
+#include "Tokenizer.h"
+#include "FastLexer.h"
+#include "Parser.h"
+#include "ParseRule.h"
+#include "BatchEval.h"
+#include "Jit.h"
+#include "ParallelEval.h"
+#include "ThreadPool.h"
+#include "VariableStore.h"
+#include "CpuFeatures.h"
+#include "Optimizer.h"
+#include "FormulaGraph.h"
+#include "Gradient.h"
+#include "ExprArena.h"
+#include "ProgramFile.h"
+#include "PerfCounters.h"
+#include "MathKernels.h"
+#include "BatchMode.h"
+#include "ExprCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <limits>
+#include <memory>
+#include <print>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Builds newline separated formulas that use every kind of token
+static std::string generateFormulas(size_t count, uint32_t seed)
+{
+	static const char* const operators[] = { " + ", " - ", " * ", " / ", "^" };
+	static const char* const functions[] = { "sin(", "cos(", "sqrt(", "log(", "arctan(" };
+	static const char* const identifiers[] = { "x", "rate", "spot", "Volatility", "t" };
+
+	std::mt19937 rng(seed);
+	std::string text;
+	for (size_t i = 0; i < count; ++i) {
+		size_t terms = 2 + rng() % 8;
+		int open = 0;
+		for (size_t t = 0; t < terms; ++t) {
+			switch (rng() % 6)
+			{
+			case 0:
+				text += std::to_string(rng() % 100000);
+				break;
+			case 1:
+				text += std::to_string(rng() % 1000) + "." + std::to_string(rng() % 100000);
+				break;
+			case 2:
+				text += identifiers[rng() % 5];
+				break;
+			case 3:
+				text += rng() % 2 ? "pi" : "e";
+				break;
+			case 4:
+				text += functions[rng() % 5];
+				text += identifiers[rng() % 5];
+				text += ")";
+				break;
+			case 5:
+				text += "(";
+				text += identifiers[rng() % 5];
+				open++;
+				break;
+			}
+			if (t + 1 < terms)
+				text += operators[rng() % 5];
+		}
+		while (open-- > 0)
+			text += ")";
+		text += "\n";
+	}
+	return text;
+}
+
+static bool sameTokens(const std::vector<Token>& a, const std::vector<Token>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].type != b[i].type || a[i].content != b[i].content ||
+			std::memcmp(&a[i].number, &b[i].number, sizeof(double)) != 0)
+			return false;
+	}
+	return true;
+}
+
+// Best of several runs, in MB/s
+template<typename Func>
+static double measureThroughput(const std::string& text, int runs, Func&& lex)
+{
+	double best = 0.0;
+	for (int run = 0; run < runs; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		lex();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::max(best, text.size() / elapsed.count() / 1e6);
+	}
+	return best;
+}
+
+void benchmarkLexers(size_t formulaCount)
+{
+	const std::string text = generateFormulas(formulaCount, 42);
+	const int runs = 5;
+
+	std::vector<Token> reference = tokenize(text);
+	std::vector<Token> fast = tokenizeFast(text);
+	if (!sameTokens(reference, fast)) {
+		throw std::runtime_error("tokenizeFast does not match tokenize");
+	}
+
+	double referenceSpeed = measureThroughput(text, runs, [&] { reference = tokenize(text); });
+	double fastSpeed = measureThroughput(text, runs, [&] { tokenizeFast(text, fast); });
+
+	std::println("Lexing {} formulas ({:.2f} MB, {} tokens)", formulaCount, text.size() / 1e6, reference.size());
+	std::println("  tokenize     {:8.1f} MB/s", referenceSpeed);
+	std::println("  tokenizeFast {:8.1f} MB/s ({:.2f}x)", fastSpeed, fastSpeed / referenceSpeed);
+}
+
+template<typename Func>
+static double measureSeconds(int runs, Func&& func)
+{
+	double best = 1e300;
+	for (int run = 0; run < runs; ++run) {
+		auto start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return best;
+}
+
+void benchmarkBatch(size_t rowCount)
+{
+	const char* source = "x * y + 3 * x - y / 2 + sqrt(x ^ 2 + y ^ 2) - -x";
+	PrattParser parser{ std::string_view(source) };
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	Program program = compile(expr.get());
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<double> dist(-100.0, 100.0);
+	StringMap<std::vector<double>> data;
+	for (const std::string& name : program.identifiers) {
+		auto& column = data[name];
+		column.resize(rowCount);
+		for (double& v : column)
+			v = dist(rng);
+	}
+	StringMap<std::span<const double>> named;
+	for (const auto& [name, column] : data)
+		named.emplace(name, column);
+	std::vector<std::span<const double>> columns = bindColumns(program, named);
+
+	std::vector<double> expected(rowCount);
+	std::vector<Binding> row(program.identifiers.size());
+	double treeTime = measureSeconds(1, [&] {
+		for (size_t r = 0; r < rowCount; ++r) {
+			for (size_t i = 0; i < row.size(); ++i)
+				row[i] = Binding{ program.identifiers[i], columns[i][r] };
+			VariableStore::global().set(row);
+			expected[r] = expr->eval();
+		}
+	});
+
+	std::println("Evaluating {} over {} rows", source, rowCount);
+	std::println("  tree walk {:>8} {:8.1f} Mrows/s", "", rowCount / treeTime / 1e6);
+
+	// What batch evaluation is meant to reach against the tree walk
+	const double target = 10.0;
+	double best = 0.0;
+	std::vector<double> out(rowCount);
+	for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+		if (level > detectSimdLevel())
+			continue;
+		double batchTime = measureSeconds(3, [&] { evaluateBatch(program, columns, out, level); });
+		if (std::memcmp(out.data(), expected.data(), rowCount * sizeof(double)) != 0) {
+			throw std::runtime_error("evaluateBatch does not match Expr::eval");
+		}
+		std::println("  batch     {:>8} {:8.1f} Mrows/s ({:.1f}x)", simdLevelToString(level), rowCount / batchTime / 1e6, treeTime / batchTime);
+		best = std::max(best, treeTime / batchTime);
+	}
+	if (best >= target)
+		std::println("  target {:.0f}x: met, best {:.1f}x", target, best);
+	else
+		std::println("  target {:.0f}x: NOT met, best {:.1f}x is {:.0f}% short", target, best, (1.0 - best / target) * 100.0);
+}
+
+// "[1, 2.5, 3]", the way the shell prints an array
+static std::string arrayToString(std::span<const double> elements)
+{
+	std::string result = "[";
+	for (size_t i = 0; i < elements.size(); ++i) {
+		result += std::format("{}{}", i ? ", " : "", elements[i]);
+	}
+	return result + "]";
+}
+
+void benchmarkBatchMode(size_t lineCount)
+{
+	// Assignments first and every thousand lines, so the order they run in shows up in the results
+	std::string input = "rate = 0.05\nspot = 100\nVolatility = 0.2\nt = 2\n";
+	std::istringstream formulas(generateFormulas(lineCount, 29));
+	size_t n = 0;
+	for (std::string line; std::getline(formulas, line); ++n) {
+		if (n % 1000 == 0) {
+			input += std::format("x = {}\n", 0.5 + n / 1000);
+			input += "xs = [1, 2.5, 3]\nsum(xs * x) + mean([4, 5])\nxs / 2 - x\n";
+		}
+		input += line;
+		input += '\n';
+	}
+
+	// What the shell prints for each line, errors as empty lines like OutputFormat::Values
+	std::string expected;
+	double shellTime = measureSeconds(1, [&] {
+		std::istringstream lines(input);
+		for (std::string line; std::getline(lines, line);) {
+			try {
+				ExprCache::Entry compiled = ExprCache::global().get(line);
+				if (compiled->isArray)
+					expected += arrayToString(compiled->elements);
+				else
+					expected += std::format("{}", execute(compiled->program));
+			}
+			catch (const std::exception&) {
+			}
+			expected += '\n';
+		}
+	});
+
+	std::println("{} lines in batch mode and through the shell", std::ranges::count(input, '\n'));
+	std::println("  shell        {:8.3f} s", shellTime);
+	for (size_t threads : { size_t(1), size_t(std::max(2u, std::thread::hardware_concurrency())) }) {
+		std::unique_ptr<std::FILE, int (*)(std::FILE*)> out{ std::tmpfile(), std::fclose };
+		if (!out) {
+			throw std::runtime_error("Cannot create a temporary file");
+		}
+		BatchOptions options;
+		options.threads = threads;
+		double batchTime = measureSeconds(1, [&] { runBatch(input, out.get(), options); });
+
+		std::string output(std::ftell(out.get()), '\0');
+		std::rewind(out.get());
+		if (std::fread(output.data(), 1, output.size(), out.get()) != output.size() || output != expected) {
+			throw std::runtime_error(std::format("runBatch on {} threads does not match the shell", threads));
+		}
+		std::println("  batch {:2} thr {:8.3f} s ({:.1f}x)", threads, batchTime, shellTime / batchTime);
+	}
+}
+
+static bool sameResults(const std::vector<EvalResult>& a, const std::vector<EvalResult>& b)
+{
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].error != b[i].error || std::memcmp(&a[i].value, &b[i].value, sizeof(double)) != 0)
+			return false;
+	}
+	return a.size() == b.size();
+}
+
+void benchmarkScaling(size_t jobCount)
+{
+	// A working set of formulas, each evaluated many times with different values
+	std::vector<std::string> formulas;
+	std::istringstream lines(generateFormulas(1000, 11));
+	for (std::string line; std::getline(lines, line);)
+		formulas.push_back(line);
+
+	static const char* const names[] = { "x", "rate", "spot", "Volatility", "t" };
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<double> dist(0.0, 10.0);
+	std::vector<Binding> bindings(jobCount * 5);
+	std::vector<EvalJob> jobs(jobCount);
+	for (size_t i = 0; i < jobCount; ++i) {
+		for (size_t n = 0; n < 5; ++n)
+			bindings[i * 5 + n] = Binding{ names[n], dist(rng) };
+		jobs[i] = EvalJob{ formulas[rng() % formulas.size()], std::span(bindings).subspan(i * 5, 5) };
+	}
+
+	const size_t hardware = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	const size_t maxThreads = std::max<size_t>(hardware, 32);
+	std::println("Evaluating {} jobs over {} formulas ({} hardware threads)", jobCount, formulas.size(), hardware);
+
+	std::vector<EvalResult> reference;
+	double baseTime = 0.0;
+	for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+		ThreadPool pool(threads);
+		std::vector<EvalResult> results;
+		double time = measureSeconds(3, [&] { results = evaluateJobs(jobs, pool, ExprCache::global(), VariableStore::global()); });
+		if (threads == 1) {
+			reference = results;
+			baseTime = time;
+		}
+		else if (!sameResults(reference, results)) {
+			throw std::runtime_error("evaluateJobs depends on the number of threads");
+		}
+		double speedup = baseTime / time;
+		std::println("  {:>3} threads {:8.2f} Mjobs/s {:6.2f}x ({:3.0f}% efficiency)", threads, jobCount / time / 1e6, speedup, 100.0 * speedup / std::min(threads, hardware));
+	}
+}
+
+void benchmarkJit(size_t rowCount)
+{
+	const char* source = "x * y + 3 * x - y / 2 + sqrt(x * x + y * y) - -x * (x - 1) / (y + 2)";
+	PrattParser parser{ std::string_view(source) };
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	JitFunction function = jitCompile(expr.get());
+	const Program& program = function.getProgram();
+
+	// Row major, one slot array per row
+	const size_t width = program.identifiers.size();
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<double> dist(-100.0, 100.0);
+	std::vector<double> rows(rowCount * width);
+	for (double& v : rows)
+		v = dist(rng);
+
+	std::vector<double> expected(rowCount);
+	double vmTime = measureSeconds(3, [&] {
+		for (size_t row = 0; row < rowCount; ++row)
+			expected[row] = execute(program, std::span(rows).subspan(row * width, width));
+	});
+
+	std::vector<double> out(rowCount);
+	NativeFunc native = function.getNative();
+	double jitTime = measureSeconds(3, [&] {
+		for (size_t row = 0; row < rowCount; ++row)
+			out[row] = native ? native(&rows[row * width]) : function(std::span(rows).subspan(row * width, width));
+	});
+	if (std::memcmp(out.data(), expected.data(), rowCount * sizeof(double)) != 0) {
+		throw std::runtime_error("JitFunction does not match execute");
+	}
+
+	std::println("Evaluating {} over {} rows", source, rowCount);
+	std::println("  bytecode {:8.1f} Mrows/s", rowCount / vmTime / 1e6);
+	std::println("  {:8} {:8.1f} Mrows/s ({:.1f}x, {} bytes)", native ? "native" : "fallback", rowCount / jitTime / 1e6, vmTime / jitTime, function.codeSize());
+}
+
+// Identifiers may only contain letters, so numbers are spelled in base 26
+static std::string letterName(std::string_view prefix, size_t n)
+{
+	std::string result(prefix);
+	do {
+		result += static_cast<char>('a' + n % 26);
+		n /= 26;
+	} while (n);
+	return result;
+}
+
+void benchmarkGraph(size_t formulaCount)
+{
+	const size_t inputCount = std::max<size_t>(1, formulaCount / 100);
+	std::mt19937 rng(11);
+	std::uniform_int_distribution<size_t> pickInput(0, inputCount - 1);
+
+	// Each formula reads one input and up to two earlier formulas close to it,
+	// so a change reaches a narrow band of the graph rather than all of it
+	std::vector<std::pair<std::string, std::string>> formulas;
+	for (size_t i = 0; i < formulaCount; ++i) {
+		std::string source = std::format("{} * 0.5 + 1", letterName("in", pickInput(rng)));
+		for (size_t back : { 1, 7 }) {
+			if (i >= back && rng() % 2)
+				source += std::format(" + sqrt({})", letterName("f", i - back));
+		}
+		formulas.emplace_back(letterName("f", i), std::move(source));
+	}
+
+	FormulaGraph graph;
+	for (size_t j = 0; j < inputCount; ++j)
+		graph.set(letterName("in", j), static_cast<double>(j));
+	for (const auto& [name, source] : formulas)
+		graph.define(name, source);
+	double fullTime = measureSeconds(1, [&] { graph.recompute(); });
+
+	const size_t changes = 200;
+	size_t dirtied = 0;
+	size_t recomputed = 0;
+	std::vector<double> inputs(inputCount);
+	for (size_t j = 0; j < inputCount; ++j)
+		inputs[j] = static_cast<double>(j);
+	double incrementalTime = measureSeconds(1, [&] {
+		for (size_t c = 0; c < changes; ++c) {
+			size_t j = pickInput(rng);
+			inputs[j] += 1.0;
+			graph.set(letterName("in", j), inputs[j]);
+			RecomputeStats stats = graph.recompute();
+			dirtied += stats.dirtied.size();
+			recomputed += stats.recomputed.size();
+		}
+	});
+
+	// A graph built from scratch over the final inputs has to agree bit for bit
+	FormulaGraph fresh;
+	for (size_t j = 0; j < inputCount; ++j)
+		fresh.set(letterName("in", j), inputs[j]);
+	for (const auto& [name, source] : formulas)
+		fresh.define(name, source);
+	for (const auto& [name, source] : formulas) {
+		double a = graph.get(name);
+		double b = fresh.get(name);
+		if (std::memcmp(&a, &b, sizeof(double)) != 0) {
+			throw std::runtime_error(std::format("Incremental value of {} differs from a full recompute", name));
+		}
+	}
+
+	std::println("{} formulas over {} inputs", formulaCount, inputCount);
+	std::println("  full recompute   {:10.3f} ms", fullTime * 1e3);
+	std::println("  one input change {:10.3f} ms ({:.1f} dirtied, {:.1f} recomputed on average)",
+		incrementalTime / changes * 1e3, static_cast<double>(dirtied) / changes, static_cast<double>(recomputed) / changes);
+}
+
+void benchmarkGradient(size_t inputCount)
+{
+	// A sum of small terms that each mix a few neighbouring inputs
+	std::string source;
+	for (size_t i = 0; i < inputCount; ++i) {
+		std::string x = letterName("in", i);
+		std::string y = letterName("in", (i + 1) % inputCount);
+		std::string z = letterName("in", (i * 7 + 3) % inputCount);
+		source += std::format("{}sin({}) * {} + sqrt({} * {} + 1) / ({}^2 + 2)", i ? " + " : "", x, y, z, z, x);
+	}
+	PrattParser parser{ std::string_view(source) };
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	Program program = compile(expr.get());
+
+	const size_t n = program.identifiers.size();
+	std::mt19937 rng(13);
+	std::uniform_real_distribution<double> dist(0.5, 2.0);
+	std::vector<double> slots(n);
+	for (double& v : slots)
+		v = dist(rng);
+
+	const int repeats = 20;
+	std::vector<double> numeric(n);
+	double numericTime = measureSeconds(3, [&] {
+		for (int r = 0; r < repeats; ++r) {
+			std::vector<double> shifted = slots;
+			for (size_t i = 0; i < n; ++i) {
+				const double h = 1e-6 * std::max(1.0, std::abs(slots[i]));
+				shifted[i] = slots[i] + h;
+				double up = execute(program, shifted);
+				shifted[i] = slots[i] - h;
+				double down = execute(program, shifted);
+				shifted[i] = slots[i];
+				numeric[i] = (up - down) / (2 * h);
+			}
+		}
+	});
+
+	std::vector<double> forward(n);
+	double forwardTime = measureSeconds(3, [&] {
+		for (int r = 0; r < repeats; ++r)
+			gradient(program, slots, forward, DiffMode::Forward);
+	});
+	std::vector<double> reverse(n);
+	double reverseTime = measureSeconds(3, [&] {
+		for (int r = 0; r < repeats; ++r)
+			gradient(program, slots, reverse, DiffMode::Reverse);
+	});
+
+	// Both modes sum the same products in a different order, finite differences are approximate
+	double modeError = 0.0;
+	double numericError = 0.0;
+	for (size_t i = 0; i < n; ++i) {
+		const double magnitude = std::max(1.0, std::abs(reverse[i]));
+		modeError = std::max(modeError, std::abs(forward[i] - reverse[i]) / magnitude);
+		numericError = std::max(numericError, std::abs(numeric[i] - reverse[i]) / magnitude);
+	}
+	if (modeError > 1e-12) {
+		throw std::runtime_error(std::format("Forward and reverse mode differ by {}", modeError));
+	}
+
+	std::println("Gradient of a formula over {} inputs ({} instructions)", n, program.code.size());
+	std::println("  central differences {:10.3f} us (max error {:.1e})", numericTime / repeats * 1e6, numericError);
+	std::println("  forward mode        {:10.3f} us", forwardTime / repeats * 1e6);
+	std::println("  reverse mode        {:10.3f} us ({:.1f}x faster than differences)", reverseTime / repeats * 1e6, numericTime / reverseTime);
+}
+
+void benchmarkSharing(size_t termCount)
+{
+	// Long sums drawn from a small pool of subterms, like generated formulas tend to be
+	static const char* const pool[] = {
+		"sin(a * b)", "cos(a * b)", "sqrt(c * c + d * d)", "(a - b) / (c + 2)", "log(e + 1) * f",
+		"arctan(g / (h + 1))", "sin(a * b) ^ 2", "mean(c, d) * e", "-(f - g)", "sqrt(c * c + d * d) * h",
+	};
+	std::mt19937 rng(17);
+	std::uniform_int_distribution<size_t> pick(0, std::size(pool) - 1);
+	std::uniform_int_distribution<int> factor(1, 4);
+	std::string source;
+	for (size_t i = 0; i < termCount; ++i) {
+		source += std::format("{}{} * {}", i ? " + " : "", factor(rng), pool[pick(rng)]);
+	}
+	const auto tokens = tokenize(source);
+	for (char name = 'a'; name <= 'h'; ++name) {
+		VariableStore::global().set(std::string(1, name), 0.25 * (name - 'a' + 1));
+	}
+
+	ExprArena tree;
+	ExprArena shared;
+	double treeParseTime = measureSeconds(3, [&] {
+		PrattParser parser{ std::vector<Token>(tokens) };
+		tree = parseArena(parser);
+	});
+	double sharedParseTime = measureSeconds(3, [&] {
+		PrattParser parser{ std::vector<Token>(tokens) };
+		shared = parseArena(parser, true);
+	});
+
+	double treeValue = 0.0;
+	double sharedValue = 0.0;
+	double treeEvalTime = measureSeconds(5, [&] { treeValue = tree.eval(); });
+	double sharedEvalTime = measureSeconds(5, [&] { sharedValue = shared.eval(); });
+	double compiledValue = execute(compile(shared));
+	if (std::memcmp(&treeValue, &sharedValue, sizeof(double)) != 0 || std::memcmp(&treeValue, &compiledValue, sizeof(double)) != 0) {
+		throw std::runtime_error("Shared nodes change the value of the expression");
+	}
+
+	auto bytes = [](const ExprArena& arena) { return arena.nodes.size() * sizeof(ExprNode) + arena.operands.size() * sizeof(NodeIndex); };
+	std::println("Sum of {} terms from a pool of {}", termCount, std::size(pool));
+	std::println("  {}", shared.sharingStats().toString());
+	std::println("  tree   {:10} bytes, parse {:8.3f} ms, eval {:8.3f} ms", bytes(tree), treeParseTime * 1e3, treeEvalTime * 1e3);
+	std::println("  shared {:10} bytes, parse {:8.3f} ms, eval {:8.3f} ms", bytes(shared), sharedParseTime * 1e3, sharedEvalTime * 1e3);
+}
+
+void benchmarkProgramFile(size_t formulaCount)
+{
+	std::vector<std::string> formulas;
+	std::istringstream lines(generateFormulas(formulaCount, 19));
+	for (std::string line; std::getline(lines, line);)
+		formulas.push_back(std::move(line));
+	for (const char* name : { "x", "rate", "spot", "Volatility", "t" })
+		VariableStore::global().set(name, 0.75);
+
+	std::vector<Program> programs;
+	double parseTime = measureSeconds(1, [&] {
+		programs.clear();
+		for (const std::string& formula : formulas) {
+			PrattParser parser{ std::string_view(formula) };
+			auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+			programs.push_back(compile(expr.get()));
+		}
+	});
+
+	ProgramFileWriter writer;
+	for (size_t i = 0; i < formulas.size(); ++i)
+		writer.add(formulas[i], programs[i]);
+	const std::string path = (std::filesystem::temp_directory_path() / "rationalis_programs.bin").string();
+	double saveTime = measureSeconds(1, [&] { writer.save(path); });
+
+	// The file was just written, so this measures mapping and checking it, not the disk
+	std::unique_ptr<ProgramFile> file;
+	double loadTime = measureSeconds(3, [&] { file = std::make_unique<ProgramFile>(path); });
+	size_t found = 0;
+	double findTime = measureSeconds(3, [&] {
+		found = 0;
+		for (const std::string& formula : formulas)
+			found += file->find(formula).has_value();
+	});
+	for (size_t i = 0; i < formulas.size(); ++i) {
+		double loaded = file->evaluate(*file->find(formulas[i]));
+		double expected = execute(programs[i]);
+		if (std::memcmp(&loaded, &expected, sizeof(double)) != 0) {
+			throw std::runtime_error(std::format("Loaded program of {} evaluates differently", formulas[i]));
+		}
+	}
+	const auto bytes = std::filesystem::file_size(path);
+	file.reset();
+	std::filesystem::remove(path);
+
+	std::println("{} formulas, {} found again, {} byte file", formulas.size(), found, bytes);
+	std::println("  parse and compile {:10.3f} ms", parseTime * 1e3);
+	std::println("  save              {:10.3f} ms", saveTime * 1e3);
+	std::println("  map and validate  {:10.3f} ms ({:.0f}x faster than parsing)", loadTime * 1e3, parseTime / loadTime);
+	std::println("  find every name   {:10.3f} ms", findTime * 1e3);
+}
+
+void benchmarkPerfCounters(size_t formulaCount)
+{
+	std::vector<std::string> formulas;
+	std::istringstream lines(generateFormulas(formulaCount, 23));
+	for (std::string line; std::getline(lines, line);)
+		formulas.push_back(std::move(line));
+	for (const char* name : { "x", "rate", "spot", "Volatility", "t" })
+		VariableStore::global().set(name, 0.75);
+
+	double sink = 0.0;
+	auto work = [&] {
+		for (const std::string& formula : formulas) {
+			PrattParser parser(tokenize(formula));
+			auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+			sink += expr->eval();
+			sink += execute(compile(expr.get()));
+		}
+	};
+
+	// Off and on take turns, so drift in the machine's speed hits both alike
+	const bool wasEnabled = PerfCounters::enabled();
+	double offTime = 1e300;
+	double onTime = 1e300;
+	for (int round = 0; round < 7; ++round) {
+		PerfCounters::enable(false);
+		offTime = std::min(offTime, measureSeconds(1, work));
+		PerfCounters::enable(true);
+		onTime = std::min(onTime, measureSeconds(1, work));
+	}
+	PerfCounters::reset();
+	work();
+	PerfStats stats = PerfCounters::read();
+	PerfCounters::enable(wasEnabled);
+
+	std::println("{} formulas lexed, parsed, walked and run as bytecode", formulas.size());
+	std::println("  counters off {:10.3f} ms", offTime * 1e3);
+	std::println("  counters on  {:10.3f} ms ({:+.1f}%)", onTime * 1e3, (onTime / offTime - 1.0) * 100.0);
+	std::println("{}", stats.toString());
+	// Keeps the optimizer from dropping the loops above
+	if (sink == 1.0)
+		std::println("");
+}
+
+// Where each keyword is hardest: trig far from zero, asin and acos near 1,
+// atan over many magnitudes and log over the whole range and next to 1
+static std::vector<double> accuracyInputs(KeywordType id, size_t count, uint32_t seed)
+{
+	std::mt19937_64 rng(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	auto exponent = [&](int lowest, int range) { return lowest + static_cast<int>(unit(rng) * range); };
+	std::vector<double> inputs(count);
+	for (size_t i = 0; i < count; ++i) {
+		const double u = unit(rng);
+		const double sign = unit(rng) < 0.5 ? -1.0 : 1.0;
+		switch (id)
+		{
+		case KeywordType::Asin:
+		case KeywordType::Acos:
+			inputs[i] = sign * (i % 4 == 0 ? 1.0 - std::ldexp(u, exponent(-40, 40)) : u);
+			break;
+		case KeywordType::Atan:
+			inputs[i] = sign * std::ldexp(0.5 + u, exponent(-30, 60));
+			break;
+		case KeywordType::Log:
+			inputs[i] = i % 4 == 0 ? 1.0 + (u - 0.5) / 8.0 : std::ldexp(0.5 + u, exponent(-1000, 2000));
+			break;
+		default:
+			// A few past 2^20, where the vector kernels hand over to libm
+			inputs[i] = sign * (i % 64 == 0 ? std::ldexp(0.5 + u, exponent(0, 900)) : std::ldexp(0.5 + u, exponent(-12, 28)));
+			break;
+		}
+	}
+	return inputs;
+}
+
+static long double exactValue(KeywordType id, long double x)
+{
+	switch (id)
+	{
+	case KeywordType::Sin:
+		return std::sin(x);
+	case KeywordType::Cos:
+		return std::cos(x);
+	case KeywordType::Tan:
+		return std::tan(x);
+	case KeywordType::Asin:
+		return std::asin(x);
+	case KeywordType::Acos:
+		return std::acos(x);
+	case KeywordType::Atan:
+		return std::atan(x);
+	default:
+		return std::log(x);
+	}
+}
+
+// |value - exact| in units of the last place of exact rounded to a double
+static double ulpError(double value, long double exact)
+{
+	const double rounded = static_cast<double>(exact);
+	if (value == rounded || (std::isnan(value) && std::isnan(rounded)))
+		return 0.0;
+	if (!std::isfinite(value) || !std::isfinite(rounded))
+		return std::numeric_limits<double>::infinity();
+	const int e = rounded == 0.0 ? -1074 : std::max(std::ilogb(rounded) - 52, -1074);
+	return static_cast<double>(std::fabs(value - exact) / std::ldexp(1.0L, e));
+}
+
+void benchmarkAccuracy(size_t sampleCount)
+{
+	// Where long double is no wider than double, the correctly rounded tier is the reference
+	constexpr bool longDoubleReference = LDBL_MANT_DIG > DBL_MANT_DIG;
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	std::println("Keywords over {} values each, errors against {}", sampleCount, longDoubleReference ? "long double" : "the correctly rounded tier");
+	const KeywordType ids[] = { KeywordType::Sin, KeywordType::Cos, KeywordType::Tan, KeywordType::Asin, KeywordType::Acos, KeywordType::Atan, KeywordType::Log };
+	for (KeywordType id : ids) {
+		const KeywordInfo& info = keywords.getByID(id);
+		const size_t index = static_cast<size_t>(id);
+		const std::vector<double> inputs = accuracyInputs(id, sampleCount, 29 + static_cast<uint32_t>(index));
+		std::vector<long double> reference(sampleCount);
+		const MathKernels& correct = MathKernels::get(MathAccuracy::CorrectlyRounded);
+		for (size_t i = 0; i < sampleCount; ++i)
+			reference[i] = longDoubleReference ? exactValue(id, inputs[i]) : correct.functions[index](inputs[i]);
+		std::vector<double> libm(sampleCount);
+		for (size_t i = 0; i < sampleCount; ++i)
+			libm[i] = info.unary(inputs[i]);
+
+		std::vector<double> out(sampleCount);
+		std::vector<double> check(sampleCount);
+		for (MathAccuracy accuracy : { MathAccuracy::Libm, MathAccuracy::CorrectlyRounded, MathAccuracy::Ulp1, MathAccuracy::Ulp4 }) {
+			const MathKernels& math = MathKernels::get(accuracy);
+			auto runAt = [&](const MathKernels& kernels, std::vector<double>& result) {
+				if (kernels.kernels[index]) {
+					kernels.kernels[index](inputs.data(), result.data(), sampleCount);
+					return;
+				}
+				for (size_t i = 0; i < sampleCount; ++i)
+					result[i] = info.unary(inputs[i]);
+			};
+			const double seconds = measureSeconds(3, [&] { runAt(math, out); });
+
+			for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+				if (level > detectSimdLevel())
+					continue;
+				runAt(MathKernels::get(accuracy, level), check);
+				if (std::memcmp(out.data(), check.data(), sampleCount * sizeof(double)) != 0) {
+					throw std::runtime_error(std::format("{} at {} differs on {}", info.name, mathAccuracyToString(accuracy), simdLevelToString(level)));
+				}
+			}
+			if (math.functions[index]) {
+				for (size_t i = 0; i < sampleCount; ++i)
+					check[i] = math.functions[index](inputs[i]);
+				if (std::memcmp(out.data(), check.data(), sampleCount * sizeof(double)) != 0) {
+					throw std::runtime_error(std::format("{} at {} differs one value at a time", info.name, mathAccuracyToString(accuracy)));
+				}
+			}
+
+			double maxError = 0.0;
+			size_t sameAsLibm = 0;
+			for (size_t i = 0; i < sampleCount; ++i) {
+				maxError = std::max(maxError, ulpError(out[i], reference[i]));
+				sameAsLibm += std::memcmp(&out[i], &libm[i], sizeof(double)) == 0;
+			}
+			std::println("  {:<5} {:<8} max {:6.3f} ulp {:6.2f}% libm {:8.2f} ns/value", info.name, mathAccuracyToString(accuracy), maxError,
+				100.0 * sameAsLibm / sampleCount, seconds / sampleCount * 1e9);
+		}
+	}
+}
+
+// -----------------------------------------------------
+double BenchmarkResult::nsPerItem() const
+{
+	return items ? seconds * 1e9 / items : 0.0;
+}
+
+double BenchmarkResult::megabytesPerSecond() const
+{
+	return seconds > 0.0 ? bytes / seconds / 1e6 : 0.0;
+}
+
+struct Workload
+{
+	std::string name;
+	std::vector<std::string> formulas;
+};
+
+static std::vector<std::string> splitLines(const std::string& text)
+{
+	std::vector<std::string> lines;
+	std::istringstream stream(text);
+	for (std::string line; std::getline(stream, line);)
+		lines.push_back(line);
+	return lines;
+}
+
+// x + 1 + rate - 2 * spot + ... with terms terms
+static std::string generateFlatSum(size_t terms, uint32_t seed)
+{
+	static const char* const identifiers[] = { "x", "rate", "spot", "Volatility", "t" };
+	static const char* const operators[] = { " + ", " - ", " * ", " / " };
+	std::mt19937 rng(seed);
+	std::string text;
+	for (size_t i = 0; i < terms; ++i) {
+		if (i > 0)
+			text += operators[rng() % 4];
+		if (rng() % 2)
+			text += identifiers[rng() % 5];
+		else
+			text += std::to_string(1 + rng() % 1000);
+	}
+	return text;
+}
+
+// ((((x + 1) * 2) - rate) ...) nested depth times
+static std::string generateNested(size_t depth, uint32_t seed)
+{
+	static const char* const operators[] = { " + ", " - ", " * ", " / " };
+	std::mt19937 rng(seed);
+	std::string text(depth, '(');
+	text += "x";
+	for (size_t i = 0; i < depth; ++i) {
+		text += operators[rng() % 4];
+		text += std::to_string(1 + rng() % 9);
+		text += ")";
+	}
+	return text;
+}
+
+static std::string generateKeywordHeavy(uint32_t seed)
+{
+	static const char* const unary[] = { "sin", "cos", "tan", "sqrt", "log", "arctan" };
+	static const char* const identifiers[] = { "x", "rate", "spot", "t" };
+	std::mt19937 rng(seed);
+	std::string text;
+	for (int term = 0; term < 4; ++term) {
+		if (term > 0)
+			text += rng() % 2 ? " + " : " * ";
+		switch (rng() % 3)
+		{
+		case 0:
+			text += std::format("{}({}({}))", unary[rng() % 6], unary[rng() % 6], identifiers[rng() % 4]);
+			break;
+		case 1:
+			text += std::format("mean({}({}), {})", unary[rng() % 6], identifiers[rng() % 4], rng() % 2 ? "pi" : "e");
+			break;
+		case 2:
+			text += std::format("{}({} * pi)", unary[rng() % 6], identifiers[rng() % 4]);
+			break;
+		}
+	}
+	return text;
+}
+
+static std::vector<Workload> generateWorkloads(double scale)
+{
+	auto scaled = [scale](size_t size) { return std::max<size_t>(1, static_cast<size_t>(size * scale)); };
+	std::vector<Workload> workloads;
+
+	workloads.push_back({ "short", splitLines(generateFormulas(scaled(20000), 42)) });
+
+	Workload flat{ "flat_sum" };
+	for (uint32_t i = 0; i < 8; ++i)
+		flat.formulas.push_back(generateFlatSum(scaled(1000), i));
+	workloads.push_back(std::move(flat));
+
+	// Every group is a level of nesting for parseExpr, eval and toString
+	Workload nested{ "deep_nesting" };
+	for (uint32_t i = 0; i < 8; ++i)
+		nested.formulas.push_back(generateNested(scaled(500), i));
+	workloads.push_back(std::move(nested));
+
+	Workload keywords{ "keyword_heavy" };
+	for (uint32_t i = 0; i < scaled(5000); ++i)
+		keywords.formulas.push_back(generateKeywordHeavy(i));
+	workloads.push_back(std::move(keywords));
+	return workloads;
+}
+
+static void benchmarkWorkload(const Workload& workload, std::vector<BenchmarkResult>& results)
+{
+	const int runs = 5;
+	size_t bytes = 0;
+	for (const std::string& formula : workload.formulas)
+		bytes += formula.size();
+
+	auto record = [&](const char* operation, size_t items, double seconds) {
+		results.push_back(BenchmarkResult{ workload.name, operation, workload.formulas.size(), bytes, items, seconds });
+	};
+
+	std::vector<std::vector<Token>> tokens(workload.formulas.size());
+	double tokenizeTime = measureSeconds(runs, [&] {
+		for (size_t i = 0; i < tokens.size(); ++i)
+			tokens[i] = tokenize(workload.formulas[i]);
+	});
+	size_t tokenCount = 0;
+	for (const auto& list : tokens)
+		tokenCount += list.size();
+	record("tokenize", tokenCount, tokenizeTime);
+
+	// Parsing consumes the tokens, so every run gets a fresh copy made outside the timing
+	std::vector<std::unique_ptr<Expr>> trees(workload.formulas.size());
+	double parseTime = 1e300;
+	for (int run = 0; run < runs; ++run) {
+		std::vector<std::vector<Token>> copies = tokens;
+		for (auto& tree : trees)
+			tree.reset();
+		double time = measureSeconds(1, [&] {
+			for (size_t i = 0; i < copies.size(); ++i) {
+				PrattParser parser(std::move(copies[i]));
+				trees[i].reset(parseExpr(parser));
+			}
+		});
+		parseTime = std::min(parseTime, time);
+	}
+	size_t nodeCount = 0;
+	for (const auto& tree : trees)
+		nodeCount += countNodes(tree.get());
+	record("parseExpr", nodeCount, parseTime);
+
+	double sink = 0.0;
+	double evalTime = measureSeconds(runs, [&] {
+		for (const auto& tree : trees)
+			sink += tree->eval();
+	});
+	record("eval", nodeCount, evalTime);
+
+	size_t printed = 0;
+	double printTime = measureSeconds(runs, [&] {
+		for (const auto& tree : trees)
+			printed += tree->toString().size();
+	});
+	record("toString", nodeCount, printTime);
+
+	// Keeps the optimizer from dropping the loops above
+	if (sink == 1.0 && printed == 1)
+		std::println("");
+}
+
+std::vector<BenchmarkResult> runBenchmarkSuite(double scale)
+{
+	Binding inputs[] = { { "x", 1.25 }, { "rate", 0.05 }, { "spot", 101.5 }, { "Volatility", 0.2 }, { "t", 2.0 } };
+	VariableStore::global().set(inputs);
+
+	std::vector<BenchmarkResult> results;
+	for (const Workload& workload : generateWorkloads(scale))
+		benchmarkWorkload(workload, results);
+	return results;
+}
+
+static std::string compilerName()
+{
+#if defined(__clang__)
+	return std::format("clang {}.{}.{}", __clang_major__, __clang_minor__, __clang_patchlevel__);
+#elif defined(__GNUC__)
+	return std::format("gcc {}.{}.{}", __GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__);
+#elif defined(_MSC_VER)
+	return std::format("msvc {}", _MSC_FULL_VER);
+#else
+	return "unknown";
+#endif
+}
+
+std::string benchmarkResultsToJson(const std::vector<BenchmarkResult>& results)
+{
+#ifdef NDEBUG
+	const char* build = "release";
+#else
+	const char* build = "debug";
+#endif
+	std::string json = "{\n";
+	json += "  \"schema\": 1,\n";
+	json += std::format("  \"compiler\": \"{}\",\n", compilerName());
+	json += std::format("  \"build\": \"{}\",\n", build);
+	json += std::format("  \"simd\": \"{}\",\n", simdLevelToString(detectSimdLevel()));
+	json += std::format("  \"hardware_threads\": {},\n", std::thread::hardware_concurrency());
+	json += "  \"results\": [";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchmarkResult& r = results[i];
+		json += i ? ",\n" : "\n";
+		json += std::format("    {{ \"workload\": \"{}\", \"operation\": \"{}\", \"formulas\": {}, \"bytes\": {}, "
+			"\"items\": {}, \"seconds\": {:.9f}, \"ns_per_item\": {:.3f}, \"mb_per_s\": {:.3f} }}",
+			r.workload, r.operation, r.formulas, r.bytes, r.items, r.seconds, r.nsPerItem(), r.megabytesPerSecond());
+	}
+	json += "\n  ]\n}\n";
+	return json;
+}
+
+std::string benchmarkResultsToTable(const std::vector<BenchmarkResult>& results)
+{
+	std::string table = std::format("{:<14} {:<10} {:>10} {:>12} {:>10}\n", "workload", "operation", "items", "ns/item", "MB/s");
+	for (const BenchmarkResult& r : results) {
+		table += std::format("{:<14} {:<10} {:>10} {:>12.2f} {:>10.1f}\n", r.workload, r.operation, r.items, r.nsPerItem(), r.megabytesPerSecond());
+	}
+	return table;
+}
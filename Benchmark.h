@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// One operation timed over one generated workload
+struct BenchmarkResult
+{
+	std::string workload;
+	std::string operation;
+	size_t formulas = 0;
+	size_t bytes = 0;
+	// Tokens for tokenize, nodes for everything else
+	size_t items = 0;
+	// Best of several runs over all formulas of the workload
+	double seconds = 0.0;
+
+	double nsPerItem() const;
+	double megabytesPerSecond() const;
+};
+
+// Times tokenize, parseExpr, Expr::eval and Expr::toString on short formulas,
+// long flat sums, deeply nested groups and keyword-heavy formulas. scale
+// multiplies the size of every workload.
+std::vector<BenchmarkResult> runBenchmarkSuite(double scale = 1.0);
+// Machine-readable form of the results, with the build and CPU they came from
+std::string benchmarkResultsToJson(const std::vector<BenchmarkResult>& results);
+std::string benchmarkResultsToTable(const std::vector<BenchmarkResult>& results);
+
+// Lexes a generated file of formulas with tokenize() and tokenizeFast(),
+// checks that both produce the same tokens and prints their throughput
+void benchmarkLexers(size_t formulaCount = 200000);
+// Evaluates one formula over many rows with a per-row tree walk and with
+// evaluateBatch at every SIMD level, and prints rows per second for each and
+// whether the best one reaches the 10x speedup batch evaluation aims for
+void benchmarkBatch(size_t rowCount = 1000000);
+// Runs generated lines, with assignments and array lines among them, through
+// runBatch and the way the shell runs them, checks both give the same results
+// and prints the time each takes
+void benchmarkBatchMode(size_t lineCount = 200000);
+// Evaluates many independent formulas with evaluateJobs on 1, 2, 4, ... threads
+// up to at least 32, checks every run gives the same results and prints the speedup
+void benchmarkScaling(size_t jobCount = 1000000);
+// Evaluates one formula row by row with the bytecode interpreter and with the
+// JIT, checks both agree bit for bit and prints rows per second for each
+void benchmarkJit(size_t rowCount = 5000000);
+// Builds a FormulaGraph of chained formulas, then changes one input at a time
+// and prints how much an incremental recompute evaluates compared to a full one
+void benchmarkGraph(size_t formulaCount = 20000);
+// Computes the gradient of a formula over many inputs with central finite
+// differences, forward mode and reverse mode, checks the modes agree and
+// prints the time each takes
+void benchmarkGradient(size_t inputCount = 64);
+// Parses a long sum of repeated subterms into an ExprArena with and without
+// shared nodes, checks both evaluate to the same value and prints their size
+// and the time to parse and evaluate each
+void benchmarkSharing(size_t termCount = 20000);
+// Parses and compiles generated formulas, saves them as a program file and
+// prints how long mapping it back takes compared to parsing everything again
+void benchmarkProgramFile(size_t formulaCount = 50000);
+// Lexes, parses and evaluates generated formulas with PerfCounters off and on,
+// prints what turning them on costs and the counters of one run
+void benchmarkPerfCounters(size_t formulaCount = 20000);
+// Runs sin, cos, tan, asin, acos, atan and log at every MathAccuracy, checks
+// every SIMD level gives the same bits and prints the largest error in ulp,
+// how often the result matches libm and the time per value
+void benchmarkAccuracy(size_t sampleCount = 200000);
@@ -0,0 +1,271 @@
+#include "Bytecode.h"
+#include "Expr.h"
+#include "Function.h"
+#include "MathKernels.h"
+#include "PerfCounters.h"
+#include "VariableStore.h"
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+std::string opCodeToString(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::Const:
+		return "Const";
+	case OpCode::Load:
+		return "Load";
+	case OpCode::Neg:
+		return "Neg";
+	case OpCode::Add:
+		return "Add";
+	case OpCode::Sub:
+		return "Sub";
+	case OpCode::Mul:
+		return "Mul";
+	case OpCode::Div:
+		return "Div";
+	case OpCode::Pow:
+		return "Pow";
+	case OpCode::Call:
+		return "Call";
+	case OpCode::CallFunction:
+		return "CallFunction";
+	default:
+		return "Unknown opcode";
+	}
+}
+
+ProgramView Program::view() const
+{
+	return ProgramView{ code, constants, functions, maxStack };
+}
+
+std::string Program::toString() const
+{
+	std::string result;
+	for (size_t i = 0; i < code.size(); ++i) {
+		const Instruction& ins = code[i];
+		result += std::format("{:04} {}", i, opCodeToString(ins.op));
+		switch (ins.op)
+		{
+		case OpCode::Const:
+			result += std::format(" {}", constants[ins.arg]);
+			break;
+		case OpCode::Load:
+			result += std::format(" {}", identifiers[ins.arg]);
+			break;
+		case OpCode::Call:
+			result += std::format(" {}/{}", keywordToString(static_cast<KeywordType>(ins.arg)), ins.count);
+			break;
+		case OpCode::CallFunction:
+			result += std::format(" {}/{}", functions[ins.arg]->name, ins.count);
+			break;
+		default:
+			break;
+		}
+		result += "\n";
+	}
+	return result;
+}
+
+// -----------------------------------------------------
+void Compiler::emit(OpCode op, uint32_t arg, uint16_t count)
+{
+	program.code.push_back(Instruction{ op, count, arg });
+
+	switch (op)
+	{
+	case OpCode::Const:
+	case OpCode::Load:
+		++depth;
+		break;
+	case OpCode::Neg:
+		break;
+	case OpCode::Call:
+	case OpCode::CallFunction:
+		depth = depth - count + 1;
+		break;
+	default: // Binary operators
+		--depth;
+		break;
+	}
+	program.maxStack = std::max(program.maxStack, depth);
+}
+
+uint32_t Compiler::addConstant(double value)
+{
+	// Compare bit patterns so -0.0 and NaN payloads survive deduplication
+	for (size_t i = 0; i < program.constants.size(); ++i) {
+		if (std::memcmp(&program.constants[i], &value, sizeof(double)) == 0)
+			return static_cast<uint32_t>(i);
+	}
+	program.constants.push_back(value);
+	return static_cast<uint32_t>(program.constants.size() - 1);
+}
+
+uint32_t Compiler::addIdentifier(const std::string& name)
+{
+	for (size_t i = 0; i < program.identifiers.size(); ++i) {
+		if (program.identifiers[i] == name)
+			return static_cast<uint32_t>(i);
+	}
+	program.identifiers.push_back(name);
+	return static_cast<uint32_t>(program.identifiers.size() - 1);
+}
+
+uint32_t Compiler::addFunction(const std::shared_ptr<const UserFunction>& function)
+{
+	for (size_t i = 0; i < program.functions.size(); ++i) {
+		if (program.functions[i] == function)
+			return static_cast<uint32_t>(i);
+	}
+	program.functions.push_back(function);
+	return static_cast<uint32_t>(program.functions.size() - 1);
+}
+
+void Compiler::inlineCall(const UserFunction& function, const std::function<void(size_t)>& emitArgument)
+{
+	const Program& body = function.body;
+	for (const Instruction& ins : body.code) {
+		switch (ins.op)
+		{
+		case OpCode::Const:
+			emit(OpCode::Const, addConstant(body.constants[ins.arg]));
+			break;
+		case OpCode::Load:
+			if (ins.arg < function.argCount)
+				emitArgument(ins.arg);
+			else
+				emit(OpCode::Load, addIdentifier(body.identifiers[ins.arg]));
+			break;
+		case OpCode::CallFunction:
+			emit(OpCode::CallFunction, addFunction(body.functions[ins.arg]), ins.count);
+			break;
+		default:
+			emit(ins.op, ins.arg, ins.count);
+			break;
+		}
+	}
+}
+
+Program compile(const Expr* expr)
+{
+	if (!expr) {
+		throw std::runtime_error("Cannot compile an empty expression");
+	}
+	Compiler compiler;
+	expr->compile(compiler);
+	return std::move(compiler.program);
+}
+
+// -----------------------------------------------------
+// The dispatch loop, parameterized on how a Load instruction finds its value
+template<typename LoadFunc>
+static double run(const ProgramView& program, LoadFunc&& load, const MathKernels& math)
+{
+	PerfTimer timer(PerfStage::Eval);
+	// Most expressions are shallow, so keep the value stack off the heap
+	constexpr size_t inlineStackSize = 64;
+	double inlineStack[inlineStackSize];
+	std::vector<double> heapStack;
+	double* stack = inlineStack;
+	if (program.maxStack > inlineStackSize) {
+		heapStack.resize(program.maxStack);
+		stack = heapStack.data();
+	}
+
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	const double* constants = program.constants.data();
+	const Instruction* ip = program.code.data();
+	const Instruction* end = ip + program.code.size();
+	double* sp = stack; // One past the top of the stack
+
+	for (; ip != end; ++ip) {
+		switch (ip->op)
+		{
+		case OpCode::Const:
+			*sp++ = constants[ip->arg];
+			break;
+		case OpCode::Load:
+			*sp++ = load(ip->arg);
+			break;
+		case OpCode::Neg:
+			sp[-1] = -sp[-1];
+			break;
+		case OpCode::Add:
+			--sp;
+			sp[-1] = sp[-1] + sp[0];
+			break;
+		case OpCode::Sub:
+			--sp;
+			sp[-1] = sp[-1] - sp[0];
+			break;
+		case OpCode::Mul:
+			--sp;
+			sp[-1] = sp[-1] * sp[0];
+			break;
+		case OpCode::Div:
+			--sp;
+			sp[-1] = sp[-1] / sp[0];
+			break;
+		case OpCode::Pow:
+			--sp;
+			sp[-1] = power(sp[-1], sp[0]);
+			break;
+		case OpCode::Call: {
+			const KeywordInfo& info = keywords.getByID(static_cast<KeywordType>(ip->arg));
+			PerfCounters::countKeyword(info.id);
+			// The arguments are already adjacent on the value stack
+			sp -= ip->count;
+			*sp = math.call(info, sp, ip->count);
+			++sp;
+			break;
+		}
+		case OpCode::CallFunction:
+			sp -= ip->count;
+			*sp = program.functions[ip->arg]->call(sp);
+			++sp;
+			break;
+		default:
+			throw std::runtime_error("Unknown opcode");
+		}
+	}
+	return sp[-1];
+}
+
+double execute(const Program& program)
+{
+	// Resolved in Load order, so the first missing identifier is reported like before
+	std::vector<double> values(program.identifiers.size());
+	VariableStore::global().withSnapshot([&](const VariableStore::Snapshot& snapshot) {
+		for (size_t i = 0; i < values.size(); ++i) {
+			values[i] = snapshot.get(program.identifiers[i]);
+		}
+	});
+	return execute(program, values);
+}
+
+double execute(const Program& program, std::span<const double> slots, MathAccuracy accuracy)
+{
+	if (slots.size() < program.identifiers.size()) {
+		throw std::runtime_error(std::format("Expected {} slots, got {}", program.identifiers.size(), slots.size()));
+	}
+	const double* values = slots.data();
+	// The one-value functions give the same bits at every level
+	return run(program.view(), [values](uint32_t index) { return values[index]; }, MathKernels::get(accuracy, SimdLevel::Scalar));
+}
+
+double execute(const Program& program, const Environment& env, std::span<const Slot> binding)
+{
+	const Slot* slots = binding.data();
+	return run(program.view(), [&env, slots](uint32_t index) { return env.get(slots[index]); }, MathKernels::get(MathAccuracy::Libm, SimdLevel::Scalar));
+}
+
+double execute(const ProgramView& program, std::span<const double> slots)
+{
+	const double* values = slots.data();
+	return run(program, [values](uint32_t index) { return values[index]; }, MathKernels::get(MathAccuracy::Libm, SimdLevel::Scalar));
+}
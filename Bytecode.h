@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Keyword.h"
+#include "Environment.h"
+#include "MathKernels.h"
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+struct Expr;
+struct UserFunction;
+
+enum class OpCode : uint8_t {
+	Const,	// push constants[arg]
+	Load,	// push value of identifiers[arg]
+	Neg,
+	Add,
+	Sub,
+	Mul,
+	Div,
+	Pow,
+	Call,	// pop count arguments, push KeywordType(arg) applied to them
+	CallFunction,	// pop count arguments, push functions[arg] applied to them
+	Total
+};
+
+std::string opCodeToString(OpCode op);
+
+// What ^ computes in every evaluator. A square is one multiplication, which is
+// correctly rounded where std::pow is sometimes an ulp off, and lets batches
+// run it on the mul kernel; every other exponent goes to std::pow.
+inline double power(double base, double exponent)
+{
+	return exponent == 2.0 ? base * base : std::pow(base, exponent);
+}
+
+struct Instruction
+{
+	OpCode op;
+	uint16_t count = 0;
+	uint32_t arg = 0;
+};
+
+// The arrays of a Program, wherever they live. Lets the interpreter run code
+// straight out of a mapped file, see ProgramFile.h.
+struct ProgramView
+{
+	std::span<const Instruction> code;
+	std::span<const double> constants;
+	std::span<const std::shared_ptr<const UserFunction>> functions;
+	size_t maxStack = 0;
+};
+
+// A flat, postfix form of an expression tree. Operands are pushed in the same
+// left-to-right order the tree evaluates them, so the result is bit-identical.
+struct Program
+{
+	std::vector<Instruction> code;
+	std::vector<double> constants;
+	std::vector<std::string> identifiers;
+	// User functions that were called rather than inlined, kept alive by the program
+	std::vector<std::shared_ptr<const UserFunction>> functions;
+	size_t maxStack = 0;
+
+	ProgramView view() const;
+	std::string toString() const;
+};
+
+// Lowers an expression tree into a Program, see Expr::compile
+struct Compiler
+{
+	Program program;
+	size_t depth = 0;
+	// Inlined calls whose arguments are being compiled, see FunctionExpr::beginCompile
+	size_t inlining = 0;
+
+	void emit(OpCode op, uint32_t arg = 0, uint16_t count = 0);
+	uint32_t addConstant(double value);
+	uint32_t addIdentifier(const std::string& name);
+	uint32_t addFunction(const std::shared_ptr<const UserFunction>& function);
+	// Appends the body of function in place of a call. emitArgument(i) appends
+	// the code of argument i wherever the body reads parameter i.
+	void inlineCall(const UserFunction& function, const std::function<void(size_t)>& emitArgument);
+};
+
+Program compile(const Expr* expr);
+// Reads identifiers from one snapshot of VariableStore::global()
+double execute(const Program& program);
+// slots[i] holds the value of program.identifiers[i]. The one-argument keywords
+// run at accuracy, libm by default.
+double execute(const Program& program, std::span<const double> slots, MathAccuracy accuracy = MathAccuracy::Libm);
+// binding comes from env.bind(program)
+double execute(const Program& program, const Environment& env, std::span<const Slot> binding);
+// slots[i] holds the value of identifier i of the program the view came from;
+// the caller has to provide as many as its Load instructions read
+double execute(const ProgramView& program, std::span<const double> slots);
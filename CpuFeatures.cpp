@@ -0,0 +1,59 @@
+#include "CpuFeatures.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static SimdLevel probeSimdLevel()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = info[3] & (1 << 26);
+	bool osxsave = info[2] & (1 << 27);
+	bool avx = info[2] & (1 << 28);
+	// The OS has to save the upper halves of the ymm registers as well
+	bool ymmEnabled = osxsave && (_xgetbv(0) & 0x6) == 0x6;
+
+	if (maxLeaf >= 7 && avx && ymmEnabled) {
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+			return SimdLevel::AVX2;
+	}
+	return sse2 ? SimdLevel::SSE2 : SimdLevel::Scalar;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return SimdLevel::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE2;
+	return SimdLevel::Scalar;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel detectSimdLevel()
+{
+	static const SimdLevel level = probeSimdLevel();
+	return level;
+}
+
+std::string simdLevelToString(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::Scalar:
+		return "Scalar";
+	case SimdLevel::SSE2:
+		return "SSE2";
+	case SimdLevel::AVX2:
+		return "AVX2";
+	default:
+		return "Unknown SIMD level";
+	}
+}
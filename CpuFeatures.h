@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+enum class SimdLevel {
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+// Widest instruction set supported by both the CPU and the OS, probed once
+SimdLevel detectSimdLevel();
+std::string simdLevelToString(SimdLevel level);
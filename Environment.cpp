@@ -0,0 +1,85 @@
+#include "Environment.h"
+#include "Bytecode.h"
+#include <format>
+#include <stdexcept>
+
+Slot Environment::intern(std::string_view name)
+{
+	auto it = nameToSlot.find(name);
+	if (it != nameToSlot.end()) {
+		return it->second;
+	}
+	Slot slot = static_cast<Slot>(slotNames.size());
+	slotNames.emplace_back(name);
+	slotValues.push_back(0.0);
+	slotDefined.push_back(false);
+	nameToSlot.emplace(slotNames.back(), slot);
+	return slot;
+}
+
+std::optional<Slot> Environment::find(std::string_view name) const
+{
+	auto it = nameToSlot.find(name);
+	if (it != nameToSlot.end()) {
+		return it->second;
+	}
+	return std::nullopt;
+}
+
+double Environment::get(Slot slot) const
+{
+	if (!slotDefined[slot]) {
+		throw std::runtime_error(std::format("Identifier '{}' not found", slotNames[slot]));
+	}
+	return slotValues[slot];
+}
+
+double Environment::get(std::string_view name) const
+{
+	auto slot = find(name);
+	if (!slot) {
+		throw std::runtime_error(std::format("Identifier '{}' not found", name));
+	}
+	return get(*slot);
+}
+
+void Environment::set(Slot slot, double value)
+{
+	slotValues[slot] = value;
+	slotDefined[slot] = true;
+}
+
+void Environment::set(std::string_view name, double value)
+{
+	set(intern(name), value);
+}
+
+bool Environment::isDefined(Slot slot) const
+{
+	return slot < slotDefined.size() && slotDefined[slot];
+}
+
+const std::string& Environment::nameOf(Slot slot) const
+{
+	return slotNames[slot];
+}
+
+size_t Environment::size() const
+{
+	return slotNames.size();
+}
+
+std::span<const double> Environment::values() const
+{
+	return slotValues;
+}
+
+std::vector<Slot> Environment::bind(const Program& program)
+{
+	std::vector<Slot> binding;
+	binding.reserve(program.identifiers.size());
+	for (const std::string& name : program.identifiers) {
+		binding.push_back(intern(name));
+	}
+	return binding;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Keyword.h"
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Program;
+
+using Slot = uint32_t;
+constexpr Slot InvalidSlot = UINT32_MAX;
+
+// A value given to one identifier
+struct Binding
+{
+	std::string_view name;
+	double value;
+};
+
+// Variable bindings stored in a flat array. Every name is interned once into a
+// dense slot index, after which reading or writing it is an indexed access.
+class Environment
+{
+public:
+	// Returns the slot of name, adding an undefined one if it is new
+	Slot intern(std::string_view name);
+	std::optional<Slot> find(std::string_view name) const;
+
+	// Throws if the slot has not been assigned yet
+	double get(Slot slot) const;
+	double get(std::string_view name) const;
+	void set(Slot slot, double value);
+	void set(std::string_view name, double value);
+	bool isDefined(Slot slot) const;
+
+	const std::string& nameOf(Slot slot) const;
+	size_t size() const;
+	std::span<const double> values() const;
+
+	// Slot of every identifier of program, in the order its Load instructions use them
+	std::vector<Slot> bind(const Program& program);
+
+private:
+	std::vector<double> slotValues;
+	std::vector<uint8_t> slotDefined;
+	std::vector<std::string> slotNames;
+	StringMap<Slot> nameToSlot;
+};
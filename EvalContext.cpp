@@ -0,0 +1,60 @@
+#include "EvalContext.h"
+#include "ArrayStore.h"
+#include "Function.h"
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+// Past this many entries the private memo is dropped and refilled from the shared cache
+constexpr size_t maxCompiled = 1024;
+
+EvalContext::EvalContext(ExprCache& cache, const VariableStore& variables, MathAccuracy accuracy)
+	: cache(cache), variables(variables), accuracy(accuracy) {
+}
+
+ExprCache::Entry EvalContext::compile(std::string_view source)
+{
+	const ParseScope& scope = cache.getScope();
+	const uint64_t generation = scope.functions.generation();
+	const uint64_t arrays = scope.arrays.generation();
+	if (generation != functionGeneration || arrays != arrayGeneration) {
+		compiled.clear();
+		functionGeneration = generation;
+		arrayGeneration = arrays;
+	}
+	auto it = compiled.find(source);
+	if (it != compiled.end()) {
+		return it->second;
+	}
+	if (source.find('=') != std::string_view::npos) {
+		throw std::runtime_error("Assignments cannot be evaluated in a context");
+	}
+	ExprCache::Entry entry = cache.get(source);
+	if (entry->isArray) {
+		throw std::runtime_error(std::format("{} is an array, not a number", entry->text));
+	}
+	if (compiled.size() >= maxCompiled) {
+		compiled.clear();
+	}
+	compiled.emplace(std::string(source), entry);
+	return entry;
+}
+
+double EvalContext::evaluate(const Program& program, std::span<const Binding> bindings)
+{
+	slots.resize(program.identifiers.size());
+	variables.withSnapshot([&](const VariableStore::Snapshot& snapshot) {
+		for (size_t i = 0; i < program.identifiers.size(); ++i) {
+			const std::string& name = program.identifiers[i];
+			auto binding = std::find_if(bindings.begin(), bindings.end(), [&name](const Binding& b) { return b.name == name; });
+			slots[i] = binding != bindings.end() ? binding->value : snapshot.get(name);
+		}
+	});
+	return execute(program, slots, accuracy);
+}
+
+double EvalContext::evaluate(std::string_view source, std::span<const Binding> bindings)
+{
+	ExprCache::Entry entry = compile(source);
+	return evaluate(entry->program, bindings);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "Environment.h"
+#include "ExprCache.h"
+#include "VariableStore.h"
+#include "Keyword.h"
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Everything one thread needs to evaluate expressions: its own scratch space
+// and a private front for the shared cache. Nothing in here is shared, so one
+// context per thread evaluates without any locking. Sources are parsed with
+// the function and array tables of the cache, and identifiers without a
+// binding are read from one snapshot of variables per evaluation. The
+// one-argument keywords run at accuracy.
+class EvalContext
+{
+public:
+	EvalContext(ExprCache& cache, const VariableStore& variables, MathAccuracy accuracy);
+
+	// Compiled form of source, asking the shared cache only the first time.
+	// Throws for assignments, which would write to VariableStore::global(), and
+	// for arrays, which are not numbers.
+	ExprCache::Entry compile(std::string_view source);
+
+	double evaluate(const Program& program, std::span<const Binding> bindings = {});
+	double evaluate(std::string_view source, std::span<const Binding> bindings = {});
+
+private:
+	ExprCache& cache;
+	const VariableStore& variables;
+	MathAccuracy accuracy;
+	StringMap<ExprCache::Entry> compiled;
+	// Generations of the tables of the cache's scope when compiled was filled
+	uint64_t functionGeneration = 0;
+	uint64_t arrayGeneration = 0;
+	std::vector<double> slots;
+};
@@ -1,100 +1,408 @@
 #include "Expr.h"
 #include "Tokenizer.h"
+#include "Bytecode.h"
+#include "Optimizer.h"
+#include "VariableStore.h"
+#include "PerfCounters.h"
 #include <cmath>
-#include <unordered_map> 
 #include <algorithm>
+#include <utility>
+
+// -----------------------------------------------------
+Expr::Expr()
+{
+	PerfCounters::countNodes();
+}
+
+Expr*& Expr::child(size_t)
+{
+	throw std::out_of_range("Expression has no children");
+}
+
+const Expr* Expr::child(size_t i) const
+{
+	return const_cast<Expr*>(this)->child(i);
+}
+
+void Expr::deleteChildren()
+{
+	std::vector<Expr*> pending;
+	for (size_t i = 0; i < childCount(); ++i) {
+		if (Expr* expr = std::exchange(child(i), nullptr))
+			pending.push_back(expr);
+	}
+	while (!pending.empty()) {
+		Expr* expr = pending.back();
+		pending.pop_back();
+		for (size_t i = 0; i < expr->childCount(); ++i) {
+			if (Expr* grandchild = std::exchange(expr->child(i), nullptr))
+				pending.push_back(grandchild);
+		}
+		// Its children are detached, so its destructor has nothing left to delete
+		delete expr;
+	}
+}
+
+// Evaluation scratch, reused by the evaluations on one thread
+struct EvalStacks
+{
+	struct Visit
+	{
+		Expr* expr;
+		size_t next;
+		size_t count;
+		// Where the values of its children start
+		size_t base;
+	};
+
+	std::vector<Visit> visits;
+	std::vector<double> values;
+	// Set while an evaluation on this thread uses these stacks
+	bool busy = false;
+
+	static EvalStacks& shared()
+	{
+		thread_local EvalStacks stacks;
+		return stacks;
+	}
+};
+
+// Children are evaluated left to right before their parent, like the bytecode
+// does, and their values wait on one value stack until the parent is applied
+static double evaluate(Expr& root)
+{
+	// A native function evaluating a tree of its own gets fresh stacks, as the
+	// caller still reads its arguments from the shared ones
+	EvalStacks& shared = EvalStacks::shared();
+	EvalStacks fresh;
+	EvalStacks& stacks = shared.busy ? fresh : shared;
+	struct Release
+	{
+		EvalStacks& stacks;
+		~Release()
+		{
+			stacks.visits.clear();
+			stacks.values.clear();
+			stacks.busy = false;
+		}
+	} release{ stacks };
+	stacks.busy = true;
+
+	auto& visits = stacks.visits;
+	auto& values = stacks.values;
+	visits.push_back({ &root, 0, root.childCount(), 0 });
+	while (true) {
+		EvalStacks::Visit& top = visits.back();
+		if (top.next < top.count) {
+			Expr* child = top.expr->child(top.next++);
+			const size_t count = child->childCount();
+			if (count == 0)
+				values.push_back(child->apply(nullptr));
+			else
+				visits.push_back({ child, 0, count, values.size() });
+			continue;
+		}
+		const size_t base = top.base;
+		double value = top.expr->apply(values.data() + base);
+		values.resize(base);
+		visits.pop_back();
+		if (visits.empty())
+			return value;
+		values.push_back(value);
+	}
+}
+
+double Expr::eval()
+{
+	PerfTimer timer(PerfStage::Eval);
+	if (childCount() == 0) {
+		return apply(nullptr);
+	}
+	// One snapshot for the whole tree, which every identifier reuses
+	return VariableStore::global().withSnapshot([this](const VariableStore::Snapshot&) { return evaluate(*this); });
+}
+
+std::string Expr::toString(const PrintOptions& options) const
+{
+	std::string out;
+	print(*this, out, options);
+	return out;
+}
+
+void Expr::compile(Compiler& out) const
+{
+	if (beginCompile(out)) {
+		return;
+	}
+	std::vector<std::pair<const Expr*, size_t>> stack{ { this, 0 } };
+	while (!stack.empty()) {
+		auto [expr, next] = stack.back();
+		if (next < expr->childCount()) {
+			++stack.back().second;
+			const Expr* child = expr->child(next);
+			if (!child->beginCompile(out))
+				stack.push_back({ child, 0 });
+			continue;
+		}
+		expr->emit(out);
+		stack.pop_back();
+	}
+}
 
 // -----------------------------------------------------
 NumberExpr::NumberExpr(double val) : value(val) {}
 
-double NumberExpr::eval() {
+double NumberExpr::apply(const double*)
+{
 	return value;
 }
 
-std::string NumberExpr::toString() const
+void NumberExpr::appendText(Printer& out, size_t) const
+{
+	out.writeNumber(value);
+}
+
+void NumberExpr::emit(Compiler& out) const
 {
-	return std::to_string(value);
+	out.emit(OpCode::Const, out.addConstant(value));
 }
 
 // -----------------------------------------------------
 UnaryExpr::UnaryExpr(TokenType op, Expr* operand) : op(op), operand(operand) {}
-UnaryExpr::~UnaryExpr() { delete operand; }
+UnaryExpr::~UnaryExpr() { deleteChildren(); }
+
+size_t UnaryExpr::childCount() const
+{
+	return 1;
+}
+
+Expr*& UnaryExpr::child(size_t)
+{
+	return operand;
+}
 
-double UnaryExpr::eval() {
+double UnaryExpr::apply(const double* values)
+{
 	if (op == TokenType::Plus) {
-		return operand->eval();
+		return values[0];
 	}
 	if (op == TokenType::Minus) {
-		return -operand->eval();
+		return -values[0];
 	}
 	throw std::runtime_error("Unknown unary operator");
 }
 
-std::string UnaryExpr::toString() const
+void UnaryExpr::appendText(Printer& out, size_t i) const
+{
+	if (i == 0) {
+		out.openBracket();
+		out.write(tokenTypeToString(op));
+	}
+	else {
+		out.closeBracket();
+	}
+}
+
+Notation UnaryExpr::notation() const
 {
-	return std::format("({}{})", tokenTypeToString(op), operand->toString());
+	return { Notation::Prefix, op };
+}
+
+void UnaryExpr::emit(Compiler& out) const
+{
+	if (op == TokenType::Plus) {
+		return;
+	}
+	if (op == TokenType::Minus) {
+		out.emit(OpCode::Neg);
+		return;
+	}
+	throw std::runtime_error("Unknown unary operator");
 }
 
 // -----------------------------------------------------
 BinaryExpr::BinaryExpr(TokenType op, Expr* l, Expr* r) : op(op), left(l), right(r) {}
-BinaryExpr::~BinaryExpr() { delete left; delete right; }
+BinaryExpr::~BinaryExpr() { deleteChildren(); }
+
+size_t BinaryExpr::childCount() const
+{
+	return 2;
+}
+
+Expr*& BinaryExpr::child(size_t i)
+{
+	return i == 0 ? left : right;
+}
 
-double BinaryExpr::eval() {
+double BinaryExpr::apply(const double* values)
+{
 	if (op == TokenType::Plus) {
-		return left->eval() + right->eval();
+		return values[0] + values[1];
 	}
 	if (op == TokenType::Minus) {
-		return left->eval() - right->eval();
+		return values[0] - values[1];
 	}
 	if (op == TokenType::Mult) {
-		return left->eval() * right->eval();
+		return values[0] * values[1];
 	}
 	if (op == TokenType::Div) {
-		return left->eval() / right->eval();
+		return values[0] / values[1];
 	}
 	if (op == TokenType::Pow) {
-		return std::pow(left->eval(), right->eval());
+		return power(values[0], values[1]);
 	}
 	throw std::runtime_error("Unknown binary operator");
 }
 
-std::string BinaryExpr::toString() const
+void BinaryExpr::appendText(Printer& out, size_t i) const
 {
-	return std::format("({} {} {})", left->toString(), tokenTypeToString(op) , right->toString());
+	switch (i)
+	{
+	case 0:
+		out.openBracket();
+		break;
+	case 1:
+		out.write(' ');
+		out.write(tokenTypeToString(op));
+		out.write(' ');
+		break;
+	default:
+		out.closeBracket();
+		break;
+	}
 }
 
-// -----------------------------------------------------
-KeywordExpr::KeywordExpr(KeywordType id, std::vector<Expr*>&& operands) : id(id), operands(std::move(operands)) {}
-KeywordExpr::~KeywordExpr() { for (Expr* expr : operands) delete expr; }
+Notation BinaryExpr::notation() const
+{
+	return { Notation::Infix, op };
+}
 
-double KeywordExpr::eval()
+void BinaryExpr::emit(Compiler& out) const
 {
-	std::vector<double> args(operands.size());
-	for (size_t i = 0; i < args.size(); ++i) {
-		args[i] = operands[i]->eval();
+	switch (op)
+	{
+	case TokenType::Plus:
+		out.emit(OpCode::Add);
+		break;
+	case TokenType::Minus:
+		out.emit(OpCode::Sub);
+		break;
+	case TokenType::Mult:
+		out.emit(OpCode::Mul);
+		break;
+	case TokenType::Div:
+		out.emit(OpCode::Div);
+		break;
+	case TokenType::Pow:
+		out.emit(OpCode::Pow);
+		break;
+	default:
+		throw std::runtime_error("Unknown binary operator");
 	}
+}
 
-	const KeywordInfo& info = KeywordInfo::getTable().getByID(id);
-	if (info.argCount != -1 && info.argCount != args.size()) {
-		throw std::runtime_error(std::format("Wrong number of arguments: Expected: {}, got: {}", info.argCount, args.size()));
+// -----------------------------------------------------
+// name, name(a) or name(a, b, ...) for keyword and function calls
+static void appendCall(Printer& out, const std::string& name, size_t count, size_t i)
+{
+	if (i == 0) {
+		out.write(name);
+		if (count > 0)
+			out.write('(');
+	}
+	else if (i < count) {
+		out.write(", ");
 	}
-	return info.eval(args);
+	else {
+		out.write(')');
+	}
+}
+
+KeywordExpr::KeywordExpr(KeywordType id, std::vector<Expr*>&& operands)
+	: id(id), operands(std::move(operands)), info(&KeywordInfo::getTable().getByID(id)) {}
+KeywordExpr::~KeywordExpr() { deleteChildren(); }
+
+size_t KeywordExpr::childCount() const
+{
+	return operands.size();
+}
+
+Expr*& KeywordExpr::child(size_t i)
+{
+	return operands[i];
+}
+
+double KeywordExpr::apply(const double* values)
+{
+	PerfCounters::countKeyword(id);
+	return info->call(values, operands.size());
+}
+
+void KeywordExpr::appendText(Printer& out, size_t i) const
+{
+	appendCall(out, info->name, operands.size(), i);
+}
+
+bool KeywordExpr::beginCompile(Compiler&) const
+{
+	// Generated code trusts the count, so hand-built trees are checked here as well
+	info->checkArity(operands.size());
+	return false;
 }
 
-std::string KeywordExpr::toString() const
+void KeywordExpr::emit(Compiler& out) const
 {
-	std::string result = keywordToString(id);
-	if (operands.empty()) {
-		return result;
+	out.emit(OpCode::Call, static_cast<uint32_t>(id), static_cast<uint16_t>(operands.size()));
+}
+
+// -----------------------------------------------------
+FunctionExpr::FunctionExpr(FunctionRef function, std::vector<Expr*>&& operands)
+	: function(std::move(function)), operands(std::move(operands)) {}
+FunctionExpr::~FunctionExpr() { deleteChildren(); }
+
+size_t FunctionExpr::childCount() const
+{
+	return operands.size();
+}
+
+Expr*& FunctionExpr::child(size_t i)
+{
+	return operands[i];
+}
+
+double FunctionExpr::apply(const double* values)
+{
+	return function->call(values);
+}
+
+void FunctionExpr::appendText(Printer& out, size_t i) const
+{
+	appendCall(out, function->name, operands.size(), i);
+}
+
+bool FunctionExpr::beginCompile(Compiler& out) const
+{
+	// Arguments of an inlined call are compiled from inside the call, so nesting
+	// is limited to keep deeply nested calls off the native stack
+	if (out.inlining >= UserFunction::InlineDepthLimit) {
+		return false;
 	}
-	result += "(";
+	std::vector<size_t> sizes(operands.size());
 	for (size_t i = 0; i < operands.size(); ++i) {
-		result += operands[i]->toString();
-		if (i + 1 < operands.size())
-			result += ", ";
+		sizes[i] = countNodes(operands[i]);
+	}
+	if (!function->shouldInline(sizes)) {
+		return false;
 	}
-	result += ")";
-	return result;
+	++out.inlining;
+	out.inlineCall(*function, [this, &out](size_t i) { operands[i]->compile(out); });
+	--out.inlining;
+	return true;
+}
+
+void FunctionExpr::emit(Compiler& out) const
+{
+	out.emit(OpCode::CallFunction, out.addFunction(function), static_cast<uint16_t>(operands.size()));
 }
 
 KeywordType stringToKeyword(const std::string& str)
@@ -108,32 +416,44 @@ std::string keywordToString(KeywordType id)
 }
 
 // -----------------------------------------------------
-static std::unordered_map<std::string, double> variables = {};
-
 IdentifierExpr::IdentifierExpr(const std::string& name)
 	: name(name) {
 }
 
-double IdentifierExpr::eval()
+double IdentifierExpr::apply(const double*)
 {
-	return lookupIdentifier(name);
+	// Reuses the snapshot the caller pinned for the whole tree, if there is one
+	return VariableStore::global().withSnapshot([this](const VariableStore::Snapshot& snapshot) { return lookup(snapshot); });
 }
 
-std::string IdentifierExpr::toString() const
+double IdentifierExpr::lookup(const VariableStore::Snapshot& snapshot)
 {
-	return name;
+	if (slot == InvalidSlot) {
+		auto found = snapshot.find(name);
+		if (!found) {
+			throw std::runtime_error(std::format("Identifier '{}' not found", name));
+		}
+		slot = *found;
+	}
+	return snapshot.get(slot);
+}
+
+void IdentifierExpr::appendText(Printer& out, size_t) const
+{
+	out.write(name);
+}
+
+void IdentifierExpr::emit(Compiler& out) const
+{
+	out.emit(OpCode::Load, out.addIdentifier(name));
 }
 
 double IdentifierExpr::lookupIdentifier(const std::string& name)
 {
-	auto it = variables.find(name);
-	if (it != variables.end()) {
-		return it->second;
-	}
-	throw std::runtime_error(std::format("Identifier '{}' not found", name));
+	return VariableStore::global().read().get(name);
 }
 
 void IdentifierExpr::setIdentifier(const std::string& name, double value)
 {
-	variables[name] = value;
-}
\ No newline at end of file
+	VariableStore::global().set(name, value);
+}
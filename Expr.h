@@ -2,13 +2,61 @@
 
 #include "Tokenizer.h"
 #include "Keyword.h"
+#include "Environment.h"
+#include "Function.h"
+#include "VariableStore.h"
+#include "Printer.h"
 #include <string>
 
+struct Compiler;
+struct Simplifier;
+
+// How a node is written, which tells Printer the brackets it needs
+struct Notation
+{
+	enum Form { Atom, Prefix, Infix } form = Atom;
+	// Operator of a Prefix or Infix node
+	TokenType op = TokenType::EndOfFile;
+};
+
 struct Expr
 {
-    virtual ~Expr() = default;
-	virtual double eval() = 0;
-	virtual std::string toString() const = 0;
+	// Counts the node when PerfCounters are enabled
+	Expr();
+	virtual ~Expr() = default;
+
+	// The whole-tree operations walk the tree with an explicit stack instead of
+	// recursing, so no tree is too deep for them, see Expr.cpp
+	double eval();
+	std::string toString(const PrintOptions& options = {}) const;
+	// Appends the postfix bytecode for this tree, see Bytecode.h
+	void compile(Compiler& out) const;
+	// Returns this node or a replacement for it, once its children have been
+	// simplified. A replaced node is deleted, see Optimizer.h
+	virtual Expr* simplify(Simplifier& pass) = 0;
+
+	// The steps of the walks for a single node. Children are in evaluation order.
+	virtual size_t childCount() const { return 0; }
+	virtual Expr*& child(size_t i);
+	const Expr* child(size_t i) const;
+	// Value of this node, given the values of its children
+	virtual double apply(const double* values) = 0;
+	// Text before child i, or after the last child for i == childCount()
+	virtual void appendText(Printer& out, size_t i) const = 0;
+	virtual Notation notation() const { return {}; }
+	// Whether appendText writes the children itself, through nested calls of
+	// Printer::print. Such a node is asked for part 0 only.
+	virtual bool printsChildren() const { return false; }
+	// Called before the children are compiled. Returns true if the node has
+	// compiled its children itself, which an inlined call does.
+	virtual bool beginCompile(Compiler& out) const { return false; }
+	// Appends the instructions of this node after those of its children
+	virtual void emit(Compiler& out) const = 0;
+
+protected:
+	// Deletes the subtrees of this node without recursing. Called by the
+	// destructors of nodes with children.
+	void deleteChildren();
 };
 
 struct NumberExpr : public Expr
@@ -16,8 +64,10 @@ struct NumberExpr : public Expr
 	double value;
 	
 	NumberExpr(double val);
-	double eval() override;
-	std::string toString() const override;
+	Expr* simplify(Simplifier& pass) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	void emit(Compiler& out) const override;
 };
 
 struct UnaryExpr : public Expr
@@ -27,8 +77,13 @@ struct UnaryExpr : public Expr
 	
 	UnaryExpr(TokenType op, Expr* operand);
 	~UnaryExpr();
-	double eval() override;
-	std::string toString() const override;
+	Expr* simplify(Simplifier& pass) override;
+	size_t childCount() const override;
+	Expr*& child(size_t i) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	Notation notation() const override;
+	void emit(Compiler& out) const override;
 };
 
 struct BinaryExpr : public Expr
@@ -39,19 +94,49 @@ struct BinaryExpr : public Expr
 	
 	BinaryExpr(TokenType op, Expr* l, Expr* r);
 	~BinaryExpr();
-	double eval() override;
-	std::string toString() const override;
+	Expr* simplify(Simplifier& pass) override;
+	size_t childCount() const override;
+	Expr*& child(size_t i) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	Notation notation() const override;
+	void emit(Compiler& out) const override;
 };
 
 struct KeywordExpr : public Expr
 {
 	KeywordType id;
 	std::vector<Expr*> operands;
+	const KeywordInfo* info; // Resolved once, so eval skips the table
 
+	// The arity is checked by the parser, not here
 	KeywordExpr(KeywordType id, std::vector<Expr*>&& operand);
 	~KeywordExpr();
-	double eval() override;
-	std::string toString() const override;
+	Expr* simplify(Simplifier& pass) override;
+	size_t childCount() const override;
+	Expr*& child(size_t i) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	bool beginCompile(Compiler& out) const override;
+	void emit(Compiler& out) const override;
+};
+
+// Call of a function from FunctionTable, see Function.h
+struct FunctionExpr : public Expr
+{
+	FunctionRef function;
+	std::vector<Expr*> operands;
+
+	FunctionExpr(FunctionRef function, std::vector<Expr*>&& operands);
+	~FunctionExpr();
+	Expr* simplify(Simplifier& pass) override;
+	size_t childCount() const override;
+	Expr*& child(size_t i) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	// Small functions are expanded in place, everything else becomes a CallFunction
+	bool beginCompile(Compiler& out) const override;
+	void emit(Compiler& out) const override;
 };
 
 KeywordType stringToKeyword(const std::string& str);
@@ -60,10 +145,16 @@ std::string keywordToString(KeywordType id);
 struct IdentifierExpr : public Expr
 {
 	std::string name;
+	// Slot of name in VariableStore::global(), resolved on the first evaluation so
+	// that parsing does not touch any shared state
+	Slot slot = InvalidSlot;
 
 	IdentifierExpr(const std::string& name);
-	double eval() override;
-	std::string toString() const override;
+	Expr* simplify(Simplifier& pass) override;
+	double apply(const double* values) override;
+	void appendText(Printer& out, size_t i) const override;
+	void emit(Compiler& out) const override;
+	double lookup(const VariableStore::Snapshot& snapshot);
 
 	static double lookupIdentifier(const std::string& name);
 	static void setIdentifier(const std::string& name, double value);
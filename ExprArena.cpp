@@ -0,0 +1,590 @@
+#include "ExprArena.h"
+#include "ArrayStore.h"
+#include "Expr.h"
+#include "Parser.h"
+#include "ParseRule.h"
+#include "PerfCounters.h"
+#include "IterativeParser.h"
+#include "VariableStore.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+// -----------------------------------------------------
+size_t SharingStats::deduplicated() const
+{
+	return treeNodes - storedNodes;
+}
+
+std::string SharingStats::toString() const
+{
+	return std::format("{} tree nodes stored as {} ({} deduplicated, {} bytes saved)", treeNodes, storedNodes, deduplicated(), bytesSaved);
+}
+
+// -----------------------------------------------------
+static uint64_t mixHash(uint64_t hash, uint64_t value)
+{
+	return hash ^ (value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2));
+}
+
+// Hash of everything that makes two nodes the same expression. Keyword and
+// function arguments are hashed by node, not by their place in the operand list.
+static uint64_t structureHash(const ExprNode& node, std::span<const NodeIndex> arguments, const UserFunction* function)
+{
+	uint64_t hash = mixHash(static_cast<uint64_t>(node.kind), node.op | (static_cast<uint64_t>(node.count) << 8));
+	switch (node.kind)
+	{
+	case NodeKind::Number: {
+		uint64_t bits;
+		std::memcpy(&bits, &node.value, sizeof(bits));
+		return mixHash(hash, bits);
+	}
+	case NodeKind::Identifier:
+	case NodeKind::Unary:
+		return mixHash(hash, node.first);
+	case NodeKind::Binary:
+		return mixHash(mixHash(hash, node.first), node.second);
+	case NodeKind::Function:
+		hash = mixHash(hash, reinterpret_cast<uintptr_t>(function));
+		[[fallthrough]];
+	case NodeKind::Keyword:
+		for (NodeIndex argument : arguments) {
+			hash = mixHash(hash, argument);
+		}
+		return hash;
+	}
+	return hash;
+}
+
+static bool sameStructure(const ExprArena& arena, const ExprNode& existing, const ExprNode& node, std::span<const NodeIndex> arguments, const UserFunction* function)
+{
+	if (existing.kind != node.kind || existing.op != node.op || existing.count != node.count) {
+		return false;
+	}
+	switch (node.kind)
+	{
+	case NodeKind::Number:
+		// Bit patterns, so 0 and -0 stay apart
+		return std::memcmp(&existing.value, &node.value, sizeof(double)) == 0;
+	case NodeKind::Identifier:
+	case NodeKind::Unary:
+		return existing.first == node.first;
+	case NodeKind::Binary:
+		return existing.first == node.first && existing.second == node.second;
+	case NodeKind::Function:
+		if (arena.functions[existing.second].get() != function) {
+			return false;
+		}
+		[[fallthrough]];
+	case NodeKind::Keyword:
+		return std::equal(arguments.begin(), arguments.end(), arena.operands.begin() + existing.first);
+	}
+	return false;
+}
+
+// With shareNodes set, returns the node that node duplicates, or InvalidNode
+// after computing the hash pushNode files the new node under
+static NodeIndex findShared(ExprArena& arena, const ExprNode& node, std::span<const NodeIndex> arguments, const UserFunction* function, uint64_t& hash)
+{
+	if (!arena.shareNodes) {
+		return InvalidNode;
+	}
+	hash = structureHash(node, arguments, function);
+	auto it = arena.sharedNodes.find(hash);
+	if (it == arena.sharedNodes.end() || !sameStructure(arena, arena.nodes[it->second], node, arguments, function)) {
+		return InvalidNode;
+	}
+	++arena.reusedNodes;
+	arena.reusedOperands += arguments.size();
+	return it->second;
+}
+
+static NodeIndex pushNode(ExprArena& arena, const ExprNode& node, uint64_t hash = 0)
+{
+	if (arena.nodes.size() >= InvalidNode) {
+		ERR("Expression has too many nodes");
+	}
+	arena.nodes.push_back(node);
+	PerfCounters::countNodes();
+	NodeIndex index = static_cast<NodeIndex>(arena.nodes.size() - 1);
+	if (arena.shareNodes) {
+		arena.sharedNodes.emplace(hash, index);
+	}
+	return index;
+}
+
+NodeIndex ExprArena::addNumber(double value)
+{
+	ExprNode node{ NodeKind::Number };
+	node.value = value;
+	uint64_t hash = 0;
+	NodeIndex existing = findShared(*this, node, {}, nullptr, hash);
+	return existing != InvalidNode ? existing : pushNode(*this, node, hash);
+}
+
+NodeIndex ExprArena::addIdentifier(std::string_view name)
+{
+	auto it = nameToIndex.find(name);
+	if (it == nameToIndex.end()) {
+		it = nameToIndex.emplace(name, static_cast<uint32_t>(names.size())).first;
+		names.emplace_back(name);
+		slots.push_back(VariableStore::global().intern(name));
+	}
+	ExprNode node{ NodeKind::Identifier };
+	node.first = it->second;
+	uint64_t hash = 0;
+	NodeIndex existing = findShared(*this, node, {}, nullptr, hash);
+	return existing != InvalidNode ? existing : pushNode(*this, node, hash);
+}
+
+NodeIndex ExprArena::addUnary(TokenType op, NodeIndex operand)
+{
+	ExprNode node{ NodeKind::Unary, static_cast<uint8_t>(op) };
+	node.first = operand;
+	uint64_t hash = 0;
+	NodeIndex existing = findShared(*this, node, {}, nullptr, hash);
+	return existing != InvalidNode ? existing : pushNode(*this, node, hash);
+}
+
+NodeIndex ExprArena::addBinary(TokenType op, NodeIndex left, NodeIndex right)
+{
+	ExprNode node{ NodeKind::Binary, static_cast<uint8_t>(op) };
+	node.first = left;
+	node.second = right;
+	uint64_t hash = 0;
+	NodeIndex existing = findShared(*this, node, {}, nullptr, hash);
+	return existing != InvalidNode ? existing : pushNode(*this, node, hash);
+}
+
+NodeIndex ExprArena::addKeyword(KeywordType id, std::span<const NodeIndex> arguments)
+{
+	ExprNode node{ NodeKind::Keyword, static_cast<uint8_t>(id), static_cast<uint16_t>(arguments.size()) };
+	node.first = static_cast<NodeIndex>(operands.size());
+	node.second = 0;
+	uint64_t hash = 0;
+	NodeIndex existing = findShared(*this, node, arguments, nullptr, hash);
+	if (existing != InvalidNode) {
+		return existing;
+	}
+	operands.insert(operands.end(), arguments.begin(), arguments.end());
+	return pushNode(*this, node, hash);
+}
+
+NodeIndex ExprArena::addFunction(FunctionRef function, std::span<const NodeIndex> arguments)
+{
+	ExprNode node{ NodeKind::Function, 0, static_cast<uint16_t>(arguments.size()) };
+	node.first = static_cast<NodeIndex>(operands.size());
+	node.second = static_cast<NodeIndex>(functions.size());
+	uint64_t hash = 0;
+	NodeIndex existing = findShared(*this, node, arguments, function.get(), hash);
+	if (existing != InvalidNode) {
+		return existing;
+	}
+	operands.insert(operands.end(), arguments.begin(), arguments.end());
+	functions.push_back(std::move(function));
+	return pushNode(*this, node, hash);
+}
+
+NodeIndex ExprArena::root() const
+{
+	return nodes.empty() ? InvalidNode : static_cast<NodeIndex>(nodes.size() - 1);
+}
+
+size_t ExprArena::size() const
+{
+	return nodes.size();
+}
+
+bool ExprArena::empty() const
+{
+	return nodes.empty();
+}
+
+void ExprArena::truncate(NodeIndex mark)
+{
+	if (mark >= nodes.size()) {
+		return;
+	}
+	// Keyword arguments are appended in node order, so the first dropped keyword
+	// tells us where the dropped part of the operand list starts
+	for (NodeIndex i = mark; i < nodes.size(); ++i) {
+		if (nodes[i].kind == NodeKind::Keyword || nodes[i].kind == NodeKind::Function) {
+			operands.resize(nodes[i].first);
+			break;
+		}
+	}
+	for (NodeIndex i = mark; i < nodes.size(); ++i) {
+		if (nodes[i].kind == NodeKind::Function) {
+			functions.resize(nodes[i].second);
+			break;
+		}
+	}
+	std::erase_if(sharedNodes, [mark](const auto& entry) { return entry.second >= mark; });
+	nodes.resize(mark);
+}
+
+void ExprArena::clear()
+{
+	nodes.clear();
+	operands.clear();
+	names.clear();
+	slots.clear();
+	nameToIndex.clear();
+	functions.clear();
+	sharedNodes.clear();
+	reusedNodes = 0;
+	reusedOperands = 0;
+}
+
+SharingStats ExprArena::sharingStats() const
+{
+	SharingStats stats;
+	stats.storedNodes = nodes.size();
+	stats.treeNodes = nodes.size() + reusedNodes;
+	stats.bytesSaved = reusedNodes * sizeof(ExprNode) + reusedOperands * sizeof(NodeIndex);
+	return stats;
+}
+
+// -----------------------------------------------------
+double ExprArena::eval() const
+{
+	if (nodes.empty()) {
+		ERR("Cannot evaluate an empty expression");
+	}
+	return eval(0, static_cast<NodeIndex>(nodes.size()));
+}
+
+double ExprArena::eval(NodeIndex first, NodeIndex last) const
+{
+	return VariableStore::global().withSnapshot([&](const VariableStore::Snapshot& variables) { return eval(first, last, variables); });
+}
+
+// Evaluates the self-contained node range [first, last) front to back and
+// returns the value of its last node. Children always precede their parents,
+// so every operand is ready by the time a node is reached.
+double ExprArena::eval(NodeIndex first, NodeIndex last, const VariableStore::Snapshot& variables) const
+{
+	PerfTimer timer(PerfStage::Eval);
+	constexpr size_t inlineSize = 64;
+	double inlineValues[inlineSize];
+	std::vector<double> heapValues;
+	double* values = inlineValues;
+	// Indexed by node number, so the nodes before first get entries they never use
+	if (last > inlineSize) {
+		heapValues.resize(last);
+		values = heapValues.data();
+	}
+
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	std::vector<double> args;
+	for (NodeIndex i = first; i < last; ++i) {
+		const ExprNode& node = nodes[i];
+		switch (node.kind)
+		{
+		case NodeKind::Number:
+			values[i] = node.value;
+			break;
+		case NodeKind::Identifier:
+			values[i] = variables.get(slots[node.first]);
+			break;
+		case NodeKind::Unary:
+			if (static_cast<TokenType>(node.op) == TokenType::Minus)
+				values[i] = -values[node.first];
+			else
+				values[i] = values[node.first];
+			break;
+		case NodeKind::Binary: {
+			double l = values[node.first];
+			double r = values[node.second];
+			switch (static_cast<TokenType>(node.op))
+			{
+			case TokenType::Plus:
+				values[i] = l + r;
+				break;
+			case TokenType::Minus:
+				values[i] = l - r;
+				break;
+			case TokenType::Mult:
+				values[i] = l * r;
+				break;
+			case TokenType::Div:
+				values[i] = l / r;
+				break;
+			case TokenType::Pow:
+				values[i] = power(l, r);
+				break;
+			default:
+				ERR("Unknown binary operator");
+			}
+			break;
+		}
+		case NodeKind::Keyword: {
+			const KeywordInfo& info = keywords.getByID(static_cast<KeywordType>(node.op));
+			PerfCounters::countKeyword(info.id);
+			const NodeIndex* arguments = operands.data() + node.first;
+			switch (info.argCount)
+			{
+			case 0:
+				values[i] = info.nullary();
+				break;
+			case 1:
+				values[i] = info.unary(values[arguments[0]]);
+				break;
+			case 2:
+				values[i] = info.binary(values[arguments[0]], values[arguments[1]]);
+				break;
+			default:
+				// Only variadic keywords gather their arguments, into one reused list
+				args.resize(node.count);
+				for (uint16_t a = 0; a < node.count; ++a) {
+					args[a] = values[arguments[a]];
+				}
+				values[i] = info.variadic(args);
+				break;
+			}
+			break;
+		}
+		case NodeKind::Function:
+			args.resize(node.count);
+			for (uint16_t a = 0; a < node.count; ++a) {
+				args[a] = values[operands[node.first + a]];
+			}
+			values[i] = functions[node.second]->call(args.data());
+			break;
+		}
+	}
+	return values[last - 1];
+}
+
+std::string ExprArena::toString() const
+{
+	if (nodes.empty()) {
+		return "";
+	}
+	return toString(root());
+}
+
+// Child number i of node, or InvalidNode past the last one
+static NodeIndex childOf(const ExprArena& arena, const ExprNode& node, uint32_t i)
+{
+	switch (node.kind)
+	{
+	case NodeKind::Unary:
+		return i == 0 ? node.first : InvalidNode;
+	case NodeKind::Binary:
+		return i == 0 ? node.first : i == 1 ? node.second : InvalidNode;
+	case NodeKind::Keyword:
+	case NodeKind::Function:
+		return i < node.count ? arena.operands[node.first + i] : InvalidNode;
+	default:
+		return InvalidNode;
+	}
+}
+
+// Text of node before child number part, or after the last child
+static void appendText(const ExprArena& arena, const ExprNode& node, uint32_t part, std::string& out)
+{
+	switch (node.kind)
+	{
+	case NodeKind::Number:
+		out += std::to_string(node.value);
+		break;
+	case NodeKind::Identifier:
+		out += arena.names[node.first];
+		break;
+	case NodeKind::Unary:
+		if (part == 0) {
+			out += '(';
+			out += tokenTypeToString(static_cast<TokenType>(node.op));
+		}
+		else {
+			out += ')';
+		}
+		break;
+	case NodeKind::Binary:
+		if (part == 0) {
+			out += '(';
+		}
+		else if (part == 1) {
+			out += ' ';
+			out += tokenTypeToString(static_cast<TokenType>(node.op));
+			out += ' ';
+		}
+		else {
+			out += ')';
+		}
+		break;
+	case NodeKind::Keyword:
+	case NodeKind::Function:
+		if (part == 0) {
+			out += node.kind == NodeKind::Keyword ? keywordToString(static_cast<KeywordType>(node.op)) : arena.functions[node.second]->name;
+			if (node.count > 0)
+				out += '(';
+		}
+		else if (part < node.count) {
+			out += ", ";
+		}
+		else {
+			out += ')';
+		}
+		break;
+	}
+}
+
+std::string ExprArena::toString(NodeIndex index) const
+{
+	std::string out;
+	std::vector<std::pair<NodeIndex, uint32_t>> stack{ { index, 0 } };
+	while (!stack.empty()) {
+		auto [current, part] = stack.back();
+		const ExprNode& node = nodes[current];
+		appendText(*this, node, part, out);
+		NodeIndex child = childOf(*this, node, part);
+		if (child != InvalidNode) {
+			++stack.back().second;
+			stack.push_back({ child, 0 });
+		}
+		else {
+			stack.pop_back();
+		}
+	}
+	return out;
+}
+
+// -----------------------------------------------------
+// Appends the nodes IterativeParser asks for to an arena
+struct ArenaBuilder
+{
+	using Node = NodeIndex;
+	struct Assignment
+	{
+		NodeIndex mark = 0;
+		bool shareNodes = false;
+	};
+
+	ArenaBuilder(ExprArena& arena, const ArrayStore& arrays) : arena(arena), arrays(arrays), shareNodes(arena.shareNodes) {}
+	// Assignments switch sharing off while they parse, a failed one must not leave it off
+	~ArenaBuilder() { arena.shareNodes = shareNodes; }
+
+	Node number(const Token& tok) { return arena.addNumber(tok.number); }
+	// A name bound to an array has to be rejected too, it must not be read as a variable
+	Node identifier(const Token& tok)
+	{
+		if (arrays.contains(tok.content)) {
+			ERR("Arrays are not supported in an ExprArena");
+		}
+		return arena.addIdentifier(tok.content);
+	}
+	Node array(std::vector<double>) { ERR("Arrays are not supported in an ExprArena"); }
+	Node unary(TokenType op, Node operand) { return arena.addUnary(op, operand); }
+	Node binary(TokenType op, Node left, Node right) { return arena.addBinary(op, left, right); }
+	Node keyword(const KeywordInfo& info, std::span<Node> arguments) { return arena.addKeyword(info.id, arguments); }
+	Node function(FunctionRef function, std::span<Node> arguments) { return arena.addFunction(std::move(function), arguments); }
+	bool isIdentifier(Node node) { return arena.nodes[node].kind == NodeKind::Identifier; }
+
+	// The right side is evaluated once and then dropped, like ledEquals does.
+	// It shares no nodes, so it can be evaluated as a range of its own.
+	Assignment beginAssignment()
+	{
+		Assignment assignment{ static_cast<NodeIndex>(arena.nodes.size()), arena.shareNodes };
+		arena.shareNodes = false;
+		return assignment;
+	}
+
+	Node assign(Node identifier, Node, Assignment assignment)
+	{
+		arena.shareNodes = assignment.shareNodes;
+		double value = arena.eval(assignment.mark, static_cast<NodeIndex>(arena.nodes.size()));
+		arena.truncate(assignment.mark);
+		VariableStore::global().set(arena.slots[arena.nodes[identifier].first], value);
+		return identifier;
+	}
+
+	// Nodes stay in the arena until it is cleared
+	void discard(Node) {}
+
+	ExprArena& arena;
+	const ArrayStore& arrays;
+	bool shareNodes;
+};
+
+NodeIndex parseArenaExpr(PrattParser& parser, ExprArena& arena, TokenType end, int minBindingPower)
+{
+	PerfTimer timer(PerfStage::Parse);
+	ArenaBuilder builder(arena, parser.getScope().arrays);
+	return IterativeParser<ArenaBuilder>(parser, builder).parse(end, minBindingPower);
+}
+
+ExprArena parseArena(PrattParser& parser, bool shareNodes)
+{
+	ExprArena arena;
+	arena.shareNodes = shareNodes;
+	parseArenaExpr(parser, arena);
+	return arena;
+}
+
+// -----------------------------------------------------
+static void emitNode(Compiler& compiler, const ExprArena& arena, const ExprNode& node)
+{
+	switch (node.kind)
+	{
+	case NodeKind::Number:
+		compiler.emit(OpCode::Const, compiler.addConstant(node.value));
+		break;
+	case NodeKind::Identifier:
+		compiler.emit(OpCode::Load, compiler.addIdentifier(arena.names[node.first]));
+		break;
+	case NodeKind::Unary:
+		if (static_cast<TokenType>(node.op) == TokenType::Minus)
+			compiler.emit(OpCode::Neg);
+		break;
+	case NodeKind::Binary: {
+		static constexpr OpCode binaryOps[] = { OpCode::Add, OpCode::Sub, OpCode::Mul, OpCode::Div, OpCode::Pow };
+		compiler.emit(binaryOps[node.op - static_cast<uint8_t>(TokenType::Plus)]);
+		break;
+	}
+	case NodeKind::Keyword:
+		compiler.emit(OpCode::Call, node.op, node.count);
+		break;
+	case NodeKind::Function:
+		// Arguments are already in postfix order here, so functions are called rather than inlined
+		compiler.emit(OpCode::CallFunction, compiler.addFunction(arena.functions[node.second]), node.count);
+		break;
+	}
+}
+
+// The arena is already in postfix order, so lowering it is a single forward pass
+Program compile(const ExprArena& arena)
+{
+	if (arena.empty()) {
+		ERR("Cannot compile an empty expression");
+	}
+	Compiler compiler;
+	if (arena.reusedNodes == 0) {
+		for (const ExprNode& node : arena.nodes) {
+			emitNode(compiler, arena, node);
+		}
+		return std::move(compiler.program);
+	}
+
+	// The stack machine consumes every value it pushes, so shared nodes are
+	// unfolded back into the tree they came from, depth first from the root
+	std::vector<std::pair<NodeIndex, uint32_t>> stack{ { arena.root(), 0 } };
+	while (!stack.empty()) {
+		auto& [index, next] = stack.back();
+		const ExprNode& node = arena.nodes[index];
+		NodeIndex child = childOf(arena, node, next);
+		if (child != InvalidNode) {
+			++next;
+			stack.push_back({ child, 0 });
+			continue;
+		}
+		emitNode(compiler, arena, node);
+		stack.pop_back();
+	}
+	return std::move(compiler.program);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Tokenizer.h"
+#include "Keyword.h"
+#include "Bytecode.h"
+#include "Environment.h"
+#include "Function.h"
+#include "VariableStore.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct PrattParser;
+
+using NodeIndex = uint32_t;
+constexpr NodeIndex InvalidNode = UINT32_MAX;
+
+enum class NodeKind : uint8_t {
+	Number,
+	Identifier,
+	Unary,
+	Binary,
+	Keyword,
+	Function
+};
+
+// A 16 byte expression node that refers to its children by index
+struct ExprNode
+{
+	NodeKind kind;
+	// TokenType for Unary/Binary, KeywordType for Keyword
+	uint8_t op = 0;
+	// Number of arguments of a Keyword or Function
+	uint16_t count = 0;
+	// Unary operand, Binary left side, Identifier name or first Keyword/Function argument in ExprArena::operands
+	NodeIndex first = InvalidNode;
+	union {
+		double value;		// Number
+		NodeIndex second;	// Binary right side, Function index in ExprArena::functions
+	};
+};
+static_assert(sizeof(ExprNode) == 16, "ExprNode should stay compact");
+
+// What hash-consing saved while an arena was built
+struct SharingStats
+{
+	// Nodes the expression has as a tree, and how many of them the arena stores
+	size_t treeNodes = 0;
+	size_t storedNodes = 0;
+	// Bytes of nodes and keyword arguments that were not stored
+	size_t bytesSaved = 0;
+
+	size_t deduplicated() const;
+	std::string toString() const;
+};
+
+// Holds every node of one expression in a single allocation. Nodes are appended
+// after their children, so the node array is already in postfix order and the
+// root is always the last node. Clearing the arena frees the whole tree at once.
+struct ExprArena
+{
+	std::vector<ExprNode> nodes;
+	std::vector<NodeIndex> operands;
+	std::vector<std::string> names;
+	// Slot of each name in VariableStore::global()
+	std::vector<Slot> slots;
+	StringMap<uint32_t> nameToIndex;
+	// User functions called by Function nodes
+	std::vector<FunctionRef> functions;
+
+	// While set, adding a node that is structurally identical to an existing one
+	// returns the existing node, so a repeated subexpression is stored and
+	// evaluated once. The nodes then form a DAG, still in postfix order.
+	bool shareNodes = false;
+	// Node for each structure hash. A colliding node is simply not shared.
+	std::unordered_map<uint64_t, NodeIndex> sharedNodes;
+	// Adds that were answered with an existing node, and the operands they did not append
+	size_t reusedNodes = 0;
+	size_t reusedOperands = 0;
+
+	NodeIndex addNumber(double value);
+	NodeIndex addIdentifier(std::string_view name);
+	NodeIndex addUnary(TokenType op, NodeIndex operand);
+	NodeIndex addBinary(TokenType op, NodeIndex left, NodeIndex right);
+	NodeIndex addKeyword(KeywordType id, std::span<const NodeIndex> arguments);
+	NodeIndex addFunction(FunctionRef function, std::span<const NodeIndex> arguments);
+
+	NodeIndex root() const;
+	size_t size() const;
+	bool empty() const;
+	// Drops every node from mark onwards
+	void truncate(NodeIndex mark);
+	// Releases all nodes but keeps the storage for the next parse
+	void clear();
+	SharingStats sharingStats() const;
+
+	double eval() const;
+	double eval(NodeIndex first, NodeIndex last) const;
+	double eval(NodeIndex first, NodeIndex last, const VariableStore::Snapshot& variables) const;
+	std::string toString() const;
+	std::string toString(NodeIndex node) const;
+};
+
+// Throws for array literals and names bound to arrays, which only Expr trees support
+NodeIndex parseArenaExpr(PrattParser& parser, ExprArena& arena, TokenType end = TokenType::EndOfFile, int minBindingPower = 0);
+ExprArena parseArena(PrattParser& parser, bool shareNodes = false);
+Program compile(const ExprArena& arena);
@@ -0,0 +1,176 @@
+#include "ExprCache.h"
+#include "Expr.h"
+#include "ArrayExpr.h"
+#include "Function.h"
+#include "Parser.h"
+#include "ParseRule.h"
+#include "Optimizer.h"
+#include <format>
+#include <stdexcept>
+
+std::string CacheStats::toString() const
+{
+	return std::format("hits: {}, misses: {}, evictions: {}, size: {}/{}", hits, misses, evictions, size, capacity);
+}
+
+// -----------------------------------------------------
+ExprCache::ExprCache(ParseScope scope, size_t capacity) : scope(scope), capacity(capacity)
+{
+	if (capacity == 0) {
+		throw std::runtime_error("Cache capacity must be positive");
+	}
+}
+
+static bool isSpace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static bool isWordChar(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.';
+}
+
+static bool isDigitOrDot(char c)
+{
+	return (c >= '0' && c <= '9') || c == '.';
+}
+
+// True if text ends in the exponent marker of a number, like "2.5e"
+static bool endsInExponent(std::string_view text)
+{
+	size_t n = text.size();
+	return n >= 2 && (text[n - 1] == 'e' || text[n - 1] == 'E') && isDigitOrDot(text[n - 2]);
+}
+
+// Whether removing the whitespace between text and next could change the tokens
+static bool gapSeparatesTokens(std::string_view text, char next)
+{
+	char last = text.back();
+	// "x y" would become "xy" and "1 2" would become "12"
+	if (isWordChar(last) && isWordChar(next))
+		return true;
+	// "1e -5" would become the single number "1e-5"
+	if (endsInExponent(text) && (next == '+' || next == '-'))
+		return true;
+	if ((last == '+' || last == '-') && isDigitOrDot(next) && endsInExponent(text.substr(0, text.size() - 1)))
+		return true;
+	return false;
+}
+
+std::string ExprCache::normalize(std::string_view source)
+{
+	std::string result;
+	result.reserve(source.size());
+	for (size_t i = 0; i < source.size(); ++i) {
+		if (!isSpace(source[i])) {
+			result += source[i];
+			continue;
+		}
+		while (i + 1 < source.size() && isSpace(source[i + 1]))
+			++i;
+		if (!result.empty() && i + 1 < source.size() && gapSeparatesTokens(result, source[i + 1]))
+			result += ' ';
+	}
+	return result;
+}
+
+ExprCache::Entry ExprCache::build(std::string normalized) const
+{
+	auto compiled = std::make_shared<CompiledExpr>();
+	compiled->source = std::move(normalized);
+
+	PrattParser parser{ std::string_view(compiled->source), scope };
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	compiled->text = expr->toString();
+	if (auto* array = dynamic_cast<ArrayExpr*>(expr.get())) {
+		compiled->isArray = true;
+		compiled->elements = array->elements();
+		return compiled;
+	}
+	// Strict simplification never changes a result, it only saves work on every evaluation
+	expr.reset(simplify(expr.release()));
+	compiled->program = compile(expr.get());
+	return compiled;
+}
+
+ExprCache::Entry ExprCache::get(std::string_view source)
+{
+	std::string normalized = normalize(source);
+	const uint64_t generation = scope.functions.generation();
+	const uint64_t arrays = scope.arrays.generation();
+	{
+		std::lock_guard lock(mutex);
+		if (generation != functionGeneration || arrays != arrayGeneration) {
+			index.clear();
+			lru.clear();
+			functionGeneration = generation;
+			arrayGeneration = arrays;
+		}
+		auto it = index.find(normalized);
+		if (it != index.end()) {
+			lru.splice(lru.begin(), lru, it->second);
+			hits.fetch_add(1, std::memory_order_relaxed);
+			return *it->second;
+		}
+	}
+	misses.fetch_add(1, std::memory_order_relaxed);
+
+	// Parse outside the lock so other threads are not blocked by a miss
+	bool cacheable = normalized.find('=') == std::string::npos;
+	Entry entry = build(std::move(normalized));
+	if (!cacheable || entry->isArray) {
+		return entry;
+	}
+
+	std::lock_guard lock(mutex);
+	// A function or array changed during build, so entry may be stale; the
+	// next get compiles it again
+	if (scope.functions.generation() != generation || scope.arrays.generation() != arrays) {
+		return entry;
+	}
+	auto it = index.find(entry->source);
+	if (it != index.end()) {
+		// Another thread compiled the same source in the meantime
+		lru.splice(lru.begin(), lru, it->second);
+		return *it->second;
+	}
+	lru.push_front(entry);
+	index.emplace(entry->source, lru.begin());
+	if (lru.size() > capacity) {
+		index.erase(lru.back()->source);
+		lru.pop_back();
+		evictions.fetch_add(1, std::memory_order_relaxed);
+	}
+	return entry;
+}
+
+CacheStats ExprCache::stats() const
+{
+	CacheStats result;
+	result.hits = hits.load(std::memory_order_relaxed);
+	result.misses = misses.load(std::memory_order_relaxed);
+	result.evictions = evictions.load(std::memory_order_relaxed);
+	result.capacity = capacity;
+	std::lock_guard lock(mutex);
+	result.size = lru.size();
+	return result;
+}
+
+void ExprCache::clear()
+{
+	std::lock_guard lock(mutex);
+	index.clear();
+	lru.clear();
+}
+
+const ParseScope& ExprCache::getScope() const
+{
+	return scope;
+}
+
+ExprCache& ExprCache::global()
+{
+	static ExprCache cache{ ParseScope::global() };
+	return cache;
+}
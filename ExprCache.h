@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "Keyword.h"
+#include "Parser.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Everything needed to evaluate and print an expression without parsing it again
+struct CompiledExpr
+{
+	std::string source;
+	// Expr::toString() of the parsed tree
+	std::string text;
+	Program program;
+	// Set for an array-valued expression like "xs * 2", which has no program.
+	// Its elements are computed once when it is compiled.
+	bool isArray = false;
+	std::vector<double> elements;
+};
+
+struct CacheStats
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	size_t size = 0;
+	size_t capacity = 0;
+
+	std::string toString() const;
+};
+
+// Bounded, thread-safe LRU cache from source text to its compiled form.
+// Sources are normalized first, so formulas that only differ in whitespace
+// share an entry. Assignments are never cached because ledEquals performs them
+// while parsing; they are compiled on every call like before. Neither are array
+// values, which are computed while compiling. Entries may have user functions
+// inlined, and a name parses differently once it is bound to an array, so
+// defining or removing either in the tables of scope empties the cache.
+class ExprCache
+{
+public:
+	using Entry = std::shared_ptr<const CompiledExpr>;
+
+	// Sources are parsed with scope
+	explicit ExprCache(ParseScope scope, size_t capacity = 4096);
+
+	// Returns the compiled form of source, lexing and parsing it only on a miss
+	Entry get(std::string_view source);
+	CacheStats stats() const;
+	void clear();
+	const ParseScope& getScope() const;
+
+	// Drops whitespace that does not separate two tokens and collapses the rest to one space
+	static std::string normalize(std::string_view source);
+	// Process-wide cache of ParseScope::global(), used by the shell and the batch entry points
+	static ExprCache& global();
+
+private:
+	Entry build(std::string normalized) const;
+
+	ParseScope scope;
+	mutable std::mutex mutex;
+	size_t capacity;
+	// Most recently used first
+	std::list<Entry> lru;
+	StringMap<std::list<Entry>::iterator> index;
+	// Generations of the tables of scope the entries were compiled against
+	uint64_t functionGeneration = 0;
+	uint64_t arrayGeneration = 0;
+
+	std::atomic<uint64_t> hits = 0;
+	std::atomic<uint64_t> misses = 0;
+	std::atomic<uint64_t> evictions = 0;
+};
@@ -0,0 +1,216 @@
+#include "FastLexer.h"
+#include "Keyword.h"
+#include "Function.h"
+#include "PerfCounters.h"
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RATIONALIS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Values below Space are the TokenType of a single character token
+enum CharClass : uint8_t {
+	Space = 0x80,
+	Digit,
+	Alpha,
+	Dot,
+	Nul,
+	Invalid = 0xFF
+};
+
+// Matches the "C" locale behaviour of isspace/isdigit/isalpha that Tokenizer relies on
+static constexpr std::array<uint8_t, 256> makeCharTable()
+{
+	std::array<uint8_t, 256> table{};
+	for (auto& cls : table)
+		cls = Invalid;
+
+	for (unsigned char c : { ' ', '\t', '\n', '\v', '\f', '\r' })
+		table[c] = Space;
+	for (unsigned char c = '0'; c <= '9'; ++c)
+		table[c] = Digit;
+	for (unsigned char c = 'a'; c <= 'z'; ++c)
+		table[c] = Alpha;
+	for (unsigned char c = 'A'; c <= 'Z'; ++c)
+		table[c] = Alpha;
+	table['.'] = Dot;
+	table['\0'] = Nul;
+
+	table['+'] = static_cast<uint8_t>(TokenType::Plus);
+	table['-'] = static_cast<uint8_t>(TokenType::Minus);
+	table['*'] = static_cast<uint8_t>(TokenType::Mult);
+	table['/'] = static_cast<uint8_t>(TokenType::Div);
+	table['^'] = static_cast<uint8_t>(TokenType::Pow);
+	table['('] = static_cast<uint8_t>(TokenType::LBracket);
+	table[')'] = static_cast<uint8_t>(TokenType::RBracket);
+	table['='] = static_cast<uint8_t>(TokenType::Equals);
+	table[','] = static_cast<uint8_t>(TokenType::Comma);
+	table['['] = static_cast<uint8_t>(TokenType::LSquare);
+	table[']'] = static_cast<uint8_t>(TokenType::RSquare);
+	return table;
+}
+
+static constexpr std::array<uint8_t, 256> charTable = makeCharTable();
+
+static inline uint8_t classOf(char c)
+{
+	return charTable[static_cast<unsigned char>(c)];
+}
+
+// -----------------------------------------------------
+// Each scan returns the position of the first byte at or after pos that is not
+// of the given class. The vector loops only run over full 16 byte blocks; the
+// remainder is finished with the table.
+#ifdef RATIONALIS_SSE2
+static inline __m128i spaceMask(__m128i block)
+{
+	// ' ' or '\t'..'\r'. Bytes >= 0x80 are negative and fail the signed compares.
+	__m128i isBlank = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+	__m128i inControlRange = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('\t' - 1)),
+		_mm_cmplt_epi8(block, _mm_set1_epi8('\r' + 1)));
+	return _mm_or_si128(isBlank, inControlRange);
+}
+
+static inline __m128i digitMask(__m128i block)
+{
+	return _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1)));
+}
+
+static inline __m128i alphaMask(__m128i block)
+{
+	// Setting bit 5 folds upper case onto lower case
+	__m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+	return _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+}
+
+template<__m128i (*Mask)(__m128i)>
+static inline size_t scanBlocks(const char* data, size_t size, size_t pos)
+{
+	while (pos + 16 <= size)
+	{
+		__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+		unsigned int inClass = static_cast<unsigned int>(_mm_movemask_epi8(Mask(block)));
+		if (inClass != 0xFFFF)
+			return pos + std::countr_one(inClass);
+		pos += 16;
+	}
+	return pos;
+}
+#endif
+
+static inline size_t scanClass(const char* data, size_t size, size_t pos, uint8_t cls)
+{
+	while (pos < size && classOf(data[pos]) == cls)
+		pos++;
+	return pos;
+}
+
+static inline size_t skipSpaces(const char* data, size_t size, size_t pos)
+{
+	// Most gaps are a single space, so check that before going wide
+	if (pos >= size || classOf(data[pos]) != Space)
+		return pos;
+#ifdef RATIONALIS_SSE2
+	pos = scanBlocks<spaceMask>(data, size, pos);
+#endif
+	return scanClass(data, size, pos, Space);
+}
+
+static inline size_t skipDigits(const char* data, size_t size, size_t pos)
+{
+#ifdef RATIONALIS_SSE2
+	pos = scanBlocks<digitMask>(data, size, pos);
+#endif
+	return scanClass(data, size, pos, Digit);
+}
+
+static inline size_t skipLetters(const char* data, size_t size, size_t pos)
+{
+#ifdef RATIONALIS_SSE2
+	pos = scanBlocks<alphaMask>(data, size, pos);
+#endif
+	return scanClass(data, size, pos, Alpha);
+}
+
+// Same grammar as Tokenizer::skipNumber
+static size_t skipNumber(const char* data, size_t size, size_t pos)
+{
+	pos = skipDigits(data, size, pos);
+	if (pos < size && data[pos] == '.')
+		pos = skipDigits(data, size, pos + 1);
+	if (pos < size && (data[pos] == 'e' || data[pos] == 'E'))
+	{
+		size_t digits = pos + 1;
+		if (digits < size && (data[digits] == '+' || data[digits] == '-'))
+			digits++;
+		if (digits < size && classOf(data[digits]) == Digit)
+			pos = skipDigits(data, size, digits);
+	}
+	return pos;
+}
+
+// -----------------------------------------------------
+void tokenizeFast(std::string_view str, std::vector<Token>& out)
+{
+	tokenizeFast(str, out, FunctionTable::global());
+}
+
+void tokenizeFast(std::string_view str, std::vector<Token>& out, const FunctionTable& functions)
+{
+	PerfTimer timer(PerfStage::Tokenize);
+	const char* data = str.data();
+	const size_t size = str.size();
+	const KeywordTable& keywords = KeywordInfo::getTable();
+
+	out.clear();
+	size_t pos = skipSpaces(data, size, 0);
+	while (pos < size)
+	{
+		uint8_t cls = classOf(data[pos]);
+		if (cls < Space)
+		{
+			out.push_back(Token{ static_cast<TokenType>(cls), str.substr(pos, 1) });
+			pos++;
+		}
+		else if (cls == Digit || cls == Dot)
+		{
+			size_t start = pos;
+			pos = skipNumber(data, size, pos);
+			std::string_view text = str.substr(start, pos - start);
+			out.push_back(Token{ TokenType::Number, text, decodeNumber(text) });
+		}
+		else if (cls == Alpha)
+		{
+			size_t start = pos;
+			pos = skipLetters(data, size, pos);
+			std::string_view word = str.substr(start, pos - start);
+			bool isKeyword = keywords.contains(word) || functions.contains(word);
+			out.push_back(Token{ isKeyword ? TokenType::Keyword : TokenType::Identifier, word });
+		}
+		else if (cls == Nul)
+		{
+			out.push_back(Token::END_OF_FILE);
+			pos++;
+		}
+		else
+		{
+			throw std::runtime_error(std::format("Unknown token: '{}'", data[pos]));
+		}
+		pos = skipSpaces(data, size, pos);
+	}
+	PerfCounters::countTokens(out.size());
+}
+
+std::vector<Token> tokenizeFast(std::string_view str)
+{
+	std::vector<Token> toks;
+	tokenizeFast(str, toks);
+	return toks;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Tokenizer.h"
+#include <string_view>
+#include <vector>
+
+// Table driven replacement for tokenize() meant for bulk input. Every byte is
+// classified with one table lookup and runs of whitespace, digits and letters
+// are skipped 16 bytes at a time where SSE2 is available. The token stream is
+// identical to the one tokenize() produces, including its errors.
+std::vector<Token> tokenizeFast(std::string_view str);
+// Same as above, but reuses the storage of out
+void tokenizeFast(std::string_view str, std::vector<Token>& out);
+// Same, for the functions of another table than FunctionTable::global()
+void tokenizeFast(std::string_view str, std::vector<Token>& out, const FunctionTable& functions);
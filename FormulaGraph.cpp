@@ -0,0 +1,326 @@
+#include "FormulaGraph.h"
+#include "Expr.h"
+#include "Parser.h"
+#include "ParseRule.h"
+#include "Optimizer.h"
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+std::string RecomputeStats::toString() const
+{
+	return std::format("changed: {}, dirtied: {}, recomputed: {}, reused: {}", changed.size(), dirtied.size(), recomputed.size(), reused);
+}
+
+// -----------------------------------------------------
+FormulaGraph::NodeId FormulaGraph::intern(std::string_view name)
+{
+	auto it = index.find(name);
+	if (it != index.end()) {
+		return it->second;
+	}
+	NodeId id = static_cast<NodeId>(nodes.size());
+	nodes.emplace_back().name = name;
+	index.emplace(std::string(name), id);
+	return id;
+}
+
+const FormulaGraph::Node& FormulaGraph::at(std::string_view name) const
+{
+	auto it = index.find(name);
+	if (it == index.end()) {
+		ERR(std::format("Unknown name: {}", name));
+	}
+	return nodes[it->second];
+}
+
+// Records that an input has a new value (or none) and dirties everything reading it
+void FormulaGraph::changeInput(NodeId id)
+{
+	if (!nodes[id].changed) {
+		nodes[id].changed = true;
+		changedInputs.push_back(id);
+	}
+	for (NodeId reader : nodes[id].readers) {
+		markDirty(reader);
+	}
+}
+
+// Marks id and everything downstream of it. A node that is already dirty has
+// dirtied its readers before, so the walk stops there.
+void FormulaGraph::markDirty(NodeId id)
+{
+	std::vector<NodeId> stack{ id };
+	while (!stack.empty()) {
+		NodeId current = stack.back();
+		stack.pop_back();
+		if (nodes[current].dirty) {
+			continue;
+		}
+		nodes[current].dirty = true;
+		dirtied.push_back(current);
+		for (NodeId reader : nodes[current].readers) {
+			stack.push_back(reader);
+		}
+	}
+}
+
+// Whether target is reachable from `from` by following what formulas read
+bool FormulaGraph::reaches(NodeId from, NodeId target) const
+{
+	std::vector<uint8_t> visited(nodes.size());
+	std::vector<NodeId> stack{ from };
+	while (!stack.empty()) {
+		NodeId current = stack.back();
+		stack.pop_back();
+		if (current == target) {
+			return true;
+		}
+		if (visited[current]) {
+			continue;
+		}
+		visited[current] = 1;
+		for (NodeId read : nodes[current].reads) {
+			stack.push_back(read);
+		}
+	}
+	return false;
+}
+
+// Removes the edges from a formula to the nodes it reads
+void FormulaGraph::detach(NodeId id)
+{
+	for (NodeId read : nodes[id].reads) {
+		std::vector<NodeId>& readers = nodes[read].readers;
+		readers.erase(std::remove(readers.begin(), readers.end(), id), readers.end());
+	}
+	nodes[id].reads.clear();
+}
+
+void FormulaGraph::define(std::string_view name, std::string_view source)
+{
+	// ledEquals would assign while parsing instead of when the formula is computed
+	if (source.find('=') != std::string_view::npos) {
+		ERR("Formulas cannot contain assignments");
+	}
+	PrattParser parser{ source };
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	expr.reset(simplify(expr.release()));
+	Program program = compile(expr.get());
+
+	NodeId id = intern(name);
+	std::vector<NodeId> reads;
+	reads.reserve(program.identifiers.size());
+	for (const std::string& identifier : program.identifiers) {
+		reads.push_back(intern(identifier));
+	}
+	// Apart from reading itself, only a node something already reads can close a cycle
+	for (NodeId read : reads) {
+		if (read == id) {
+			ERR(std::format("Formula {} would depend on itself", name));
+		}
+		if (!nodes[id].readers.empty() && reaches(read, id)) {
+			ERR(std::format("Formula {} would depend on itself through {}", name, nodes[read].name));
+		}
+	}
+
+	detach(id);
+	Node& node = nodes[id];
+	node.isFormula = true;
+	node.forced = true;
+	node.program = std::move(program);
+	node.reads = std::move(reads);
+	for (NodeId read : node.reads) {
+		nodes[read].readers.push_back(id);
+	}
+	markDirty(id);
+}
+
+bool FormulaGraph::remove(std::string_view name)
+{
+	auto it = index.find(name);
+	if (it == index.end() || !nodes[it->second].isFormula) {
+		return false;
+	}
+	NodeId id = it->second;
+	detach(id);
+	Node& node = nodes[id];
+	node.isFormula = false;
+	node.defined = false;
+	node.error.clear();
+	node.program = Program{};
+	changeInput(id);
+	return true;
+}
+
+void FormulaGraph::set(std::string_view name, double value)
+{
+	NodeId id = intern(name);
+	Node& node = nodes[id];
+	if (node.isFormula) {
+		ERR(std::format("Cannot assign to formula {}", name));
+	}
+	// Compare bit patterns, so setting the same value again dirties nothing
+	if (node.defined && std::memcmp(&node.value, &value, sizeof(double)) == 0) {
+		return;
+	}
+	node.value = value;
+	node.defined = true;
+	changeInput(id);
+}
+
+void FormulaGraph::set(std::span<const Binding> bindings)
+{
+	for (const Binding& binding : bindings) {
+		set(binding.name, binding.value);
+	}
+}
+
+void FormulaGraph::evaluate(Node& node)
+{
+	scratch.resize(node.reads.size());
+	for (size_t i = 0; i < node.reads.size(); ++i) {
+		const Node& read = nodes[node.reads[i]];
+		if (!read.defined) {
+			node.defined = false;
+			node.error = read.isFormula ? read.error : std::format("Identifier not defined: {}", read.name);
+			return;
+		}
+		scratch[i] = read.value;
+	}
+	try {
+		node.value = execute(node.program, scratch);
+		node.defined = true;
+		node.error.clear();
+	}
+	catch (const std::exception& e) {
+		node.defined = false;
+		node.error = e.what();
+	}
+}
+
+RecomputeStats FormulaGraph::recompute()
+{
+	RecomputeStats stats;
+
+	// Depth-first over the dirty formulas, emitting each one after everything it reads
+	std::vector<NodeId> order;
+	std::vector<std::pair<NodeId, size_t>> stack;
+	std::vector<uint8_t> visited(nodes.size());
+	for (NodeId start : dirtied) {
+		if (visited[start]) {
+			continue;
+		}
+		visited[start] = 1;
+		stack.push_back({ start, 0 });
+		while (!stack.empty()) {
+			auto& [current, next] = stack.back();
+			const std::vector<NodeId>& reads = nodes[current].reads;
+			if (next < reads.size()) {
+				NodeId read = reads[next++];
+				if (nodes[read].dirty && !visited[read]) {
+					visited[read] = 1;
+					stack.push_back({ read, 0 });
+				}
+				continue;
+			}
+			order.push_back(current);
+			stack.pop_back();
+		}
+	}
+
+	for (NodeId id : order) {
+		Node& node = nodes[id];
+		node.dirty = false;
+		if (!node.isFormula) {
+			continue;
+		}
+		bool needed = node.forced || std::any_of(node.reads.begin(), node.reads.end(), [this](NodeId read) { return nodes[read].changed; });
+		node.forced = false;
+		if (!needed) {
+			++stats.reused;
+			continue;
+		}
+		const bool wasDefined = node.defined;
+		const double oldValue = node.value;
+		const std::string oldError = node.error;
+		evaluate(node);
+		node.changed = wasDefined != node.defined || node.error != oldError ||
+			(node.defined && std::memcmp(&oldValue, &node.value, sizeof(double)) != 0);
+		stats.recomputed.push_back(node.name);
+	}
+
+	for (NodeId id : changedInputs) {
+		stats.changed.push_back(nodes[id].name);
+		nodes[id].changed = false;
+	}
+	for (NodeId id : dirtied) {
+		stats.dirtied.push_back(nodes[id].name);
+		nodes[id].changed = false;
+	}
+	changedInputs.clear();
+	dirtied.clear();
+	last = stats;
+	return stats;
+}
+
+const RecomputeStats& FormulaGraph::lastRecompute() const
+{
+	return last;
+}
+
+double FormulaGraph::get(std::string_view name)
+{
+	if (!dirtied.empty()) {
+		recompute();
+	}
+	const Node& node = at(name);
+	if (!node.defined) {
+		ERR(node.error.empty() ? std::format("Identifier not defined: {}", name) : node.error);
+	}
+	return node.value;
+}
+
+bool FormulaGraph::contains(std::string_view name) const
+{
+	return index.find(name) != index.end();
+}
+
+bool FormulaGraph::isFormula(std::string_view name) const
+{
+	auto it = index.find(name);
+	return it != index.end() && nodes[it->second].isFormula;
+}
+
+bool FormulaGraph::isDirty(std::string_view name) const
+{
+	return at(name).dirty;
+}
+
+std::vector<std::string> FormulaGraph::dependencies(std::string_view name) const
+{
+	std::vector<std::string> result;
+	for (NodeId read : at(name).reads) {
+		result.push_back(nodes[read].name);
+	}
+	return result;
+}
+
+std::vector<std::string> FormulaGraph::dependents(std::string_view name) const
+{
+	std::vector<std::string> result;
+	for (NodeId reader : at(name).readers) {
+		result.push_back(nodes[reader].name);
+	}
+	return result;
+}
+
+size_t FormulaGraph::size() const
+{
+	return nodes.size();
+}
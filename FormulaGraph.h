@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "Environment.h"
+#include "Keyword.h"
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What one call to FormulaGraph::recompute did
+struct RecomputeStats
+{
+	// Inputs that were given a new value
+	std::vector<std::string> changed;
+	// Formulas downstream of a change or redefinition, in the order they were marked
+	std::vector<std::string> dirtied;
+	// Dirty formulas that were evaluated again, dependencies first
+	std::vector<std::string> recomputed;
+	// Dirty formulas whose inputs all came out unchanged, so their cached value was kept
+	size_t reused = 0;
+
+	std::string toString() const;
+};
+
+// Named formulas over shared inputs, like the cells of a spreadsheet. The graph
+// records which names every formula reads. Changing an input only dirties the
+// formulas downstream of it, and recompute() evaluates just those in
+// topological order. A formula whose inputs all come out bit-identical keeps its
+// cached value, which stops the change from travelling any further.
+// Unlike an assignment, nothing is evaluated while a formula is defined.
+// Not thread-safe; use one graph per thread or lock around it.
+class FormulaGraph
+{
+public:
+	using NodeId = uint32_t;
+
+	// Adds or replaces the formula name = source. Every name source reads that
+	// is not a formula becomes an input. Throws if name would depend on itself.
+	void define(std::string_view name, std::string_view source);
+	// Turns a formula back into an input without a value
+	bool remove(std::string_view name);
+	// Throws if name is a formula
+	void set(std::string_view name, double value);
+	void set(std::span<const Binding> bindings);
+
+	// Value of a formula or input, recomputing dirty formulas first. Throws if
+	// it has no value, for example because an input it reads was never set.
+	double get(std::string_view name);
+	// Brings every formula up to date
+	RecomputeStats recompute();
+	// Stats of the last recompute, including the ones get() triggered
+	const RecomputeStats& lastRecompute() const;
+
+	bool contains(std::string_view name) const;
+	bool isFormula(std::string_view name) const;
+	bool isDirty(std::string_view name) const;
+	// Names a formula reads, and names that read a node
+	std::vector<std::string> dependencies(std::string_view name) const;
+	std::vector<std::string> dependents(std::string_view name) const;
+	size_t size() const;
+
+private:
+	struct Node
+	{
+		std::string name;
+		bool isFormula = false;
+		bool defined = false;
+		// Downstream of a change since the last recompute
+		bool dirty = false;
+		// Redefined, so it has to be evaluated even if its inputs did not change
+		bool forced = false;
+		// Got a different value during the current recompute
+		bool changed = false;
+		double value = 0.0;
+		// Why a formula has no value
+		std::string error;
+		Program program;
+		// Node of every program identifier, in slot order
+		std::vector<NodeId> reads;
+		std::vector<NodeId> readers;
+	};
+
+	NodeId intern(std::string_view name);
+	const Node& at(std::string_view name) const;
+	void changeInput(NodeId id);
+	void markDirty(NodeId id);
+	bool reaches(NodeId from, NodeId target) const;
+	void detach(NodeId id);
+	void evaluate(Node& node);
+
+	std::vector<Node> nodes;
+	StringMap<NodeId> index;
+	std::vector<NodeId> changedInputs;
+	std::vector<NodeId> dirtied;
+	std::vector<double> scratch;
+	RecomputeStats last;
+};
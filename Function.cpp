@@ -0,0 +1,264 @@
+#include "Function.h"
+#include "ArrayStore.h"
+#include "Expr.h"
+#include "Parser.h"
+#include "ParseRule.h"
+#include "Optimizer.h"
+#include "Tokenizer.h"
+#include "VariableStore.h"
+#include <algorithm>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+bool UserFunction::isNative() const
+{
+	return static_cast<bool>(native);
+}
+
+bool UserFunction::shouldInline(std::span<const size_t> argumentSizes) const
+{
+	if (isNative() || body.code.size() > InlineLimit) {
+		return false;
+	}
+	// A parameter used twice evaluates its argument twice once inlined
+	size_t duplicated = 0;
+	for (size_t i = 0; i < argumentSizes.size(); ++i) {
+		if (parameterUses[i] > 1)
+			duplicated += (parameterUses[i] - 1) * argumentSizes[i];
+	}
+	return duplicated <= DuplicateLimit;
+}
+
+double UserFunction::call(const double* args) const
+{
+	if (isNative()) {
+		return native({ args, argCount });
+	}
+	const size_t slotCount = body.identifiers.size();
+	if (slotCount == argCount) {
+		return execute(body, { args, argCount });
+	}
+
+	// Free variables follow the parameters
+	constexpr size_t inlineSize = 16;
+	double inlineSlots[inlineSize];
+	std::vector<double> heapSlots;
+	double* slots = inlineSlots;
+	if (slotCount > inlineSize) {
+		heapSlots.resize(slotCount);
+		slots = heapSlots.data();
+	}
+	bindSlots(args, { slots, slotCount });
+	return execute(body, { slots, slotCount });
+}
+
+void UserFunction::bindSlots(const double* args, std::span<double> slots) const
+{
+	std::copy_n(args, argCount, slots.data());
+	if (slots.size() == argCount) {
+		return;
+	}
+	VariableStore::global().withSnapshot([&](const VariableStore::Snapshot& snapshot) {
+		for (size_t i = argCount; i < slots.size(); ++i) {
+			slots[i] = snapshot.get(body.identifiers[i]);
+		}
+	});
+}
+
+std::string UserFunction::toString() const
+{
+	if (isNative()) {
+		return std::format("{}/{} (native)", name, argCount);
+	}
+	std::string result = name + "(";
+	for (size_t i = 0; i < parameters.size(); ++i) {
+		result += parameters[i];
+		if (i + 1 < parameters.size())
+			result += ", ";
+	}
+	return result + ") = " + bodyText;
+}
+
+// -----------------------------------------------------
+// Names have to lex as a single word, so calls to them can be recognized
+static void checkName(std::string_view name)
+{
+	if (KeywordInfo::getTable().contains(name)) {
+		ERR(std::format("Cannot redefine keyword: {}", name));
+	}
+	std::vector<Token> tokens = tokenize(name);
+	if (tokens.size() != 1 || tokens[0].content != name ||
+		(tokens[0].type != TokenType::Identifier && tokens[0].type != TokenType::Keyword)) {
+		ERR(std::format("Invalid function name: '{}'", name));
+	}
+}
+
+FunctionRef FunctionTable::find(std::string_view name) const
+{
+	if (count.load(std::memory_order_acquire) == 0) {
+		return nullptr;
+	}
+	std::shared_lock lock(mutex);
+	auto it = functions.find(name);
+	return it != functions.end() ? it->second : nullptr;
+}
+
+bool FunctionTable::contains(std::string_view name) const
+{
+	if (count.load(std::memory_order_acquire) == 0) {
+		return false;
+	}
+	std::shared_lock lock(mutex);
+	return functions.find(name) != functions.end();
+}
+
+FunctionRef FunctionTable::defineNative(std::string name, size_t argCount, UserFunction::NativeFunc func)
+{
+	if (!func) {
+		ERR("A native function needs a callback");
+	}
+	checkName(name);
+	auto function = std::make_shared<UserFunction>();
+	function->name = std::move(name);
+	function->argCount = argCount;
+	function->native = std::move(func);
+	return publish(std::move(function));
+}
+
+FunctionRef FunctionTable::define(std::string_view source)
+{
+	std::vector<Token> tokens = tokenize(source, *this);
+	if (tokens.size() < 2 || tokens[1].type != TokenType::LBracket ||
+		(tokens[0].type != TokenType::Identifier && tokens[0].type != TokenType::Keyword)) {
+		ERR("Expected a definition like f(x, y) = x * y");
+	}
+	// Lets the checks below look one token ahead without running off the end
+	tokens.push_back(Token::END_OF_FILE);
+	checkName(tokens[0].content);
+
+	auto function = std::make_shared<UserFunction>();
+	function->name = tokens[0].content;
+	size_t pos = 2;
+	while (tokens[pos].type != TokenType::RBracket) {
+		const Token& parameter = tokens[pos];
+		if (parameter.type != TokenType::Identifier) {
+			ERR(std::format("Expected a parameter name, got {}", parameter.toString()));
+		}
+		if (std::find(function->parameters.begin(), function->parameters.end(), parameter.content) != function->parameters.end()) {
+			ERR(std::format("Parameter {} appears twice", parameter.content));
+		}
+		// The body would read the array instead of the parameter
+		if (ArrayStore::global().contains(parameter.content)) {
+			ERR(std::format("Parameter {} is the name of an array", parameter.content));
+		}
+		function->parameters.emplace_back(parameter.content);
+		++pos;
+		if (tokens[pos].type == TokenType::Comma && tokens[pos + 1].type != TokenType::RBracket) {
+			++pos;
+		}
+		else if (tokens[pos].type != TokenType::RBracket) {
+			ERR("Expected closing bracket");
+		}
+	}
+	if (tokens[pos + 1].type != TokenType::Equals) {
+		ERR("Expected equals sign after the parameters");
+	}
+	pos += 2;
+	// ledEquals would assign while parsing, long before the function is called
+	for (size_t i = pos; i < tokens.size(); ++i) {
+		if (tokens[i].type == TokenType::Equals)
+			ERR("Function bodies cannot contain assignments");
+	}
+	function->argCount = function->parameters.size();
+
+	// The body sees the functions of this table defined so far, so a function never calls itself
+	PrattParser parser(std::move(tokens), pos, ParseScope{ *this, ArrayStore::global() });
+	auto body = std::unique_ptr<Expr>{ parseExpr(parser) };
+	// Written so that it reads back as the same definition
+	function->bodyText = body->toString({ .minimalBrackets = true, .exactNumbers = true });
+	body.reset(simplify(body.release()));
+
+	Compiler compiler;
+	for (const std::string& parameter : function->parameters) {
+		compiler.addIdentifier(parameter);
+	}
+	body->compile(compiler);
+	function->body = std::move(compiler.program);
+
+	function->parameterUses.assign(function->argCount, 0);
+	for (const Instruction& ins : function->body.code) {
+		if (ins.op == OpCode::Load && ins.arg < function->argCount)
+			++function->parameterUses[ins.arg];
+	}
+	return publish(std::move(function));
+}
+
+FunctionRef FunctionTable::publish(std::shared_ptr<UserFunction> function)
+{
+	std::unique_lock lock(mutex);
+	FunctionRef& slot = functions[function->name];
+	slot = std::move(function);
+	count.store(functions.size(), std::memory_order_release);
+	changes.fetch_add(1, std::memory_order_release);
+	return slot;
+}
+
+bool FunctionTable::remove(std::string_view name)
+{
+	std::unique_lock lock(mutex);
+	auto it = functions.find(name);
+	if (it == functions.end()) {
+		return false;
+	}
+	functions.erase(it);
+	count.store(functions.size(), std::memory_order_release);
+	changes.fetch_add(1, std::memory_order_release);
+	return true;
+}
+
+std::vector<FunctionRef> FunctionTable::list() const
+{
+	std::shared_lock lock(mutex);
+	std::vector<FunctionRef> result;
+	result.reserve(functions.size());
+	for (const auto& [name, function] : functions) {
+		result.push_back(function);
+	}
+	std::sort(result.begin(), result.end(), [](const FunctionRef& a, const FunctionRef& b) { return a->name < b->name; });
+	return result;
+}
+
+uint64_t FunctionTable::generation() const
+{
+	return changes.load(std::memory_order_acquire);
+}
+
+bool FunctionTable::isDefinition(std::string_view source)
+{
+	std::vector<Token> tokens;
+	try {
+		tokens = tokenize(source);
+	}
+	catch (const std::exception&) {
+		return false;
+	}
+	if (tokens.size() < 2 || tokens[1].type != TokenType::LBracket ||
+		(tokens[0].type != TokenType::Identifier && tokens[0].type != TokenType::Keyword)) {
+		return false;
+	}
+	// Parameters are plain names, so the first closing bracket ends them
+	for (size_t i = 2; i + 1 < tokens.size(); ++i) {
+		if (tokens[i].type == TokenType::RBracket)
+			return tokens[i + 1].type == TokenType::Equals;
+	}
+	return false;
+}
+
+FunctionTable& FunctionTable::global()
+{
+	static FunctionTable table;
+	return table;
+}
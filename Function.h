@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "Keyword.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A function registered at runtime. Calls to it are lexed and parsed like keyword
+// calls. Native functions wrap a callback, defined ones were written in the
+// expression language as "f(x, y) = x*y + sqrt(x)". Both should be pure: inlined
+// calls may evaluate an argument more than once, or not at all.
+struct UserFunction
+{
+	using NativeFunc = std::function<double(std::span<const double>)>;
+
+	// Bodies up to this many instructions are expanded into their callers
+	static constexpr size_t InlineLimit = 32;
+	// How many nodes of arguments inlining may duplicate per call
+	static constexpr size_t DuplicateLimit = 16;
+	// Calls nested deeper than this in the arguments of inlined calls are not inlined
+	static constexpr size_t InlineDepthLimit = 64;
+
+	std::string name;
+	size_t argCount = 0;
+	// Set for native functions only
+	NativeFunc native;
+	// Defined functions only. The first argCount identifiers of body are the
+	// parameters; the rest are free variables read from VariableStore::global().
+	std::vector<std::string> parameters;
+	std::string bodyText;
+	Program body;
+	// Number of Load instructions of each parameter in body
+	std::vector<uint16_t> parameterUses;
+
+	bool isNative() const;
+	// argumentSizes[i] is the node count of argument i
+	bool shouldInline(std::span<const size_t> argumentSizes) const;
+	// args holds argCount values
+	double call(const double* args) const;
+	// Fills the slots of body: args, then the free variables from one snapshot
+	void bindSlots(const double* args, std::span<double> slots) const;
+	std::string toString() const;
+};
+
+using FunctionRef = std::shared_ptr<const UserFunction>;
+
+// Thread-safe registry of user functions. Replacing or removing a function
+// does not affect expressions parsed before, they keep the version they saw.
+class FunctionTable
+{
+public:
+	FunctionRef find(std::string_view name) const;
+	bool contains(std::string_view name) const;
+
+	// Throws if name is taken by a keyword
+	FunctionRef defineNative(std::string name, size_t argCount, UserFunction::NativeFunc func);
+	// Parses and registers a definition like "f(x, y) = x*y + sqrt(x)". The body
+	// calls functions of this table; names of arrays are looked up in
+	// ArrayStore::global().
+	FunctionRef define(std::string_view source);
+	bool remove(std::string_view name);
+	std::vector<FunctionRef> list() const;
+	// Changes on every define or remove, so caches of compiled code can tell when to drop it
+	uint64_t generation() const;
+
+	// Whether source has the shape of a definition rather than an expression
+	static bool isDefinition(std::string_view source);
+	static FunctionTable& global();
+
+private:
+	FunctionRef publish(std::shared_ptr<UserFunction> function);
+
+	mutable std::shared_mutex mutex;
+	StringMap<FunctionRef> functions;
+	// Lets the lexers skip the lock while no function is registered
+	std::atomic<size_t> count = 0;
+	std::atomic<uint64_t> changes = 0;
+};
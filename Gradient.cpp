@@ -0,0 +1,329 @@
+#include "Gradient.h"
+#include "Function.h"
+#include "Keyword.h"
+#include "VariableStore.h"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <limits>
+#include <stdexcept>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+std::string Gradient::toString() const
+{
+	std::string result = std::format("value: {}, partials: [", value);
+	for (size_t i = 0; i < partials.size(); ++i) {
+		result += std::format("{}{}", i ? ", " : "", partials[i]);
+	}
+	return result + "]";
+}
+
+// -----------------------------------------------------
+static_assert(static_cast<size_t>(KeywordType::Total) == 16, "Add the derivative of the new keyword to keywordPartial");
+
+// d keyword(args) / d args[j], given the result the keyword returned
+static double keywordPartial(KeywordType id, const double* args, size_t count, double result, size_t j)
+{
+	const double x = args[j];
+	switch (id)
+	{
+	case KeywordType::Sin:
+		return std::cos(x);
+	case KeywordType::Cos:
+		return -std::sin(x);
+	case KeywordType::Tan:
+		return 1.0 + result * result;
+	case KeywordType::Asin:
+		return 1.0 / std::sqrt(1.0 - x * x);
+	case KeywordType::Acos:
+		return -1.0 / std::sqrt(1.0 - x * x);
+	case KeywordType::Atan:
+		return 1.0 / (1.0 + x * x);
+	case KeywordType::Sqrt:
+		return 0.5 / result;
+	case KeywordType::Log:
+		return 1.0 / x;
+	case KeywordType::Mean:
+		return 1.0 / static_cast<double>(count);
+	case KeywordType::Sum:
+		return 1.0;
+	case KeywordType::Min:
+	case KeywordType::Max:
+		// Only the first argument equal to the result moves it
+		return x == result && std::find(args, args + j, result) == args + j ? 1.0 : 0.0;
+	case KeywordType::Dot:
+		return args[1 - j];
+	case KeywordType::Var: {
+		const double mean = reduceKeyword<KeywordType::Mean>({ args, count });
+		return 2.0 * (x - mean) / static_cast<double>(count);
+	}
+	default:
+		ERR(std::format("No derivative for keyword {}", KeywordSignatures[static_cast<size_t>(id)].name));
+	}
+}
+
+static size_t operandCount(const Instruction& ins)
+{
+	switch (ins.op)
+	{
+	case OpCode::Const:
+	case OpCode::Load:
+		return 0;
+	case OpCode::Neg:
+		return 1;
+	case OpCode::Call:
+	case OpCode::CallFunction:
+		return ins.count;
+	default:
+		return 2;
+	}
+}
+
+static double sweep(const Program& program, std::span<const double> slots, std::span<double> partials, DiffMode mode);
+
+// Result of one instruction applied to its operands, computed exactly like the
+// interpreter does, and its partial derivative with respect to every active operand
+static double differentiate(const Program& program, const Instruction& ins, const double* args, const uint8_t* active, double* local)
+{
+	switch (ins.op)
+	{
+	case OpCode::Neg:
+		local[0] = -1.0;
+		return -args[0];
+	case OpCode::Add:
+		local[0] = 1.0;
+		local[1] = 1.0;
+		return args[0] + args[1];
+	case OpCode::Sub:
+		local[0] = 1.0;
+		local[1] = -1.0;
+		return args[0] - args[1];
+	case OpCode::Mul:
+		local[0] = args[1];
+		local[1] = args[0];
+		return args[0] * args[1];
+	case OpCode::Div: {
+		double z = args[0] / args[1];
+		local[0] = 1.0 / args[1];
+		local[1] = -z / args[1];
+		return z;
+	}
+	case OpCode::Pow: {
+		const double a = args[0];
+		const double b = args[1];
+		double z = power(a, b);
+		local[0] = b == 0.0 ? 0.0 : b * std::pow(a, b - 1.0);
+		if (active[1]) {
+			// a^b = exp(b * log(a)) only has a slope in b for positive a
+			local[1] = a > 0.0 ? z * std::log(a) : (a == 0.0 && b > 0.0 ? 0.0 : std::numeric_limits<double>::quiet_NaN());
+		}
+		return z;
+	}
+	case OpCode::Call: {
+		const KeywordInfo& info = KeywordInfo::getTable().getByID(static_cast<KeywordType>(ins.arg));
+		double z = info.call(args, ins.count);
+		for (size_t j = 0; j < ins.count; ++j) {
+			if (active[j])
+				local[j] = keywordPartial(info.id, args, ins.count, z, j);
+		}
+		return z;
+	}
+	case OpCode::CallFunction: {
+		const UserFunction& function = *program.functions[ins.arg];
+		if (function.isNative()) {
+			ERR(std::format("Cannot differentiate native function {}", function.name));
+		}
+		// The body is differentiated on its own; its parameter partials are ours
+		std::vector<double> bodySlots(function.body.identifiers.size());
+		function.bindSlots(args, bodySlots);
+		std::vector<double> bodyPartials(bodySlots.size());
+		double z = sweep(function.body, bodySlots, bodyPartials, DiffMode::Auto);
+		std::copy_n(bodyPartials.begin(), ins.count, local);
+		return z;
+	}
+	default:
+		ERR("Unknown opcode");
+	}
+}
+
+static size_t maxOperands(const Program& program)
+{
+	size_t result = 2;
+	for (const Instruction& ins : program.code) {
+		result = std::max(result, operandCount(ins));
+	}
+	return result;
+}
+
+// Every stack entry carries its partials with respect to all n identifiers
+static double forward(const Program& program, std::span<const double> slots, std::span<double> partials)
+{
+	const size_t n = program.identifiers.size();
+	std::vector<double> values(program.maxStack);
+	std::vector<uint8_t> active(program.maxStack);
+	std::vector<double> tangents(program.maxStack * n);
+	std::vector<double> local(maxOperands(program));
+	std::vector<double> row(n);
+
+	size_t sp = 0;
+	for (const Instruction& ins : program.code) {
+		if (ins.op == OpCode::Const) {
+			values[sp] = program.constants[ins.arg];
+			active[sp] = 0;
+			++sp;
+			continue;
+		}
+		if (ins.op == OpCode::Load) {
+			values[sp] = slots[ins.arg];
+			active[sp] = 1;
+			std::fill_n(&tangents[sp * n], n, 0.0);
+			tangents[sp * n + ins.arg] = 1.0;
+			++sp;
+			continue;
+		}
+
+		const size_t count = operandCount(ins);
+		const size_t base = sp - count;
+		double z = differentiate(program, ins, &values[base], &active[base], local.data());
+		bool anyActive = false;
+		std::fill(row.begin(), row.end(), 0.0);
+		for (size_t j = 0; j < count; ++j) {
+			if (!active[base + j])
+				continue;
+			anyActive = true;
+			const double* tangent = &tangents[(base + j) * n];
+			if (std::isfinite(local[j])) {
+				for (size_t k = 0; k < n; ++k)
+					row[k] += local[j] * tangent[k];
+			}
+			else {
+				// A NaN or infinite slope only reaches the identifiers the operand depends on
+				for (size_t k = 0; k < n; ++k) {
+					if (tangent[k] != 0.0)
+						row[k] += local[j] * tangent[k];
+				}
+			}
+		}
+		values[base] = z;
+		active[base] = anyActive;
+		if (anyActive)
+			std::copy(row.begin(), row.end(), &tangents[base * n]);
+		sp = base + 1;
+	}
+
+	for (size_t k = 0; k < n; ++k) {
+		partials[k] = active[0] ? tangents[k] : 0.0;
+	}
+	return values[0];
+}
+
+// Records every instruction's value and the local partials along each edge to
+// its operands, then sweeps once from the result back to the identifiers
+static double reverse(const Program& program, std::span<const double> slots, std::span<double> partials)
+{
+	const size_t m = program.code.size();
+	std::vector<double> values(m);
+	std::vector<uint8_t> active(m);
+	std::vector<uint32_t> edgeStart(m + 1);
+	std::vector<uint32_t> producers;
+	std::vector<double> weights;
+	producers.reserve(m * 2);
+	weights.reserve(m * 2);
+
+	// Instruction that produced each stack entry
+	std::vector<uint32_t> stack(program.maxStack);
+	const size_t width = maxOperands(program);
+	std::vector<double> args(width);
+	std::vector<uint8_t> argActive(width);
+	std::vector<double> local(width);
+
+	size_t sp = 0;
+	for (uint32_t i = 0; i < m; ++i) {
+		const Instruction& ins = program.code[i];
+		edgeStart[i] = static_cast<uint32_t>(producers.size());
+		if (ins.op == OpCode::Const || ins.op == OpCode::Load) {
+			values[i] = ins.op == OpCode::Const ? program.constants[ins.arg] : slots[ins.arg];
+			active[i] = ins.op == OpCode::Load;
+			stack[sp++] = i;
+			continue;
+		}
+
+		const size_t count = operandCount(ins);
+		const size_t base = sp - count;
+		for (size_t j = 0; j < count; ++j) {
+			args[j] = values[stack[base + j]];
+			argActive[j] = active[stack[base + j]];
+		}
+		values[i] = differentiate(program, ins, args.data(), argActive.data(), local.data());
+		for (size_t j = 0; j < count; ++j) {
+			if (!argActive[j])
+				continue;
+			active[i] = 1;
+			producers.push_back(stack[base + j]);
+			weights.push_back(local[j]);
+		}
+		stack[base] = i;
+		sp = base + 1;
+	}
+	edgeStart[m] = static_cast<uint32_t>(producers.size());
+
+	std::fill(partials.begin(), partials.begin() + program.identifiers.size(), 0.0);
+	std::vector<double> adjoint(m);
+	adjoint[m - 1] = 1.0;
+	for (size_t i = m; i-- > 0;) {
+		if (!active[i])
+			continue;
+		const double adj = adjoint[i];
+		if (program.code[i].op == OpCode::Load) {
+			partials[program.code[i].arg] += adj;
+			continue;
+		}
+		for (uint32_t e = edgeStart[i]; e < edgeStart[i + 1]; ++e) {
+			adjoint[producers[e]] += adj * weights[e];
+		}
+	}
+	return values[m - 1];
+}
+
+static double sweep(const Program& program, std::span<const double> slots, std::span<double> partials, DiffMode mode)
+{
+	if (mode == DiffMode::Auto) {
+		mode = program.identifiers.size() <= ForwardModeLimit ? DiffMode::Forward : DiffMode::Reverse;
+	}
+	return mode == DiffMode::Forward ? forward(program, slots, partials) : reverse(program, slots, partials);
+}
+
+// -----------------------------------------------------
+double gradient(const Program& program, std::span<const double> slots, std::span<double> partials, DiffMode mode)
+{
+	if (program.code.empty()) {
+		ERR("Cannot differentiate an empty program");
+	}
+	if (slots.size() < program.identifiers.size()) {
+		ERR(std::format("Expected {} slots, got {}", program.identifiers.size(), slots.size()));
+	}
+	if (partials.size() < program.identifiers.size()) {
+		ERR(std::format("Expected room for {} partials, got {}", program.identifiers.size(), partials.size()));
+	}
+	return sweep(program, slots, partials, mode);
+}
+
+Gradient gradient(const Program& program, std::span<const double> slots, DiffMode mode)
+{
+	Gradient result;
+	result.partials.resize(program.identifiers.size());
+	result.value = gradient(program, slots, result.partials, mode);
+	return result;
+}
+
+Gradient gradient(const Program& program, DiffMode mode)
+{
+	std::vector<double> values(program.identifiers.size());
+	VariableStore::global().withSnapshot([&](const VariableStore::Snapshot& snapshot) {
+		for (size_t i = 0; i < values.size(); ++i) {
+			values[i] = snapshot.get(program.identifiers[i]);
+		}
+	});
+	return gradient(program, values, mode);
+}
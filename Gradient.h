@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Bytecode.h"
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+enum class DiffMode {
+	Auto,		// Forward for up to ForwardModeLimit identifiers, reverse otherwise
+	Forward,	// Carries every partial along with each value, one pass
+	Reverse		// Records one pass, then propagates adjoints back over it
+};
+
+// Forward mode costs a multiple of the identifier count per instruction,
+// reverse mode a constant factor, so reverse wins past a handful of inputs
+constexpr size_t ForwardModeLimit = 4;
+
+// Value of a program and its partial derivative with respect to each identifier
+struct Gradient
+{
+	double value = 0.0;
+	// partials[i] belongs to program.identifiers[i]
+	std::vector<double> partials;
+
+	std::string toString() const;
+};
+
+// Differentiates program at slots, where slots[i] holds the value of
+// program.identifiers[i], and writes the partials to partials, which needs one
+// entry per identifier. Returns the value, bit-identical to execute().
+//
+// Every operator and keyword is covered. Calls to defined user functions are
+// differentiated through their body; their free variables count as constants.
+// Native functions have no derivative and throw. Where a derivative does not
+// exist, like d(a^b)/db for a < 0, the partial is NaN; inputs a result does not
+// depend on, like the exponent constant in x^2, are never differentiated.
+double gradient(const Program& program, std::span<const double> slots, std::span<double> partials, DiffMode mode = DiffMode::Auto);
+Gradient gradient(const Program& program, std::span<const double> slots, DiffMode mode = DiffMode::Auto);
+// Reads identifiers from one snapshot of VariableStore::global()
+Gradient gradient(const Program& program, DiffMode mode = DiffMode::Auto);
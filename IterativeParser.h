@@ -0,0 +1,411 @@
+#pragma once
+
+#include "Parser.h"
+#include "ParseRule.h"
+#include "Keyword.h"
+#include "Function.h"
+#include <cstdint>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// The Pratt loop of parseExpr with its recursion replaced by explicit stacks,
+// so nesting depth is limited by memory rather than by the native stack. Every
+// parseExpr call the recursive parser would make is a Frame here, and every
+// nud or led waiting for an inner expression is a Continuation. Binding powers
+// and nud/led presence come from ParseRule::Table(), and the nodes are built in
+// the same order with the same errors as the nud/led functions of ParseRule.cpp.
+// Each token is looked at a constant number of times, so parsing is linear.
+//
+// Builder creates the nodes:
+//   using Node; using Assignment;
+//   Node number(const Token&), identifier(const Token&), array(std::vector<double>)
+//   Node unary(TokenType, Node), binary(TokenType, Node, Node)
+//   Node keyword(const KeywordInfo&, std::span<Node>), function(FunctionRef, std::span<Node>)
+//   bool isIdentifier(Node)
+//   Assignment beginAssignment(); Node assign(Node identifier, Node value, Assignment)
+//     returns the node that stands for the assigned name from then on
+//   void discard(Node) for nodes left over when parsing fails
+template<typename Builder>
+class IterativeParser
+{
+public:
+	using Node = typename Builder::Node;
+
+	IterativeParser(PrattParser& parser, Builder& builder)
+		: parser(parser), builder(builder), rules(ParseRule::Table())
+	{
+		// Reuses the stacks of the last parse on this thread, a nested parse starts empty
+		std::swap(stacks, spare());
+	}
+
+	~IterativeParser()
+	{
+		stacks.frames.clear();
+		stacks.continuations.clear();
+		stacks.arguments.clear();
+		std::swap(stacks, spare());
+	}
+
+	IterativeParser(const IterativeParser&) = delete;
+	IterativeParser& operator=(const IterativeParser&) = delete;
+
+	Node parse(TokenType end, int minBindingPower)
+	{
+		try {
+			beginExpression(end, minBindingPower);
+			Step step = Step::Operand;
+			while (true) {
+				switch (step)
+				{
+				case Step::Operand:
+					step = parseOperand();
+					break;
+				case Step::Operators:
+					step = parseOperators();
+					break;
+				case Step::Value:
+					if (stacks.continuations.empty())
+						return std::exchange(value, Node{});
+					step = resume();
+					break;
+				}
+			}
+		}
+		catch (...) {
+			discardAll();
+			throw;
+		}
+	}
+
+private:
+	enum class Step : uint8_t {
+		Operand,	// Parse the nud at the current token
+		Operators,	// Run the led loop of the innermost frame
+		Value		// Hand value to the innermost continuation
+	};
+
+	// What a finished operand or expression is for
+	enum class Then : uint8_t {
+		Left,		// The left side of the innermost frame, before its led loop
+		Unary,		// The operand of the prefix op
+		Binary,		// The right side of op, with left on the other side
+		Assign,		// The value assigned to the identifier left
+		Group,		// The inside of brackets
+		Argument	// The next argument of a keyword or function call
+	};
+
+	struct Continuation
+	{
+		Then then;
+		TokenType op = TokenType::EndOfFile;
+		Node left{};
+		typename Builder::Assignment assignment{};
+		// Calls
+		const KeywordInfo* keyword = nullptr;
+		FunctionRef function;
+		int argCount = 0;
+		size_t argBase = 0;
+	};
+
+	// One parseExpr call of the recursive parser
+	struct Frame
+	{
+		TokenType end;
+		int minBindingPower;
+		Node left{};
+	};
+
+	struct Stacks
+	{
+		std::vector<Frame> frames;
+		std::vector<Continuation> continuations;
+		// Arguments of the calls that are still open
+		std::vector<Node> arguments;
+	};
+
+	static Stacks& spare()
+	{
+		thread_local Stacks stacks;
+		return stacks;
+	}
+
+	const ParseRule& rule(TokenType type) const
+	{
+		return rules[static_cast<size_t>(type)];
+	}
+
+	// The checks at the top of parseExpr
+	void beginExpression(TokenType end, int minBindingPower)
+	{
+		const Token& tok = parser.peek();
+		if (tok.type == TokenType::EndOfFile || tok.type == end)
+		{
+			throw std::runtime_error("Unexpected end of file");
+		}
+		if (!rule(tok.type).nud)
+		{
+			throw std::runtime_error(std::format("Token {} should not be at the beginning of an expression!", tok.toString()));
+		}
+		stacks.frames.push_back(Frame{ end, minBindingPower });
+		stacks.continuations.push_back(Continuation{ Then::Left });
+	}
+
+	Step parseOperand()
+	{
+		const Token tok = parser.peek();
+		switch (tok.type)
+		{
+		case TokenType::Number:
+			parser.consume();
+			value = builder.number(tok);
+			return Step::Value;
+		case TokenType::Identifier:
+			parser.consume();
+			value = builder.identifier(tok);
+			return Step::Value;
+		case TokenType::Plus:
+		case TokenType::Minus: {
+			parser.consume(); // Consume the unary operator token
+			// The operand is a single nud, so -2^2 is (-2)^2
+			const Token& nextTok = parser.peek();
+			if (!rule(nextTok.type).nud) {
+				throw std::runtime_error("No nud function for token: " + nextTok.toString());
+			}
+			stacks.continuations.push_back(Continuation{ Then::Unary, tok.type });
+			return Step::Operand;
+		}
+		case TokenType::LBracket:
+			parser.consume(); // Consume the opening bracket
+			stacks.continuations.push_back(Continuation{ Then::Group });
+			beginExpression(TokenType::RBracket, 0);
+			return Step::Operand;
+		case TokenType::Keyword:
+			return beginCall(tok);
+		case TokenType::LSquare:
+			value = builder.array(parseArrayLiteral(parser));
+			return Step::Value;
+		default:
+			throw std::runtime_error(std::format("Token {} should not be at the beginning of an expression!", tok.toString()));
+		}
+	}
+
+	Step beginCall(const Token& identifier)
+	{
+		parser.consume(); // Consume the identifier token
+
+		// Everything the lexer marks as a keyword that is not one is a user function
+		const KeywordTable& keywords = KeywordInfo::getTable();
+		Continuation call{ Then::Argument };
+		if (keywords.contains(identifier.content)) {
+			call.keyword = &keywords.getByName(identifier.content);
+			call.argCount = call.keyword->argCount;
+		}
+		else {
+			call.function = parser.getScope().functions.find(identifier.content);
+			if (!call.function) {
+				throw std::runtime_error(std::format("Unknown function: {}", identifier.content));
+			}
+			call.argCount = static_cast<int>(call.function->argCount);
+		}
+		call.argBase = stacks.arguments.size();
+		if (call.argCount == 0) {
+			value = buildCall(call);
+			return Step::Value;
+		}
+
+		if (parser.peek().type != TokenType::LBracket)
+		{
+			throw std::runtime_error("Expected opening bracket");
+		}
+		parser.consume(); // Consume the opening bracket
+		if (call.argCount < 0 && parser.peek().type == TokenType::RBracket) {
+			return closeCall(call);
+		}
+		stacks.continuations.push_back(std::move(call));
+		beginArgument(stacks.continuations.back());
+		return Step::Operand;
+	}
+
+	// A binding power of 1 stops at both commas and the closing bracket, so too
+	// few arguments are an error instead of a hang
+	void beginArgument(const Continuation& call)
+	{
+		const size_t parsed = stacks.arguments.size() - call.argBase;
+		if (call.argCount < 0 || parsed + 1 < static_cast<size_t>(call.argCount))
+			beginExpression(TokenType::Comma, 1);
+		else
+			beginExpression(TokenType::RBracket, 0);
+	}
+
+	// Called with the argument just parsed already on the argument stack
+	Step continueCall()
+	{
+		Continuation& call = stacks.continuations.back();
+		const size_t parsed = stacks.arguments.size() - call.argBase;
+		if (call.argCount < 0) {
+			if (parser.peek().type == TokenType::Comma) {
+				parser.consume(); // Consume the comma
+				if (parser.peek().type != TokenType::RBracket) {
+					beginArgument(call);
+					return Step::Operand;
+				}
+			}
+		}
+		else if (parsed < static_cast<size_t>(call.argCount)) {
+			if (parser.peek().type == TokenType::Comma) {
+				parser.consume(); // Consume the comma
+			}
+			beginArgument(call);
+			return Step::Operand;
+		}
+		Continuation done = std::move(call);
+		stacks.continuations.pop_back();
+		return closeCall(done);
+	}
+
+	Step closeCall(Continuation& call)
+	{
+		if (parser.peek().type != TokenType::RBracket)
+		{
+			throw std::runtime_error("Expected closing bracket");
+		}
+		parser.consume(); // Consume the closing bracket
+		value = buildCall(call);
+		return Step::Value;
+	}
+
+	Node buildCall(Continuation& call)
+	{
+		std::span<Node> arguments(stacks.arguments.data() + call.argBase, stacks.arguments.size() - call.argBase);
+		Node node;
+		if (call.function) {
+			node = builder.function(std::move(call.function), arguments);
+		}
+		else {
+			// The only arity check; evaluation trusts the argument count from here on
+			call.keyword->checkArity(arguments.size());
+			node = builder.keyword(*call.keyword, arguments);
+		}
+		stacks.arguments.resize(call.argBase);
+		return node;
+	}
+
+	// The led loop of parseExpr for the innermost frame
+	Step parseOperators()
+	{
+		Frame& frame = stacks.frames.back();
+		while (true) {
+			const Token& nextTok = parser.peek();
+			const TokenType type = nextTok.type;
+			if (type == frame.end || type == TokenType::EndOfFile)
+				break;
+			const ParseRule& nextRule = rule(type);
+			if (nextRule.lbp < frame.minBindingPower)
+				break;
+			if (!nextRule.led)
+			{
+				throw std::runtime_error(std::format("Token {} should not be in the middle of an expression", nextTok.toString()));
+			}
+
+			switch (type)
+			{
+			case TokenType::Plus:
+			case TokenType::Minus:
+			case TokenType::Mult:
+			case TokenType::Div:
+			case TokenType::Pow: {
+				parser.consume(); // Consume the operator
+				stacks.continuations.push_back(Continuation{ Then::Binary, type, std::exchange(frame.left, Node{}) });
+				beginExpression(TokenType::EndOfFile, nextRule.rbp);
+				return Step::Operand;
+			}
+			case TokenType::Equals: {
+				if (!builder.isIdentifier(frame.left))
+				{
+					throw std::runtime_error("Left side of assignment must be an identifier");
+				}
+				TokenType end = parser[parser.getPosition() - 2].type == TokenType::LBracket ? TokenType::RBracket : TokenType::EndOfFile;
+				parser.consume(); // Consume the equals sign
+				Continuation assign{ Then::Assign, type, std::exchange(frame.left, Node{}) };
+				assign.assignment = builder.beginAssignment();
+				stacks.continuations.push_back(std::move(assign));
+				beginExpression(end, nextRule.rbp);
+				return Step::Operand;
+			}
+			default:
+				// ledNone returns without consuming, so the recursive loop never ended here
+				throw std::runtime_error("Unexpected closing bracket");
+			}
+		}
+		value = frame.left;
+		stacks.frames.pop_back();
+		return Step::Value;
+	}
+
+	Step resume()
+	{
+		Continuation& next = stacks.continuations.back();
+		switch (next.then)
+		{
+		case Then::Left:
+			stacks.continuations.pop_back();
+			stacks.frames.back().left = std::exchange(value, Node{});
+			return Step::Operators;
+		case Then::Unary: {
+			TokenType op = next.op;
+			stacks.continuations.pop_back();
+			value = builder.unary(op, value);
+			return Step::Value;
+		}
+		case Then::Binary: {
+			TokenType op = next.op;
+			Node left = next.left;
+			stacks.continuations.pop_back();
+			stacks.frames.back().left = builder.binary(op, left, std::exchange(value, Node{}));
+			return Step::Operators;
+		}
+		case Then::Assign: {
+			Node identifier = next.left;
+			auto assignment = next.assignment;
+			stacks.continuations.pop_back();
+			// Back in the frame first, so it is discarded if the assignment throws
+			stacks.frames.back().left = identifier;
+			stacks.frames.back().left = builder.assign(identifier, std::exchange(value, Node{}), assignment);
+			return Step::Operators;
+		}
+		case Then::Group:
+			stacks.continuations.pop_back();
+			if (parser.peek().type != TokenType::RBracket)
+			{
+				throw std::runtime_error("Expected closing bracket");
+			}
+			parser.consume(); // Consume the closing bracket
+			return Step::Value;
+		case Then::Argument:
+			stacks.arguments.push_back(std::exchange(value, Node{}));
+			return continueCall();
+		}
+		return Step::Value;
+	}
+
+	void discardAll()
+	{
+		builder.discard(std::exchange(value, Node{}));
+		for (Frame& frame : stacks.frames)
+			builder.discard(std::exchange(frame.left, Node{}));
+		for (Continuation& next : stacks.continuations)
+			builder.discard(std::exchange(next.left, Node{}));
+		for (Node& argument : stacks.arguments)
+			builder.discard(std::exchange(argument, Node{}));
+	}
+
+	PrattParser& parser;
+	Builder& builder;
+	const ParseTable& rules;
+	Stacks stacks;
+	// The operand or expression that was just finished
+	Node value{};
+};
@@ -0,0 +1,559 @@
+#include "Jit.h"
+#include "Function.h"
+#include "Keyword.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define RATIONALIS_JIT 1
+#endif
+
+#ifdef RATIONALIS_JIT
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// The first exception thrown below generated code on this thread, rethrown by
+// JitFunction::operator() once that code has returned
+static thread_local std::exception_ptr pendingError;
+
+#ifdef RATIONALIS_JIT
+// Called from generated code with the platform's C calling convention
+static double callPow(double base, double exponent)
+{
+	return power(base, exponent);
+}
+
+// Generated code has no unwind info, so exceptions must not leave these. A
+// failed call gives NaN and the rest of the code runs on to the ret.
+static double callKeyword(const KeywordInfo* info, const double* args, uint32_t count)
+{
+	try {
+		return info->call(args, count);
+	}
+	catch (...) {
+		if (!pendingError)
+			pendingError = std::current_exception();
+		return std::nan("");
+	}
+}
+
+static double callFunction(const UserFunction* function, const double* args, uint32_t)
+{
+	try {
+		return function->call(args);
+	}
+	catch (...) {
+		if (!pendingError)
+			pendingError = std::current_exception();
+		return std::nan("");
+	}
+}
+
+// -----------------------------------------------------
+// Just enough of an x86-64 encoder for scalar double code
+namespace
+{
+	constexpr int Rbx = 3;
+	constexpr int Rsp = 4;
+
+	enum : uint8_t {
+		NoPrefix = 0,
+		Scalar = 0xF2, // sd forms
+		Packed = 0x66, // pd forms
+
+		MovLoad = 0x10,
+		MovStore = 0x11,
+		SqrtOp = 0x51,
+		XorOp = 0x57,
+		AddOp = 0x58,
+		MulOp = 0x59,
+		SubOp = 0x5C,
+		DivOp = 0x5E
+	};
+
+	struct Assembler
+	{
+		std::vector<uint8_t> code;
+		// Code offset of a rip-relative displacement and the pool offset it refers to
+		std::vector<std::pair<size_t, uint32_t>> fixups;
+
+		void byte(uint8_t value)
+		{
+			code.push_back(value);
+		}
+
+		void bytes(std::initializer_list<uint8_t> values)
+		{
+			code.insert(code.end(), values);
+		}
+
+		void u32(uint32_t value)
+		{
+			for (int i = 0; i < 4; ++i)
+				byte(static_cast<uint8_t>(value >> (8 * i)));
+		}
+
+		void u64(uint64_t value)
+		{
+			for (int i = 0; i < 8; ++i)
+				byte(static_cast<uint8_t>(value >> (8 * i)));
+		}
+
+		void sseHeader(uint8_t prefix, uint8_t op, int reg, int rm)
+		{
+			if (prefix != NoPrefix)
+				byte(prefix);
+			uint8_t rex = 0x40 | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+			if (rex != 0x40)
+				byte(rex);
+			bytes({ 0x0F, op });
+		}
+
+		// op xmm(dst), xmm(src)
+		void sseReg(uint8_t prefix, uint8_t op, int dst, int src)
+		{
+			sseHeader(prefix, op, dst, src);
+			byte(static_cast<uint8_t>(0xC0 | (dst & 7) << 3 | (src & 7)));
+		}
+
+		// op xmm(reg), [base + disp], or the store form for MovStore
+		void sseMem(uint8_t prefix, uint8_t op, int reg, int base, int32_t disp)
+		{
+			sseHeader(prefix, op, reg, base);
+			byte(static_cast<uint8_t>(0x80 | (reg & 7) << 3 | (base & 7)));
+			if ((base & 7) == Rsp)
+				byte(0x24); // SIB for a plain rsp base
+			u32(static_cast<uint32_t>(disp));
+		}
+
+		// op xmm(reg), [rip + constant pool + poolOffset]
+		void ssePool(uint8_t prefix, uint8_t op, int reg, uint32_t poolOffset)
+		{
+			sseHeader(prefix, op, reg, 0);
+			byte(static_cast<uint8_t>(0x05 | (reg & 7) << 3));
+			fixups.emplace_back(code.size(), poolOffset);
+			u32(0);
+		}
+
+		void callAbsolute(const void* target)
+		{
+			bytes({ 0x48, 0xB8 }); // mov rax, imm64
+			u64(reinterpret_cast<uint64_t>(target));
+			bytes({ 0xFF, 0xD0 }); // call rax
+		}
+	};
+
+#ifdef _WIN64
+	constexpr bool win64 = true;
+#else
+	constexpr bool win64 = false;
+#endif
+
+	// Stack positions 0 to 7 live in xmm8 to xmm15, deeper ones only in their
+	// home slot in the frame. xmm0 and xmm1 are scratch and call registers.
+	constexpr size_t registerCount = 8;
+	// Win64 callers own 32 bytes above the return address of every call
+	constexpr int32_t shadowSpace = 32;
+	constexpr int32_t maxFrame = 4096;
+
+	struct CodeGen
+	{
+		const Program& program;
+		Assembler as;
+		// Two sign masks for xorpd, then the program constants, then folded keywords
+		std::vector<double> pool;
+		size_t sp = 0;
+
+		explicit CodeGen(const Program& program)
+			: program(program), pool{ -0.0, -0.0 } {
+			pool.insert(pool.end(), program.constants.begin(), program.constants.end());
+		}
+
+		static bool inRegister(size_t pos) { return pos < registerCount; }
+		static int reg(size_t pos) { return static_cast<int>(8 + pos); }
+		static int32_t home(size_t pos) { return static_cast<int32_t>(shadowSpace + 8 * pos); }
+
+		uint32_t poolOffset(size_t index) const { return static_cast<uint32_t>(8 * index); }
+
+		// Register holding the value at pos, loading it into scratch if it lives in memory
+		int fetch(size_t pos, int scratch)
+		{
+			if (inRegister(pos))
+				return reg(pos);
+			as.sseMem(Scalar, MovLoad, scratch, Rsp, home(pos));
+			return scratch;
+		}
+
+		// Register to compute the value at pos in
+		int target(size_t pos) const
+		{
+			return inRegister(pos) ? reg(pos) : 0;
+		}
+
+		void storeBack(size_t pos, int from)
+		{
+			if (!inRegister(pos))
+				as.sseMem(Scalar, MovStore, from, Rsp, home(pos));
+		}
+
+		void moveTo(int dst, size_t pos)
+		{
+			if (inRegister(pos))
+				as.sseReg(Scalar, MovLoad, dst, reg(pos));
+			else
+				as.sseMem(Scalar, MovLoad, dst, Rsp, home(pos));
+		}
+
+		// Every xmm register is clobbered by calls on System V, so the live ones go to their homes
+		void spill(size_t count)
+		{
+			for (size_t pos = 0; pos < std::min(count, registerCount); ++pos)
+				as.sseMem(Scalar, MovStore, reg(pos), Rsp, home(pos));
+		}
+
+		void reload(size_t count)
+		{
+			for (size_t pos = 0; pos < std::min(count, registerCount); ++pos)
+				as.sseMem(Scalar, MovLoad, reg(pos), Rsp, home(pos));
+		}
+
+		// Puts the call result from xmm0 at pos
+		void setResult(size_t pos)
+		{
+			if (inRegister(pos))
+				as.sseReg(Scalar, MovLoad, reg(pos), 0);
+			else
+				as.sseMem(Scalar, MovStore, 0, Rsp, home(pos));
+		}
+
+		void pushConstant(size_t index)
+		{
+			int r = target(sp);
+			as.ssePool(Scalar, MovLoad, r, poolOffset(index));
+			storeBack(sp, r);
+			++sp;
+		}
+
+		void binary(uint8_t op)
+		{
+			int left = fetch(sp - 2, 0);
+			int right = fetch(sp - 1, 1);
+			as.sseReg(Scalar, op, left, right);
+			storeBack(sp - 2, left);
+			--sp;
+		}
+
+		void power()
+		{
+			moveTo(0, sp - 2);
+			moveTo(1, sp - 1);
+			spill(sp - 2);
+			as.callAbsolute(reinterpret_cast<const void*>(&callPow));
+			reload(sp - 2);
+			setResult(sp - 2);
+			--sp;
+		}
+
+		void call(const Instruction& ins)
+		{
+			const KeywordInfo& info = KeywordInfo::getTable().getByID(static_cast<KeywordType>(ins.arg));
+			if (ins.count == 0) {
+				// Keywords are pure, so constants like pi are evaluated right now
+				pool.push_back(info.nullary());
+				pushConstant(pool.size() - 1);
+				return;
+			}
+			if (info.id == KeywordType::Sqrt && ins.count == 1) {
+				// sqrtsd is correctly rounded, exactly like std::sqrt
+				int r = fetch(sp - 1, 0);
+				as.sseReg(Scalar, SqrtOp, r, r);
+				storeBack(sp - 1, r);
+				return;
+			}
+
+			size_t first = sp - ins.count;
+			if (!info.isVariadic()) {
+				// Fixed-arity keywords take their arguments in xmm0 and xmm1, just like pow
+				for (size_t i = 0; i < ins.count; ++i)
+					moveTo(static_cast<int>(i), first + i);
+				spill(first);
+				as.callAbsolute(info.unary ? reinterpret_cast<const void*>(info.unary) : reinterpret_cast<const void*>(info.binary));
+				reload(first);
+				setResult(first);
+				sp = first + 1;
+				return;
+			}
+
+			// Variadic arguments are adjacent home slots, passed as one array
+			callWithArray(reinterpret_cast<const void*>(&callKeyword), &info, ins.count);
+		}
+
+		// User functions take their arguments the way variadic keywords do
+		void callFunction(const Instruction& ins)
+		{
+			callWithArray(reinterpret_cast<const void*>(&::callFunction), program.functions[ins.arg].get(), ins.count);
+		}
+
+		// Calls target(object, args, count) with the top count values as args
+		void callWithArray(const void* target, const void* object, uint16_t count)
+		{
+			size_t first = sp - count;
+			spill(sp);
+			if (win64) {
+				as.bytes({ 0x48, 0xB9 }); // mov rcx, imm64
+				as.u64(reinterpret_cast<uint64_t>(object));
+				as.bytes({ 0x48, 0x8D, 0x94, 0x24 }); // lea rdx, [rsp + disp32]
+				as.u32(static_cast<uint32_t>(home(first)));
+				as.bytes({ 0x41, 0xB8 }); // mov r8d, imm32
+				as.u32(count);
+			}
+			else {
+				as.bytes({ 0x48, 0xBF }); // mov rdi, imm64
+				as.u64(reinterpret_cast<uint64_t>(object));
+				as.bytes({ 0x48, 0x8D, 0xB4, 0x24 }); // lea rsi, [rsp + disp32]
+				as.u32(static_cast<uint32_t>(home(first)));
+				as.byte(0xBA); // mov edx, imm32
+				as.u32(count);
+			}
+			as.callAbsolute(target);
+			reload(first);
+			setResult(first);
+			sp = first + 1;
+		}
+
+		// Returns false for anything it cannot translate
+		bool generate()
+		{
+			const size_t used = std::min(program.maxStack, registerCount);
+			const int32_t saveArea = static_cast<int32_t>((home(program.maxStack) + 15) & ~15);
+			// The return address and rbx leave rsp 16-byte aligned, the frame keeps it so
+			const int32_t frame = saveArea + (win64 ? static_cast<int32_t>(16 * used) : 0);
+			// Larger frames would have to probe the stack page by page
+			if (program.maxStack > maxFrame / 8 || frame >= maxFrame)
+				return false;
+
+			as.byte(0x53); // push rbx
+			as.bytes({ 0x48, 0x81, 0xEC }); // sub rsp, imm32
+			as.u32(static_cast<uint32_t>(frame));
+			// rbx keeps the slot array across calls
+			as.bytes({ 0x48, 0x89, static_cast<uint8_t>(win64 ? 0xCB : 0xFB) });
+			// xmm6 to xmm15 belong to the caller on Win64
+			if (win64) {
+				for (size_t i = 0; i < used; ++i)
+					as.sseMem(NoPrefix, MovStore, reg(i), Rsp, saveArea + static_cast<int32_t>(16 * i));
+			}
+
+			for (const Instruction& ins : program.code) {
+				switch (ins.op)
+				{
+				case OpCode::Const:
+					pushConstant(2 + ins.arg);
+					break;
+				case OpCode::Load: {
+					int r = target(sp);
+					as.sseMem(Scalar, MovLoad, r, Rbx, static_cast<int32_t>(8 * ins.arg));
+					storeBack(sp, r);
+					++sp;
+					break;
+				}
+				case OpCode::Neg: {
+					int r = fetch(sp - 1, 0);
+					as.ssePool(Packed, XorOp, r, poolOffset(0));
+					storeBack(sp - 1, r);
+					break;
+				}
+				case OpCode::Add:
+					binary(AddOp);
+					break;
+				case OpCode::Sub:
+					binary(SubOp);
+					break;
+				case OpCode::Mul:
+					binary(MulOp);
+					break;
+				case OpCode::Div:
+					binary(DivOp);
+					break;
+				case OpCode::Pow:
+					power();
+					break;
+				case OpCode::Call:
+					call(ins);
+					break;
+				case OpCode::CallFunction:
+					callFunction(ins);
+					break;
+				default:
+					return false;
+				}
+			}
+			if (sp != 1)
+				return false;
+
+			moveTo(0, 0);
+			if (win64) {
+				for (size_t i = 0; i < used; ++i)
+					as.sseMem(NoPrefix, MovLoad, reg(i), Rsp, saveArea + static_cast<int32_t>(16 * i));
+			}
+			as.bytes({ 0x48, 0x81, 0xC4 }); // add rsp, imm32
+			as.u32(static_cast<uint32_t>(frame));
+			as.byte(0x5B); // pop rbx
+			as.byte(0xC3); // ret
+			return true;
+		}
+	};
+}
+
+static void* allocateWritable(size_t size)
+{
+#ifdef _WIN32
+	return VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
+#endif
+}
+
+// Pages are never writable and executable at the same time
+static bool makeExecutable(void* memory, size_t size)
+{
+#ifdef _WIN32
+	DWORD previous;
+	if (!VirtualProtect(memory, size, PAGE_EXECUTE_READ, &previous))
+		return false;
+	return FlushInstructionCache(GetCurrentProcess(), memory, size) != 0;
+#else
+	return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+static void freeExecutable(void* memory, size_t size)
+{
+#ifdef _WIN32
+	(void)size;
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
+#endif
+
+// -----------------------------------------------------
+JitFunction::JitFunction(Program program)
+	: program(std::move(program))
+{
+#ifdef RATIONALIS_JIT
+	CodeGen gen(this->program);
+	if (!gen.generate())
+		return;
+
+	// The constant pool follows the code, 16-byte aligned for xorpd
+	std::vector<uint8_t>& code = gen.as.code;
+	const size_t poolStart = (code.size() + 15) & ~size_t(15);
+	for (auto [at, offset] : gen.as.fixups) {
+		int64_t disp = static_cast<int64_t>(poolStart + offset) - static_cast<int64_t>(at + 4);
+		uint32_t value = static_cast<uint32_t>(static_cast<int32_t>(disp));
+		std::memcpy(&code[at], &value, sizeof(value));
+	}
+
+	const size_t size = poolStart + gen.pool.size() * sizeof(double);
+	void* block = allocateWritable(size);
+	if (!block)
+		return;
+	auto* bytes = static_cast<uint8_t*>(block);
+	std::memcpy(bytes, code.data(), code.size());
+	std::memset(bytes + code.size(), 0xCC, poolStart - code.size()); // int3 padding
+	std::memcpy(bytes + poolStart, gen.pool.data(), gen.pool.size() * sizeof(double));
+	if (!makeExecutable(block, size)) {
+		freeExecutable(block, size);
+		return;
+	}
+	memory = block;
+	memorySize = size;
+	entry = reinterpret_cast<NativeFunc>(block);
+#endif
+}
+
+JitFunction::~JitFunction()
+{
+	release();
+}
+
+JitFunction::JitFunction(JitFunction&& other) noexcept
+	: program(std::move(other.program)), memory(std::exchange(other.memory, nullptr)),
+	memorySize(std::exchange(other.memorySize, 0)), entry(std::exchange(other.entry, nullptr)) {
+}
+
+JitFunction& JitFunction::operator=(JitFunction&& other) noexcept
+{
+	if (this != &other) {
+		release();
+		program = std::move(other.program);
+		memory = std::exchange(other.memory, nullptr);
+		memorySize = std::exchange(other.memorySize, 0);
+		entry = std::exchange(other.entry, nullptr);
+	}
+	return *this;
+}
+
+void JitFunction::release()
+{
+#ifdef RATIONALIS_JIT
+	if (memory)
+		freeExecutable(memory, memorySize);
+#endif
+	memory = nullptr;
+	memorySize = 0;
+	entry = nullptr;
+}
+
+NativeFunc JitFunction::getNative() const
+{
+	return entry;
+}
+
+bool JitFunction::isNative() const
+{
+	return entry != nullptr;
+}
+
+const Program& JitFunction::getProgram() const
+{
+	return program;
+}
+
+size_t JitFunction::codeSize() const
+{
+	return memorySize;
+}
+
+double JitFunction::operator()(std::span<const double> slots) const
+{
+	if (slots.size() < program.identifiers.size()) {
+		throw std::runtime_error(std::format("Expected {} slots, got {}", program.identifiers.size(), slots.size()));
+	}
+	if (!entry)
+		return execute(program, slots);
+	pendingError = nullptr;
+	const double result = entry(slots.data());
+	if (pendingError)
+		std::rethrow_exception(std::exchange(pendingError, nullptr));
+	return result;
+}
+
+JitFunction jitCompile(const Expr* expr)
+{
+	return JitFunction(compile(expr));
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Bytecode.h"
+#include <cstddef>
+#include <span>
+
+struct Expr;
+
+// Signature of generated code: slots[i] holds the value of program.identifiers[i]
+using NativeFunc = double (*)(const double* slots);
+
+// An expression compiled to x86-64 machine code. Arithmetic runs inline on SSE2
+// registers, pow and keywords call the same functions the interpreter uses, so
+// results are bit-identical to execute(). On other CPUs, or when executable
+// memory cannot be had, it falls back to interpreting the bytecode.
+class JitFunction
+{
+public:
+	explicit JitFunction(Program program);
+	~JitFunction();
+
+	JitFunction(JitFunction&& other) noexcept;
+	JitFunction& operator=(JitFunction&& other) noexcept;
+	JitFunction(const JitFunction&) = delete;
+	JitFunction& operator=(const JitFunction&) = delete;
+
+	// nullptr when the interpreter is used. Only valid while this object lives.
+	// Where a keyword or function it calls throws, the code returns NaN instead;
+	// only operator() rethrows the exception.
+	NativeFunc getNative() const;
+	bool isNative() const;
+	const Program& getProgram() const;
+	// Size of the generated code and its constants, 0 when interpreted
+	size_t codeSize() const;
+
+	double operator()(std::span<const double> slots) const;
+
+private:
+	void release();
+
+	Program program;
+	void* memory = nullptr;
+	size_t memorySize = 0;
+	NativeFunc entry = nullptr;
+};
+
+JitFunction jitCompile(const Expr* expr);
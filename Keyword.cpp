@@ -1,33 +1,61 @@
 #include "Keyword.h"
+#include <format>
 #include <stdexcept>
-#include <numeric>
 
-const KeywordInfo& KeywordTable::setItem(KeywordType type, std::string name, KeywordInfo::EvalFunc f, int argc)
+KeywordInfo& KeywordTable::addItem(KeywordType type, std::string name, int argc)
 {
 	size_t idx = static_cast<size_t>(type);
-	table[idx] = { type, std::move(name), f, argc };
+	table[idx] = KeywordInfo{ type, std::move(name), argc };
 	nameToID[table[idx].name] = type;
 	return table[idx];
 }
 
+const KeywordInfo& KeywordTable::setItem(KeywordType type, std::string name, KeywordInfo::NullaryFunc f)
+{
+	KeywordInfo& info = addItem(type, std::move(name), 0);
+	info.nullary = f;
+	return info;
+}
+
+const KeywordInfo& KeywordTable::setItem(KeywordType type, std::string name, KeywordInfo::UnaryFunc f)
+{
+	KeywordInfo& info = addItem(type, std::move(name), 1);
+	info.unary = f;
+	return info;
+}
+
+const KeywordInfo& KeywordTable::setItem(KeywordType type, std::string name, KeywordInfo::BinaryFunc f)
+{
+	KeywordInfo& info = addItem(type, std::move(name), 2);
+	info.binary = f;
+	return info;
+}
+
+const KeywordInfo& KeywordTable::setItem(KeywordType type, std::string name, KeywordInfo::VariadicFunc f)
+{
+	KeywordInfo& info = addItem(type, std::move(name), -1);
+	info.variadic = f;
+	return info;
+}
+
 const KeywordInfo& KeywordTable::getByID(KeywordType id) const
 {
 	return table[static_cast<size_t>(id)];
 }
 
-const KeywordInfo& KeywordTable::getByName(const std::string& name) const
+const KeywordInfo& KeywordTable::getByName(std::string_view name) const
 {
 	auto it = nameToID.find(name);
 	if (it != nameToID.end())
 	{
 		return table[static_cast<size_t>(it->second)];
 	}
-	throw std::runtime_error("Keyword not found: " + name);
+	throw std::runtime_error("Keyword not found: " + std::string(name));
 }
 
-bool KeywordTable::contains(const std::string& name) const
+bool KeywordTable::contains(std::string_view name) const
 {
-	return nameToID.contains(name);
+	return nameToID.find(name) != nameToID.end();
 }
 
 bool KeywordTable::contains(KeywordType id) const
@@ -35,19 +63,46 @@ bool KeywordTable::contains(KeywordType id) const
 	return id >= KeywordType::Sin && id < KeywordType::Total;
 }
 
+// The lambda's parameter list picks the setItem overload, and so the argument count
+template<typename Func>
+static void setKeyword(KeywordTable* table, KeywordType type, Func f)
+{
+	const KeywordSignature& signature = KeywordSignatures[static_cast<size_t>(type)];
+	const KeywordInfo& info = table->setItem(type, std::string(signature.name), +f);
+	if (info.argCount != signature.argCount) {
+		throw std::logic_error(std::format("Keyword {} is registered with the wrong signature", signature.name));
+	}
+}
+
 static void initTable(KeywordTable* table) 
 {
-	table->setItem(KeywordType::Sin, "sin", [](const std::vector<double>& args) { return std::sin(args[0]); }, 1);
-	table->setItem(KeywordType::Cos, "cos", [](const std::vector<double>& args) { return std::cos(args[0]); }, 1);
-	table->setItem(KeywordType::Tan, "tan", [](const std::vector<double>& args) { return std::tan(args[0]); }, 1);
-	table->setItem(KeywordType::Asin, "arcsin", [](const std::vector<double>& args) { return std::asin(args[0]); }, 1);
-	table->setItem(KeywordType::Acos, "arccos", [](const std::vector<double>& args) { return std::acos(args[0]); }, 1);
-	table->setItem(KeywordType::Atan, "arctan", [](const std::vector<double>& args) { return std::atan(args[0]); }, 1);
-	table->setItem(KeywordType::Sqrt, "sqrt", [](const std::vector<double>& args) { return std::sqrt(args[0]); }, 1);
-	table->setItem(KeywordType::Log, "log", [](const std::vector<double>& args) { return std::log(args[0]); }, 1);
-	table->setItem(KeywordType::Pi, "pi", [](const std::vector<double>&) { return 3.14159265358979323846; }, 0);
-	table->setItem(KeywordType::E, "e", [](const std::vector<double>&) { return 2.71828182845904523536; }, 0);
-	table->setItem(KeywordType::Mean, "mean", [](const std::vector<double>& args) { return std::accumulate(args.begin(), args.end(), 0.0) / args.size(); }, 2);
+	setKeyword(table, KeywordType::Sin, [](double x) { return applyKeyword<KeywordType::Sin>(x); });
+	setKeyword(table, KeywordType::Cos, [](double x) { return applyKeyword<KeywordType::Cos>(x); });
+	setKeyword(table, KeywordType::Tan, [](double x) { return applyKeyword<KeywordType::Tan>(x); });
+	setKeyword(table, KeywordType::Asin, [](double x) { return applyKeyword<KeywordType::Asin>(x); });
+	setKeyword(table, KeywordType::Acos, [](double x) { return applyKeyword<KeywordType::Acos>(x); });
+	setKeyword(table, KeywordType::Atan, [](double x) { return applyKeyword<KeywordType::Atan>(x); });
+	setKeyword(table, KeywordType::Sqrt, [](double x) { return applyKeyword<KeywordType::Sqrt>(x); });
+	setKeyword(table, KeywordType::Log, [](double x) { return applyKeyword<KeywordType::Log>(x); });
+	setKeyword(table, KeywordType::Pi, [] { return applyKeyword<KeywordType::Pi>(); });
+	setKeyword(table, KeywordType::E, [] { return applyKeyword<KeywordType::E>(); });
+	setKeyword(table, KeywordType::Mean, [](std::span<const double> x) { return reduceKeyword<KeywordType::Mean>(x); });
+	setKeyword(table, KeywordType::Sum, [](std::span<const double> x) { return reduceKeyword<KeywordType::Sum>(x); });
+	setKeyword(table, KeywordType::Min, [](std::span<const double> x) { return reduceKeyword<KeywordType::Min>(x); });
+	setKeyword(table, KeywordType::Max, [](std::span<const double> x) { return reduceKeyword<KeywordType::Max>(x); });
+	setKeyword(table, KeywordType::Dot, [](double a, double b) { return applyKeyword<KeywordType::Dot>(a, b); });
+	setKeyword(table, KeywordType::Var, [](std::span<const double> x) { return reduceKeyword<KeywordType::Var>(x); });
+}
+
+void KeywordInfo::checkArity(size_t count) const
+{
+	if (accepts(count)) {
+		return;
+	}
+	if (isVariadic()) {
+		throw std::runtime_error(std::format("Wrong number of arguments: Expected at least 1, got: {}", count));
+	}
+	throw std::runtime_error(std::format("Wrong number of arguments: Expected: {}, got: {}", argCount, count));
 }
 
 std::string KeywordInfo::toString() const
@@ -57,11 +112,11 @@ std::string KeywordInfo::toString() const
 
 const KeywordTable& KeywordInfo::getTable()
 {
-	static KeywordTable* table = nullptr;
-	if (!table)
-	{
-		table = new KeywordTable();
-		initTable(table);
-	}
-	return *table;
+	// Initialized exactly once even when several threads get here first
+	static const KeywordTable table = [] {
+		KeywordTable result;
+		initTable(&result);
+		return result;
+	}();
+	return table;
 }
\ No newline at end of file
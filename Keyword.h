@@ -2,7 +2,13 @@
 
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstddef>
+#include <span>
 
 enum class KeywordType {
 	Sin,
@@ -16,19 +22,148 @@ enum class KeywordType {
 	Pi,
 	E,
 	Mean,
+	Sum,
+	Min,
+	Max,
+	Dot,
+	Var,
 	Total
 };
 
 class KeywordTable;
 
+// Name and number of arguments of a keyword, usable in constant expressions
+struct KeywordSignature
+{
+	KeywordType id;
+	std::string_view name;
+	int argCount;
+};
+
+constexpr std::array<KeywordSignature, static_cast<size_t>(KeywordType::Total)> KeywordSignatures = { {
+	{ KeywordType::Sin, "sin", 1 },
+	{ KeywordType::Cos, "cos", 1 },
+	{ KeywordType::Tan, "tan", 1 },
+	{ KeywordType::Asin, "arcsin", 1 },
+	{ KeywordType::Acos, "arccos", 1 },
+	{ KeywordType::Atan, "arctan", 1 },
+	{ KeywordType::Sqrt, "sqrt", 1 },
+	{ KeywordType::Log, "log", 1 },
+	{ KeywordType::Pi, "pi", 0 },
+	{ KeywordType::E, "e", 0 },
+	{ KeywordType::Mean, "mean", -1 },
+	{ KeywordType::Sum, "sum", -1 },
+	{ KeywordType::Min, "min", -1 },
+	{ KeywordType::Max, "max", -1 },
+	{ KeywordType::Dot, "dot", 2 },
+	{ KeywordType::Var, "var", -1 },
+} };
+
+// The variadic keywords, over their arguments. Called with arrays they reduce
+// the elements instead, see ArrayExpr.h.
+template<KeywordType Id>
+inline double reduceKeyword(std::span<const double> x)
+{
+	if constexpr (Id == KeywordType::Min || Id == KeywordType::Max) {
+		// A NaN wins over every number
+		double result = x[0];
+		for (double value : x) {
+			if (std::isnan(value))
+				return value;
+			result = Id == KeywordType::Min ? std::min(result, value) : std::max(result, value);
+		}
+		return result;
+	}
+	else {
+		// Summed from 0.0 like std::accumulate, which turns a lone -0.0 into 0.0
+		double sum = 0.0;
+		for (double value : x)
+			sum += value;
+		if constexpr (Id == KeywordType::Sum) return sum;
+		else if constexpr (Id == KeywordType::Mean) return sum / x.size();
+		else if constexpr (Id == KeywordType::Var) {
+			// Population variance, from the deviations rather than the sum of squares
+			const double mean = sum / x.size();
+			double squares = 0.0;
+			for (double value : x)
+				squares += (value - mean) * (value - mean);
+			return squares / x.size();
+		}
+		else static_assert(Id != Id, "Not a variadic keyword");
+	}
+}
+
+// The math behind every keyword. KeywordTable and the compile-time parser both
+// call this, so they always agree on the result.
+template<KeywordType Id, typename... Args>
+inline double applyKeyword(Args... args)
+{
+	const double x[] = { 0.0, static_cast<double>(args)... };
+	if constexpr (Id == KeywordType::Sin) return std::sin(x[1]);
+	else if constexpr (Id == KeywordType::Cos) return std::cos(x[1]);
+	else if constexpr (Id == KeywordType::Tan) return std::tan(x[1]);
+	else if constexpr (Id == KeywordType::Asin) return std::asin(x[1]);
+	else if constexpr (Id == KeywordType::Acos) return std::acos(x[1]);
+	else if constexpr (Id == KeywordType::Atan) return std::atan(x[1]);
+	else if constexpr (Id == KeywordType::Sqrt) return std::sqrt(x[1]);
+	else if constexpr (Id == KeywordType::Log) return std::log(x[1]);
+	else if constexpr (Id == KeywordType::Pi) return 3.14159265358979323846;
+	else if constexpr (Id == KeywordType::E) return 2.71828182845904523536;
+	else if constexpr (Id == KeywordType::Dot) return x[1] * x[2];
+	else if constexpr (Id == KeywordType::Mean || Id == KeywordType::Sum || Id == KeywordType::Min ||
+		Id == KeywordType::Max || Id == KeywordType::Var)
+		return reduceKeyword<Id>(std::span<const double>(x + 1, sizeof...(Args)));
+	else static_assert(Id != Id, "Missing keyword");
+}
+
+// Lets string keyed maps be searched with a string_view without a temporary string
+struct StringHash
+{
+	using is_transparent = void;
+	size_t operator()(std::string_view str) const { return std::hash<std::string_view>{}(str); }
+};
+
+template<typename T>
+using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+// Every keyword is registered with the signature matching its argument count, so
+// calling it never builds an argument list. Exactly one of the functions is set.
 struct KeywordInfo
 {
-	using EvalFunc = double (*)(const std::vector<double>&);
+	using NullaryFunc = double (*)();
+	using UnaryFunc = double (*)(double);
+	using BinaryFunc = double (*)(double, double);
+	// Keywords with argCount == -1 take any number of arguments as one array
+	using VariadicFunc = double (*)(std::span<const double>);
 
 	KeywordType id;
 	std::string name;
-	EvalFunc eval;
 	int argCount;
+	NullaryFunc nullary = nullptr;
+	UnaryFunc unary = nullptr;
+	BinaryFunc binary = nullptr;
+	VariadicFunc variadic = nullptr;
+
+	bool isVariadic() const { return argCount < 0; }
+	bool accepts(size_t count) const { return isVariadic() ? count > 0 : count == static_cast<size_t>(argCount); }
+	// Throws if count arguments cannot be passed. Parsers call this once per call site.
+	void checkArity(size_t count) const;
+
+	// args points at count values, which accepts(count) has already allowed
+	double call(const double* args, size_t count) const
+	{
+		switch (argCount)
+		{
+		case 0:
+			return nullary();
+		case 1:
+			return unary(args[0]);
+		case 2:
+			return binary(args[0], args[1]);
+		default:
+			return variadic({ args, count });
+		}
+	}
 
 	std::string toString() const;
 	static const KeywordTable& getTable();
@@ -40,13 +175,18 @@ public:
 	using TableType = std::array<KeywordInfo,\
 		static_cast<size_t>(KeywordType::Total)>;
 
-	const KeywordInfo& setItem(KeywordType, std::string, KeywordInfo::EvalFunc, int);
+	const KeywordInfo& setItem(KeywordType, std::string, KeywordInfo::NullaryFunc);
+	const KeywordInfo& setItem(KeywordType, std::string, KeywordInfo::UnaryFunc);
+	const KeywordInfo& setItem(KeywordType, std::string, KeywordInfo::BinaryFunc);
+	const KeywordInfo& setItem(KeywordType, std::string, KeywordInfo::VariadicFunc);
 	const KeywordInfo& getByID(KeywordType id) const;
-	const KeywordInfo& getByName(const std::string& name) const;
-	bool contains(const std::string& name) const;
+	const KeywordInfo& getByName(std::string_view name) const;
+	bool contains(std::string_view name) const;
 	bool contains(KeywordType id) const;
 private:
+	KeywordInfo& addItem(KeywordType, std::string, int argCount);
+
 	TableType table;
-	std::unordered_map<std::string, KeywordType> nameToID;
+	StringMap<KeywordType> nameToID;
 };
 
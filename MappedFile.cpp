@@ -0,0 +1,87 @@
+#include "MappedFile.h"
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			size = data ? static_cast<size_t>(fileSize.QuadPart) : 0;
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+		void* memory = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (memory != MAP_FAILED) {
+			data = static_cast<const char*>(memory);
+			size = static_cast<size_t>(info.st_size);
+		}
+	}
+	close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	unmap();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other) {
+		unmap();
+		data = std::exchange(other.data, nullptr);
+		size = std::exchange(other.size, 0);
+	}
+	return *this;
+}
+
+bool MappedFile::isMapped() const
+{
+	return data != nullptr;
+}
+
+std::string_view MappedFile::view() const
+{
+	return std::string_view(data, size);
+}
+
+void MappedFile::unmap()
+{
+	if (!data)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<char*>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+}
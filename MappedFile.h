@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A read-only view of a whole file mapped into memory, or none if the file
+// cannot be mapped, like empty files and pipes. The view is page aligned.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool isMapped() const;
+	std::string_view view() const;
+
+private:
+	void unmap();
+
+	const char* data = nullptr;
+	size_t size = 0;
+};
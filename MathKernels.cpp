@@ -0,0 +1,1147 @@
+#include "MathKernels.h"
+#include "SimdKernels.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RATIONALIS_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit AVX2 code in functions that ask for it, MSVC always can.
+// The kernels are generic and only become AVX2 code once inlined into an AVX2
+// loop, so everything between the loop and Avx2Lanes is forced inline, in debug
+// builds too.
+#if defined(__GNUC__) || defined(__clang__)
+#define RATIONALIS_TARGET_AVX2 __attribute__((target("avx2")))
+#define RATIONALIS_INLINE __attribute__((always_inline)) inline
+#else
+#define RATIONALIS_TARGET_AVX2
+#define RATIONALIS_INLINE __forceinline
+#endif
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+constexpr double Infinity = std::numeric_limits<double>::infinity();
+
+std::string mathAccuracyToString(MathAccuracy accuracy)
+{
+	switch (accuracy)
+	{
+	case MathAccuracy::Libm:
+		return "libm";
+	case MathAccuracy::CorrectlyRounded:
+		return "correct";
+	case MathAccuracy::Ulp1:
+		return "ulp1";
+	case MathAccuracy::Ulp4:
+		return "ulp4";
+	default:
+		return "unknown";
+	}
+}
+
+MathAccuracy parseMathAccuracy(std::string_view name)
+{
+	for (MathAccuracy accuracy : { MathAccuracy::Libm, MathAccuracy::CorrectlyRounded, MathAccuracy::Ulp1, MathAccuracy::Ulp4 }) {
+		if (name == mathAccuracyToString(accuracy))
+			return accuracy;
+	}
+	ERR(std::format("Unknown accuracy '{}', expected libm, correct, ulp1 or ulp4", name));
+}
+
+// -----------------------------------------------------
+// Lanes. The Ulp1 and Ulp4 kernels are written once against these and only use
+// operations that round the same in every instruction set: IEEE adds,
+// multiplies, divides and square roots, never fused multiply-adds, and bit
+// operations on the patterns. A mask has all bits of a lane set or clear.
+struct ScalarLanes
+{
+	using Type = double;
+	static constexpr size_t Width = 1;
+
+	static uint64_t bits(double a) { return std::bit_cast<uint64_t>(a); }
+	static double fromBits(uint64_t a) { return std::bit_cast<double>(a); }
+	static double mask(bool set) { return fromBits(set ? ~uint64_t(0) : 0); }
+
+	static Type load(const double* p) { return *p; }
+	static void store(double* p, Type a) { *p = a; }
+	static Type set(double x) { return x; }
+	static Type setBits(uint64_t x) { return fromBits(x); }
+	static Type add(Type a, Type b) { return a + b; }
+	static Type sub(Type a, Type b) { return a - b; }
+	static Type mul(Type a, Type b) { return a * b; }
+	static Type div(Type a, Type b) { return a / b; }
+	static Type sqrt(Type a) { return std::sqrt(a); }
+	static Type bitAnd(Type a, Type b) { return fromBits(bits(a) & bits(b)); }
+	static Type bitOr(Type a, Type b) { return fromBits(bits(a) | bits(b)); }
+	static Type bitXor(Type a, Type b) { return fromBits(bits(a) ^ bits(b)); }
+	// ~a & b
+	static Type andNot(Type a, Type b) { return fromBits(~bits(a) & bits(b)); }
+	// Integer arithmetic on the patterns
+	static Type addBits(Type a, Type b) { return fromBits(bits(a) + bits(b)); }
+	static Type shiftLeft(Type a, int n) { return fromBits(bits(a) << n); }
+	static Type shiftRight(Type a, int n) { return fromBits(bits(a) >> n); }
+	static Type less(Type a, Type b) { return mask(a < b); }
+	static Type lessEqual(Type a, Type b) { return mask(a <= b); }
+	static Type equal(Type a, Type b) { return mask(a == b); }
+	// Also set where either is NaN
+	static Type notLessEqual(Type a, Type b) { return mask(!(a <= b)); }
+	// Bit i set for every set lane i
+	static int laneBits(Type m) { return static_cast<int>(bits(m) >> 63); }
+};
+
+#ifdef RATIONALIS_X86
+struct Sse2Lanes
+{
+	using Type = __m128d;
+	static constexpr size_t Width = 2;
+
+	static __m128i bits(Type a) { return _mm_castpd_si128(a); }
+	static Type fromBits(__m128i a) { return _mm_castsi128_pd(a); }
+
+	static Type load(const double* p) { return _mm_loadu_pd(p); }
+	static void store(double* p, Type a) { _mm_storeu_pd(p, a); }
+	static Type set(double x) { return _mm_set1_pd(x); }
+	static Type setBits(uint64_t x) { return fromBits(_mm_set1_epi64x(static_cast<long long>(x))); }
+	static Type add(Type a, Type b) { return _mm_add_pd(a, b); }
+	static Type sub(Type a, Type b) { return _mm_sub_pd(a, b); }
+	static Type mul(Type a, Type b) { return _mm_mul_pd(a, b); }
+	static Type div(Type a, Type b) { return _mm_div_pd(a, b); }
+	static Type sqrt(Type a) { return _mm_sqrt_pd(a); }
+	static Type bitAnd(Type a, Type b) { return _mm_and_pd(a, b); }
+	static Type bitOr(Type a, Type b) { return _mm_or_pd(a, b); }
+	static Type bitXor(Type a, Type b) { return _mm_xor_pd(a, b); }
+	static Type andNot(Type a, Type b) { return _mm_andnot_pd(a, b); }
+	static Type addBits(Type a, Type b) { return fromBits(_mm_add_epi64(bits(a), bits(b))); }
+	static Type shiftLeft(Type a, int n) { return fromBits(_mm_sll_epi64(bits(a), _mm_cvtsi32_si128(n))); }
+	static Type shiftRight(Type a, int n) { return fromBits(_mm_srl_epi64(bits(a), _mm_cvtsi32_si128(n))); }
+	static Type less(Type a, Type b) { return _mm_cmplt_pd(a, b); }
+	static Type lessEqual(Type a, Type b) { return _mm_cmple_pd(a, b); }
+	static Type equal(Type a, Type b) { return _mm_cmpeq_pd(a, b); }
+	static Type notLessEqual(Type a, Type b) { return _mm_cmpnle_pd(a, b); }
+	static int laneBits(Type m) { return _mm_movemask_pd(m); }
+};
+
+struct Avx2Lanes
+{
+	using Type = __m256d;
+	static constexpr size_t Width = 4;
+
+	RATIONALIS_TARGET_AVX2 static __m256i bits(Type a) { return _mm256_castpd_si256(a); }
+	RATIONALIS_TARGET_AVX2 static Type fromBits(__m256i a) { return _mm256_castsi256_pd(a); }
+
+	RATIONALIS_TARGET_AVX2 static Type load(const double* p) { return _mm256_loadu_pd(p); }
+	RATIONALIS_TARGET_AVX2 static void store(double* p, Type a) { _mm256_storeu_pd(p, a); }
+	RATIONALIS_TARGET_AVX2 static Type set(double x) { return _mm256_set1_pd(x); }
+	RATIONALIS_TARGET_AVX2 static Type setBits(uint64_t x) { return fromBits(_mm256_set1_epi64x(static_cast<long long>(x))); }
+	RATIONALIS_TARGET_AVX2 static Type add(Type a, Type b) { return _mm256_add_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type sub(Type a, Type b) { return _mm256_sub_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type mul(Type a, Type b) { return _mm256_mul_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type div(Type a, Type b) { return _mm256_div_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type sqrt(Type a) { return _mm256_sqrt_pd(a); }
+	RATIONALIS_TARGET_AVX2 static Type bitAnd(Type a, Type b) { return _mm256_and_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type bitOr(Type a, Type b) { return _mm256_or_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type bitXor(Type a, Type b) { return _mm256_xor_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type andNot(Type a, Type b) { return _mm256_andnot_pd(a, b); }
+	RATIONALIS_TARGET_AVX2 static Type addBits(Type a, Type b) { return fromBits(_mm256_add_epi64(bits(a), bits(b))); }
+	RATIONALIS_TARGET_AVX2 static Type shiftLeft(Type a, int n) { return fromBits(_mm256_sll_epi64(bits(a), _mm_cvtsi32_si128(n))); }
+	RATIONALIS_TARGET_AVX2 static Type shiftRight(Type a, int n) { return fromBits(_mm256_srl_epi64(bits(a), _mm_cvtsi32_si128(n))); }
+	RATIONALIS_TARGET_AVX2 static Type less(Type a, Type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+	RATIONALIS_TARGET_AVX2 static Type lessEqual(Type a, Type b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+	RATIONALIS_TARGET_AVX2 static Type equal(Type a, Type b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+	RATIONALIS_TARGET_AVX2 static Type notLessEqual(Type a, Type b) { return _mm256_cmp_pd(a, b, _CMP_NLE_UQ); }
+	RATIONALIS_TARGET_AVX2 static int laneBits(Type m) { return _mm256_movemask_pd(m); }
+};
+#endif
+
+// One value per lane of L, with constants broadcast to every lane
+template<typename L>
+struct Vec
+{
+	typename L::Type v;
+
+	RATIONALIS_INLINE Vec(typename L::Type v) : v(v) {}
+	RATIONALIS_INLINE Vec(double x) requires (!std::is_same_v<typename L::Type, double>) : v(L::set(x)) {}
+
+	RATIONALIS_INLINE static Vec fromBits(uint64_t x) { return L::setBits(x); }
+
+	friend RATIONALIS_INLINE Vec operator+(Vec a, Vec b) { return L::add(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator-(Vec a, Vec b) { return L::sub(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator*(Vec a, Vec b) { return L::mul(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator/(Vec a, Vec b) { return L::div(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator&(Vec a, Vec b) { return L::bitAnd(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator|(Vec a, Vec b) { return L::bitOr(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator^(Vec a, Vec b) { return L::bitXor(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec operator<<(Vec a, int n) { return L::shiftLeft(a.v, n); }
+	friend RATIONALIS_INLINE Vec operator>>(Vec a, int n) { return L::shiftRight(a.v, n); }
+	friend RATIONALIS_INLINE Vec sqrt(Vec a) { return L::sqrt(a.v); }
+	friend RATIONALIS_INLINE Vec addBits(Vec a, Vec b) { return L::addBits(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec less(Vec a, Vec b) { return L::less(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec lessEqual(Vec a, Vec b) { return L::lessEqual(a.v, b.v); }
+	friend RATIONALIS_INLINE Vec equal(Vec a, Vec b) { return L::equal(a.v, b.v); }
+	// Lanes where a is above limit or NaN
+	friend RATIONALIS_INLINE Vec outside(Vec a, Vec limit) { return L::notLessEqual(a.v, limit.v); }
+	// a where mask is set, b elsewhere
+	friend RATIONALIS_INLINE Vec select(Vec mask, Vec a, Vec b) { return L::bitOr(L::bitAnd(mask.v, a.v), L::andNot(mask.v, b.v)); }
+	friend RATIONALIS_INLINE int laneBits(Vec mask) { return L::laneBits(mask.v); }
+};
+
+constexpr uint64_t SignBit = 0x8000000000000000;
+constexpr uint64_t MantissaBits = 0x000FFFFFFFFFFFFF;
+// Clears the low 32 bits, as fdlibm does to split a value into exact halves
+constexpr uint64_t HighWordBits = 0xFFFFFFFF00000000;
+constexpr uint64_t OneBits = 0x3FF0000000000000;
+// The pattern of 2^52. Or'ed with a small integer it gives 2^52 plus that integer.
+constexpr uint64_t TwoTo52Bits = 0x4330000000000000;
+
+// -----------------------------------------------------
+// The polynomials and the steps around them follow fdlibm:
+//
+// Copyright (C) 1993 by Sun Microsystems, Inc. All rights reserved.
+// Developed at SunPro, a Sun Microsystems, Inc. business.
+// Permission to use, copy, modify, and distribute this software is freely
+// granted, provided that this notice is preserved.
+//
+// Its branches are all computed and picked per lane. The Ulp4 tier keeps the
+// polynomials, which cannot be shortened without losing far more than 4 ulp,
+// and drops the steps that recover the last bits.
+constexpr double S1 = -1.66666666666666324348e-01;
+constexpr double S2 = 8.33333333332248946124e-03;
+constexpr double S3 = -1.98412698298579493134e-04;
+constexpr double S4 = 2.75573137070700676789e-06;
+constexpr double S5 = -2.50507602534068634195e-08;
+constexpr double S6 = 1.58969099521155010221e-10;
+
+constexpr double C1 = 4.16666666666666019037e-02;
+constexpr double C2 = -1.38888888888741095749e-03;
+constexpr double C3 = 2.48015872894767294178e-05;
+constexpr double C4 = -2.75573143513906633035e-07;
+constexpr double C5 = 2.08757232129817482790e-09;
+constexpr double C6 = -1.13596475577881948265e-11;
+
+constexpr double T[] = {
+	3.33333333333334091986e-01,
+	1.33333333333201242699e-01,
+	5.39682539762260521377e-02,
+	2.18694882948595424599e-02,
+	8.86323982359930005737e-03,
+	3.59207910759131235356e-03,
+	1.45620945432529025516e-03,
+	5.88041240820264096874e-04,
+	2.46463134818469906812e-04,
+	7.81794442939557092300e-05,
+	7.14072491382608190305e-05,
+	-1.85586374855275456654e-05,
+	2.59073051863633712884e-05,
+};
+constexpr double Pio4 = 7.85398163397448278999e-01;
+constexpr double Pio4Lo = 3.06161699786838301793e-17;
+
+constexpr double Lg1 = 6.666666666666735130e-01;
+constexpr double Lg2 = 3.999999999940941908e-01;
+constexpr double Lg3 = 2.857142874366239149e-01;
+constexpr double Lg4 = 2.222219843214978396e-01;
+constexpr double Lg5 = 1.818357216161805012e-01;
+constexpr double Lg6 = 1.531383769920937332e-01;
+constexpr double Lg7 = 1.479819860511658591e-01;
+constexpr double Ln2Hi = 6.93147180369123816490e-01;
+constexpr double Ln2Lo = 1.90821492927058770002e-10;
+constexpr double Ln2 = 0x1.62e42fefa39efp-1;
+
+// atan at 1/2, 1, 3/2 and infinity, split into two parts
+constexpr double AtanHi[] = { 4.63647609000806093515e-01, 7.85398163397448278999e-01, 9.82793723247329054082e-01, 1.57079632679489655800e+00 };
+constexpr double AtanLo[] = { 2.26987774529616870924e-17, 3.06161699786838301793e-17, 1.39033110312309984516e-17, 6.12323399573676603587e-17 };
+constexpr double AT[] = {
+	3.33333333333329318027e-01,
+	-1.99999999998764832476e-01,
+	1.42857142725034663711e-01,
+	-1.11111104054623557880e-01,
+	9.09088713343650656196e-02,
+	-7.69187620504482999495e-02,
+	6.66107313738753120669e-02,
+	-5.83357013379057348645e-02,
+	4.97687799461593236017e-02,
+	-3.65315727442169155270e-02,
+	1.62858201153657823623e-02,
+};
+
+constexpr double Pio2Hi = 1.57079632679489655800e+00;
+constexpr double Pio2Lo = 6.12323399573676603587e-17;
+constexpr double PiHi = 3.14159265358979311600e+00;
+constexpr double PS0 = 1.66666666666666657415e-01;
+constexpr double PS1 = -3.25565818622400915405e-01;
+constexpr double PS2 = 2.01212532134862925881e-01;
+constexpr double PS3 = -4.00555345006794114027e-02;
+constexpr double PS4 = 7.91534994289814532176e-04;
+constexpr double PS5 = 3.47933107596021167570e-05;
+constexpr double QS1 = -2.40339491173441421878e+00;
+constexpr double QS2 = 2.02094576023350569471e+00;
+constexpr double QS3 = -6.88283971605453293030e-01;
+constexpr double QS4 = 7.70381505559019352791e-02;
+
+// x + Shifter - Shifter rounds x to an integer for |x| < 2^51, and the low bits
+// of x + Shifter hold that integer
+constexpr double Shifter = 0x1.8p52;
+constexpr double TwoOverPi = 0x1.45f306dc9c883p-1;
+// pi/2 in parts; the first three have 33 bits, so n times each is exact for n < 2^20
+constexpr double Pio2_1 = 0x1.921fb544p+0;
+constexpr double Pio2_2 = 0x1.0b4611a6p-34;
+constexpr double Pio2_3 = 0x1.3198a2ep-69;
+constexpr double Pio2_4 = 0x1.b839a252049c1p-104;
+// Pio2_3 + Pio2_4 rounded, for the Ulp4 tier
+constexpr double Pio2_34 = 0x1.3198a2e037073p-69;
+// The trig kernels reduce arguments up to this themselves and leave larger ones to libm
+constexpr double TrigLimit = 0x1p20;
+
+// The exact error of s = a - b
+template<typename L>
+RATIONALIS_INLINE static Vec<L> subtractionError(Vec<L> a, Vec<L> b, Vec<L> s)
+{
+	const Vec<L> bb = s - a;
+	return (a - (s - bb)) - (b + bb);
+}
+
+// |x| = n pi/2 + hi + lo with |hi + lo| <= about pi/4, for |x| <= TrigLimit.
+// Returns the sum holding n in the low bits of its pattern.
+template<MathAccuracy Tier, typename L>
+RATIONALIS_INLINE static Vec<L> reduceQuadrant(Vec<L> ax, Vec<L>& hi, Vec<L>& lo)
+{
+	using V = Vec<L>;
+	const V t = ax * TwoOverPi + Shifter;
+	const V n = t - Shifter;
+	const V a = ax - n * Pio2_1;
+	if constexpr (Tier == MathAccuracy::Ulp4) {
+		hi = (a - n * Pio2_2) - n * Pio2_34;
+		lo = 0.0;
+	}
+	else {
+		// The products are exact, so only the subtractions round, and what they
+		// round off is carried along
+		const V w2 = n * Pio2_2;
+		const V b = a - w2;
+		const V w3 = n * Pio2_3;
+		const V c = b - w3;
+		const V tail = (subtractionError(a, w2, b) + subtractionError(b, w3, c)) - n * Pio2_4;
+		hi = c + tail;
+		lo = tail - (hi - c);
+	}
+	return t;
+}
+
+// Mask of the lanes where the n held by t is even
+template<typename L>
+RATIONALIS_INLINE static Vec<L> evenQuadrant(Vec<L> t)
+{
+	return equal((t & Vec<L>::fromBits(1)) | Vec<L>::fromBits(TwoTo52Bits), 0x1p52);
+}
+
+// The sign bit where bit 1 of the pattern of t is set
+template<typename L>
+RATIONALIS_INLINE static Vec<L> quadrantSign(Vec<L> t)
+{
+	return (t << 62) & Vec<L>::fromBits(SignBit);
+}
+
+// sin(x + y) for |x| <= pi/4 and y below half an ulp of x
+template<MathAccuracy Tier, typename L>
+RATIONALIS_INLINE static Vec<L> sinPolynomial(Vec<L> x, Vec<L> y)
+{
+	using V = Vec<L>;
+	const V z = x * x;
+	const V v = z * x;
+	const V r = S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)));
+	if constexpr (Tier == MathAccuracy::Ulp4)
+		return x + v * (S1 + z * r);
+	else
+		return x - ((z * (0.5 * y - v * r) - y) - v * S1);
+}
+
+template<MathAccuracy Tier, typename L>
+RATIONALIS_INLINE static Vec<L> cosPolynomial(Vec<L> x, Vec<L> y)
+{
+	using V = Vec<L>;
+	const V z = x * x;
+	const V r = z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+	if constexpr (Tier == MathAccuracy::Ulp4) {
+		return 1.0 - (0.5 * z - z * r);
+	}
+	else {
+		// 1 - z/2 loses bits past |x| = 0.3, so a short part of z/2 is taken off exactly first
+		const V ax = x & V::fromBits(~SignBit);
+		const V qx = select(less(ax, 0.3), 0.0, select(less(0.78125, ax), 0.28125, (ax & V::fromBits(HighWordBits)) * 0.25));
+		const V hz = 0.5 * z - qx;
+		const V a = 1.0 - qx;
+		return a - (hz - (z * r - x * y));
+	}
+}
+
+// tan(x + y) for |x| <= pi/4, or -1/tan(x + y) where even is clear
+template<MathAccuracy Tier, typename L>
+RATIONALIS_INLINE static Vec<L> tanPolynomial(Vec<L> x, Vec<L> y, Vec<L> even)
+{
+	using V = Vec<L>;
+	// Past 0.6744 the polynomial runs on pi/4 - |x| instead
+	const V sign = x & V::fromBits(SignBit);
+	const V big = lessEqual(0.6744, x ^ sign);
+	x = select(big, (Pio4 - (x ^ sign)) + (Pio4Lo - (y ^ sign)), x);
+	y = select(big, 0.0, y);
+
+	const V z = x * x;
+	V w = z * z;
+	V r = T[1] + w * (T[3] + w * (T[5] + w * (T[7] + w * (T[9] + w * T[11]))));
+	V v = z * (T[2] + w * (T[4] + w * (T[6] + w * (T[8] + w * (T[10] + w * T[12])))));
+	const V s = z * x;
+	r = y + z * (s * (r + v) + y);
+	r = r + T[0] * s;
+	w = x + r;
+
+	const V iy = select(even, 1.0, -1.0);
+	const V fromPio4 = (iy - 2.0 * (x - (w * w / (w + iy) - r))) ^ sign;
+	if constexpr (Tier == MathAccuracy::Ulp4) {
+		return select(big, fromPio4, select(even, w, -1.0 / w));
+	}
+	else {
+		// -1/(x + r) with the high halves of both taken exactly
+		const V wHigh = w & V::fromBits(HighWordBits);
+		const V rest = r - (wHigh - x);
+		const V a = -1.0 / w;
+		const V aHigh = a & V::fromBits(HighWordBits);
+		const V inverse = aHigh + a * ((1.0 + aHigh * wHigh) + aHigh * rest);
+		return select(big, fromPio4, select(even, w, inverse));
+	}
+}
+
+template<MathAccuracy Tier>
+struct Sin
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		const V sign = x & V::fromBits(SignBit);
+		const V ax = x ^ sign;
+		slow = outside(ax, TrigLimit);
+		V hi = 0.0, lo = 0.0;
+		const V t = reduceQuadrant<Tier>(ax, hi, lo);
+		const V result = select(evenQuadrant(t), sinPolynomial<Tier>(hi, lo), cosPolynomial<Tier>(hi, lo));
+		return result ^ (sign ^ quadrantSign(t));
+	}
+	static double fallback(double x) { return std::sin(x); }
+};
+
+template<MathAccuracy Tier>
+struct Cos
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		const V ax = x & V::fromBits(~SignBit);
+		slow = outside(ax, TrigLimit);
+		V hi = 0.0, lo = 0.0;
+		const V t = reduceQuadrant<Tier>(ax, hi, lo);
+		const V result = select(evenQuadrant(t), cosPolynomial<Tier>(hi, lo), sinPolynomial<Tier>(hi, lo));
+		// Negative in quadrants 1 and 2
+		return result ^ quadrantSign(addBits(t, V::fromBits(1)));
+	}
+	static double fallback(double x) { return std::cos(x); }
+};
+
+template<MathAccuracy Tier>
+struct Tan
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		const V sign = x & V::fromBits(SignBit);
+		const V ax = x ^ sign;
+		slow = outside(ax, TrigLimit);
+		V hi = 0.0, lo = 0.0;
+		const V t = reduceQuadrant<Tier>(ax, hi, lo);
+		return tanPolynomial<Tier>(hi, lo, evenQuadrant(t)) ^ sign;
+	}
+	static double fallback(double x) { return std::tan(x); }
+};
+
+// p/q, the rational approximation asin and acos share
+template<typename L>
+RATIONALIS_INLINE static Vec<L> asinRatio(Vec<L> t)
+{
+	const Vec<L> p = t * (PS0 + t * (PS1 + t * (PS2 + t * (PS3 + t * (PS4 + t * PS5)))));
+	const Vec<L> q = 1.0 + t * (QS1 + t * (QS2 + t * (QS3 + t * QS4)));
+	return p / q;
+}
+
+template<MathAccuracy Tier>
+struct Asin
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		const V sign = x & V::fromBits(SignBit);
+		const V ax = x ^ sign;
+		slow = outside(ax, 1.0);
+		const V small = less(ax, 0.5);
+		const V t = select(small, ax * ax, (1.0 - ax) * 0.5);
+		const V r = asinRatio(t);
+		const V s = sqrt(t);
+		const V nearZero = ax + ax * r;
+		V nearOne = Pio2Hi - (2.0 * (s + s * r) - Pio2Lo);
+		if constexpr (Tier != MathAccuracy::Ulp4) {
+			// Below 0.975 pi/2 - 2 asin(s) is taken from pi/4 with s split into exact halves
+			const V w = s & V::fromBits(HighWordBits);
+			const V c = (t - w * w) / (s + w);
+			const V middle = Pio4 - ((2.0 * s * r - (Pio2Lo - 2.0 * c)) - (Pio4 - 2.0 * w));
+			nearOne = select(lessEqual(0x1.f3333p-1, ax), nearOne, middle);
+		}
+		return select(small, nearZero, nearOne) ^ sign;
+	}
+	static double fallback(double x) { return std::asin(x); }
+};
+
+template<MathAccuracy Tier>
+struct Acos
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		const V ax = x & V::fromBits(~SignBit);
+		slow = outside(ax, 1.0);
+		const V small = less(ax, 0.5);
+		const V t = select(small, x * x, (1.0 - ax) * 0.5);
+		const V r = asinRatio(t);
+		const V s = sqrt(t);
+		const V nearZero = Pio2Hi - (x - (Pio2Lo - x * r));
+		const V nearMinusOne = PiHi - 2.0 * (s + (r * s - Pio2Lo));
+		V nearOne = 2.0 * (s + r * s);
+		if constexpr (Tier != MathAccuracy::Ulp4) {
+			const V w = s & V::fromBits(HighWordBits);
+			const V c = (t - w * w) / (s + w);
+			// c is 0/0 at 1
+			nearOne = select(equal(x, 1.0), 0.0, 2.0 * (w + (r * s + c)));
+		}
+		return select(small, nearZero, select(less(x, 0.0), nearMinusOne, nearOne));
+	}
+	static double fallback(double x) { return std::acos(x); }
+};
+
+// Where mask is set, atan(x) = atan(c) + atan(n / d) with c = AtanHi[i] + AtanLo[i]
+template<typename L>
+RATIONALIS_INLINE static void atanAround(Vec<L> mask, Vec<L> n, Vec<L> d, size_t i, Vec<L>& num, Vec<L>& den, Vec<L>& hi, Vec<L>& lo)
+{
+	num = select(mask, n, num);
+	den = select(mask, d, den);
+	hi = select(mask, AtanHi[i], hi);
+	lo = select(mask, AtanLo[i], lo);
+}
+
+template<MathAccuracy Tier>
+struct Atan
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		const V sign = x & V::fromBits(SignBit);
+		const V ax = x ^ sign;
+		slow = V::fromBits(0);
+		// atan(x) = atan(c) + atan((x - c) / (1 + x c)) around c = 1/2, 1, 3/2 or
+		// infinity, or only around 1 and infinity for Ulp4
+		V num = ax, den = 1.0, hi = 0.0, lo = 0.0;
+		const V reduced = lessEqual(0.4375, ax);
+		if constexpr (Tier == MathAccuracy::Ulp4) {
+			atanAround(reduced, ax - 1.0, ax + 1.0, 1, num, den, hi, lo);
+		}
+		else {
+			atanAround(reduced, 2.0 * ax - 1.0, 2.0 + ax, 0, num, den, hi, lo);
+			atanAround(lessEqual(0.6875, ax), ax - 1.0, ax + 1.0, 1, num, den, hi, lo);
+			atanAround(lessEqual(1.1875, ax), ax - 1.5, 1.0 + 1.5 * ax, 2, num, den, hi, lo);
+		}
+		atanAround(lessEqual(2.4375, ax), V(-1.0), ax, 3, num, den, hi, lo);
+
+		const V t = num / den;
+		const V z = t * t;
+		const V w = z * z;
+		const V s1 = z * (AT[0] + w * (AT[2] + w * (AT[4] + w * (AT[6] + w * (AT[8] + w * AT[10])))));
+		const V s2 = w * (AT[1] + w * (AT[3] + w * (AT[5] + w * (AT[7] + w * AT[9]))));
+		const V result = select(reduced, hi - ((t * (s1 + s2) - lo) - t), t - t * (s1 + s2));
+		return result ^ sign;
+	}
+	static double fallback(double x) { return std::atan(x); }
+};
+
+template<MathAccuracy Tier>
+struct Log
+{
+	template<typename L>
+	RATIONALIS_INLINE static Vec<L> apply(Vec<L> x, Vec<L>& slow)
+	{
+		using V = Vec<L>;
+		// Zero, negatives, subnormals, infinity and NaN
+		slow = less(x, 0x1p-1022) | outside(x, std::numeric_limits<double>::max());
+		// x = 2^k m with m in [1, 2), then halved at sqrt(2) so f = m - 1 stays small
+		V m = (x & V::fromBits(MantissaBits)) | V::fromBits(OneBits);
+		V k = ((x >> 52) | V::fromBits(TwoTo52Bits)) - (0x1p52 + 1023.0);
+		const V nearSqrt2 = lessEqual(0x1.6147ap0, m) & less(m, 0x1.6b852p0);
+		const V high = lessEqual(0x1.6a09cp0, m);
+		m = select(high, m * 0.5, m);
+		k = select(high, k + 1.0, k);
+
+		const V f = m - 1.0;
+		const V hfsq = 0.5 * f * f;
+		const V s = f / (2.0 + f);
+		const V z = s * s;
+		const V w = z * z;
+		const V R = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7))) + w * (Lg2 + w * (Lg4 + w * Lg6));
+		if constexpr (Tier == MathAccuracy::Ulp4)
+			return (f - (hfsq - s * (hfsq + R))) + k * Ln2;
+		else
+			return select(nearSqrt2, k * Ln2Hi - ((hfsq - (s * (hfsq + R) + k * Ln2Lo)) - f), k * Ln2Hi - ((s * (f - R) - k * Ln2Lo) - f));
+	}
+	static double fallback(double x) { return std::log(x); }
+};
+
+// -----------------------------------------------------
+// Correctly rounded: every function is computed in double-double arithmetic,
+// about 104 bits, and rounded once. That gives the nearest double unless the
+// exact result lies within about 2^-100 of halfway between two doubles.
+struct DoubleDouble
+{
+	double hi;
+	double lo;
+
+	DoubleDouble(double hi, double lo = 0.0) : hi(hi), lo(lo) {}
+};
+
+// |a| >= |b|
+static DoubleDouble quickTwoSum(double a, double b)
+{
+	const double s = a + b;
+	return { s, b - (s - a) };
+}
+
+static DoubleDouble twoSum(double a, double b)
+{
+	const double s = a + b;
+	const double bb = s - a;
+	return { s, (a - (s - bb)) + (b - bb) };
+}
+
+// Dekker's product, exact without a fused multiply-add for |a|, |b| below 2^996
+static DoubleDouble twoProduct(double a, double b)
+{
+	constexpr double Split = 0x1p27 + 1.0;
+	const double p = a * b;
+	const double ta = Split * a;
+	const double ah = ta - (ta - a);
+	const double al = a - ah;
+	const double tb = Split * b;
+	const double bh = tb - (tb - b);
+	const double bl = b - bh;
+	return { p, ((ah * bh - p) + ah * bl + al * bh) + al * bl };
+}
+
+static DoubleDouble operator+(DoubleDouble a, DoubleDouble b)
+{
+	DoubleDouble s = twoSum(a.hi, b.hi);
+	const DoubleDouble t = twoSum(a.lo, b.lo);
+	s = quickTwoSum(s.hi, s.lo + t.hi);
+	return quickTwoSum(s.hi, s.lo + t.lo);
+}
+
+static DoubleDouble operator-(DoubleDouble a)
+{
+	return { -a.hi, -a.lo };
+}
+
+static DoubleDouble operator-(DoubleDouble a, DoubleDouble b)
+{
+	return a + -b;
+}
+
+static DoubleDouble operator*(DoubleDouble a, DoubleDouble b)
+{
+	const DoubleDouble p = twoProduct(a.hi, b.hi);
+	return quickTwoSum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+static DoubleDouble operator/(DoubleDouble a, DoubleDouble b)
+{
+	const double q1 = a.hi / b.hi;
+	DoubleDouble r = a - b * q1;
+	const double q2 = r.hi / b.hi;
+	r = r - b * q2;
+	const double q3 = r.hi / b.hi;
+	return quickTwoSum(q1, q2) + q3;
+}
+
+static DoubleDouble sqrt(DoubleDouble a)
+{
+	if (a.hi <= 0.0)
+		return std::sqrt(a.hi);
+	const double s = std::sqrt(a.hi);
+	const DoubleDouble square = twoProduct(s, s);
+	return quickTwoSum(s, (((a.hi - square.hi) - square.lo) + a.lo) / (2.0 * s));
+}
+
+static DoubleDouble twice(DoubleDouble a)
+{
+	return { 2.0 * a.hi, 2.0 * a.lo };
+}
+
+// c[0] - u (c[1] - u (c[2] - ...)), or the same with + where alternating is false
+static DoubleDouble series(DoubleDouble u, const DoubleDouble* c, size_t count, bool alternating)
+{
+	DoubleDouble sum = c[count - 1];
+	for (size_t k = count - 1; k-- > 0;) {
+		sum = sum * u;
+		sum = alternating ? c[k] - sum : c[k] + sum;
+	}
+	return sum;
+}
+
+// 1/(2k+1)!, enough for sin r to 2^-110 with |r| <= pi/4
+static const DoubleDouble SinCoefficients[] = {
+	{ 0x1.0000000000000p+0, 0.0 },
+	{ 0x1.5555555555555p-3, 0x1.5555555555555p-57 },
+	{ 0x1.1111111111111p-7, 0x1.1111111111111p-63 },
+	{ 0x1.a01a01a01a01ap-13, 0x1.a01a01a01a01ap-73 },
+	{ 0x1.71de3a556c734p-19, -0x1.c154f8ddc6c00p-73 },
+	{ 0x1.ae64567f544e4p-26, -0x1.c062e06d1f209p-80 },
+	{ 0x1.6124613a86d09p-33, 0x1.f28e0cc748ebep-87 },
+	{ 0x1.ae7f3e733b81fp-41, 0x1.1d8656b0ee8cbp-97 },
+	{ 0x1.952c77030ad4ap-49, 0x1.ac981465ddc6cp-103 },
+	{ 0x1.2f49b46814157p-57, 0x1.2650f61dbdcb4p-112 },
+	{ 0x1.71b8ef6dcf572p-66, -0x1.d043ae40c4647p-120 },
+	{ 0x1.761b41316381ap-75, -0x1.3423c7d91404fp-130 },
+	{ 0x1.3f3ccdd165fa9p-84, -0x1.58ddadf344487p-139 },
+	{ 0x1.d1ab1c2dccea3p-94, 0x1.054d0c78aea14p-149 },
+	{ 0x1.259f98b4358adp-103, 0x1.eaf8c39dd9bc5p-157 },
+};
+
+// 1/(2k)!
+static const DoubleDouble CosCoefficients[] = {
+	{ 0x1.0000000000000p+0, 0.0 },
+	{ 0x1.0000000000000p-1, 0.0 },
+	{ 0x1.5555555555555p-5, 0x1.5555555555555p-59 },
+	{ 0x1.6c16c16c16c17p-10, -0x1.f49f49f49f49fp-65 },
+	{ 0x1.a01a01a01a01ap-16, 0x1.a01a01a01a01ap-76 },
+	{ 0x1.27e4fb7789f5cp-22, 0x1.cbbc05b4fa99ap-76 },
+	{ 0x1.1eed8eff8d898p-29, -0x1.2aec959e14c06p-83 },
+	{ 0x1.93974a8c07c9dp-37, 0x1.05d6f8a2efd1fp-92 },
+	{ 0x1.ae7f3e733b81fp-45, 0x1.1d8656b0ee8cbp-101 },
+	{ 0x1.6827863b97d97p-53, 0x1.eec01221a8b0bp-107 },
+	{ 0x1.e542ba4020225p-62, 0x1.ea72b4afe3c2fp-120 },
+	{ 0x1.0ce396db7f853p-70, -0x1.aebcdbd20331cp-124 },
+	{ 0x1.f2cf01972f578p-80, -0x1.9ada5fcc1ab14p-135 },
+	{ 0x1.88e85fc6a4e5ap-89, -0x1.71c37ebd16540p-143 },
+	{ 0x1.0a18a2635085dp-98, 0x1.b9e2e28e1aa54p-153 },
+	{ 0x1.3932c5047d60ep-108, 0x1.832b7b530a627p-162 },
+};
+
+// 1/(2k+1), for atan with |u| <= 1/16 (15 terms) and atanh with |s| <= 0.172 (23 terms)
+static const DoubleDouble InverseOdd[] = {
+	{ 0x1.0000000000000p+0, 0.0 },
+	{ 0x1.5555555555555p-2, 0x1.5555555555555p-56 },
+	{ 0x1.999999999999ap-3, -0x1.999999999999ap-57 },
+	{ 0x1.2492492492492p-3, 0x1.2492492492492p-57 },
+	{ 0x1.c71c71c71c71cp-4, 0x1.c71c71c71c71cp-58 },
+	{ 0x1.745d1745d1746p-4, -0x1.745d1745d1746p-59 },
+	{ 0x1.3b13b13b13b14p-4, -0x1.3b13b13b13b14p-58 },
+	{ 0x1.1111111111111p-4, 0x1.1111111111111p-60 },
+	{ 0x1.e1e1e1e1e1e1ep-5, 0x1.e1e1e1e1e1e1ep-61 },
+	{ 0x1.af286bca1af28p-5, 0x1.af286bca1af28p-59 },
+	{ 0x1.8618618618618p-5, 0x1.8618618618618p-59 },
+	{ 0x1.642c8590b2164p-5, 0x1.642c8590b2164p-60 },
+	{ 0x1.47ae147ae147bp-5, -0x1.eb851eb851eb8p-61 },
+	{ 0x1.2f684bda12f68p-5, 0x1.2f684bda12f68p-59 },
+	{ 0x1.1a7b9611a7b96p-5, 0x1.1a7b9611a7b96p-61 },
+	{ 0x1.0842108421084p-5, 0x1.0842108421084p-60 },
+	{ 0x1.f07c1f07c1f08p-6, -0x1.f07c1f07c1f08p-61 },
+	{ 0x1.d41d41d41d41dp-6, 0x1.0750750750750p-60 },
+	{ 0x1.bacf914c1bad0p-6, -0x1.bacf914c1bad0p-60 },
+	{ 0x1.a41a41a41a41ap-6, 0x1.0690690690690p-60 },
+	{ 0x1.8f9c18f9c18fap-6, -0x1.f3831f3831f38p-61 },
+	{ 0x1.7d05f417d05f4p-6, 0x1.7d05f417d05f4p-62 },
+	{ 0x1.6c16c16c16c17p-6, -0x1.f49f49f49f49fp-61 },
+};
+
+// atan(k/8)
+static const DoubleDouble AtanEighths[] = {
+	{ 0.0, 0.0 },
+	{ 0x1.fd5ba9aac2f6ep-4, -0x1.cd37686760c17p-59 },
+	{ 0x1.f5b75f92c80ddp-3, 0x1.8ab6e3cf7afbdp-57 },
+	{ 0x1.6f61941e4def1p-2, -0x1.c63aae6f6e918p-56 },
+	{ 0x1.dac670561bb4fp-2, 0x1.a2b7f222f65e2p-56 },
+	{ 0x1.1e00babdefeb4p-1, -0x1.928df287a668fp-58 },
+	{ 0x1.4978fa3269ee1p-1, 0x1.2419a87f2a458p-56 },
+	{ 0x1.700a7c5784634p-1, -0x1.8c34d25aadef6p-56 },
+	{ 0x1.921fb54442d18p-1, 0x1.1a62633145c07p-55 },
+};
+
+static const DoubleDouble PiOverTwo = { 0x1.921fb54442d18p+0, 0x1.1a62633145c07p-54 };
+// ln 2 in three parts, the first with 42 bits so k times it is exact for |k| < 2^11
+constexpr double Ln2Parts[] = { 0x1.62e42fefa38p-1, 0x1.ef35793c7673p-45, 0x1.f97b57a079a19p-103 };
+
+// The bits of 2/pi after the point, 32 at a time. 1408 bits cover the largest
+// double, whose multiples of 4 quadrants are skipped, plus 256 bits past it.
+static const uint32_t TwoOverPiBits[] = {
+	0xA2F9836E, 0x4E441529, 0xFC2757D1, 0xF534DDC0, 0xDB629599, 0x3C439041, 0xFE5163AB, 0xDEBBC561,
+	0xB7246E3A, 0x424DD2E0, 0x06492EEA, 0x09D1921C, 0xFE1DEB1C, 0xB129A73E, 0xE88235F5, 0x2EBB4484,
+	0xE99C7026, 0xB45F7E41, 0x3991D639, 0x835339F4, 0x9C845F8B, 0xBDF9283B, 0x1FF897FF, 0xDE05980F,
+	0xEF2F118B, 0x5A0A6D1F, 0x6D367ECF, 0x27CB09B7, 0x4F463F66, 0x9E5FEA2D, 0x7527BAC7, 0xEBE5F17B,
+	0x3D0739F7, 0x8A5292EA, 0x6BFB5FB1, 0x1F8D5D08, 0x56033046, 0xFC7B6BAB, 0xF0CFBC20, 0x9AF4361D,
+	0xA9E39161, 0x5EE61B08, 0x6599855F, 0x14A06840,
+};
+
+// x = quadrant pi/2 + r with |r| <= about pi/4, for finite x >= 0. Past pi/4
+// x times 2/pi is worked out in integers (Payne and Hanek), so even the
+// largest doubles keep about 200 bits of r.
+static DoubleDouble reduceQuadrantExactly(double x, unsigned& quadrant)
+{
+	quadrant = 0;
+	if (x <= Pio4)
+		return x;
+
+	// x = mantissa 2^exponent with an integer mantissa
+	const uint64_t bits = std::bit_cast<uint64_t>(x);
+	const int exponent = static_cast<int>(bits >> 52) - 1075;
+	const uint64_t mantissa = (bits & MantissaBits) | (uint64_t(1) << 52);
+	// Bits of 2/pi before first only add multiples of 4 quadrants. The 256
+	// from first on form window, least significant limb first.
+	const int first = std::max(1, exponent - 1);
+	const int limb = (first - 1) / 32;
+	const int shift = (first - 1) % 32;
+	uint32_t window[8];
+	for (int j = 0; j < 8; ++j) {
+		const int k = limb + 7 - j;
+		const uint64_t pair = (uint64_t(TwoOverPiBits[k]) << 32) | TwoOverPiBits[k + 1];
+		window[j] = static_cast<uint32_t>(pair >> (32 - shift));
+	}
+
+	uint32_t product[10] = {};
+	const uint64_t halves[2] = { mantissa & 0xFFFFFFFF, mantissa >> 32 };
+	for (int i = 0; i < 2; ++i) {
+		uint64_t carry = 0;
+		for (int j = 0; j < 8; ++j) {
+			const uint64_t t = halves[i] * window[j] + product[i + j] + carry;
+			product[i + j] = static_cast<uint32_t>(t);
+			carry = t >> 32;
+		}
+		product[i + 8] = static_cast<uint32_t>(carry);
+	}
+
+	// x 2/pi mod 4 is product 2^-point mod 4
+	const int point = first + 255 - exponent;
+	auto bitAt = [&](int i) { return (product[i / 32] >> (i % 32)) & 1u; };
+	unsigned q = bitAt(point) | (bitAt(point + 1) << 1);
+	DoubleDouble fraction = 0.0;
+	for (int k = point / 32; k >= 0; --k) {
+		const uint32_t below = k == point / 32 ? product[k] & ((uint32_t(1) << (point % 32)) - 1) : product[k];
+		fraction = fraction + std::ldexp(static_cast<double>(below), 32 * k - point);
+	}
+	if (fraction.hi >= 0.5) {
+		fraction = fraction - 1.0;
+		++q;
+	}
+	quadrant = q & 3;
+	return fraction * PiOverTwo;
+}
+
+static double sinCorrect(double x)
+{
+	const double ax = std::fabs(x);
+	if (!(ax < Infinity))
+		return std::sin(x);
+	if (ax < 0x1p-27)
+		return x;
+	unsigned quadrant;
+	const DoubleDouble r = reduceQuadrantExactly(ax, quadrant);
+	const DoubleDouble u = r * r;
+	DoubleDouble v = quadrant & 1 ? series(u, CosCoefficients, 16, true) : r * series(u, SinCoefficients, 15, true);
+	if (quadrant & 2)
+		v = -v;
+	const double result = v.hi + v.lo;
+	return x < 0 ? -result : result;
+}
+
+static double cosCorrect(double x)
+{
+	const double ax = std::fabs(x);
+	if (!(ax < Infinity))
+		return std::cos(x);
+	if (ax < 0x1p-27)
+		return 1.0;
+	unsigned quadrant;
+	const DoubleDouble r = reduceQuadrantExactly(ax, quadrant);
+	const DoubleDouble u = r * r;
+	DoubleDouble v = quadrant & 1 ? r * series(u, SinCoefficients, 15, true) : series(u, CosCoefficients, 16, true);
+	if ((quadrant + 1) & 2)
+		v = -v;
+	return v.hi + v.lo;
+}
+
+static double tanCorrect(double x)
+{
+	const double ax = std::fabs(x);
+	if (!(ax < Infinity))
+		return std::tan(x);
+	if (ax < 0x1p-27)
+		return x;
+	unsigned quadrant;
+	const DoubleDouble r = reduceQuadrantExactly(ax, quadrant);
+	const DoubleDouble u = r * r;
+	const DoubleDouble s = r * series(u, SinCoefficients, 15, true);
+	const DoubleDouble c = series(u, CosCoefficients, 16, true);
+	const DoubleDouble v = quadrant & 1 ? -(c / s) : s / c;
+	const double result = v.hi + v.lo;
+	return x < 0 ? -result : result;
+}
+
+// atan(t) for t >= 0, as atan(k/8) + atan((t - k/8) / (1 + t k/8)) with k/8 nearest to t
+static DoubleDouble atanPositive(DoubleDouble t)
+{
+	if (t.hi > 1.0)
+		return PiOverTwo - atanPositive(1.0 / t);
+	const int k = static_cast<int>(t.hi * 8.0 + 0.5);
+	const double c = k / 8.0;
+	const DoubleDouble u = (t - c) / (t * c + 1.0);
+	return AtanEighths[k] + u * series(u * u, InverseOdd, 15, true);
+}
+
+static double atanCorrect(double x)
+{
+	const double ax = std::fabs(x);
+	if (std::isnan(x) || ax < 0x1p-27)
+		return x;
+	const DoubleDouble v = ax == Infinity ? PiOverTwo : atanPositive(ax);
+	const double result = v.hi + v.lo;
+	return x < 0 ? -result : result;
+}
+
+// asin x = atan(x / sqrt(1 - x^2)), with 1 - x^2 taken as (1 - x)(1 + x)
+static double asinCorrect(double x)
+{
+	const double ax = std::fabs(x);
+	if (!(ax <= 1.0))
+		return std::asin(x);
+	if (ax < 0x1p-27)
+		return x;
+	const DoubleDouble v = ax == 1.0 ? PiOverTwo : atanPositive(DoubleDouble(ax) / sqrt(twoSum(1.0, -ax) * twoSum(1.0, ax)));
+	const double result = v.hi + v.lo;
+	return x < 0 ? -result : result;
+}
+
+// acos x = 2 atan(sqrt((1 - x) / (1 + x)))
+static double acosCorrect(double x)
+{
+	if (!(std::fabs(x) <= 1.0))
+		return std::acos(x);
+	if (x == 1.0)
+		return 0.0;
+	if (x == -1.0)
+		return PiHi;
+	const DoubleDouble v = twice(atanPositive(sqrt(twoSum(1.0, -x) / twoSum(1.0, x))));
+	return v.hi + v.lo;
+}
+
+// log x = k ln 2 + 2 atanh(f / (2 + f)) with x = 2^k (1 + f) and 1 + f within sqrt(2) of 1
+static double logCorrect(double x)
+{
+	if (!(x > 0.0 && x < Infinity))
+		return std::log(x);
+	if (x == 1.0)
+		return 0.0;
+	int k = 0;
+	if (x < 0x1p-1022) {
+		x *= 0x1p54;
+		k = -54;
+	}
+	const uint64_t bits = std::bit_cast<uint64_t>(x);
+	k += static_cast<int>(bits >> 52) - 1023;
+	double m = std::bit_cast<double>((bits & MantissaBits) | OneBits);
+	if (m > 0x1.6a09e667f3bcdp+0) {
+		m *= 0.5;
+		++k;
+	}
+	const double f = m - 1.0;
+	const DoubleDouble s = DoubleDouble(f) / twoSum(2.0, f);
+	const DoubleDouble logM = twice(s * series(s * s, InverseOdd, 23, false));
+	const DoubleDouble kLn2 = (DoubleDouble(k * Ln2Parts[0]) + twoProduct(k, Ln2Parts[1])) + k * Ln2Parts[2];
+	const DoubleDouble v = kLn2 + logM;
+	return v.hi + v.lo;
+}
+
+// -----------------------------------------------------
+// F over the first count of one vector of values, with the lanes it leaves
+// slow handed to F::fallback. in may be out.
+template<typename L, typename F>
+RATIONALIS_INLINE static void runVector(const double* in, double* out, size_t count)
+{
+	const Vec<L> x = L::load(in);
+	Vec<L> slow = 0.0;
+	const Vec<L> y = F::template apply<L>(x, slow);
+	const int lanes = laneBits(slow) & ((1 << count) - 1);
+	if (!lanes) {
+		L::store(out, y.v);
+		return;
+	}
+	double values[L::Width];
+	L::store(values, x.v);
+	L::store(out, y.v);
+	for (size_t i = 0; i < count; ++i) {
+		if (lanes & (1 << i))
+			out[i] = F::fallback(values[i]);
+	}
+}
+
+// F over n values, two vectors at a time. The last values are padded to a whole
+// vector, so every value goes through the same operations wherever it sits.
+template<typename L, typename F>
+RATIONALIS_INLINE static void runLanes(const double* a, double* out, size_t n)
+{
+	constexpr size_t W = L::Width;
+	size_t i = 0;
+	for (; i + 2 * W <= n; i += 2 * W) {
+		runVector<L, F>(a + i, out + i, W);
+		runVector<L, F>(a + i + W, out + i + W, W);
+	}
+	for (; i < n; i += W) {
+		const size_t count = std::min(W, n - i);
+		double padded[W] = {};
+		std::copy_n(a + i, count, padded);
+		runVector<L, F>(padded, padded, count);
+		std::copy_n(padded, count, out + i);
+	}
+}
+
+template<typename F>
+static void runScalar(const double* a, double* out, size_t n)
+{
+	runLanes<ScalarLanes, F>(a, out, n);
+}
+
+#ifdef RATIONALIS_X86
+template<typename F>
+static void runSse2(const double* a, double* out, size_t n)
+{
+	runLanes<Sse2Lanes, F>(a, out, n);
+}
+
+template<typename F>
+RATIONALIS_TARGET_AVX2 static void runAvx2(const double* a, double* out, size_t n)
+{
+	runLanes<Avx2Lanes, F>(a, out, n);
+}
+#endif
+
+// The same operations for one value
+template<typename F>
+static double runOne(double x)
+{
+	Vec<ScalarLanes> slow = 0.0;
+	const Vec<ScalarLanes> y = F::template apply<ScalarLanes>(x, slow);
+	return laneBits(slow) ? F::fallback(x) : y.v;
+}
+
+template<double (*F)(double)>
+static void runEach(const double* a, double* out, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = F(a[i]);
+}
+
+template<typename F>
+static void setVectorized(MathKernels& kernels, KeywordType id)
+{
+	const size_t i = static_cast<size_t>(id);
+	kernels.functions[i] = runOne<F>;
+	switch (kernels.level)
+	{
+#ifdef RATIONALIS_X86
+	case SimdLevel::AVX2:
+		kernels.kernels[i] = runAvx2<F>;
+		break;
+	case SimdLevel::SSE2:
+		kernels.kernels[i] = runSse2<F>;
+		break;
+#endif
+	default:
+		kernels.kernels[i] = runScalar<F>;
+		break;
+	}
+}
+
+template<MathAccuracy Tier>
+static void setVectorized(MathKernels& kernels)
+{
+	setVectorized<Sin<Tier>>(kernels, KeywordType::Sin);
+	setVectorized<Cos<Tier>>(kernels, KeywordType::Cos);
+	setVectorized<Tan<Tier>>(kernels, KeywordType::Tan);
+	setVectorized<Asin<Tier>>(kernels, KeywordType::Asin);
+	setVectorized<Acos<Tier>>(kernels, KeywordType::Acos);
+	setVectorized<Atan<Tier>>(kernels, KeywordType::Atan);
+	setVectorized<Log<Tier>>(kernels, KeywordType::Log);
+}
+
+template<double (*F)(double)>
+static void setCorrect(MathKernels& kernels, KeywordType id)
+{
+	kernels.functions[static_cast<size_t>(id)] = F;
+	kernels.kernels[static_cast<size_t>(id)] = runEach<F>;
+}
+
+static MathKernels makeKernels(MathAccuracy accuracy, SimdLevel level)
+{
+	MathKernels kernels{ accuracy, level };
+	// Hardware square roots are correctly rounded at every level
+	kernels.kernels[static_cast<size_t>(KeywordType::Sqrt)] = SimdKernels::get(level).sqrt;
+	switch (accuracy)
+	{
+	case MathAccuracy::CorrectlyRounded:
+		setCorrect<sinCorrect>(kernels, KeywordType::Sin);
+		setCorrect<cosCorrect>(kernels, KeywordType::Cos);
+		setCorrect<tanCorrect>(kernels, KeywordType::Tan);
+		setCorrect<asinCorrect>(kernels, KeywordType::Asin);
+		setCorrect<acosCorrect>(kernels, KeywordType::Acos);
+		setCorrect<atanCorrect>(kernels, KeywordType::Atan);
+		setCorrect<logCorrect>(kernels, KeywordType::Log);
+		break;
+	case MathAccuracy::Ulp1:
+		setVectorized<MathAccuracy::Ulp1>(kernels);
+		break;
+	case MathAccuracy::Ulp4:
+		setVectorized<MathAccuracy::Ulp4>(kernels);
+		break;
+	default:
+		// Libm functions are left to KeywordInfo
+		break;
+	}
+	return kernels;
+}
+
+const MathKernels& MathKernels::get(MathAccuracy accuracy, SimdLevel level)
+{
+	constexpr size_t Accuracies = 4;
+	constexpr size_t Levels = 3;
+	static const std::array<MathKernels, Accuracies * Levels> table = [] {
+		std::array<MathKernels, Accuracies * Levels> result;
+		for (size_t a = 0; a < Accuracies; ++a) {
+			for (size_t l = 0; l < Levels; ++l)
+				result[a * Levels + l] = makeKernels(static_cast<MathAccuracy>(a), static_cast<SimdLevel>(l));
+		}
+		return result;
+	}();
+	const SimdLevel clamped = std::min(level, detectSimdLevel());
+	return table[static_cast<size_t>(accuracy) * Levels + static_cast<size_t>(clamped)];
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "CpuFeatures.h"
+#include "Keyword.h"
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// How close the one-argument keywords come to the exact result
+enum class MathAccuracy {
+	// std::sin and friends, what every evaluation used before the others existed
+	Libm,
+	// The double nearest to the exact result, one value at a time
+	CorrectlyRounded,
+	// Within 1 ulp, several values at a time
+	Ulp1,
+	// Within 4 ulp, the same polynomials without the correction steps
+	Ulp4
+};
+
+std::string mathAccuracyToString(MathAccuracy accuracy);
+// "libm", "correct", "ulp1" or "ulp4"
+MathAccuracy parseMathAccuracy(std::string_view name);
+
+// The one-argument keywords at one accuracy: kernels over n contiguous values
+// like SimdKernels, and the same math one value at a time. The Ulp1 and Ulp4
+// kernels run 2 (SSE2) or 4 (AVX2) lanes per vector, two vectors per step, and
+// give the same bits at every level and one value at a time. sqrt is correctly
+// rounded at every accuracy.
+struct MathKernels
+{
+	using Unary = void (*)(const double* a, double* out, size_t n);
+	using Function = double (*)(double);
+
+	MathAccuracy accuracy;
+	SimdLevel level;
+	// Indexed by KeywordType. Null where KeywordInfo is called instead: keywords
+	// with other than one argument, and every Libm function. sqrt has a kernel
+	// at every accuracy but no function, since std::sqrt is already exact.
+	std::array<Unary, static_cast<size_t>(KeywordType::Total)> kernels{};
+	std::array<Function, static_cast<size_t>(KeywordType::Total)> functions{};
+
+	// Applies info to count arguments, like KeywordInfo::call
+	double call(const KeywordInfo& info, const double* args, size_t count) const
+	{
+		if (Function f = functions[static_cast<size_t>(info.id)])
+			return f(args[0]);
+		return info.call(args, count);
+	}
+
+	// Kernels for the given accuracy and level, clamped to what this CPU supports
+	static const MathKernels& get(MathAccuracy accuracy, SimdLevel level = detectSimdLevel());
+};
@@ -0,0 +1,255 @@
+#include "Optimizer.h"
+#include "Expr.h"
+#include "ArrayExpr.h"
+#include <cstring>
+#include <format>
+#include <utility>
+#include <vector>
+
+// Exact comparison, so 0.0 and -0.0 are told apart
+static bool isNumber(const Expr* expr, double value)
+{
+	auto* number = dynamic_cast<const NumberExpr*>(expr);
+	return number && std::memcmp(&number->value, &value, sizeof(double)) == 0;
+}
+
+static bool isConstant(const Expr* expr)
+{
+	return dynamic_cast<const NumberExpr*>(expr) != nullptr;
+}
+
+// The node is only evaluated once here, on numbers, so the folded value is the
+// exact value it would have produced at runtime. Where eval throws, expr is
+// left in the tree for simplifyTree to delete.
+static Expr* fold(Expr* expr, Simplifier& pass)
+{
+	auto* number = new NumberExpr(expr->eval());
+	delete expr;
+	pass.stats.folded++;
+	return number;
+}
+
+// -----------------------------------------------------
+Expr* NumberExpr::simplify(Simplifier&)
+{
+	return this;
+}
+
+Expr* IdentifierExpr::simplify(Simplifier&)
+{
+	return this;
+}
+
+Expr* UnaryExpr::simplify(Simplifier& pass)
+{
+	if (isConstant(operand)) {
+		return fold(this, pass);
+	}
+
+	auto* inner = dynamic_cast<UnaryExpr*>(operand);
+	bool doubleNegation = op == TokenType::Minus && inner && inner->op == TokenType::Minus;
+	if (op == TokenType::Plus || doubleNegation) {
+		// +x and -(-x) are exactly x
+		Expr* result = doubleNegation ? inner->operand : operand;
+		if (doubleNegation)
+			inner->operand = nullptr;
+		else
+			operand = nullptr;
+		delete this;
+		pass.stats.rewritten++;
+		return result;
+	}
+	return this;
+}
+
+// Replaces the binary node by one of its children
+static Expr* keepChild(BinaryExpr* expr, Expr*& child, Simplifier& pass)
+{
+	Expr* result = child;
+	child = nullptr;
+	delete expr;
+	pass.stats.rewritten++;
+	return result;
+}
+
+static Expr* replaceWith(BinaryExpr* expr, double value, Simplifier& pass)
+{
+	delete expr;
+	pass.stats.rewritten++;
+	return new NumberExpr(value);
+}
+
+Expr* BinaryExpr::simplify(Simplifier& pass)
+{
+	if (isConstant(left) && isConstant(right)) {
+		return fold(this, pass);
+	}
+
+	const bool relaxed = !pass.options.strict;
+	switch (op)
+	{
+	case TokenType::Plus:
+		// x + -0 is x for every x, but x + 0 turns -0 into +0
+		if (isNumber(right, -0.0) || (relaxed && isNumber(right, 0.0)))
+			return keepChild(this, left, pass);
+		if (isNumber(left, -0.0) || (relaxed && isNumber(left, 0.0)))
+			return keepChild(this, right, pass);
+		break;
+	case TokenType::Minus:
+		if (isNumber(right, 0.0) || (relaxed && isNumber(right, -0.0)))
+			return keepChild(this, left, pass);
+		break;
+	case TokenType::Mult:
+		if (isNumber(right, 1.0))
+			return keepChild(this, left, pass);
+		if (isNumber(left, 1.0))
+			return keepChild(this, right, pass);
+		// Wrong for NaN, infinities and the sign of zero
+		if (relaxed && (isNumber(left, 0.0) || isNumber(right, 0.0)))
+			return replaceWith(this, 0.0, pass);
+		break;
+	case TokenType::Div:
+		if (isNumber(right, 1.0))
+			return keepChild(this, left, pass);
+		break;
+	case TokenType::Pow:
+		if (relaxed && isNumber(right, 1.0))
+			return keepChild(this, left, pass);
+		if (relaxed && isNumber(right, 0.0))
+			return replaceWith(this, 1.0, pass);
+		break;
+	default:
+		break;
+	}
+
+	// c1 + (c2 + x) => (c1 + c2) + x, and the same for *. This rounds differently.
+	auto* inner = dynamic_cast<BinaryExpr*>(right);
+	if (relaxed && (op == TokenType::Plus || op == TokenType::Mult) && isConstant(left) &&
+		inner && inner->op == op && isConstant(inner->left))
+	{
+		double c1 = left->eval();
+		double c2 = inner->left->eval();
+		Expr* rest = inner->right;
+		inner->right = nullptr;
+		TokenType combined = op;
+		delete this;
+		pass.stats.rewritten++;
+		double value = combined == TokenType::Plus ? c1 + c2 : c1 * c2;
+		return new BinaryExpr(combined, new NumberExpr(value), rest);
+	}
+	return this;
+}
+
+// All keywords are pure, so a call with constant arguments is a constant
+Expr* KeywordExpr::simplify(Simplifier& pass)
+{
+	bool allConstant = true;
+	for (const Expr* operand : operands) {
+		allConstant = allConstant && isConstant(operand);
+	}
+	if (allConstant) {
+		return fold(this, pass);
+	}
+	return this;
+}
+
+// User functions may read variables or call native code, so calls are never folded
+Expr* FunctionExpr::simplify(Simplifier&)
+{
+	return this;
+}
+
+// The element-wise part of an array is left as it is, only its inputs are simplified
+Expr* ArrayLiteralExpr::simplify(Simplifier&)
+{
+	return this;
+}
+
+Expr* ArrayIdentifierExpr::simplify(Simplifier&)
+{
+	return this;
+}
+
+Expr* ArrayExpr::simplify(Simplifier&)
+{
+	return this;
+}
+
+// Named arrays may be bound again, but a reduction of literals and constants is a constant
+Expr* ReduceExpr::simplify(Simplifier& pass)
+{
+	if (!isLiteral()) {
+		return this;
+	}
+	for (size_t i = 0; i < childCount(); ++i) {
+		if (!isConstant(child(i)))
+			return this;
+	}
+	return fold(this, pass);
+}
+
+// -----------------------------------------------------
+size_t SimplifyStats::removed() const
+{
+	return nodesBefore - nodesAfter;
+}
+
+std::string SimplifyStats::toString() const
+{
+	return std::format("nodes: {} -> {} ({} removed), folded: {}, rewritten: {}", nodesBefore, nodesAfter, removed(), folded, rewritten);
+}
+
+size_t countNodes(const Expr* expr)
+{
+	size_t count = 0;
+	std::vector<const Expr*> pending;
+	if (expr)
+		pending.push_back(expr);
+	while (!pending.empty()) {
+		const Expr* next = pending.back();
+		pending.pop_back();
+		++count;
+		for (size_t i = 0; i < next->childCount(); ++i)
+			pending.push_back(next->child(i));
+	}
+	return count;
+}
+
+// Simplifies bottom up with an explicit stack. Every node is replaced in the
+// slot that points to it, so a parent sees its simplified children. A node
+// that throws, like a fold whose eval fails, stays in place, so the tree is
+// whole and can be deleted.
+static Expr* simplifyTree(Expr* root, Simplifier& pass)
+{
+	std::vector<std::pair<Expr**, size_t>> stack{ { &root, 0 } };
+	try {
+		while (!stack.empty()) {
+			auto [slot, next] = stack.back();
+			Expr* expr = *slot;
+			if (next < expr->childCount()) {
+				++stack.back().second;
+				stack.push_back({ &expr->child(next), 0 });
+				continue;
+			}
+			*slot = expr->simplify(pass);
+			stack.pop_back();
+		}
+	}
+	catch (...) {
+		delete root;
+		throw;
+	}
+	return root;
+}
+
+Expr* simplify(Expr* expr, const SimplifyOptions& options, SimplifyStats* stats)
+{
+	Simplifier pass{ options };
+	pass.stats.nodesBefore = countNodes(expr);
+	Expr* result = simplifyTree(expr, pass);
+	pass.stats.nodesAfter = countNodes(result);
+	if (stats) {
+		*stats = pass.stats;
+	}
+	return result;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+struct Expr;
+
+struct SimplifyOptions
+{
+	// Only rewrite when the result is bit-identical for every input, e.g. x*1
+	// but not x+0 (which turns -0 into +0) or 2*(3*x) (which rounds differently)
+	bool strict = true;
+};
+
+struct SimplifyStats
+{
+	size_t nodesBefore = 0;
+	size_t nodesAfter = 0;
+	// Constant subtrees replaced by a number
+	size_t folded = 0;
+	// Algebraic identities applied
+	size_t rewritten = 0;
+
+	size_t removed() const;
+	std::string toString() const;
+};
+
+struct Simplifier
+{
+	SimplifyOptions options;
+	SimplifyStats stats;
+};
+
+// Folds constant subtrees and applies algebraic identities. Takes ownership
+// of expr and returns the simplified tree, which may be a different node.
+// When it throws, expr has been deleted.
+Expr* simplify(Expr* expr, const SimplifyOptions& options = {}, SimplifyStats* stats = nullptr);
+size_t countNodes(const Expr* expr);
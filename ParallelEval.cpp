@@ -0,0 +1,34 @@
+#include "ParallelEval.h"
+#include <exception>
+#include <memory>
+
+// Small enough to balance, large enough that stealing stays rare
+constexpr size_t jobGrain = 64;
+
+bool EvalResult::ok() const
+{
+	return error.empty();
+}
+
+std::vector<EvalResult> evaluateJobs(std::span<const EvalJob> jobs, ThreadPool& pool, ExprCache& cache, const VariableStore& variables, MathAccuracy accuracy)
+{
+	std::vector<EvalResult> results(jobs.size());
+	// One per worker plus one for the calling thread
+	std::vector<std::unique_ptr<EvalContext>> contexts;
+	for (size_t i = 0; i <= pool.size(); ++i) {
+		contexts.push_back(std::make_unique<EvalContext>(cache, variables, accuracy));
+	}
+
+	pool.parallelFor(jobs.size(), jobGrain, [&](size_t begin, size_t end, size_t worker) {
+		EvalContext& context = *contexts[worker];
+		for (size_t i = begin; i < end; ++i) {
+			try {
+				results[i].value = context.evaluate(jobs[i].source, jobs[i].bindings);
+			}
+			catch (const std::exception& e) {
+				results[i].error = e.what();
+			}
+		}
+	});
+	return results;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "EvalContext.h"
+#include "ExprCache.h"
+#include "ThreadPool.h"
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One formula and the values of its identifiers
+struct EvalJob
+{
+	std::string_view source;
+	std::span<const Binding> bindings;
+};
+
+struct EvalResult
+{
+	double value = 0.0;
+	// Empty unless the job failed to parse or evaluate
+	std::string error;
+
+	bool ok() const;
+};
+
+// Evaluates every job on pool, each worker with its own EvalContext on cache and
+// variables, and returns the results in the order of jobs. A failing job only
+// fails its own result.
+std::vector<EvalResult> evaluateJobs(std::span<const EvalJob> jobs, ThreadPool& pool, ExprCache& cache, const VariableStore& variables, MathAccuracy accuracy = MathAccuracy::Libm);
@@ -1,6 +1,13 @@
 #include "ParseRule.h"
 #include "Parser.h"
 #include "Keyword.h"
+#include "ArrayExpr.h"
+#include "Function.h"
+#include "PerfCounters.h"
+#include "IterativeParser.h"
+#include <algorithm>
+#include <memory>
+#include <span>
 #include <string>
 #include <print>
 
@@ -8,41 +15,42 @@
 
 const ParseTable& ParseRule::Table()
 {
-	static ParseTable table = {
-		ParseRule{ nudUnary, ledBinary, 10, 10}, // Plus
-		ParseRule{ nudUnary, ledBinary, 10, 10}, // Minus
-		ParseRule{ nullptr, ledBinary, 20, 20 }, // Mult
-		ParseRule{ nullptr, ledBinary, 20, 20 }, // Div
-		ParseRule{ nullptr, ledBinary, 40, 30 }, // Pow
-		ParseRule{ nudGroup, nullptr, 0, 0 },  // LBracket
-		ParseRule{ nullptr, ledNone, 0, 0},  // RBracket
-		ParseRule{ nudLiteral, nullptr, 0, 0 },  // Number
-		ParseRule{ nullptr, ledEquals, 0, 0 },  // Equals
-		ParseRule{ nudIdentifier, nullptr, 0, 0 },  // Identifier
-		ParseRule{ nudKeyword, nullptr, 0, 0 },  // Keyword
-		ParseRule{ nullptr, nullptr, 0, 0 },  // Comma
-		ParseRule{ nullptr, nullptr, 0, 0 }   // EndOfFile
-	};
+	static ParseTable table = [] {
+		ParseTable rules = {
+			ParseRule{ nudUnary, ledBinary }, // Plus
+			ParseRule{ nudUnary, ledBinary }, // Minus
+			ParseRule{ nullptr, ledBinary }, // Mult
+			ParseRule{ nullptr, ledBinary }, // Div
+			ParseRule{ nullptr, ledBinary }, // Pow
+			ParseRule{ nudGroup, nullptr },  // LBracket
+			ParseRule{ nullptr, ledNone },  // RBracket
+			ParseRule{ nudLiteral, nullptr },  // Number
+			ParseRule{ nullptr, ledEquals },  // Equals
+			ParseRule{ nudIdentifier, nullptr },  // Identifier
+			ParseRule{ nudKeyword, nullptr },  // Keyword
+			ParseRule{ nullptr, nullptr },  // Comma
+			ParseRule{ nudArray, nullptr },  // LSquare
+			ParseRule{ nullptr, nullptr },  // RSquare
+			ParseRule{ nullptr, nullptr }   // EndOfFile
+		};
+		for (size_t i = 0; i < rules.size(); ++i) {
+			rules[i].lbp = BindingPowers[i].lbp;
+			rules[i].rbp = BindingPowers[i].rbp;
+		}
+		return rules;
+	}();
 
     return table;
 }
 
-Expr* nudKeyword(PrattParser& parser)
+// Parses the bracketed arguments of a call taking argCount of them, or any number if it is -1
+static std::vector<Expr*> parseArguments(PrattParser& parser, int argCount)
 {
-	const Token& identifier = parser.peek();
-	if (identifier.type != TokenType::Keyword)
-	{
-		ERR("Expected an identifier");
-	}
-	parser.consume(); // Consume the identifier token
-
-	const KeywordInfo& identifierDetails = KeywordInfo::getTable().getByName(identifier.content);
 	std::vector<Expr*> arguments;
-	arguments.reserve(std::max(0, identifierDetails.argCount)); // Reserve space for arguments
-
-	if (identifierDetails.argCount == 0) {
-		return new KeywordExpr(identifierDetails.id, {});
+	if (argCount == 0) {
+		return arguments;
 	}
+	arguments.reserve(std::max(0, argCount)); // Reserve space for arguments
 
 	if (parser.peek().type != TokenType::LBracket)
 	{
@@ -50,50 +58,90 @@ Expr* nudKeyword(PrattParser& parser)
 	}
 	parser.consume(); // Consume the opening bracket if there are arguments
 
-	// Parse arguments separated by commas
-	for (size_t i = 0; i < identifierDetails.argCount - 1; ++i) {
-		arguments.push_back(parseExpr(parser, TokenType::Comma, 0));
-		if (parser.peek().type == TokenType::Comma) {
+	if (argCount < 0) {
+		// Any number of arguments; a binding power of 1 stops at both commas and the closing bracket
+		while (parser.peek().type != TokenType::RBracket) {
+			arguments.push_back(parseExpr(parser, TokenType::Comma, 1));
+			if (parser.peek().type != TokenType::Comma) {
+				break;
+			}
 			parser.consume(); // Consume the comma
 		}
 	}
-	// Parse the last argument, which is followed by a closing bracket
-	arguments.push_back(parseExpr(parser, TokenType::RBracket, 0));
+	else {
+		// Parse arguments separated by commas. A binding power of 1 also stops at a
+		// closing bracket, so too few arguments are an error instead of a hang.
+		for (int i = 0; i < argCount - 1; ++i) {
+			arguments.push_back(parseExpr(parser, TokenType::Comma, 1));
+			if (parser.peek().type == TokenType::Comma) {
+				parser.consume(); // Consume the comma
+			}
+		}
+		// Parse the last argument, which is followed by a closing bracket
+		arguments.push_back(parseExpr(parser, TokenType::RBracket, 0));
+	}
 
 	if (parser.peek().type != TokenType::RBracket)
 	{
 		ERR("Expected closing bracket");
 	}
-	parser.consume(); // Consume the closing bracket	
-	
+	parser.consume(); // Consume the closing bracket
+	return arguments;
+}
+
+Expr* nudKeyword(PrattParser& parser)
+{
+	const Token identifier = parser.peek();
+	if (identifier.type != TokenType::Keyword)
+	{
+		ERR("Expected an identifier");
+	}
+	parser.consume(); // Consume the identifier token
+
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	if (!keywords.contains(identifier.content)) {
+		// Everything else the lexer marks as a keyword is a user function
+		FunctionRef function = parser.getScope().functions.find(identifier.content);
+		if (!function)
+		{
+			ERR(std::format("Unknown function: {}", identifier.content));
+		}
+		std::vector<Expr*> arguments = parseArguments(parser, static_cast<int>(function->argCount));
+		return new FunctionExpr(std::move(function), std::move(arguments));
+	}
+
+	const KeywordInfo& identifierDetails = keywords.getByName(identifier.content);
+	std::vector<Expr*> arguments = parseArguments(parser, identifierDetails.argCount);
+	// The only arity check; evaluation trusts the argument count from here on
+	identifierDetails.checkArity(arguments.size());
 	return new KeywordExpr(identifierDetails.id, std::move(arguments));
 }
 
 Expr* nudLiteral(PrattParser& parser)
 {
-	const Token& peek = parser.peek();
+	const Token peek = parser.peek();
 	if (peek.type != TokenType::Number)
 	{
 		ERR("Expected a number");
 	}
 	parser.consume();
-	return new NumberExpr{ std::stod(peek.content) };
+	return new NumberExpr{ peek.number };
 }
 
 Expr* nudIdentifier(PrattParser& parser)
 {
-	const Token& peek = parser.peek();
+	const Token peek = parser.peek();
 	if (peek.type != TokenType::Identifier)
 	{
 		ERR("Expected an identifier");
 	}
 	parser.consume(); // Consume the identifier token
-	return new IdentifierExpr(peek.content);
+	return new IdentifierExpr(std::string(peek.content));
 }
 
 Expr* nudUnary(PrattParser& parser)
 {
-	const Token& peek = parser.peek();
+	const Token peek = parser.peek();
 	if (peek.type != TokenType::Plus && peek.type != TokenType::Minus)
 	{
 		ERR("Expected unary operator");
@@ -110,7 +158,7 @@ Expr* nudUnary(PrattParser& parser)
 
 Expr* ledBinary(PrattParser& parser, Expr* expr1)
 {
-	const Token& peek = parser.peek();
+	const Token peek = parser.peek();
 	if (peek.type != TokenType::Plus && peek.type != TokenType::Minus &&
 		peek.type != TokenType::Mult && peek.type != TokenType::Div && peek.type != TokenType::Pow)
 	{
@@ -134,6 +182,44 @@ Expr* nudGroup(PrattParser& parser)
 	return expr;
 }
 
+std::vector<double> parseArrayLiteral(PrattParser& parser)
+{
+	parser.consume(); // Consume the opening bracket
+	std::vector<double> values;
+	if (parser.peek().type == TokenType::RSquare) {
+		parser.consume();
+		return values;
+	}
+	while (true) {
+		const TokenType sign = parser.peek().type;
+		if (sign == TokenType::Plus || sign == TokenType::Minus) {
+			parser.consume();
+		}
+		const Token element = parser.peek();
+		if (element.type != TokenType::Number)
+		{
+			ERR(std::format("Expected a number in the array, got {}", element.toString()));
+		}
+		parser.consume();
+		values.push_back(sign == TokenType::Minus ? -element.number : element.number);
+
+		if (parser.peek().type == TokenType::RSquare) {
+			parser.consume(); // Consume the closing bracket
+			return values;
+		}
+		if (parser.peek().type != TokenType::Comma)
+		{
+			ERR("Expected comma or closing square bracket");
+		}
+		parser.consume(); // Consume the comma
+	}
+}
+
+Expr* nudArray(PrattParser& parser)
+{
+	return new ArrayExpr(new ArrayLiteralExpr(parseArrayLiteral(parser)));
+}
+
 // We allow inline assignment using the equals sign, which is a special case in the Pratt parser.
 Expr* ledEquals(PrattParser& parser, Expr* left)
 {
@@ -142,7 +228,7 @@ Expr* ledEquals(PrattParser& parser, Expr* left)
 	{
 		ERR("Left side of assignment must be an identifier");
 	}
-	const Token& tok = parser.peek();
+	const Token tok = parser.peek();
 	if (tok.type != TokenType::Equals)
 	{
 		ERR("Expected equals sign for assignment");
@@ -155,36 +241,117 @@ Expr* ledEquals(PrattParser& parser, Expr* left)
 	return left; // Return the left side of the assignment, which is the identifier
 }
 
-Expr* parseExpr(PrattParser& parser, TokenType end, int minBindingPower)
+// -----------------------------------------------------
+// Builds Expr trees for IterativeParser, the same nodes the nud/led functions above build
+struct TreeBuilder
 {
-	const auto& ruleTable = ParseRule::Table();
-	const auto& tok = parser.peek();
-	if (tok.type == TokenType::EndOfFile || tok.type == end)
+	using Node = Expr*;
+	struct Assignment {};
+
+	// Where identifiers are looked up and array assignments go
+	ArrayStore& store;
+	// Set once an array is seen, so expressions without any skip the checks for them
+	bool arrays = false;
+
+	static ArrayExpr* asArray(Node node) { return dynamic_cast<ArrayExpr*>(node); }
+	bool anyArray(std::span<Node> nodes) const
 	{
-		ERR("Unexpected end of file");
+		return arrays && std::any_of(nodes.begin(), nodes.end(), [](Node node) { return asArray(node) != nullptr; });
 	}
-	const ParseRule& rule1 = ruleTable[static_cast<size_t>(tok.type)];
-	if (!rule1.nud)
+
+	Node number(const Token& tok) { return new NumberExpr{ tok.number }; }
+
+	Node identifier(const Token& tok)
 	{
-		ERR(std::format("Token {} should not be at the beginning of an expression!", tok.toString()));
+		std::string name(tok.content);
+		if (store.contains(name)) {
+			arrays = true;
+			return new ArrayExpr(new ArrayIdentifierExpr(name, store));
+		}
+		return new IdentifierExpr(name);
 	}
 
-	Expr* left = rule1.nud(parser);
+	Node array(std::vector<double> values)
+	{
+		arrays = true;
+		return new ArrayExpr(new ArrayLiteralExpr(std::move(values)));
+	}
 
-	while (parser.peek().type != end && parser.peek().type != TokenType::EndOfFile)
+	Node unary(TokenType op, Node operand)
 	{
-		const auto& nextTok = parser.peek();
-		const ParseRule& rule2 = ruleTable[static_cast<size_t>(nextTok.type)];
-		if (rule2.lbp < minBindingPower)
-		{
-			break;
+		if (ArrayExpr* array = arrays ? asArray(operand) : nullptr) {
+			return ArrayExpr::unary(op, array);
 		}
-		if (!rule2.led)
-		{
-			ERR(std::format("Token {} should not be in the middle of an expression", nextTok.toString()));
+		return new UnaryExpr(op, operand);
+	}
+
+	Node binary(TokenType op, Node left, Node right)
+	{
+		Node operands[] = { left, right };
+		if (anyArray(operands)) {
+			return ArrayExpr::binary(op, left, right);
+		}
+		return new BinaryExpr(op, left, right);
+	}
+
+	Node keyword(const KeywordInfo& info, std::span<Node> arguments)
+	{
+		if (anyArray(arguments)) {
+			return ArrayExpr::keyword(info, arguments);
+		}
+		return new KeywordExpr(info.id, std::vector<Expr*>(arguments.begin(), arguments.end()));
+	}
+
+	Node function(FunctionRef function, std::span<Node> arguments)
+	{
+		if (anyArray(arguments)) {
+			ERR(std::format("{} takes numbers, not arrays", function->name));
 		}
-		left = rule2.led(parser, left);
+		return new FunctionExpr(std::move(function), std::vector<Expr*>(arguments.begin(), arguments.end()));
 	}
 
-	return left;
+	bool isIdentifier(Node node)
+	{
+		if (ArrayExpr* array = arrays ? asArray(node) : nullptr) {
+			return !array->identifierName().empty();
+		}
+		return dynamic_cast<IdentifierExpr*>(node) != nullptr;
+	}
+
+	Assignment beginAssignment() { return {}; }
+
+	// Like ledEquals, the right side is evaluated once and then dropped. An array
+	// value binds the name in store, a number unbinds it there.
+	Node assign(Node identifier, Node value, Assignment)
+	{
+		std::unique_ptr<Expr> right(value);
+		ArrayExpr* wasArray = arrays ? asArray(identifier) : nullptr;
+		const std::string name = wasArray ? wasArray->identifierName() : static_cast<IdentifierExpr*>(identifier)->name;
+		if (ArrayExpr* elements = arrays ? asArray(value) : nullptr) {
+			store.set(name, elements->elements());
+			if (wasArray) {
+				return identifier;
+			}
+			delete identifier;
+			return new ArrayExpr(new ArrayIdentifierExpr(name, store));
+		}
+		IdentifierExpr::setIdentifier(name, right->eval());
+		if (store.contains(name)) {
+			store.remove(name);
+		}
+		if (!wasArray) {
+			return identifier;
+		}
+		delete identifier;
+		return new IdentifierExpr(name);
+	}
+
+	void discard(Node node) { delete node; }
+};
+
+Expr* parseExpr(PrattParser& parser, TokenType end, int minBindingPower)
+{
+	PerfTimer timer(PerfStage::Parse);
+	TreeBuilder builder{ parser.getScope().arrays };
+	return IterativeParser<TreeBuilder>(parser, builder).parse(end, minBindingPower);
 }
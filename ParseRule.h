@@ -12,6 +12,31 @@ using NudFunc = Expr * (*)(PrattParser&);
 using LedFunc = Expr * (*)(PrattParser&, Expr*);
 using ParseTable = std::array<ParseRule, static_cast<size_t>(TokenType::Total)>;
 
+struct BindingPower
+{
+	int lbp;
+	int rbp;
+};
+
+// Binding powers of every token, shared by ParseRule::Table() and the compile-time parser
+constexpr std::array<BindingPower, static_cast<size_t>(TokenType::Total)> BindingPowers = { {
+	{ 10, 10 }, // Plus
+	{ 10, 10 }, // Minus
+	{ 20, 20 }, // Mult
+	{ 20, 20 }, // Div
+	{ 40, 30 }, // Pow
+	{ 0, 0 },   // LBracket
+	{ 0, 0 },   // RBracket
+	{ 0, 0 },   // Number
+	{ 0, 0 },   // Equals
+	{ 0, 0 },   // Identifier
+	{ 0, 0 },   // Keyword
+	{ 0, 0 },   // Comma
+	{ 0, 0 },   // LSquare
+	{ 0, 0 },   // RSquare
+	{ 0, 0 }    // EndOfFile
+} };
+
 struct ParseRule
 {
 	// What to do if this token appears at the start of an expression, e.g. the + in "+1"
@@ -32,6 +57,10 @@ Expr* nudLiteral(PrattParser& parser);
 Expr* nudIdentifier(PrattParser& parser);
 Expr* nudUnary(PrattParser& parser);
 Expr* nudGroup(PrattParser& parser);
+Expr* nudArray(PrattParser& parser);
 Expr* ledEquals(PrattParser& parser, Expr* left);
 Expr* ledBinary(PrattParser& parser, Expr* left);
-Expr* parseExpr(PrattParser& parser, TokenType end = TokenType::EndOfFile, int minBindingPower = 0);
\ No newline at end of file
+Expr* parseExpr(PrattParser& parser, TokenType end = TokenType::EndOfFile, int minBindingPower = 0);
+// Reads an array literal like "[1, -2, 3.5]", starting at its opening bracket.
+// The elements are numbers with an optional sign.
+std::vector<double> parseArrayLiteral(PrattParser& parser);
\ No newline at end of file
@@ -1,10 +1,39 @@
 #include "Parser.h"
 #include "ParseRule.h"
+#include "ArrayStore.h"
+#include "Function.h"
+#include "PerfCounters.h"
 #include <print>
 #include <sstream>
 
-PrattParser::PrattParser(std::vector<Token>&& tokens, size_t pos) 
-	: toks(std::move(tokens)), pos(pos) {}
+ParseScope ParseScope::global()
+{
+	return ParseScope{ FunctionTable::global(), ArrayStore::global() };
+}
+
+PrattParser::PrattParser(std::vector<Token>&& tokens, size_t pos, ParseScope scope) 
+	: toks(std::move(tokens)), pos(pos), scope(scope) {}
+
+PrattParser::PrattParser(std::string_view source, ParseScope scope)
+	: source{ source, 0, &scope.functions }, pos(0), streaming(true), scope(scope)
+{
+	this->source.skipWhitespace();
+}
+
+void PrattParser::fill(size_t index) const
+{
+	if (!streaming || toks.size() > index || !source.areTokensLeft())
+		return;
+	// Usually one token at a time, too little to time without doubling its
+	// cost, so this counts as parsing
+	const size_t lexed = toks.size();
+	while (toks.size() <= index && source.areTokensLeft())
+	{
+		toks.push_back(source.getToken());
+		source.skipWhitespace();
+	}
+	PerfCounters::countTokens(toks.size() - lexed);
+}
 
 // This just wraps the parseExpr function from ParseRule.h
 Expr* PrattParser::parseExpression()
@@ -14,6 +43,7 @@ Expr* PrattParser::parseExpression()
 
 const Token& PrattParser::operator[](size_t index) const
 {
+	fill(index);
 	if (index < toks.size())
 		return toks[index];
 	return Token::END_OF_FILE;
@@ -34,9 +64,15 @@ size_t PrattParser::getPosition() const
 	return pos;
 }
 
+const ParseScope& PrattParser::getScope() const
+{
+	return scope;
+}
+
 bool PrattParser::consume(size_t count)
 {
 	pos += count;
+	fill(pos);
 	return pos < toks.size();
 }
 
@@ -45,6 +81,7 @@ std::string PrattParser::toString() const
 	std::stringstream ss;
 	const size_t interval = 10;
 	size_t start = std::max(0, static_cast<int>(pos) - static_cast<int>(interval));
+	fill(pos + interval);
 	size_t end = std::min(toks.size(), pos + interval);
 
 	for (size_t i = start; i < end; ++i) {
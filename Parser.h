@@ -3,18 +3,43 @@
 #include "Tokenizer.h"
 #include "Expr.h"
 #include <vector>
+#include <string_view>
+
+class ArrayStore;
+
+// The tables names are looked up in while parsing, other than the keywords:
+// calls of user functions, and identifiers bound to arrays. Assignments of
+// arrays are stored in arrays.
+struct ParseScope
+{
+	const FunctionTable& functions;
+	ArrayStore& arrays;
+
+	// FunctionTable::global() and ArrayStore::global(), the ones the shell defines into
+	static ParseScope global();
+};
 
 struct PrattParser
 {
 private:
-	std::vector<Token> toks;
+	// In streaming mode tokens are pulled from source as the parser looks ahead
+	mutable std::vector<Token> toks;
+	mutable Tokenizer source;
 	size_t pos;
+	bool streaming = false;
+	ParseScope scope;
+
+	void fill(size_t index) const;
 public:
-	PrattParser(std::vector<Token>&& tokens, size_t pos = 0);
+	// The tokens have to be lexed with the functions of scope
+	PrattParser(std::vector<Token>&& tokens, size_t pos = 0, ParseScope scope = ParseScope::global());
+	// Lexes on demand instead of up front. The source has to outlive the parser.
+	explicit PrattParser(std::string_view source, ParseScope scope = ParseScope::global());
 	const Token& operator[](size_t index) const;
     const Token& peek() const;
 	const Token& nextToken() const;
 	size_t getPosition() const;
+	const ParseScope& getScope() const;
 	bool consume(size_t count = 1);
 
 	Expr* parseExpression();
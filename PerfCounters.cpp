@@ -0,0 +1,203 @@
+#include "PerfCounters.h"
+#include <algorithm>
+#include <format>
+#include <mutex>
+#include <vector>
+
+std::string perfStageToString(PerfStage stage)
+{
+	switch (stage)
+	{
+	case PerfStage::Tokenize:
+		return "tokenize";
+	case PerfStage::Parse:
+		return "parse";
+	case PerfStage::Eval:
+		return "eval";
+	default:
+		return "Unknown stage";
+	}
+}
+
+uint64_t PerfStats::totalKeywordCalls() const
+{
+	uint64_t total = 0;
+	for (uint64_t count : keywordCalls)
+		total += count;
+	return total;
+}
+
+std::string PerfStats::toString() const
+{
+	std::string result;
+	for (size_t i = 0; i < PerfStageCount; ++i) {
+		result += std::format("{:<9} {:12.3f} ms in {} calls\n", perfStageToString(static_cast<PerfStage>(i)), nanoseconds[i] / 1e6, calls[i]);
+	}
+	result += std::format("tokens: {}, nodes: {}, keyword calls: {}", tokens, nodes, totalKeywordCalls());
+	for (size_t i = 0; i < KeywordCount; ++i) {
+		if (keywordCalls[i])
+			result += std::format("\n  {:<8} {}", KeywordSignatures[i].name, keywordCalls[i]);
+	}
+	return result;
+}
+
+// -----------------------------------------------------
+// Written only by its own thread, with a plain load and store instead of a
+// locked add; read by any thread. Relaxed atomics keep the reads race free.
+using Counter = std::atomic<uint64_t>;
+
+static void add(Counter& counter, uint64_t amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct PerfCounters::ThreadCounters
+{
+	std::array<Counter, PerfStageCount> nanoseconds{};
+	std::array<Counter, PerfStageCount> calls{};
+	Counter tokens{ 0 };
+	Counter nodes{ 0 };
+	std::array<Counter, KeywordCount> keywordCalls{};
+
+	// Only touched by the owning thread
+	std::array<unsigned, PerfStageCount> depth{};
+	PerfTimer* open = nullptr;
+
+	ThreadCounters();
+	~ThreadCounters();
+
+	void addTo(PerfStats& stats) const
+	{
+		for (size_t i = 0; i < PerfStageCount; ++i) {
+			stats.nanoseconds[i] += nanoseconds[i].load(std::memory_order_relaxed);
+			stats.calls[i] += calls[i].load(std::memory_order_relaxed);
+		}
+		stats.tokens += tokens.load(std::memory_order_relaxed);
+		stats.nodes += nodes.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < KeywordCount; ++i)
+			stats.keywordCalls[i] += keywordCalls[i].load(std::memory_order_relaxed);
+	}
+};
+
+// Every thread that ever counted. The lock is only taken when a thread counts
+// for the first time, when it exits and when the counters are read or reset.
+struct PerfRegistry
+{
+	std::mutex mutex;
+	std::vector<const PerfCounters::ThreadCounters*> threads;
+	// Counts of threads that have exited
+	PerfStats finished;
+	// Everything counted before the last reset
+	PerfStats baseline;
+
+	PerfStats total() const
+	{
+		PerfStats stats = finished;
+		for (const auto* counters : threads)
+			counters->addTo(stats);
+		return stats;
+	}
+
+	// Never destroyed, so threads exiting during static destruction can still report
+	static PerfRegistry& global()
+	{
+		static PerfRegistry* registry = new PerfRegistry;
+		return *registry;
+	}
+};
+
+PerfCounters::ThreadCounters::ThreadCounters()
+{
+	PerfRegistry& registry = PerfRegistry::global();
+	std::lock_guard lock(registry.mutex);
+	registry.threads.push_back(this);
+}
+
+PerfCounters::ThreadCounters::~ThreadCounters()
+{
+	PerfRegistry& registry = PerfRegistry::global();
+	std::lock_guard lock(registry.mutex);
+	addTo(registry.finished);
+	std::erase(registry.threads, this);
+}
+
+// -----------------------------------------------------
+void PerfCounters::enable(bool on)
+{
+	active.store(on, std::memory_order_relaxed);
+}
+
+PerfStats PerfCounters::read()
+{
+	PerfRegistry& registry = PerfRegistry::global();
+	std::lock_guard lock(registry.mutex);
+	PerfStats stats = registry.total();
+	const PerfStats& base = registry.baseline;
+	for (size_t i = 0; i < PerfStageCount; ++i) {
+		stats.nanoseconds[i] -= base.nanoseconds[i];
+		stats.calls[i] -= base.calls[i];
+	}
+	stats.tokens -= base.tokens;
+	stats.nodes -= base.nodes;
+	for (size_t i = 0; i < KeywordCount; ++i)
+		stats.keywordCalls[i] -= base.keywordCalls[i];
+	return stats;
+}
+
+// Other threads may be counting, so nothing is cleared; later reads subtract
+// what was counted up to now instead
+void PerfCounters::reset()
+{
+	PerfRegistry& registry = PerfRegistry::global();
+	std::lock_guard lock(registry.mutex);
+	registry.baseline = registry.total();
+}
+
+PerfCounters::ThreadCounters& PerfCounters::local()
+{
+	thread_local ThreadCounters counters;
+	return counters;
+}
+
+void PerfCounters::addTokens(size_t count)
+{
+	add(local().tokens, count);
+}
+
+void PerfCounters::addNodes(size_t count)
+{
+	add(local().nodes, count);
+}
+
+void PerfCounters::addKeyword(KeywordType id)
+{
+	add(local().keywordCalls[static_cast<size_t>(id)], 1);
+}
+
+// -----------------------------------------------------
+void PerfTimer::start()
+{
+	counters = &PerfCounters::local();
+	if (counters->depth[static_cast<size_t>(stage)]++ > 0) {
+		// Already inside this stage, the outermost timer covers this one
+		return;
+	}
+	outer = counters->open;
+	counters->open = this;
+	began = std::chrono::steady_clock::now();
+}
+
+void PerfTimer::stop()
+{
+	const size_t index = static_cast<size_t>(stage);
+	if (--counters->depth[index] > 0) {
+		return;
+	}
+	const uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - began).count();
+	counters->open = outer;
+	add(counters->nanoseconds[index], elapsed - std::min(nested, elapsed));
+	add(counters->calls[index], 1);
+	if (outer) {
+		outer->nested += elapsed;
+	}
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Keyword.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Stages a request goes through, timed separately
+enum class PerfStage {
+	Tokenize,	// tokenize() and tokenizeFast()
+	Parse,		// parseExpr() and parseArenaExpr() with the lexing on demand of a streaming PrattParser, minus the evaluation they do
+	Eval,		// Expr::eval(), ExprArena::eval() and the bytecode interpreter
+	Total
+};
+
+std::string perfStageToString(PerfStage stage);
+
+constexpr size_t PerfStageCount = static_cast<size_t>(PerfStage::Total);
+constexpr size_t KeywordCount = static_cast<size_t>(KeywordType::Total);
+
+// Counters summed over every thread since the last PerfCounters::reset()
+struct PerfStats
+{
+	// Time spent in each stage itself, stages nested in it are not included
+	std::array<uint64_t, PerfStageCount> nanoseconds{};
+	// Outermost entries into each stage
+	std::array<uint64_t, PerfStageCount> calls{};
+	uint64_t tokens = 0;
+	// Expr and ExprArena nodes created; shared arena nodes are not counted again
+	uint64_t nodes = 0;
+	std::array<uint64_t, KeywordCount> keywordCalls{};
+
+	uint64_t totalKeywordCalls() const;
+	std::string toString() const;
+};
+
+// Optional instrumentation of the lexer, the parsers and the evaluators. It is
+// off until enable() is called; while off every hook is a single relaxed load.
+// Each thread counts into its own block, which only that thread writes, and
+// read() adds the blocks up, so counting never contends with other threads.
+class PerfCounters
+{
+public:
+	static void enable(bool on = true);
+	static bool enabled() { return active.load(std::memory_order_relaxed); }
+
+	// Sum over running and finished threads. Counts of a thread still inside a
+	// stage show up once it leaves that stage.
+	static PerfStats read();
+	// Starts counting from zero again
+	static void reset();
+
+	static void countTokens(size_t count)
+	{
+		if (enabled())
+			addTokens(count);
+	}
+
+	static void countNodes(size_t count = 1)
+	{
+		if (enabled())
+			addNodes(count);
+	}
+
+	static void countKeyword(KeywordType id)
+	{
+		if (enabled())
+			addKeyword(id);
+	}
+
+private:
+	friend class PerfTimer;
+	friend struct PerfRegistry;
+	struct ThreadCounters;
+
+	static ThreadCounters& local();
+	static void addTokens(size_t count);
+	static void addNodes(size_t count);
+	static void addKeyword(KeywordType id);
+
+	static inline std::atomic<bool> active{ false };
+};
+
+// Times the scope it lives in as stage, when counters are enabled. Only the
+// outermost scope of a stage is timed, so nested parsing and evaluation are
+// counted once, and time spent in another stage inside it is moved to that stage.
+// The two clock reads of a timed scope are most of what enabled counters cost.
+class PerfTimer
+{
+public:
+	explicit PerfTimer(PerfStage stage) : stage(stage)
+	{
+		if (PerfCounters::enabled())
+			start();
+	}
+
+	~PerfTimer()
+	{
+		if (counters)
+			stop();
+	}
+
+	PerfTimer(const PerfTimer&) = delete;
+	PerfTimer& operator=(const PerfTimer&) = delete;
+
+private:
+	void start();
+	void stop();
+
+	PerfStage stage;
+	PerfCounters::ThreadCounters* counters = nullptr;
+	// The timer of the stage this one interrupted
+	PerfTimer* outer = nullptr;
+	std::chrono::steady_clock::time_point began;
+	// Time of the stages nested in this one
+	uint64_t nested = 0;
+};
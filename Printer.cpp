@@ -0,0 +1,144 @@
+#include "Printer.h"
+#include "Expr.h"
+#include "ParseRule.h"
+#include <charconv>
+#include <cstring>
+
+// -----------------------------------------------------
+Printer::Printer(PrintSink sink, const PrintOptions& options) : options(options), sink(sink) {}
+
+// The walk keeps, for every node on the stack, the Place it is written in:
+// - left is the binding power of the parseExpr call that reads it, so an
+//   infix node whose operator binds less than that would end the call early
+// - follow is the left binding power of the operator written after it, which
+//   an infix node must not pull into its right side
+// - operand is set right after a prefix operator, which only takes a nud
+//
+// A node that prints its own children calls this again from appendText. The
+// nested call works on top of the visits of the outer one and starts a fresh
+// Place, like the arguments of a call do.
+void Printer::print(const Expr& root)
+{
+	const size_t base = stack.size();
+	const bool outer = bracketed;
+	stack.push_back(visit(root, Place{}));
+	while (stack.size() > base) {
+		// A copy, as a nested call may move the stack
+		const Visit top = stack.back();
+		bracketed = top.bracketed;
+		top.expr->appendText(*this, top.part);
+		if (top.part < top.count) {
+			const Expr* child = top.expr->child(top.part);
+			const Place place = childPlace(top, top.part);
+			++stack.back().part;
+			stack.push_back(visit(*child, place));
+		}
+		else {
+			stack.pop_back();
+		}
+	}
+	bracketed = outer;
+	if (base == 0)
+		flush();
+}
+
+Printer::Visit Printer::visit(const Expr& expr, const Place& place) const
+{
+	const size_t count = expr.printsChildren() ? 0 : expr.childCount();
+	return Visit{ &expr, 0, count, place, needsBrackets(expr, place) };
+}
+
+bool Printer::needsBrackets(const Expr& expr, const Place& place) const
+{
+	const Notation notation = expr.notation();
+	if (notation.form == Notation::Atom) {
+		return false;
+	}
+	if (!options.minimalBrackets) {
+		return true;
+	}
+	// nudUnary reads its operand straight away, so a prefix node never splits
+	if (notation.form == Notation::Prefix) {
+		return false;
+	}
+	const BindingPower& power = BindingPowers[static_cast<size_t>(notation.op)];
+	return place.operand || power.lbp < place.left || place.follow >= power.rbp;
+}
+
+Printer::Place Printer::childPlace(const Visit& parent, size_t i) const
+{
+	const Notation notation = parent.expr->notation();
+	// Brackets start a fresh parseExpr call
+	const Place outer = parent.bracketed ? Place{} : parent.place;
+	switch (notation.form)
+	{
+	case Notation::Prefix:
+		return Place{ 0, 0, true };
+	case Notation::Infix: {
+		const BindingPower& power = BindingPowers[static_cast<size_t>(notation.op)];
+		if (i == 0)
+			return Place{ outer.left, power.lbp, false };
+		return Place{ power.rbp, outer.follow, false };
+	}
+	default:
+		// Arguments are read up to the next comma or the closing bracket
+		return Place{};
+	}
+}
+
+void Printer::write(char c)
+{
+	if (used == sizeof(buffer))
+		flush();
+	buffer[used++] = c;
+}
+
+void Printer::write(std::string_view text)
+{
+	if (text.size() > sizeof(buffer) - used) {
+		flush();
+		if (text.size() > sizeof(buffer)) {
+			sink.write(sink.target, text);
+			return;
+		}
+	}
+	std::memcpy(buffer + used, text.data(), text.size());
+	used += text.size();
+}
+
+void Printer::writeNumber(double value)
+{
+	// Room for the integer digits of the largest double in fixed notation
+	char digits[400];
+	std::to_chars_result result = options.exactNumbers
+		? std::to_chars(digits, digits + sizeof(digits), value)
+		: std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::fixed, 6);
+	write(std::string_view(digits, result.ptr - digits));
+}
+
+void Printer::openBracket()
+{
+	if (bracketed)
+		write('(');
+}
+
+void Printer::closeBracket()
+{
+	if (bracketed)
+		write(')');
+}
+
+void Printer::flush()
+{
+	if (used > 0) {
+		sink.write(sink.target, std::string_view(buffer, used));
+		used = 0;
+	}
+}
+
+// -----------------------------------------------------
+void print(const Expr& expr, std::string& out, const PrintOptions& options)
+{
+	PrintSink sink{ &out, [](void* target, std::string_view text) { static_cast<std::string*>(target)->append(text); } };
+	Printer(sink, options).print(expr);
+}
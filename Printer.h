@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Expr;
+
+struct PrintOptions
+{
+	// Only the brackets the binding powers need, e.g. "1 + 2 * 3" rather than
+	// "(1 + (2 * 3))". The text still parses back to the same tree.
+	bool minimalBrackets = false;
+	// Shortest digits that read back as the same double, instead of the six
+	// decimals std::to_string keeps. Infinities and NaN have no literal and
+	// are still written as inf and nan.
+	bool exactNumbers = false;
+};
+
+// Where printed text goes, a chunk at a time
+struct PrintSink
+{
+	void* target;
+	void (*write)(void* target, std::string_view text);
+};
+
+// Writes the text of a tree in one pass. Nodes write their parts through the
+// printer, which gathers them in a small buffer and hands full chunks to the
+// sink, so no node builds a string of its own.
+class Printer
+{
+public:
+	Printer(PrintSink sink, const PrintOptions& options);
+
+	void print(const Expr& expr);
+
+	// For Expr::appendText
+	void write(char c);
+	void write(std::string_view text);
+	void writeNumber(double value);
+	// Brackets of the node being written, left out when it does not need them
+	void openBracket();
+	void closeBracket();
+
+	const PrintOptions options;
+
+private:
+	// What surrounds a node in the text, see Printer.cpp
+	struct Place
+	{
+		int left = 0;
+		int follow = 0;
+		bool operand = false;
+	};
+
+	struct Visit
+	{
+		const Expr* expr;
+		size_t part;
+		// Children the walk visits, none for a node that prints its own
+		size_t count;
+		Place place;
+		bool bracketed;
+	};
+
+	Visit visit(const Expr& expr, const Place& place) const;
+	bool needsBrackets(const Expr& expr, const Place& place) const;
+	Place childPlace(const Visit& parent, size_t i) const;
+	void flush();
+
+	PrintSink sink;
+	std::vector<Visit> stack;
+	bool bracketed = false;
+	size_t used = 0;
+	char buffer[512];
+};
+
+// Appends the text of expr to out
+void print(const Expr& expr, std::string& out, const PrintOptions& options = {});
+
+// Writes the text of expr through an output iterator, like a char* into a
+// caller's buffer or std::ostreambuf_iterator, and returns the iterator after it
+template <std::output_iterator<char> Out>
+Out print(const Expr& expr, Out out, const PrintOptions& options = {})
+{
+	PrintSink sink{ &out, [](void* target, std::string_view text) {
+		Out& it = *static_cast<Out*>(target);
+		it = std::copy(text.begin(), text.end(), it);
+	} };
+	Printer(sink, options).print(expr);
+	return out;
+}
@@ -0,0 +1,608 @@
+#include "ProgramFile.h"
+#include "Keyword.h"
+#include "VariableStore.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <stdexcept>
+
+#define ERR(msg) throw std::runtime_error(msg)
+
+static constexpr char fileMagic[8] = { 'R', 'A', 'T', 'P', 'R', 'O', 'G', '\0' };
+// Written as a number, so a file from a host with the other byte order is recognized
+static constexpr uint32_t byteOrderMark = 0x01020304;
+
+enum SectionId {
+	EntrySection,
+	LookupSection,
+	CodeSection,
+	ConstantSection,
+	NodeSection,
+	OperandSection,
+	IdentifierSection,	// String ids of program identifiers and arena names
+	StringSection,		// Offset and length of every interned string
+	CharSection,
+	SectionCount
+};
+
+struct Section
+{
+	uint64_t offset = 0;
+	uint64_t size = 0;
+};
+
+struct StringRef
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct LookupRecord
+{
+	uint64_t hash;
+	uint32_t entry;
+	uint32_t unused;
+};
+
+struct ProgramFile::Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t keywordLayout;
+	uint64_t fileSize;
+	// Of everything after the header
+	uint64_t checksum;
+	uint32_t entryCount;
+	uint32_t stringCount;
+	Section sections[SectionCount];
+};
+
+// Ranges index into the sections, counted in elements
+struct ProgramFile::EntryRecord
+{
+	uint32_t name;
+	uint32_t maxStack;
+	uint32_t codeBegin, codeCount;
+	uint32_t constantBegin, constantCount;
+	uint32_t identifierBegin, identifierCount;
+	uint32_t nodeBegin, nodeCount;
+	uint32_t operandBegin, operandCount;
+	uint32_t nodeNameBegin, nodeNameCount;
+	// ExprArena::reusedNodes and reusedOperands, so a shared arena is loaded as one
+	uint32_t reusedNodes, reusedOperands;
+};
+
+static_assert(sizeof(Instruction) == 8, "Instruction is stored as is");
+
+// -----------------------------------------------------
+static constexpr uint64_t fnvOffset = 0xcbf29ce484222325ull;
+static constexpr uint64_t fnvPrime = 0x100000001b3ull;
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ bytes[i]) * fnvPrime;
+	}
+	return hash;
+}
+
+// FNV-1a over 8 byte words in four interleaved lanes, which keeps checking a
+// whole file on load well below the cost of reading it
+static uint64_t checksum(std::span<const std::byte> data)
+{
+	uint64_t lanes[4] = { fnvOffset, fnvOffset + 1, fnvOffset + 2, fnvOffset + 3 };
+	size_t i = 0;
+	for (; i + 32 <= data.size(); i += 32) {
+		for (size_t lane = 0; lane < 4; ++lane) {
+			uint64_t word;
+			std::memcpy(&word, data.data() + i + lane * 8, sizeof(word));
+			lanes[lane] = (lanes[lane] ^ word) * fnvPrime;
+		}
+	}
+	uint64_t hash = hashBytes(fnvOffset, lanes, sizeof(lanes));
+	return hashBytes(hash, data.data() + i, data.size() - i);
+}
+
+static uint64_t nameHash(std::string_view name)
+{
+	return hashBytes(fnvOffset, name.data(), name.size());
+}
+
+uint64_t keywordLayoutHash()
+{
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	const uint32_t layout[] = {
+		static_cast<uint32_t>(KeywordType::Total), static_cast<uint32_t>(OpCode::Total),
+		static_cast<uint32_t>(NodeKind::Function) + 1, sizeof(Instruction), sizeof(ExprNode)
+	};
+	uint64_t hash = hashBytes(fnvOffset, layout, sizeof(layout));
+	for (size_t id = 0; id < static_cast<size_t>(KeywordType::Total); ++id) {
+		const KeywordInfo& info = keywords.getByID(static_cast<KeywordType>(id));
+		const int32_t fields[] = { static_cast<int32_t>(info.id), info.argCount, static_cast<int32_t>(info.name.size()) };
+		hash = hashBytes(hash, fields, sizeof(fields));
+		hash = hashBytes(hash, info.name.data(), info.name.size());
+	}
+	return hash;
+}
+
+static uint32_t checkedCount(size_t count, const char* what)
+{
+	if (count >= UINT32_MAX) {
+		ERR(std::format("Too many {} for a program file", what));
+	}
+	return static_cast<uint32_t>(count);
+}
+
+// -----------------------------------------------------
+void ProgramFileWriter::add(std::string_view name, const Program& program)
+{
+	if (!program.functions.empty()) {
+		ERR(std::format("{} calls user function {}, which cannot be saved", name, program.functions.front()->name));
+	}
+	if (program.code.empty()) {
+		ERR(std::format("{} is an empty program", name));
+	}
+	entries.push_back({ std::string(name), program });
+}
+
+void ProgramFileWriter::add(std::string_view name, const ExprArena& arena)
+{
+	add(name, compile(arena));
+	Entry& entry = entries.back();
+	entry.nodes = arena.nodes;
+	entry.operands = arena.operands;
+	entry.nodeNames = arena.names;
+	entry.reusedNodes = arena.reusedNodes;
+	entry.reusedOperands = arena.reusedOperands;
+}
+
+size_t ProgramFileWriter::size() const
+{
+	return entries.size();
+}
+
+std::vector<std::byte> ProgramFileWriter::serialize() const
+{
+	// Every string is stored once, whether it names an entry or an identifier
+	std::vector<std::string_view> strings;
+	StringMap<uint32_t> stringIds;
+	auto intern = [&](std::string_view text) {
+		auto it = stringIds.find(text);
+		if (it != stringIds.end())
+			return it->second;
+		uint32_t id = checkedCount(strings.size(), "strings");
+		stringIds.emplace(std::string(text), id);
+		strings.push_back(text);
+		return id;
+	};
+
+	std::vector<ProgramFile::EntryRecord> records;
+	std::vector<uint32_t> identifiers;
+	size_t codeCount = 0, constantCount = 0, nodeCount = 0, operandCount = 0, charCount = 0;
+	for (const Entry& entry : entries) {
+		ProgramFile::EntryRecord record{};
+		record.name = intern(entry.name);
+		record.maxStack = checkedCount(entry.program.maxStack, "stack slots");
+		record.codeBegin = checkedCount(codeCount, "instructions");
+		record.codeCount = checkedCount(entry.program.code.size(), "instructions");
+		record.constantBegin = checkedCount(constantCount, "constants");
+		record.constantCount = checkedCount(entry.program.constants.size(), "constants");
+		record.identifierBegin = checkedCount(identifiers.size(), "identifiers");
+		record.identifierCount = checkedCount(entry.program.identifiers.size(), "identifiers");
+		for (const std::string& identifier : entry.program.identifiers)
+			identifiers.push_back(intern(identifier));
+		record.nodeBegin = checkedCount(nodeCount, "nodes");
+		record.nodeCount = checkedCount(entry.nodes.size(), "nodes");
+		record.operandBegin = checkedCount(operandCount, "operands");
+		record.operandCount = checkedCount(entry.operands.size(), "operands");
+		record.nodeNameBegin = checkedCount(identifiers.size(), "identifiers");
+		record.nodeNameCount = checkedCount(entry.nodeNames.size(), "identifiers");
+		for (const std::string& nodeName : entry.nodeNames)
+			identifiers.push_back(intern(nodeName));
+		record.reusedNodes = checkedCount(entry.reusedNodes, "nodes");
+		record.reusedOperands = checkedCount(entry.reusedOperands, "operands");
+		records.push_back(record);
+
+		codeCount += entry.program.code.size();
+		constantCount += entry.program.constants.size();
+		nodeCount += entry.nodes.size();
+		operandCount += entry.operands.size();
+	}
+	for (std::string_view text : strings) {
+		charCount += text.size();
+	}
+	checkedCount(charCount, "characters");
+
+	// Sorted by name hash for a binary search
+	std::vector<LookupRecord> lookup;
+	for (uint32_t i = 0; i < records.size(); ++i) {
+		lookup.push_back({ nameHash(entries[i].name), i, 0 });
+	}
+	std::stable_sort(lookup.begin(), lookup.end(), [](const LookupRecord& a, const LookupRecord& b) { return a.hash < b.hash; });
+
+	ProgramFile::Header header{};
+	std::memcpy(header.magic, fileMagic, sizeof(fileMagic));
+	header.version = ProgramFileVersion;
+	header.byteOrder = byteOrderMark;
+	header.keywordLayout = keywordLayoutHash();
+	header.entryCount = checkedCount(records.size(), "entries");
+	header.stringCount = checkedCount(strings.size(), "strings");
+	const size_t sizes[SectionCount] = {
+		records.size() * sizeof(ProgramFile::EntryRecord), lookup.size() * sizeof(LookupRecord),
+		codeCount * sizeof(Instruction), constantCount * sizeof(double), nodeCount * sizeof(ExprNode),
+		operandCount * sizeof(NodeIndex), identifiers.size() * sizeof(uint32_t), strings.size() * sizeof(StringRef), charCount
+	};
+	// Every section starts 8 byte aligned, like the mapping itself
+	uint64_t offset = sizeof(ProgramFile::Header);
+	for (size_t s = 0; s < SectionCount; ++s) {
+		header.sections[s] = { offset, sizes[s] };
+		offset = (offset + sizes[s] + 7) & ~uint64_t(7);
+	}
+	header.fileSize = offset;
+
+	// Zero filled, so padding is deterministic and the checksum reproducible
+	std::vector<std::byte> file(offset);
+	auto at = [&](SectionId s, size_t byteOffset = 0) { return file.data() + header.sections[s].offset + byteOffset; };
+	std::memcpy(at(EntrySection), records.data(), sizes[EntrySection]);
+	std::memcpy(at(LookupSection), lookup.data(), sizes[LookupSection]);
+	std::memcpy(at(IdentifierSection), identifiers.data(), sizes[IdentifierSection]);
+
+	Instruction* code = reinterpret_cast<Instruction*>(at(CodeSection));
+	double* constants = reinterpret_cast<double*>(at(ConstantSection));
+	ExprNode* nodes = reinterpret_cast<ExprNode*>(at(NodeSection));
+	NodeIndex* operands = reinterpret_cast<NodeIndex*>(at(OperandSection));
+	for (size_t e = 0; e < entries.size(); ++e) {
+		const Entry& entry = entries[e];
+		const ProgramFile::EntryRecord& record = records[e];
+		// Field by field, so padding bytes stay zero
+		for (size_t i = 0; i < entry.program.code.size(); ++i) {
+			Instruction& ins = code[record.codeBegin + i];
+			ins.op = entry.program.code[i].op;
+			ins.count = entry.program.code[i].count;
+			ins.arg = entry.program.code[i].arg;
+		}
+		std::copy(entry.program.constants.begin(), entry.program.constants.end(), constants + record.constantBegin);
+		for (size_t i = 0; i < entry.nodes.size(); ++i) {
+			const ExprNode& source = entry.nodes[i];
+			ExprNode& node = nodes[record.nodeBegin + i];
+			node.kind = source.kind;
+			node.op = source.op;
+			node.count = source.count;
+			node.first = source.first;
+			if (source.kind == NodeKind::Number)
+				node.value = source.value;
+			else if (source.kind == NodeKind::Binary)
+				node.second = source.second;
+		}
+		std::copy(entry.operands.begin(), entry.operands.end(), operands + record.operandBegin);
+	}
+
+	StringRef* stringRefs = reinterpret_cast<StringRef*>(at(StringSection));
+	uint32_t charOffset = 0;
+	for (size_t i = 0; i < strings.size(); ++i) {
+		stringRefs[i] = { charOffset, static_cast<uint32_t>(strings[i].size()) };
+		std::memcpy(at(CharSection, charOffset), strings[i].data(), strings[i].size());
+		charOffset += static_cast<uint32_t>(strings[i].size());
+	}
+
+	header.checksum = checksum(std::span<const std::byte>(file).subspan(sizeof(header)));
+	std::memcpy(file.data(), &header, sizeof(header));
+	return file;
+}
+
+void ProgramFileWriter::save(const std::string& path) const
+{
+	std::vector<std::byte> file = serialize();
+	std::unique_ptr<std::FILE, int(*)(std::FILE*)> out(std::fopen(path.c_str(), "wb"), &std::fclose);
+	if (!out || std::fwrite(file.data(), 1, file.size(), out.get()) != file.size()) {
+		ERR(std::format("Cannot write {}", path));
+	}
+}
+
+// -----------------------------------------------------
+ProgramFile::ProgramFile(const std::string& path)
+	: mapped(path)
+{
+	if (!mapped.isMapped()) {
+		ERR(std::format("Cannot map {}", path));
+	}
+	bytes = std::as_bytes(std::span(mapped.view()));
+	validate();
+}
+
+ProgramFile::ProgramFile(std::span<const std::byte> bytes)
+	: bytes(bytes)
+{
+	validate();
+}
+
+template<typename T>
+static std::span<const T> sectionOf(std::span<const std::byte> bytes, const Section& section)
+{
+	return { reinterpret_cast<const T*>(bytes.data() + section.offset), static_cast<size_t>(section.size / sizeof(T)) };
+}
+
+static bool inRange(uint64_t begin, uint64_t count, uint64_t total)
+{
+	return begin <= total && count <= total - begin;
+}
+
+// Replays the stack effect of every instruction, so the interpreter can trust the program
+static void validateProgram(std::span<const Instruction> code, size_t constantCount, size_t identifierCount, size_t maxStack)
+{
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	size_t depth = 0;
+	size_t deepest = 0;
+	for (const Instruction& ins : code) {
+		size_t operands = 0;
+		switch (ins.op)
+		{
+		case OpCode::Const:
+			if (ins.arg >= constantCount)
+				ERR("Program file reads a constant that does not exist");
+			break;
+		case OpCode::Load:
+			if (ins.arg >= identifierCount)
+				ERR("Program file reads an identifier that does not exist");
+			break;
+		case OpCode::Neg:
+			operands = 1;
+			break;
+		case OpCode::Add:
+		case OpCode::Sub:
+		case OpCode::Mul:
+		case OpCode::Div:
+		case OpCode::Pow:
+			operands = 2;
+			break;
+		case OpCode::Call:
+			if (ins.arg >= static_cast<uint32_t>(KeywordType::Total) || !keywords.getByID(static_cast<KeywordType>(ins.arg)).accepts(ins.count))
+				ERR("Program file calls a keyword that does not exist or with the wrong number of arguments");
+			operands = ins.count;
+			break;
+		default:
+			ERR(std::format("Program file contains invalid opcode {}", static_cast<int>(ins.op)));
+		}
+		if (depth < operands)
+			ERR("Program file pops more values than it pushed");
+		depth = depth - operands + 1;
+		deepest = std::max(deepest, depth);
+	}
+	if (depth != 1 || deepest > maxStack)
+		ERR("Program file has an inconsistent stack");
+}
+
+static void validateNodes(std::span<const ExprNode> nodes, size_t operandCount, std::span<const NodeIndex> operands, size_t nameCount)
+{
+	const KeywordTable& keywords = KeywordInfo::getTable();
+	for (NodeIndex i = 0; i < nodes.size(); ++i) {
+		const ExprNode& node = nodes[i];
+		bool valid = false;
+		const TokenType op = static_cast<TokenType>(node.op);
+		switch (node.kind)
+		{
+		case NodeKind::Number:
+			valid = true;
+			break;
+		case NodeKind::Identifier:
+			valid = node.first < nameCount;
+			break;
+		case NodeKind::Unary:
+			valid = (op == TokenType::Plus || op == TokenType::Minus) && node.first < i;
+			break;
+		case NodeKind::Binary:
+			valid = node.op >= static_cast<uint8_t>(TokenType::Plus) && node.op <= static_cast<uint8_t>(TokenType::Pow) && node.first < i && node.second < i;
+			break;
+		case NodeKind::Keyword:
+			valid = node.op < static_cast<uint8_t>(KeywordType::Total) && keywords.getByID(static_cast<KeywordType>(node.op)).accepts(node.count) &&
+				inRange(node.first, node.count, operandCount) &&
+				std::all_of(operands.begin() + node.first, operands.begin() + node.first + node.count, [i](NodeIndex child) { return child < i; });
+			break;
+		default:
+			break;
+		}
+		if (!valid)
+			ERR(std::format("Program file contains invalid node {}", i));
+	}
+}
+
+void ProgramFile::validate()
+{
+	if (bytes.size() < sizeof(Header)) {
+		ERR("Program file is too short");
+	}
+	if (reinterpret_cast<uintptr_t>(bytes.data()) % alignof(Header) != 0) {
+		ERR("Program file has to be 8 byte aligned in memory");
+	}
+	header = reinterpret_cast<const Header*>(bytes.data());
+	if (std::memcmp(header->magic, fileMagic, sizeof(fileMagic)) != 0) {
+		ERR("Not a program file");
+	}
+	if (header->byteOrder != byteOrderMark) {
+		ERR("Program file was written with a different byte order");
+	}
+	if (header->version != ProgramFileVersion) {
+		ERR(std::format("Program file has version {}, expected {}", header->version, ProgramFileVersion));
+	}
+	if (header->keywordLayout != keywordLayoutHash()) {
+		ERR("Program file was written with a different keyword table");
+	}
+	if (header->fileSize != bytes.size()) {
+		ERR(std::format("Program file should be {} bytes, got {}", header->fileSize, bytes.size()));
+	}
+	if (header->checksum != checksum(bytes.subspan(sizeof(Header)))) {
+		ERR("Program file is corrupt, its checksum does not match");
+	}
+
+	static constexpr size_t elementSizes[SectionCount] = {
+		sizeof(EntryRecord), sizeof(LookupRecord), sizeof(Instruction), sizeof(double), sizeof(ExprNode),
+		sizeof(NodeIndex), sizeof(uint32_t), sizeof(StringRef), 1
+	};
+	for (size_t s = 0; s < SectionCount; ++s) {
+		const Section& section = header->sections[s];
+		if (section.offset < sizeof(Header) || section.offset % 8 != 0 || !inRange(section.offset, section.size, bytes.size()) ||
+			section.size % elementSizes[s] != 0) {
+			ERR("Program file has a malformed section");
+		}
+	}
+	if (header->sections[EntrySection].size != header->entryCount * sizeof(EntryRecord) ||
+		header->sections[LookupSection].size != header->entryCount * sizeof(LookupRecord) ||
+		header->sections[StringSection].size != header->stringCount * sizeof(StringRef)) {
+		ERR("Program file has a malformed section");
+	}
+
+	const size_t charCount = header->sections[CharSection].size;
+	for (const StringRef& ref : sectionOf<StringRef>(bytes, header->sections[StringSection])) {
+		if (!inRange(ref.offset, ref.length, charCount))
+			ERR("Program file has a malformed string");
+	}
+	auto lookup = sectionOf<LookupRecord>(bytes, header->sections[LookupSection]);
+	for (size_t i = 0; i < lookup.size(); ++i) {
+		if (lookup[i].entry >= header->entryCount || (i > 0 && lookup[i - 1].hash > lookup[i].hash))
+			ERR("Program file has a malformed name index");
+	}
+
+	auto code = sectionOf<Instruction>(bytes, header->sections[CodeSection]);
+	auto operands = sectionOf<NodeIndex>(bytes, header->sections[OperandSection]);
+	auto nodes = sectionOf<ExprNode>(bytes, header->sections[NodeSection]);
+	auto identifiers = sectionOf<uint32_t>(bytes, header->sections[IdentifierSection]);
+	const size_t constantCount = header->sections[ConstantSection].size / sizeof(double);
+	for (const EntryRecord& entry : sectionOf<EntryRecord>(bytes, header->sections[EntrySection])) {
+		if (entry.name >= header->stringCount || entry.codeCount == 0 ||
+			!inRange(entry.codeBegin, entry.codeCount, code.size()) ||
+			!inRange(entry.constantBegin, entry.constantCount, constantCount) ||
+			!inRange(entry.identifierBegin, entry.identifierCount, identifiers.size()) ||
+			!inRange(entry.nodeBegin, entry.nodeCount, nodes.size()) ||
+			!inRange(entry.operandBegin, entry.operandCount, operands.size()) ||
+			!inRange(entry.nodeNameBegin, entry.nodeNameCount, identifiers.size())) {
+			ERR("Program file has a malformed entry");
+		}
+		auto names = identifiers.subspan(entry.identifierBegin, entry.identifierCount);
+		auto nodeNames = identifiers.subspan(entry.nodeNameBegin, entry.nodeNameCount);
+		if (std::any_of(names.begin(), names.end(), [this](uint32_t id) { return id >= header->stringCount; }) ||
+			std::any_of(nodeNames.begin(), nodeNames.end(), [this](uint32_t id) { return id >= header->stringCount; })) {
+			ERR("Program file has a malformed identifier");
+		}
+		validateProgram(code.subspan(entry.codeBegin, entry.codeCount), entry.constantCount, entry.identifierCount, entry.maxStack);
+		validateNodes(nodes.subspan(entry.nodeBegin, entry.nodeCount), entry.operandCount,
+			operands.subspan(entry.operandBegin, entry.operandCount), entry.nodeNameCount);
+	}
+}
+
+// -----------------------------------------------------
+const ProgramFile::EntryRecord& ProgramFile::record(size_t entry) const
+{
+	if (entry >= header->entryCount) {
+		ERR(std::format("Program file has no entry {}", entry));
+	}
+	return sectionOf<EntryRecord>(bytes, header->sections[EntrySection])[entry];
+}
+
+std::string_view ProgramFile::string(uint32_t id) const
+{
+	const StringRef& ref = sectionOf<StringRef>(bytes, header->sections[StringSection])[id];
+	const char* chars = reinterpret_cast<const char*>(bytes.data() + header->sections[CharSection].offset);
+	return std::string_view(chars + ref.offset, ref.length);
+}
+
+size_t ProgramFile::size() const
+{
+	return header->entryCount;
+}
+
+std::optional<size_t> ProgramFile::find(std::string_view name) const
+{
+	auto lookup = sectionOf<LookupRecord>(bytes, header->sections[LookupSection]);
+	const uint64_t hash = nameHash(name);
+	auto it = std::lower_bound(lookup.begin(), lookup.end(), hash, [](const LookupRecord& r, uint64_t h) { return r.hash < h; });
+	for (; it != lookup.end() && it->hash == hash; ++it) {
+		if (this->name(it->entry) == name)
+			return it->entry;
+	}
+	return std::nullopt;
+}
+
+std::string_view ProgramFile::name(size_t entry) const
+{
+	return string(record(entry).name);
+}
+
+ProgramView ProgramFile::program(size_t entry) const
+{
+	const EntryRecord& r = record(entry);
+	ProgramView view;
+	view.code = sectionOf<Instruction>(bytes, header->sections[CodeSection]).subspan(r.codeBegin, r.codeCount);
+	view.constants = sectionOf<double>(bytes, header->sections[ConstantSection]).subspan(r.constantBegin, r.constantCount);
+	view.maxStack = r.maxStack;
+	return view;
+}
+
+size_t ProgramFile::identifierCount(size_t entry) const
+{
+	return record(entry).identifierCount;
+}
+
+std::string_view ProgramFile::identifier(size_t entry, size_t index) const
+{
+	const EntryRecord& r = record(entry);
+	if (index >= r.identifierCount) {
+		ERR(std::format("Program {} has no identifier {}", name(entry), index));
+	}
+	return string(sectionOf<uint32_t>(bytes, header->sections[IdentifierSection])[r.identifierBegin + index]);
+}
+
+double ProgramFile::evaluate(size_t entry) const
+{
+	std::vector<double> slots(identifierCount(entry));
+	VariableStore::global().withSnapshot([&](const VariableStore::Snapshot& snapshot) {
+		for (size_t i = 0; i < slots.size(); ++i) {
+			slots[i] = snapshot.get(identifier(entry, i));
+		}
+	});
+	return execute(program(entry), slots);
+}
+
+Program ProgramFile::toProgram(size_t entry) const
+{
+	ProgramView view = program(entry);
+	Program result;
+	result.code.assign(view.code.begin(), view.code.end());
+	result.constants.assign(view.constants.begin(), view.constants.end());
+	for (size_t i = 0; i < identifierCount(entry); ++i) {
+		result.identifiers.emplace_back(identifier(entry, i));
+	}
+	result.maxStack = view.maxStack;
+	return result;
+}
+
+bool ProgramFile::hasNodes(size_t entry) const
+{
+	return record(entry).nodeCount > 0;
+}
+
+ExprArena ProgramFile::toArena(size_t entry) const
+{
+	const EntryRecord& r = record(entry);
+	if (r.nodeCount == 0) {
+		ERR(std::format("{} was saved without its nodes", name(entry)));
+	}
+	ExprArena arena;
+	auto nodes = sectionOf<ExprNode>(bytes, header->sections[NodeSection]).subspan(r.nodeBegin, r.nodeCount);
+	auto operands = sectionOf<NodeIndex>(bytes, header->sections[OperandSection]).subspan(r.operandBegin, r.operandCount);
+	arena.nodes.assign(nodes.begin(), nodes.end());
+	arena.operands.assign(operands.begin(), operands.end());
+	auto names = sectionOf<uint32_t>(bytes, header->sections[IdentifierSection]).subspan(r.nodeNameBegin, r.nodeNameCount);
+	for (uint32_t id : names) {
+		std::string_view text = string(id);
+		arena.nameToIndex.emplace(std::string(text), static_cast<uint32_t>(arena.names.size()));
+		arena.names.emplace_back(text);
+		arena.slots.push_back(VariableStore::global().intern(text));
+	}
+	arena.reusedNodes = r.reusedNodes;
+	arena.reusedOperands = r.reusedOperands;
+	return arena;
+}
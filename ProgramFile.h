@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "ExprArena.h"
+#include "MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Binary image of many compiled expressions, saved once and mapped back at
+// startup instead of parsing every formula again. It holds the opcode stream of
+// each program and, for expressions added as an ExprArena, its node stream,
+// with constants, one interned identifier table and a name index. Keywords are
+// stored by KeywordType, so a file only loads into a build whose KeywordTable
+// has the same layout. Everything is stored in host byte order.
+constexpr uint32_t ProgramFileVersion = 1;
+
+// Changes whenever a keyword is added, renamed, reordered or changes arity,
+// or the layout of Instruction or ExprNode changes
+uint64_t keywordLayoutHash();
+
+// Collects programs and writes them in the format ProgramFile reads
+class ProgramFileWriter
+{
+public:
+	// name is how the program is found again, typically its source text. Throws
+	// for programs that call user functions, which only exist at runtime.
+	void add(std::string_view name, const Program& program);
+	// Stores the nodes of arena along with the program compile(arena) gives
+	void add(std::string_view name, const ExprArena& arena);
+	size_t size() const;
+
+	std::vector<std::byte> serialize() const;
+	void save(const std::string& path) const;
+
+private:
+	struct Entry
+	{
+		std::string name;
+		Program program;
+		// Empty for entries added as a Program
+		std::vector<ExprNode> nodes;
+		std::vector<NodeIndex> operands;
+		std::vector<std::string> nodeNames;
+		size_t reusedNodes = 0;
+		size_t reusedOperands = 0;
+	};
+
+	std::vector<Entry> entries;
+};
+
+// A validated, read-only view of a program file. Loading maps the file and
+// checks it once; nothing is copied and nothing is allocated per program or
+// node, the programs are executed straight out of the mapping.
+class ProgramFile
+{
+public:
+	// Throws if the file cannot be read, has a different version or keyword
+	// layout, fails its checksum or does not describe well-formed programs
+	explicit ProgramFile(const std::string& path);
+	// Checks bytes in place; they have to outlive the ProgramFile
+	explicit ProgramFile(std::span<const std::byte> bytes);
+
+	size_t size() const;
+	std::optional<size_t> find(std::string_view name) const;
+	std::string_view name(size_t entry) const;
+
+	ProgramView program(size_t entry) const;
+	// Identifiers in slot order, as execute(program(entry), slots) reads them
+	size_t identifierCount(size_t entry) const;
+	std::string_view identifier(size_t entry, size_t index) const;
+	// Reads identifiers from one snapshot of VariableStore::global()
+	double evaluate(size_t entry) const;
+
+	// Copies into the owning forms, for the JIT, the optimizer and the like
+	Program toProgram(size_t entry) const;
+	bool hasNodes(size_t entry) const;
+	ExprArena toArena(size_t entry) const;
+
+private:
+	// Shares the record layouts
+	friend class ProgramFileWriter;
+	struct Header;
+	struct EntryRecord;
+
+	void validate();
+	const EntryRecord& record(size_t entry) const;
+	std::string_view string(uint32_t id) const;
+
+	MappedFile mapped;
+	std::span<const std::byte> bytes;
+	const Header* header = nullptr;
+};
@@ -0,0 +1,328 @@
+#include "SimdKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RATIONALIS_X86 1
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit AVX2 code in functions that ask for it, MSVC always can
+#if defined(__GNUC__) || defined(__clang__)
+#define RATIONALIS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RATIONALIS_TARGET_AVX2
+#endif
+
+// -----------------------------------------------------
+#define SCALAR_BINARY(name, op) \
+	static void name##Scalar(const double* a, const double* b, double* out, size_t n) \
+	{ \
+		for (size_t i = 0; i < n; ++i) \
+			out[i] = a[i] op b[i]; \
+	}
+
+SCALAR_BINARY(add, +)
+SCALAR_BINARY(sub, -)
+SCALAR_BINARY(mul, *)
+SCALAR_BINARY(div, /)
+
+static void negScalar(const double* a, double* out, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = -a[i];
+}
+
+static void sqrtScalar(const double* a, double* out, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = std::sqrt(a[i]);
+}
+
+// -----------------------------------------------------
+// The lanes of a reduction are combined pairwise, then the elements left over
+// after the last full group of four are taken one at a time
+constexpr size_t ReduceLanes = 4;
+constexpr double Infinity = std::numeric_limits<double>::infinity();
+
+// Pick like minpd and maxpd, which return the second operand unless the first
+// one wins, so a NaN is lost and has to be tracked separately
+static double minOf(double a, double b) { return a < b ? a : b; }
+static double maxOf(double a, double b) { return a > b ? a : b; }
+
+static double finishSum(const double* lane, const double* a, size_t i, size_t n)
+{
+	double result = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+	for (; i < n; ++i)
+		result += a[i];
+	return result;
+}
+
+template<double (*Pick)(double, double)>
+static double finishPick(const double* lane, bool nan, const double* a, size_t i, size_t n)
+{
+	double result = Pick(Pick(lane[0], lane[1]), Pick(lane[2], lane[3]));
+	for (; i < n; ++i) {
+		nan |= std::isnan(a[i]);
+		result = Pick(result, a[i]);
+	}
+	return nan ? std::numeric_limits<double>::quiet_NaN() : result;
+}
+
+static double finishDeviation(const double* lane, const double* a, double mean, size_t i, size_t n)
+{
+	double result = (lane[0] + lane[1]) + (lane[2] + lane[3]);
+	for (; i < n; ++i)
+		result += (a[i] - mean) * (a[i] - mean);
+	return result;
+}
+
+static double sumScalar(const double* a, size_t n)
+{
+	double lane[ReduceLanes] = {};
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes)
+		for (size_t k = 0; k < ReduceLanes; ++k)
+			lane[k] += a[i + k];
+	return finishSum(lane, a, i, n);
+}
+
+template<double (*Pick)(double, double), double Start>
+static double pickScalar(const double* a, size_t n)
+{
+	double lane[ReduceLanes] = { Start, Start, Start, Start };
+	bool nan = false;
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		for (size_t k = 0; k < ReduceLanes; ++k) {
+			nan |= std::isnan(a[i + k]);
+			lane[k] = Pick(lane[k], a[i + k]);
+		}
+	}
+	return finishPick<Pick>(lane, nan, a, i, n);
+}
+
+static double squaredDeviationScalar(const double* a, double mean, size_t n)
+{
+	double lane[ReduceLanes] = {};
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes)
+		for (size_t k = 0; k < ReduceLanes; ++k)
+			lane[k] += (a[i + k] - mean) * (a[i + k] - mean);
+	return finishDeviation(lane, a, mean, i, n);
+}
+
+#ifdef RATIONALIS_X86
+// -----------------------------------------------------
+#define SSE2_BINARY(name, op, intrinsic) \
+	static void name##Sse2(const double* a, const double* b, double* out, size_t n) \
+	{ \
+		size_t i = 0; \
+		for (; i + 2 <= n; i += 2) \
+			_mm_storeu_pd(out + i, intrinsic(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i))); \
+		for (; i < n; ++i) \
+			out[i] = a[i] op b[i]; \
+	}
+
+SSE2_BINARY(add, +, _mm_add_pd)
+SSE2_BINARY(sub, -, _mm_sub_pd)
+SSE2_BINARY(mul, *, _mm_mul_pd)
+SSE2_BINARY(div, /, _mm_div_pd)
+
+static void negSse2(const double* a, double* out, size_t n)
+{
+	const __m128d sign = _mm_set1_pd(-0.0);
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(out + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+	for (; i < n; ++i)
+		out[i] = -a[i];
+}
+
+static void sqrtSse2(const double* a, double* out, size_t n)
+{
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2)
+		_mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+	for (; i < n; ++i)
+		out[i] = std::sqrt(a[i]);
+}
+
+// Lanes 0 and 1 in lo, 2 and 3 in hi
+static double sumSse2(const double* a, size_t n)
+{
+	__m128d lo = _mm_setzero_pd();
+	__m128d hi = _mm_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		lo = _mm_add_pd(lo, _mm_loadu_pd(a + i));
+		hi = _mm_add_pd(hi, _mm_loadu_pd(a + i + 2));
+	}
+	double lane[ReduceLanes];
+	_mm_storeu_pd(lane, lo);
+	_mm_storeu_pd(lane + 2, hi);
+	return finishSum(lane, a, i, n);
+}
+
+template<double (*Pick)(double, double), __m128d (*Intrinsic)(__m128d, __m128d), double Start>
+static double pickSse2(const double* a, size_t n)
+{
+	__m128d lo = _mm_set1_pd(Start);
+	__m128d hi = lo;
+	__m128d nan = _mm_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		const __m128d x = _mm_loadu_pd(a + i);
+		const __m128d y = _mm_loadu_pd(a + i + 2);
+		nan = _mm_or_pd(nan, _mm_or_pd(_mm_cmpunord_pd(x, x), _mm_cmpunord_pd(y, y)));
+		lo = Intrinsic(lo, x);
+		hi = Intrinsic(hi, y);
+	}
+	double lane[ReduceLanes];
+	_mm_storeu_pd(lane, lo);
+	_mm_storeu_pd(lane + 2, hi);
+	return finishPick<Pick>(lane, _mm_movemask_pd(nan) != 0, a, i, n);
+}
+
+static __m128d minSse2Pd(__m128d a, __m128d b) { return _mm_min_pd(a, b); }
+static __m128d maxSse2Pd(__m128d a, __m128d b) { return _mm_max_pd(a, b); }
+
+static double squaredDeviationSse2(const double* a, double mean, size_t n)
+{
+	const __m128d m = _mm_set1_pd(mean);
+	__m128d lo = _mm_setzero_pd();
+	__m128d hi = _mm_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		const __m128d x = _mm_sub_pd(_mm_loadu_pd(a + i), m);
+		const __m128d y = _mm_sub_pd(_mm_loadu_pd(a + i + 2), m);
+		lo = _mm_add_pd(lo, _mm_mul_pd(x, x));
+		hi = _mm_add_pd(hi, _mm_mul_pd(y, y));
+	}
+	double lane[ReduceLanes];
+	_mm_storeu_pd(lane, lo);
+	_mm_storeu_pd(lane + 2, hi);
+	return finishDeviation(lane, a, mean, i, n);
+}
+
+// -----------------------------------------------------
+#define AVX2_BINARY(name, op, intrinsic) \
+	RATIONALIS_TARGET_AVX2 static void name##Avx2(const double* a, const double* b, double* out, size_t n) \
+	{ \
+		size_t i = 0; \
+		for (; i + 4 <= n; i += 4) \
+			_mm256_storeu_pd(out + i, intrinsic(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+		for (; i < n; ++i) \
+			out[i] = a[i] op b[i]; \
+	}
+
+AVX2_BINARY(add, +, _mm256_add_pd)
+AVX2_BINARY(sub, -, _mm256_sub_pd)
+AVX2_BINARY(mul, *, _mm256_mul_pd)
+AVX2_BINARY(div, /, _mm256_div_pd)
+
+RATIONALIS_TARGET_AVX2 static void negAvx2(const double* a, double* out, size_t n)
+{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+	for (; i < n; ++i)
+		out[i] = -a[i];
+}
+
+RATIONALIS_TARGET_AVX2 static void sqrtAvx2(const double* a, double* out, size_t n)
+{
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+	for (; i < n; ++i)
+		out[i] = std::sqrt(a[i]);
+}
+
+RATIONALIS_TARGET_AVX2 static double sumAvx2(const double* a, size_t n)
+{
+	__m256d acc = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes)
+		acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+	double lane[ReduceLanes];
+	_mm256_storeu_pd(lane, acc);
+	return finishSum(lane, a, i, n);
+}
+
+RATIONALIS_TARGET_AVX2 static double minAvx2(const double* a, size_t n)
+{
+	__m256d acc = _mm256_set1_pd(Infinity);
+	__m256d nan = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		const __m256d x = _mm256_loadu_pd(a + i);
+		nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+		acc = _mm256_min_pd(acc, x);
+	}
+	double lane[ReduceLanes];
+	_mm256_storeu_pd(lane, acc);
+	return finishPick<minOf>(lane, _mm256_movemask_pd(nan) != 0, a, i, n);
+}
+
+RATIONALIS_TARGET_AVX2 static double maxAvx2(const double* a, size_t n)
+{
+	__m256d acc = _mm256_set1_pd(-Infinity);
+	__m256d nan = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		const __m256d x = _mm256_loadu_pd(a + i);
+		nan = _mm256_or_pd(nan, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+		acc = _mm256_max_pd(acc, x);
+	}
+	double lane[ReduceLanes];
+	_mm256_storeu_pd(lane, acc);
+	return finishPick<maxOf>(lane, _mm256_movemask_pd(nan) != 0, a, i, n);
+}
+
+RATIONALIS_TARGET_AVX2 static double squaredDeviationAvx2(const double* a, double mean, size_t n)
+{
+	const __m256d m = _mm256_set1_pd(mean);
+	__m256d acc = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + ReduceLanes <= n; i += ReduceLanes) {
+		const __m256d x = _mm256_sub_pd(_mm256_loadu_pd(a + i), m);
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(x, x));
+	}
+	double lane[ReduceLanes];
+	_mm256_storeu_pd(lane, acc);
+	return finishDeviation(lane, a, mean, i, n);
+}
+#endif
+
+// -----------------------------------------------------
+const SimdKernels& SimdKernels::get(SimdLevel level)
+{
+	static const SimdKernels scalar{ SimdLevel::Scalar, addScalar, subScalar, mulScalar, divScalar, negScalar, sqrtScalar,
+		sumScalar, pickScalar<minOf, Infinity>, pickScalar<maxOf, -Infinity>, squaredDeviationScalar };
+#ifdef RATIONALIS_X86
+	static const SimdKernels sse2{ SimdLevel::SSE2, addSse2, subSse2, mulSse2, divSse2, negSse2, sqrtSse2,
+		sumSse2, pickSse2<minOf, minSse2Pd, Infinity>, pickSse2<maxOf, maxSse2Pd, -Infinity>, squaredDeviationSse2 };
+	static const SimdKernels avx2{ SimdLevel::AVX2, addAvx2, subAvx2, mulAvx2, divAvx2, negAvx2, sqrtAvx2,
+		sumAvx2, minAvx2, maxAvx2, squaredDeviationAvx2 };
+#endif
+
+	switch (std::min(level, detectSimdLevel()))
+	{
+#ifdef RATIONALIS_X86
+	case SimdLevel::AVX2:
+		return avx2;
+	case SimdLevel::SSE2:
+		return sse2;
+#endif
+	default:
+		return scalar;
+	}
+}
+
+const SimdKernels& SimdKernels::best()
+{
+	return get(detectSimdLevel());
+}
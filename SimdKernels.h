@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CpuFeatures.h"
+#include <cstddef>
+
+// Element-wise kernels over n contiguous doubles. Inputs may alias the output.
+// Every variant rounds exactly like the scalar operator, so the result does
+// not depend on the selected instruction set.
+struct SimdKernels
+{
+	using Unary = void (*)(const double* a, double* out, size_t n);
+	using Binary = void (*)(const double* a, const double* b, double* out, size_t n);
+	using Reduce = double (*)(const double* a, size_t n);
+	using Deviation = double (*)(const double* a, double mean, size_t n);
+
+	SimdLevel level;
+	Binary add;
+	Binary sub;
+	Binary mul;
+	Binary div;
+	Unary neg;
+	Unary sqrt;
+
+	// Reductions keep one partial result per lane of an AVX2 register, even in
+	// the scalar and SSE2 variants, and combine the lanes in the same order, so
+	// they too give the same bits at every level.
+	Reduce sum;
+	// NaN if any element is NaN, +inf (-inf for max) if n is 0
+	Reduce min;
+	Reduce max;
+	// Sum of (a[i] - mean)^2
+	Deviation squaredDeviation;
+
+	// Kernels for the given level, clamped to what this CPU supports
+	static const SimdKernels& get(SimdLevel level);
+	// Kernels for the widest level this CPU supports
+	static const SimdKernels& best();
+};
@@ -0,0 +1,653 @@
+#pragma once
+
+#include "Tokenizer.h"
+#include "Bytecode.h"
+#include "Keyword.h"
+#include "ParseRule.h"
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Parses a string literal while compiling, with the grammar and binding powers
+// of parseExpr, into an expression template whose type is the tree:
+//
+//	constexpr auto f = parseStatic<"x * y + sqrt(x)">();
+//	double value = f(2.0, 3.0); // arguments follow f.identifiers
+//
+// Evaluating it is plain inline arithmetic and gives bit-identical results to
+// execute(compile(parseExpr(...))). Syntax errors stop compilation at a call to
+// staticSyntaxError(), whose argument is the message parseExpr would throw.
+// Assignments are rejected, since ledEquals has side effects.
+
+// Not constexpr on purpose: reaching it during constant evaluation is the error
+inline void staticSyntaxError(const char* message)
+{
+	throw std::runtime_error(message);
+}
+
+// A string literal usable as a template argument
+template<size_t N>
+struct FixedString
+{
+	char text[N] = {};
+
+	consteval FixedString(const char (&str)[N])
+	{
+		for (size_t i = 0; i < N; ++i)
+			text[i] = str[i];
+	}
+
+	constexpr std::string_view view() const { return { text, N - 1 }; }
+};
+
+// -----------------------------------------------------
+// Unsigned integer big enough to round any literal of up to StaticMaxDigits
+// significant digits to the nearest double exactly, like std::from_chars
+constexpr size_t StaticMaxDigits = 768;
+
+struct StaticBigInt
+{
+	static constexpr size_t Capacity = 128; // 4096 bits
+	uint32_t limbs[Capacity] = {};
+	size_t size = 0;
+
+	constexpr void multiplyAdd(uint32_t factor, uint32_t addend)
+	{
+		uint64_t carry = addend;
+		for (size_t i = 0; i < size; ++i) {
+			uint64_t product = uint64_t(limbs[i]) * factor + carry;
+			limbs[i] = static_cast<uint32_t>(product);
+			carry = product >> 32;
+		}
+		if (carry)
+			limbs[size++] = static_cast<uint32_t>(carry);
+	}
+
+	constexpr void shiftLeft(size_t bits)
+	{
+		if (size == 0)
+			return;
+		const size_t words = bits / 32, rest = bits % 32;
+		size_t newSize = size + words + 1;
+		for (size_t i = newSize; i-- > 0;) {
+			uint64_t high = i >= words && i - words < size ? limbs[i - words] : 0;
+			uint64_t low = i >= words + 1 && i - words - 1 < size ? limbs[i - words - 1] : 0;
+			limbs[i] = rest ? static_cast<uint32_t>((high << rest) | (low >> (32 - rest))) : static_cast<uint32_t>(high);
+		}
+		size = newSize;
+		trim();
+	}
+
+	constexpr void subtract(const StaticBigInt& other)
+	{
+		int64_t borrow = 0;
+		for (size_t i = 0; i < size; ++i) {
+			int64_t diff = int64_t(limbs[i]) - (i < other.size ? other.limbs[i] : 0) - borrow;
+			borrow = diff < 0;
+			limbs[i] = static_cast<uint32_t>(diff + (borrow << 32));
+		}
+		trim();
+	}
+
+	constexpr int compare(const StaticBigInt& other) const
+	{
+		if (size != other.size)
+			return size < other.size ? -1 : 1;
+		for (size_t i = size; i-- > 0;) {
+			if (limbs[i] != other.limbs[i])
+				return limbs[i] < other.limbs[i] ? -1 : 1;
+		}
+		return 0;
+	}
+
+	constexpr size_t bitLength() const
+	{
+		return size == 0 ? 0 : 32 * (size - 1) + std::bit_width(limbs[size - 1]);
+	}
+
+	constexpr void trim()
+	{
+		while (size > 0 && limbs[size - 1] == 0)
+			--size;
+	}
+};
+
+// floor(num * 2^shift / den) for a quotient known to fit in 56 bits
+constexpr uint64_t staticDivide(StaticBigInt num, StaticBigInt den, int shift, bool& inexact)
+{
+	if (shift >= 0)
+		num.shiftLeft(shift);
+	else
+		den.shiftLeft(-shift);
+	uint64_t quotient = 0;
+	for (int bit = 56; bit >= 0; --bit) {
+		StaticBigInt part = den;
+		part.shiftLeft(bit);
+		if (part.compare(num) <= 0) {
+			num.subtract(part);
+			quotient |= uint64_t(1) << bit;
+		}
+	}
+	inexact = num.size != 0;
+	return quotient;
+}
+
+// Decodes a Number token to the nearest double, ties to even
+consteval double staticDecodeNumber(std::string_view text)
+{
+	StaticBigInt mantissa;
+	int digits = 0, exponent = 0;
+	bool anyDigit = false, afterDot = false;
+	size_t i = 0;
+	for (; i < text.size() && text[i] != 'e' && text[i] != 'E'; ++i) {
+		if (text[i] == '.') {
+			afterDot = true;
+			continue;
+		}
+		anyDigit = true;
+		if (afterDot)
+			--exponent;
+		if (digits == 0 && text[i] == '0')
+			continue; // Leading zeros are not significant
+		if (++digits > static_cast<int>(StaticMaxDigits))
+			staticSyntaxError("Number has too many digits to be decoded at compile time");
+		mantissa.multiplyAdd(10, static_cast<uint32_t>(text[i] - '0'));
+	}
+	if (!anyDigit)
+		staticSyntaxError("Invalid number");
+	if (i < text.size()) {
+		bool negative = text[++i] == '-';
+		if (text[i] == '+' || text[i] == '-')
+			++i;
+		int value = 0;
+		for (; i < text.size(); ++i)
+			value = value > 100000 ? value : value * 10 + (text[i] - '0');
+		exponent += negative ? -value : value;
+	}
+	if (mantissa.size == 0)
+		return 0.0;
+
+	// The value is below 10^(digits + exponent)
+	if (digits + exponent > 310)
+		staticSyntaxError("Number is too large");
+	if (digits + exponent < -324)
+		staticSyntaxError("Number is too small");
+
+	StaticBigInt num = mantissa, den;
+	den.limbs[0] = 1;
+	den.size = 1;
+	for (int e = 0; e < (exponent < 0 ? -exponent : exponent); ++e)
+		(exponent < 0 ? den : num).multiplyAdd(10, 0);
+
+	// Scale so the quotient has 54 bits, one more than a double keeps for rounding
+	int shift = 54 - (static_cast<int>(num.bitLength()) - static_cast<int>(den.bitLength()));
+	bool inexact = false;
+	uint64_t quotient = staticDivide(num, den, shift, inexact);
+	if (quotient >= (uint64_t(1) << 54))
+		quotient = staticDivide(num, den, --shift, inexact);
+	else if (quotient < (uint64_t(1) << 53))
+		quotient = staticDivide(num, den, ++shift, inexact);
+
+	// Subnormals have a fixed exponent and fewer bits
+	const bool subnormal = 1 - shift < -1074;
+	if (subnormal) {
+		shift = 1075;
+		quotient = staticDivide(num, den, shift, inexact);
+	}
+
+	uint64_t bits = quotient >> 1;
+	if ((quotient & 1) && (inexact || (bits & 1)))
+		++bits;
+	if (subnormal) {
+		if (bits == 0)
+			staticSyntaxError("Number is too small");
+		return std::bit_cast<double>(bits);
+	}
+	int binaryExponent = 1 - shift;
+	if (bits == (uint64_t(1) << 53)) {
+		bits >>= 1;
+		++binaryExponent;
+	}
+	const int biased = binaryExponent + 52 + 1023;
+	if (biased >= 2047)
+		staticSyntaxError("Number is too large");
+	return std::bit_cast<double>((uint64_t(biased) << 52) | (bits & ((uint64_t(1) << 52) - 1)));
+}
+
+// -----------------------------------------------------
+enum class StaticNodeKind : uint8_t {
+	Number,
+	Identifier,
+	Unary,
+	Binary,
+	Keyword
+};
+
+struct StaticNode
+{
+	StaticNodeKind kind = StaticNodeKind::Number;
+	// TokenType for Unary/Binary, KeywordType for Keyword
+	unsigned op = 0;
+	// Number of arguments of a Keyword
+	size_t count = 0;
+	// Operand, left side, identifier index or first argument in StaticTree::operands
+	size_t first = 0;
+	size_t second = 0;
+	double value = 0.0;
+};
+
+// The parsed form of a literal of N characters, which has at most N nodes
+template<size_t N>
+struct StaticTree
+{
+	char source[N] = {};
+	StaticNode nodes[N] = {};
+	size_t operands[N] = {};
+	// Distinct identifiers in the order compile() would list them
+	size_t identifierBegin[N] = {};
+	size_t identifierLength[N] = {};
+	size_t nodeCount = 0;
+	size_t operandCount = 0;
+	size_t identifierCount = 0;
+	size_t root = 0;
+
+	constexpr std::string_view identifier(size_t index) const
+	{
+		return { source + identifierBegin[index], identifierLength[index] };
+	}
+};
+
+struct StaticToken
+{
+	TokenType type = TokenType::EndOfFile;
+	size_t begin = 0;
+	size_t length = 0;
+	double number = 0.0;
+};
+
+constexpr bool staticIsSpace(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool staticIsDigit(char c) { return c >= '0' && c <= '9'; }
+constexpr bool staticIsAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+// Mirrors Tokenizer and the nud/led functions of ParseRule.cpp one for one
+template<size_t N>
+struct StaticParser
+{
+	StaticTree<N> tree;
+	std::string_view text;
+	size_t pos = 0;
+	StaticToken current;
+	bool peeked = false;
+
+	consteval StaticParser(const char (&source)[N])
+	{
+		for (size_t i = 0; i < N; ++i)
+			tree.source[i] = source[i];
+		text = std::string_view(tree.source, N - 1);
+	}
+
+	consteval StaticToken lex()
+	{
+		while (pos < text.size() && staticIsSpace(text[pos]))
+			++pos;
+		if (pos >= text.size())
+			return StaticToken{ TokenType::EndOfFile, pos, 0 };
+
+		const size_t start = pos;
+		switch (text[pos])
+		{
+		case '+': ++pos; return StaticToken{ TokenType::Plus, start, 1 };
+		case '-': ++pos; return StaticToken{ TokenType::Minus, start, 1 };
+		case '*': ++pos; return StaticToken{ TokenType::Mult, start, 1 };
+		case '/': ++pos; return StaticToken{ TokenType::Div, start, 1 };
+		case '^': ++pos; return StaticToken{ TokenType::Pow, start, 1 };
+		case '(': ++pos; return StaticToken{ TokenType::LBracket, start, 1 };
+		case ')': ++pos; return StaticToken{ TokenType::RBracket, start, 1 };
+		case '=': ++pos; return StaticToken{ TokenType::Equals, start, 1 };
+		case ',': ++pos; return StaticToken{ TokenType::Comma, start, 1 };
+		default:
+			break;
+		}
+		if (staticIsDigit(text[pos]) || text[pos] == '.') {
+			skipNumber();
+			return StaticToken{ TokenType::Number, start, pos - start, staticDecodeNumber(text.substr(start, pos - start)) };
+		}
+		if (staticIsAlpha(text[pos])) {
+			while (pos < text.size() && staticIsAlpha(text[pos]))
+				++pos;
+			bool keyword = findKeyword(text.substr(start, pos - start)) != nullptr;
+			return StaticToken{ keyword ? TokenType::Keyword : TokenType::Identifier, start, pos - start };
+		}
+		staticSyntaxError("Unknown token");
+		return {};
+	}
+
+	consteval void skipNumber()
+	{
+		while (pos < text.size() && staticIsDigit(text[pos]))
+			++pos;
+		if (pos < text.size() && text[pos] == '.') {
+			++pos;
+			while (pos < text.size() && staticIsDigit(text[pos]))
+				++pos;
+		}
+		if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+			size_t digits = pos + 1;
+			if (digits < text.size() && (text[digits] == '+' || text[digits] == '-'))
+				++digits;
+			if (digits < text.size() && staticIsDigit(text[digits])) {
+				pos = digits;
+				while (pos < text.size() && staticIsDigit(text[pos]))
+					++pos;
+			}
+		}
+	}
+
+	static consteval const KeywordSignature* findKeyword(std::string_view name)
+	{
+		for (const KeywordSignature& signature : KeywordSignatures) {
+			if (signature.name == name)
+				return &signature;
+		}
+		return nullptr;
+	}
+
+	consteval const StaticToken& peek()
+	{
+		if (!peeked) {
+			current = lex();
+			peeked = true;
+		}
+		return current;
+	}
+
+	consteval void consume()
+	{
+		peek();
+		peeked = false;
+	}
+
+	consteval size_t addNode(StaticNode node)
+	{
+		tree.nodes[tree.nodeCount] = node;
+		return tree.nodeCount++;
+	}
+
+	consteval size_t identifierIndex(const StaticToken& tok)
+	{
+		std::string_view name = text.substr(tok.begin, tok.length);
+		for (size_t i = 0; i < tree.identifierCount; ++i) {
+			if (tree.identifier(i) == name)
+				return i;
+		}
+		tree.identifierBegin[tree.identifierCount] = tok.begin;
+		tree.identifierLength[tree.identifierCount] = tok.length;
+		return tree.identifierCount++;
+	}
+
+	static consteval const BindingPower& power(TokenType type)
+	{
+		return BindingPowers[static_cast<size_t>(type)];
+	}
+
+	static consteval bool hasNud(TokenType type)
+	{
+		return type == TokenType::Plus || type == TokenType::Minus || type == TokenType::LBracket ||
+			type == TokenType::Number || type == TokenType::Identifier || type == TokenType::Keyword;
+	}
+
+	static consteval bool hasLed(TokenType type)
+	{
+		return type == TokenType::Plus || type == TokenType::Minus || type == TokenType::Mult ||
+			type == TokenType::Div || type == TokenType::Pow || type == TokenType::RBracket || type == TokenType::Equals;
+	}
+
+	consteval size_t nud()
+	{
+		const StaticToken tok = peek();
+		switch (tok.type)
+		{
+		case TokenType::Plus:
+		case TokenType::Minus: {
+			// Like nudUnary, the operand is a single nud and not a whole expression
+			consume();
+			if (!hasNud(peek().type))
+				staticSyntaxError("No nud function for token");
+			size_t operand = nud();
+			return addNode(StaticNode{ StaticNodeKind::Unary, static_cast<unsigned>(tok.type), 0, operand });
+		}
+		case TokenType::LBracket: {
+			consume();
+			size_t expr = parse(TokenType::RBracket, 0);
+			if (peek().type != TokenType::RBracket)
+				staticSyntaxError("Expected closing bracket");
+			consume();
+			return expr;
+		}
+		case TokenType::Number:
+			consume();
+			return addNode(StaticNode{ StaticNodeKind::Number, 0, 0, 0, 0, tok.number });
+		case TokenType::Identifier:
+			consume();
+			return addNode(StaticNode{ StaticNodeKind::Identifier, 0, 0, identifierIndex(tok) });
+		case TokenType::Keyword:
+			consume();
+			return keyword(*findKeyword(text.substr(tok.begin, tok.length)));
+		default:
+			staticSyntaxError("Token should not be at the beginning of an expression");
+			return 0;
+		}
+	}
+
+	consteval size_t keyword(const KeywordSignature& signature)
+	{
+		std::vector<size_t> arguments;
+		if (signature.argCount < 0) {
+			if (peek().type != TokenType::LBracket)
+				staticSyntaxError("Expected opening bracket");
+			consume();
+			// Binding power 1 ends an argument at a comma and at the closing
+			// bracket alike, which both bind with 0, and at no operator
+			arguments.push_back(parse(TokenType::Comma, 1));
+			while (peek().type == TokenType::Comma) {
+				consume();
+				arguments.push_back(parse(TokenType::Comma, 1));
+			}
+			if (peek().type != TokenType::RBracket)
+				staticSyntaxError("Expected closing bracket");
+			consume();
+		}
+		else if (signature.argCount > 0) {
+			if (peek().type != TokenType::LBracket)
+				staticSyntaxError("Expected opening bracket");
+			consume();
+			for (int i = 0; i < signature.argCount - 1; ++i) {
+				arguments.push_back(parse(TokenType::Comma, 0));
+				if (peek().type == TokenType::Comma)
+					consume();
+			}
+			arguments.push_back(parse(TokenType::RBracket, 0));
+			if (peek().type != TokenType::RBracket)
+				staticSyntaxError("Expected closing bracket");
+			consume();
+		}
+		StaticNode node{ StaticNodeKind::Keyword, static_cast<unsigned>(signature.id), arguments.size(), tree.operandCount };
+		for (size_t argument : arguments)
+			tree.operands[tree.operandCount++] = argument;
+		return addNode(node);
+	}
+
+	consteval size_t parse(TokenType end, int minBindingPower)
+	{
+		const StaticToken first = peek();
+		if (first.type == TokenType::EndOfFile || first.type == end)
+			staticSyntaxError("Unexpected end of file");
+		if (!hasNud(first.type))
+			staticSyntaxError("Token should not be at the beginning of an expression!");
+		size_t left = nud();
+
+		while (peek().type != end && peek().type != TokenType::EndOfFile) {
+			const StaticToken tok = peek();
+			if (power(tok.type).lbp < minBindingPower)
+				break;
+			if (!hasLed(tok.type))
+				staticSyntaxError("Token should not be in the middle of an expression");
+			if (tok.type == TokenType::Equals)
+				staticSyntaxError("Assignments are not supported in static expressions");
+			// ledNone would return without consuming and parseExpr would never finish
+			if (tok.type == TokenType::RBracket)
+				staticSyntaxError("Unexpected closing bracket");
+			consume();
+			size_t right = parse(TokenType::EndOfFile, power(tok.type).rbp);
+			left = addNode(StaticNode{ StaticNodeKind::Binary, static_cast<unsigned>(tok.type), 0, left, right });
+		}
+		return left;
+	}
+};
+
+template<FixedString Source>
+consteval auto parseStaticTree()
+{
+	StaticParser<sizeof(Source.text)> parser(Source.text);
+	parser.tree.root = parser.parse(TokenType::EndOfFile, 0);
+	return parser.tree;
+}
+
+template<FixedString Source>
+inline constexpr auto StaticTreeOf = parseStaticTree<Source>();
+
+// -----------------------------------------------------
+// Expression template nodes. load(i) returns the value of identifier i.
+template<double Value>
+struct StaticConstant
+{
+	template<typename Load>
+	static double eval(const Load&) { return Value; }
+};
+
+template<size_t Index>
+struct StaticVariable
+{
+	template<typename Load>
+	static double eval(const Load& load) { return load(Index); }
+};
+
+template<TokenType Op, typename Operand>
+struct StaticUnary
+{
+	template<typename Load>
+	static double eval(const Load& load)
+	{
+		double value = Operand::eval(load);
+		return Op == TokenType::Minus ? -value : value;
+	}
+};
+
+template<TokenType Op, typename Left, typename Right>
+struct StaticBinary
+{
+	template<typename Load>
+	static double eval(const Load& load)
+	{
+		// Left before right, like every other evaluator
+		double left = Left::eval(load);
+		double right = Right::eval(load);
+		if constexpr (Op == TokenType::Plus) return left + right;
+		else if constexpr (Op == TokenType::Minus) return left - right;
+		else if constexpr (Op == TokenType::Mult) return left * right;
+		else if constexpr (Op == TokenType::Div) return left / right;
+		else return power(left, right);
+	}
+};
+
+template<KeywordType Id, typename... Args>
+struct StaticCall
+{
+	template<typename Load>
+	static double eval(const Load& load)
+	{
+		// Braced initialization keeps the arguments in order
+		const double values[] = { 0.0, Args::eval(load)... };
+		return [&]<size_t... I>(std::index_sequence<I...>) {
+			return applyKeyword<Id>(values[I + 1]...);
+		}(std::index_sequence_for<Args...>{});
+	}
+};
+
+template<const auto& Tree, size_t Index>
+consteval auto makeStaticNode()
+{
+	constexpr StaticNode node = Tree.nodes[Index];
+	if constexpr (node.kind == StaticNodeKind::Number)
+		return StaticConstant<node.value>{};
+	else if constexpr (node.kind == StaticNodeKind::Identifier)
+		return StaticVariable<node.first>{};
+	else if constexpr (node.kind == StaticNodeKind::Unary)
+		return StaticUnary<static_cast<TokenType>(node.op), decltype(makeStaticNode<Tree, node.first>())>{};
+	else if constexpr (node.kind == StaticNodeKind::Binary)
+		return StaticBinary<static_cast<TokenType>(node.op), decltype(makeStaticNode<Tree, node.first>()), decltype(makeStaticNode<Tree, node.second>())>{};
+	else
+		return [&]<size_t... I>(std::index_sequence<I...>) {
+			return StaticCall<static_cast<KeywordType>(node.op), decltype(makeStaticNode<Tree, Tree.operands[node.first + I]>())...>{};
+		}(std::make_index_sequence<node.count>{});
+}
+
+// -----------------------------------------------------
+template<typename Root, const auto& Tree>
+struct StaticExpr
+{
+	using RootNode = Root;
+	static constexpr size_t identifierCount = Tree.identifierCount;
+
+	// Names of the identifiers, in the order arguments and slots follow
+	static constexpr std::array<std::string_view, identifierCount> identifiers = [] {
+		std::array<std::string_view, identifierCount> names{};
+		for (size_t i = 0; i < identifierCount; ++i)
+			names[i] = Tree.identifier(i);
+		return names;
+	}();
+
+	template<typename... Values>
+	double operator()(Values... values) const
+	{
+		static_assert(sizeof...(Values) == identifierCount, "Expected one value per identifier");
+		const double slots[] = { static_cast<double>(values)..., 0.0 };
+		return eval(slots);
+	}
+
+	// slots[i] holds the value of identifiers[i]
+	double eval(const double* slots) const
+	{
+		return Root::eval([slots](size_t i) { return slots[i]; });
+	}
+
+	// Evaluates every row, columns[i] holds the values of identifiers[i]
+	void evalBatch(std::span<const std::span<const double>> columns, std::span<double> out) const
+	{
+		if (columns.size() < identifierCount) {
+			throw std::runtime_error("Expected one column per identifier");
+		}
+		std::array<const double*, identifierCount + 1> data{};
+		for (size_t i = 0; i < identifierCount; ++i) {
+			if (columns[i].size() < out.size())
+				throw std::runtime_error("Column is shorter than the output");
+			data[i] = columns[i].data();
+		}
+		for (size_t row = 0; row < out.size(); ++row)
+			out[row] = Root::eval([&data, row](size_t i) { return data[i][row]; });
+	}
+};
+
+template<FixedString Source>
+consteval auto parseStatic()
+{
+	constexpr const auto& tree = StaticTreeOf<Source>;
+	return StaticExpr<decltype(makeStaticNode<tree, tree.root>()), tree>{};
+}
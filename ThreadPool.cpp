@@ -0,0 +1,153 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <exception>
+
+// Which pool the current thread works for, so nested submits stay local
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+	threadCount = std::max<size_t>(threadCount, 1);
+	for (size_t i = 0; i < threadCount; ++i) {
+		workers.push_back(std::make_unique<Worker>());
+	}
+	for (size_t i = 0; i < threadCount; ++i) {
+		threads.emplace_back([this, i] { run(i); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+size_t ThreadPool::size() const
+{
+	return workers.size();
+}
+
+void ThreadPool::submit(Task task)
+{
+	bool local = currentPool == this && currentWorker < workers.size();
+	size_t worker = local ? currentWorker : nextWorker++ % workers.size();
+	push(worker, std::move(task));
+}
+
+void ThreadPool::push(size_t worker, Task task)
+{
+	{
+		std::lock_guard lock(workers[worker]->mutex);
+		workers[worker]->tasks.push_back(std::move(task));
+	}
+	// Counting under sleepMutex means a worker about to sleep cannot miss it
+	{
+		std::lock_guard lock(sleepMutex);
+		++pending;
+	}
+	wake.notify_one();
+}
+
+bool ThreadPool::pop(size_t worker, Task& task)
+{
+	const size_t count = workers.size();
+	for (size_t i = 0; i < count; ++i) {
+		Worker& victim = *workers[(worker + i) % count];
+		std::lock_guard lock(victim.mutex);
+		if (victim.tasks.empty())
+			continue;
+		// Own tasks newest first while they are still in cache, stolen ones oldest first
+		if (i == 0) {
+			task = std::move(victim.tasks.back());
+			victim.tasks.pop_back();
+		}
+		else {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+		}
+		--pending;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::run(size_t worker)
+{
+	currentPool = this;
+	currentWorker = worker;
+	while (true) {
+		Task task;
+		if (pop(worker, task)) {
+			task();
+			continue;
+		}
+		std::unique_lock lock(sleepMutex);
+		wake.wait(lock, [this] { return stopping || pending > 0; });
+		if (stopping && pending == 0)
+			return;
+	}
+}
+
+// -----------------------------------------------------
+void ThreadPool::parallelFor(size_t count, size_t grain, const RangeBody& body)
+{
+	if (count == 0)
+		return;
+	grain = std::max<size_t>(grain, 1);
+	const size_t chunks = (count + grain - 1) / grain;
+
+	std::atomic<size_t> remaining = chunks;
+	std::mutex doneMutex;
+	std::condition_variable done;
+	std::exception_ptr error;
+
+	auto runChunk = [&](size_t chunk, size_t worker) {
+		size_t begin = chunk * grain;
+		size_t end = std::min(begin + grain, count);
+		try {
+			body(begin, end, worker);
+		}
+		catch (...) {
+			std::lock_guard lock(doneMutex);
+			if (!error)
+				error = std::current_exception();
+		}
+		// Under the lock, so the waiter cannot see 0 and destroy all of this
+		// before the notify is done with it
+		std::lock_guard lock(doneMutex);
+		if (--remaining == 0)
+			done.notify_all();
+	};
+
+	// Every worker starts with a contiguous run of chunks and steals the rest
+	const size_t workerCount = workers.size();
+	for (size_t chunk = 0; chunk < chunks; ++chunk) {
+		size_t worker = chunk * workerCount / chunks;
+		push(worker, [&runChunk, chunk] { runChunk(chunk, currentWorker); });
+	}
+
+	// A worker waiting here could starve the pool, so it runs tasks itself
+	const size_t self = currentPool == this ? currentWorker : workerCount;
+	Task task;
+	while (remaining > 0 && pop(self % workerCount, task)) {
+		size_t saved = currentWorker;
+		const ThreadPool* savedPool = currentPool;
+		currentPool = this;
+		currentWorker = self;
+		task();
+		currentWorker = saved;
+		currentPool = savedPool;
+	}
+
+	std::unique_lock lock(doneMutex);
+	done.wait(lock, [&] { return remaining == 0; });
+	if (error)
+		std::rethrow_exception(error);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker pops the
+// newest task of its own deque and, once that is empty, steals the oldest task
+// of another one, so uneven work spreads out without a shared queue.
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+	// body(begin, end, worker) handles the indices [begin, end)
+	using RangeBody = std::function<void(size_t, size_t, size_t)>;
+
+	explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const;
+
+	// Tasks submitted from a worker go to its own deque, others are spread round robin
+	void submit(Task task);
+
+	// Splits [0, count) into chunks of grain indices and blocks until body has run
+	// on all of them. worker is below size(), or equal to it for the calling
+	// thread, which helps instead of idling. Rethrows the first exception thrown.
+	void parallelFor(size_t count, size_t grain, const RangeBody& body);
+
+private:
+	struct Worker
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void push(size_t worker, Task task);
+	bool pop(size_t worker, Task& task);
+	void run(size_t worker);
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+
+	// Tasks pushed but not popped yet
+	std::atomic<size_t> pending = 0;
+	std::atomic<size_t> nextWorker = 0;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
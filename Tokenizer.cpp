@@ -1,8 +1,12 @@
 #include "Tokenizer.h"
 
 #include <stdexcept>
+#include <charconv>
+#include <format>
 #include <iostream>
 #include "Keyword.h"
+#include "Function.h"
+#include "PerfCounters.h"
 
 const Token Token::END_OF_FILE{ TokenType::EndOfFile, "\0" };
 
@@ -30,6 +34,10 @@ std::string tokenTypeToString(TokenType type)
 		return "Keyword";
 	case TokenType::Comma:
 		return ",";
+	case TokenType::LSquare:
+		return "[";
+	case TokenType::RSquare:
+		return "]";
 	default:
 		return "Unknown token type";
 	}
@@ -89,6 +97,33 @@ void Tokenizer::skipNumber()
 			pos++;
 		}
 	}
+	// Only take the exponent if digits follow, so "2e" stays a number and the keyword e
+	if (pos < tokens.size() && (tokens[pos] == 'e' || tokens[pos] == 'E'))
+	{
+		size_t digits = pos + 1;
+		if (digits < tokens.size() && (tokens[digits] == '+' || tokens[digits] == '-'))
+			digits++;
+		if (digits < tokens.size() && isdigit(tokens[digits]))
+		{
+			pos = digits;
+			while (pos < tokens.size() && isdigit(tokens[pos]))
+			{
+				pos++;
+			}
+		}
+	}
+}
+
+// from_chars is locale-independent and round-trips exactly, unlike std::stod
+double decodeNumber(std::string_view text)
+{
+	double value = 0.0;
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (ec != std::errc() || end != text.data() + text.size())
+	{
+		throw std::runtime_error(std::format("Invalid number: '{}'", text));
+	}
+	return value;
 }
 
 void Tokenizer::skipWord()
@@ -119,16 +154,21 @@ Token Tokenizer::getToken()
 		return Token{ TokenType::Equals, "=" };
 	if (match(','))
 		return Token{ TokenType::Comma, "," };
+	if (match('['))
+		return Token{ TokenType::LSquare, "[" };
+	if (match(']'))
+		return Token{ TokenType::RSquare, "]" };
 	if (isdigit(peek()) || peek() == '.') {
 		size_t start = pos;
 		skipNumber();
-		return Token{ TokenType::Number, tokens.substr(start, pos - start) };
+		std::string_view text = tokens.substr(start, pos - start);
+		return Token{ TokenType::Number, text, decodeNumber(text) };
 	}
 	if (isalpha(peek())) {
 		size_t start = pos;
 		skipWord();
-		std::string word = tokens.substr(start, pos - start);
-		if (KeywordInfo::getTable().contains(word)) {
+		std::string_view word = tokens.substr(start, pos - start);
+		if (KeywordInfo::getTable().contains(word) || functions->contains(word)) {
 			return Token{ TokenType::Keyword, word };
 		}
 		else {
@@ -140,9 +180,15 @@ Token Tokenizer::getToken()
 	throw std::runtime_error(std::format("Unknown token: '{}'", peek()));
 }
 
-std::vector<Token> tokenize(const std::string& str)
+std::vector<Token> tokenize(std::string_view str)
+{
+	return tokenize(str, FunctionTable::global());
+}
+
+std::vector<Token> tokenize(std::string_view str, const FunctionTable& functions)
 {
-	Tokenizer tokenizer{ str, 0 };
+	PerfTimer timer(PerfStage::Tokenize);
+	Tokenizer tokenizer{ str, 0, &functions };
 	std::vector<Token> toks;
 
 	tokenizer.skipWhitespace();
@@ -151,6 +197,7 @@ std::vector<Token> tokenize(const std::string& str)
 		toks.push_back(tokenizer.getToken());
 		tokenizer.skipWhitespace();
 	}
+	PerfCounters::countTokens(toks.size());
 	return toks;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <ostream>
 
@@ -17,16 +18,21 @@ Equals,
 Identifier,
 Keyword,
 Comma,
+LSquare,
+RSquare,
 EndOfFile,
 Total
 };
 
 std::string tokenTypeToString(TokenType type);
 
+// Tokens are views into the source text, which has to outlive them
 struct Token
 {
 	TokenType type;
-	std::string content;
+	std::string_view content;
+	// Decoded value of a Number token
+	double number = 0.0;
 
 	static const Token END_OF_FILE;
 	std::string toString() const;
@@ -34,10 +40,14 @@ struct Token
 
 std::ostream& operator<<(std::ostream& os, const Token& token);
 
+class FunctionTable;
+
 struct Tokenizer
 {
-	std::string tokens;
+	std::string_view tokens;
 	size_t pos = 0;
+	// Names of these functions lex as Keyword tokens, like the keywords do
+	const FunctionTable* functions = nullptr;
 
 	char peek();
 	char next();
@@ -49,5 +59,10 @@ struct Tokenizer
 	Token getToken();
 };
 
-std::vector<Token> tokenize(const std::string& str);
+// Names of the functions in FunctionTable::global() lex as Keyword tokens
+std::vector<Token> tokenize(std::string_view str);
+// Same, for the functions of another table
+std::vector<Token> tokenize(std::string_view str, const FunctionTable& functions);
+// Decodes the text of a Number token, throws if it is not a valid number
+double decodeNumber(std::string_view text);
 
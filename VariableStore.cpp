@@ -0,0 +1,212 @@
+#include "VariableStore.h"
+#include <format>
+#include <stdexcept>
+#include <thread>
+
+// Names only ever grow and are shared by every version until one is added
+struct VariableStore::Names
+{
+	std::vector<std::string> slotNames;
+	StringMap<Slot> nameToSlot;
+};
+
+struct VariableStore::Version
+{
+	std::shared_ptr<const Names> names;
+	std::vector<double> values;
+	std::vector<uint8_t> defined;
+	uint64_t number = 0;
+};
+
+// Spreads threads over the reader counters so they do not share a cache line
+static size_t readerShard(size_t shardCount)
+{
+	static std::atomic<size_t> nextShard = 0;
+	static thread_local size_t shard = nextShard++;
+	return shard % shardCount;
+}
+
+static thread_local const VariableStore::Snapshot* innermostSnapshot = nullptr;
+
+// -----------------------------------------------------
+VariableStore::Snapshot::Snapshot(const VariableStore& store)
+	: store(store), outer(innermostSnapshot)
+{
+	uint64_t parity = store.epoch.load() & 1;
+	counter = &store.readers[readerShard(shardCount)][parity].count;
+	counter->fetch_add(1);
+	// Loaded after announcing ourselves, so a writer either waits for us or
+	// already published a newer version than the one we get
+	pinned = store.latest.load();
+	innermostSnapshot = this;
+}
+
+VariableStore::Snapshot::~Snapshot()
+{
+	innermostSnapshot = outer;
+	counter->fetch_sub(1, std::memory_order_release);
+}
+
+std::optional<Slot> VariableStore::Snapshot::find(std::string_view name) const
+{
+	auto it = pinned->names->nameToSlot.find(name);
+	if (it != pinned->names->nameToSlot.end()) {
+		return it->second;
+	}
+	return std::nullopt;
+}
+
+double VariableStore::Snapshot::get(Slot slot) const
+{
+	if (!isDefined(slot)) {
+		throw std::runtime_error(std::format("Identifier '{}' not found", pinned->names->slotNames[slot]));
+	}
+	return pinned->values[slot];
+}
+
+double VariableStore::Snapshot::get(std::string_view name) const
+{
+	auto slot = find(name);
+	if (!slot) {
+		throw std::runtime_error(std::format("Identifier '{}' not found", name));
+	}
+	return get(*slot);
+}
+
+bool VariableStore::Snapshot::isDefined(Slot slot) const
+{
+	return slot < pinned->defined.size() && pinned->defined[slot];
+}
+
+uint64_t VariableStore::Snapshot::version() const
+{
+	return pinned->number;
+}
+
+// -----------------------------------------------------
+VariableStore::VariableStore()
+{
+	auto first = std::make_unique<Version>();
+	first->names = std::make_shared<Names>();
+	latest.store(first.release());
+}
+
+VariableStore::~VariableStore()
+{
+	delete latest.load();
+}
+
+VariableStore::Snapshot VariableStore::read() const
+{
+	return Snapshot(*this);
+}
+
+const VariableStore::Snapshot* VariableStore::current() const
+{
+	for (const Snapshot* snapshot = innermostSnapshot; snapshot; snapshot = snapshot->outer) {
+		if (&snapshot->store == this)
+			return snapshot;
+	}
+	return nullptr;
+}
+
+std::unique_ptr<VariableStore::Version> VariableStore::copyCurrent() const
+{
+	if (current()) {
+		throw std::runtime_error("Cannot assign variables while reading them on the same thread");
+	}
+	// Only writers replace latest and they hold writeMutex, so it cannot be freed here
+	const Version* now = latest.load();
+	auto next = std::make_unique<Version>(*now);
+	next->number = now->number + 1;
+	return next;
+}
+
+Slot VariableStore::internLocked(std::string_view name, std::unique_ptr<Version>& next)
+{
+	auto it = next->names->nameToSlot.find(name);
+	if (it != next->names->nameToSlot.end()) {
+		return it->second;
+	}
+	auto names = std::make_shared<Names>(*next->names);
+	Slot slot = static_cast<Slot>(names->slotNames.size());
+	names->slotNames.emplace_back(name);
+	names->nameToSlot.emplace(names->slotNames.back(), slot);
+	next->names = std::move(names);
+	next->values.push_back(0.0);
+	next->defined.push_back(false);
+	return slot;
+}
+
+Slot VariableStore::intern(std::string_view name)
+{
+	if (!current()) {
+		Snapshot snapshot = read();
+		if (auto slot = snapshot.find(name))
+			return *slot;
+	}
+	std::lock_guard lock(writeMutex);
+	auto next = copyCurrent();
+	size_t before = next->names->slotNames.size();
+	Slot slot = internLocked(name, next);
+	// Another writer may have added it in the meantime
+	if (next->names->slotNames.size() != before) {
+		publish(std::move(next));
+	}
+	return slot;
+}
+
+void VariableStore::set(Slot slot, double value)
+{
+	std::lock_guard lock(writeMutex);
+	auto next = copyCurrent();
+	next->values[slot] = value;
+	next->defined[slot] = true;
+	publish(std::move(next));
+}
+
+void VariableStore::set(std::string_view name, double value)
+{
+	Binding binding{ name, value };
+	set(std::span(&binding, 1));
+}
+
+void VariableStore::set(std::span<const Binding> bindings)
+{
+	std::lock_guard lock(writeMutex);
+	auto next = copyCurrent();
+	for (const Binding& binding : bindings) {
+		Slot slot = internLocked(binding.name, next);
+		next->values[slot] = binding.value;
+		next->defined[slot] = true;
+	}
+	publish(std::move(next));
+}
+
+void VariableStore::publish(std::unique_ptr<Version> next)
+{
+	const Version* old = latest.exchange(next.release());
+	waitForReaders();
+	delete old;
+}
+
+// Any reader that announced itself after its counter was seen empty loads the
+// new version, so draining both counters is enough. Flipping the epoch first
+// sends new readers to the other counter, which lets the old one drain even
+// under a steady stream of reads.
+void VariableStore::waitForReaders()
+{
+	for (int phase = 0; phase < 2; ++phase) {
+		uint64_t parity = epoch.fetch_add(1) & 1;
+		for (ReaderCounter (&shard)[2] : readers) {
+			while (shard[parity].count.load() != 0)
+				std::this_thread::yield();
+		}
+	}
+}
+
+VariableStore& VariableStore::global()
+{
+	static VariableStore store;
+	return store;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Environment.h"
+#include "Keyword.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Variables shared between one or more writers and any number of evaluating
+// threads. Every write publishes a new immutable version with a single atomic
+// store; readers pin the current version without locks, loops or allocation,
+// so a whole evaluation sees one consistent set of values. A version is freed
+// once every reader that could still see it has let go (read-copy-update with
+// two-phase grace periods over sharded reader counters).
+class VariableStore
+{
+	struct Names;
+	struct Version;
+
+public:
+	// A pinned, unchanging view of the variables. Snapshots are released in the
+	// reverse order they were taken, and a thread must not write to a store it
+	// holds a snapshot of.
+	class Snapshot
+	{
+	public:
+		~Snapshot();
+		Snapshot(const Snapshot&) = delete;
+		Snapshot& operator=(const Snapshot&) = delete;
+
+		std::optional<Slot> find(std::string_view name) const;
+		// Throws if the identifier has not been assigned in this version
+		double get(Slot slot) const;
+		double get(std::string_view name) const;
+		bool isDefined(Slot slot) const;
+		// Incremented by every write
+		uint64_t version() const;
+
+	private:
+		friend class VariableStore;
+		explicit Snapshot(const VariableStore& store);
+
+		const VariableStore& store;
+		const Version* pinned;
+		std::atomic<uint64_t>* counter;
+		const Snapshot* outer;
+	};
+
+	VariableStore();
+	~VariableStore();
+	VariableStore(const VariableStore&) = delete;
+	VariableStore& operator=(const VariableStore&) = delete;
+
+	// Wait-free
+	Snapshot read() const;
+	// Innermost snapshot of this store held by the calling thread, if any
+	const Snapshot* current() const;
+	// Calls func with the snapshot the calling thread already holds, or with
+	// one pinned just for the call
+	template<typename Func>
+	decltype(auto) withSnapshot(Func&& func) const
+	{
+		if (const Snapshot* held = current()) {
+			return func(*held);
+		}
+		Snapshot snapshot = read();
+		return func(snapshot);
+	}
+
+	// Writers are serialized among themselves and wait for older readers to
+	// finish before freeing the version they replace; readers never wait.
+	Slot intern(std::string_view name);
+	void set(Slot slot, double value);
+	void set(std::string_view name, double value);
+	// Publishes all bindings as a single version
+	void set(std::span<const Binding> bindings);
+
+	// Backs IdentifierExpr::setIdentifier, tree evaluation and execute(program)
+	static VariableStore& global();
+
+private:
+	struct alignas(64) ReaderCounter
+	{
+		std::atomic<uint64_t> count = 0;
+	};
+	static constexpr size_t shardCount = 32;
+
+	Slot internLocked(std::string_view name, std::unique_ptr<Version>& next);
+	std::unique_ptr<Version> copyCurrent() const;
+	void publish(std::unique_ptr<Version> next);
+	void waitForReaders();
+
+	std::atomic<const Version*> latest;
+	std::atomic<uint64_t> epoch = 0;
+	// Readers count themselves in [shard][epoch parity]
+	mutable ReaderCounter readers[shardCount][2];
+	std::mutex writeMutex;
+};
@@ -1,26 +1,84 @@
 #include "Tokenizer.h"
 #include "Parser.h"
 #include "ParseRule.h"
+#include "Bytecode.h"
+#include "ExprArena.h"
+#include "Benchmark.h"
+#include "BatchMode.h"
+#include "ExprCache.h"
+#include "FormulaGraph.h"
+#include "Function.h"
+#include "Gradient.h"
+#include "Optimizer.h"
+#include "PerfCounters.h"
+#include "StaticExpr.h"
 
+#include <algorithm>
 #include <iostream>
 #include <print>
 #include <cassert>
 #include <memory>
+#include <span>
+#include <string>
+
+// :stats prints the counters, :stats on|off|reset switches or clears them
+static void statsCommand(std::string_view argument)
+{
+	if (argument == "on" || argument == "off") {
+		PerfCounters::enable(argument == "on");
+		std::println("Counters {}", argument);
+	}
+	else if (argument == "reset") {
+		PerfCounters::reset();
+		std::println("Counters reset");
+	}
+	else if (argument.empty()) {
+		std::println("{}", PerfCounters::read().toString());
+		if (!PerfCounters::enabled())
+			std::println("Counters are off, ':stats on' turns them on");
+	}
+	else {
+		std::println("Usage: :stats [on|off|reset]");
+	}
+}
+
+// "[1, 2.5, 3]", each element the way std::println writes a number
+static std::string arrayToString(std::span<const double> elements)
+{
+	std::string result = "[";
+	for (size_t i = 0; i < elements.size(); ++i) {
+		result += std::format("{}{}", i ? ", " : "", elements[i]);
+	}
+	return result + "]";
+}
 
 void shell()
 {
 	std::println("\nWelcome to the Pratt Parser shell!"
-			     "\nType 'exit' to quit.");
+			     "\nType 'exit' to quit, ':stats' for timings and counts.");
 	std::string input;
 	while (true) {
 		std::print("> ");
 		std::getline(std::cin, input);
 		if (input == "exit") break;
+		if (input.starts_with(":stats")) {
+			std::string_view argument = std::string_view(input).substr(6);
+			argument.remove_prefix(std::min(argument.find_first_not_of(' '), argument.size()));
+			statsCommand(argument);
+			continue;
+		}
 		try {
-			auto parser = PrattParser(tokenize(input));
-			auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
-			assert(expr);
-			std::println("Parsed expression: {} = {}", expr->toString(), expr->eval());
+			if (FunctionTable::isDefinition(input)) {
+				std::println("Defined {}", FunctionTable::global().define(input)->toString());
+				continue;
+			}
+			// Repeated lines are served from the cache without lexing or parsing
+			ExprCache::Entry compiled = ExprCache::global().get(input);
+			if (compiled->isArray) {
+				std::println("Parsed expression: {} = {}", compiled->text, arrayToString(compiled->elements));
+				continue;
+			}
+			std::println("Parsed expression: {} = {}", compiled->text, execute(compiled->program));
 		}
 		catch (const std::exception& e) {
 			std::println("Error: {}", e.what());
@@ -28,6 +86,45 @@ void shell()
 	}
 }
 
+// rationalis --batch FILE [--format values|csv|json] [--threads N] [--output FILE] [--stats]
+int batch(int argc, char** argv)
+{
+	std::string input = "-";
+	std::string output;
+	BatchOptions options;
+	try {
+		for (int i = 2; i < argc; ++i) {
+			std::string_view arg = argv[i];
+			if (arg == "--format" && i + 1 < argc)
+				options.format = parseOutputFormat(argv[++i]);
+			else if (arg == "--threads" && i + 1 < argc)
+				options.threads = std::stoul(argv[++i]);
+			else if (arg == "--output" && i + 1 < argc)
+				output = argv[++i];
+			else if (arg == "--stats")
+				PerfCounters::enable();
+			else
+				input = arg;
+		}
+
+		std::FILE* out = stdout;
+		if (!output.empty() && !(out = std::fopen(output.c_str(), "wb"))) {
+			throw std::runtime_error(std::format("Cannot open {}", output));
+		}
+		BatchSummary summary = runBatchFile(input, out, options);
+		if (out != stdout)
+			std::fclose(out);
+		std::println(stderr, "{}", summary.toString());
+		if (PerfCounters::enabled())
+			std::println(stderr, "{}", PerfCounters::read().toString());
+		return summary.errors ? 2 : 0;
+	}
+	catch (const std::exception& e) {
+		std::println(stderr, "Error: {}", e.what());
+		return 1;
+	}
+}
+
 void example0()
 {
 	auto input = "sin3 + 5 * (2 / 8) - 1";
@@ -40,7 +137,7 @@ void example1()
 	char input[] = "88";
 	auto parser = PrattParser(tokenize(input));
 	std::println("{}", parser.toString());
-	auto* expr = nudLiteral(parser);
+	auto expr = std::unique_ptr<Expr>{ nudLiteral(parser) };
 	std::println("Parsed expression: {} = {}\n", expr->toString(), expr->eval());
 }
 
@@ -49,7 +146,7 @@ void example2()
 	char input[] = "-1";
 	auto parser = PrattParser(tokenize(input));
 	std::println("{}", parser.toString());
-	auto* expr = nudUnary(parser);
+	auto expr = std::unique_ptr<Expr>{ nudUnary(parser) };
 	std::println("Parsed expression: {} = {}\n", expr->toString(), expr->eval());
 }
 
@@ -57,7 +154,7 @@ void example3()
 {
 	char input[] = "2*(1+2) - 2";
 	auto parser = PrattParser(tokenize(input));
-	auto* expr = parseExpr(parser);
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
 	assert(expr);
 	std::println("Parsed expression: {} = {}", expr->toString(), expr->eval());
 }
@@ -66,11 +163,121 @@ void example4()
 {
 	char input[] = "1 + 1 * 2 - 3";
 	auto parser = PrattParser(tokenize(input));
-	auto* expr = parseExpr(parser);
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
 	assert(expr);
 	std::println("Parsed expression: {} = {}", expr->toString(), expr->eval());
 }
 
+void example5()
+{
+	char input[] = "sin(pi / 4) * 2 ^ 3 - -1";
+	auto parser = PrattParser(tokenize(input));
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	Program program = compile(expr.get());
+	std::println("{}", program.toString());
+	std::println("Tree: {} = {}, VM: {}", expr->toString(), expr->eval(), execute(program));
+}
+
+void example6()
+{
+	char input[] = "mean(2, 4) * (1 + 2) ^ 2";
+	auto parser = PrattParser(tokenize(input));
+	ExprArena arena = parseArena(parser);
+	std::println("Parsed expression: {} = {} ({} nodes)", arena.toString(), arena.eval(), arena.size());
+	arena.clear(); // Frees the whole tree at once
+}
+
+void example7()
+{
+	char input[] = "2 * pi * r + 0 * x + sqrt(2) * 1 - -(-y)";
+	for (bool strict : { true, false }) {
+		auto parser = PrattParser(tokenize(input));
+		SimplifyStats stats;
+		auto expr = std::unique_ptr<Expr>{ simplify(parseExpr(parser), { strict }, &stats) };
+		std::println("{}: {} [{}]", strict ? "Strict" : "Relaxed", expr->toString(), stats.toString());
+	}
+}
+
+void example8()
+{
+	char input[] = "rate * t + sqrt(spot)";
+	auto parser = PrattParser(tokenize(input));
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	Program program = compile(expr.get());
+
+	// Names are resolved to slots once, every evaluation after that is an indexed load
+	Environment env;
+	std::vector<Slot> binding = env.bind(program);
+	env.set("rate", 0.05);
+	env.set("spot", 100.0);
+	for (double t = 1.0; t <= 3.0; t += 1.0) {
+		env.set(env.intern("t"), t);
+		std::println("t = {}: {}", t, execute(program, env, binding));
+	}
+}
+
+void example9()
+{
+	// Parsed while compiling, a typo here is a compile error
+	constexpr auto formula = parseStatic<"rate * t + sqrt(spot)">();
+	for (double t = 1.0; t <= 3.0; t += 1.0) {
+		std::println("{}, {}, {} = {}, {}, {}: {}", formula.identifiers[0], formula.identifiers[1], formula.identifiers[2], 0.05, t, 100.0, formula(0.05, t, 100.0));
+	}
+}
+
+void example10()
+{
+	// Registered functions are lexed and parsed like keywords from now on
+	FunctionTable::global().defineNative("clamp", 3, [](std::span<const double> args) { return std::clamp(args[0], args[1], args[2]); });
+	FunctionTable::global().define("hyp(a, b) = sqrt(a ^ 2 + b ^ 2)");
+
+	char input[] = "clamp(hyp(3, 4), 0, 4) + hyp(1, 1)";
+	auto parser = PrattParser(tokenize(input));
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	// hyp is small, so its body replaces both calls in the bytecode
+	Program program = compile(expr.get());
+	std::println("{}", program.toString());
+	std::println("Tree: {} = {}, VM: {}", expr->toString(), expr->eval(), execute(program));
+}
+
+void example11()
+{
+	FormulaGraph sheet;
+	sheet.define("total", "net + tax");
+	sheet.define("tax", "net * rate");
+	sheet.define("net", "price * qty");
+	sheet.set(std::vector<Binding>{ { "price", 20.0 }, { "qty", 3.0 }, { "rate", 0.2 } });
+	std::println("total = {} [{}]", sheet.get("total"), sheet.lastRecompute().toString());
+
+	// Only tax and total read rate, net keeps its cached value
+	sheet.set("rate", 0.25);
+	RecomputeStats stats = sheet.recompute();
+	std::println("total = {} [{}]", sheet.get("total"), stats.toString());
+}
+
+void example12()
+{
+	auto parser = PrattParser(tokenize("x^2 * sin(y) + sqrt(x * y)"));
+	auto expr = std::unique_ptr<Expr>{ parseExpr(parser) };
+	Program program = compile(expr.get());
+	std::vector<double> slots{ 2.0, 0.5 };
+	// Value and both partials from one pass over the bytecode
+	Gradient result = gradient(program, slots);
+	for (size_t i = 0; i < program.identifiers.size(); ++i) {
+		std::println("d/d{} = {}", program.identifiers[i], result.partials[i]);
+	}
+	std::println("value = {}", result.value);
+}
+
+void example13()
+{
+	char input[] = "sin(a * b) * sin(a * b) + cos(a * b)";
+	auto parser = PrattParser(tokenize(input));
+	// a * b is stored and evaluated once, sin(a * b) too
+	ExprArena arena = parseArena(parser, true);
+	std::println("{} ({})", arena.toString(), arena.sharingStats().toString());
+}
+
 int main(int argc, char** argv)
 {
 #if 0
@@ -80,6 +287,15 @@ int main(int argc, char** argv)
 		example2();
 		example3();
 		example4();
+		example5();
+		example6();
+		example7();
+		example8();
+		example9();
+		example10();
+		example11();
+		example12();
+		example13();
 	}
 	catch (const std::exception& e)
 	{
@@ -87,6 +303,55 @@ int main(int argc, char** argv)
 	}
 #endif
 
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-lexer") {
+		benchmarkLexers();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-batch") {
+		benchmarkBatch();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-batch-mode") {
+		benchmarkBatchMode();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-scaling") {
+		benchmarkScaling();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-jit") {
+		benchmarkJit();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-graph") {
+		benchmarkGraph();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-gradient") {
+		benchmarkGradient();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-sharing") {
+		benchmarkSharing();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-load") {
+		benchmarkProgramFile();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-stats") {
+		benchmarkPerfCounters();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--bench-accuracy") {
+		benchmarkAccuracy();
+		return 0;
+	}
+
+	if (argc > 1 && std::string_view(argv[1]) == "--batch") {
+		return batch(argc, argv);
+	}
+
 	shell();
 
 	return 0;